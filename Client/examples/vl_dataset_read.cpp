@@ -0,0 +1,108 @@
+/* Copyright 2018, Institute for Artificial Intelligence - University of Bremen */
+
+/*
+ * Indexes a recorded session and decodes all frames of the given streams with the prefetcher,
+ * printing the index summary and the decode rate.
+ *
+ *   vl_dataset_read <Saved/viewport> [stream,stream,...] [threads]
+ */
+
+#include "vl_dataset.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s <directory> [stream,stream,...] [threads]\n", argv[0]);
+		return 1;
+	}
+	const std::chrono::steady_clock::time_point index_start = std::chrono::steady_clock::now();
+	vl::DatasetReader reader;
+	if (!reader.open(argv[1]))
+	{
+		fprintf(stderr, "could not open dataset %s\n", argv[1]);
+		return 1;
+	}
+	const double index_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - index_start).count();
+	printf("%zu frames, %zu files, index from %s in %.3f s\n", reader.frames().size(), reader.files().size(),
+		reader.has_manifest() ? "manifest" : "file names", index_seconds);
+
+	/* All image streams by default */
+	std::vector<int> streams;
+	if (argc > 2)
+	{
+		std::string list = argv[2];
+		size_t start = 0;
+		while (start <= list.size())
+		{
+			const size_t end = std::min(list.find(',', start), list.size());
+			const int stream = reader.find_stream(list.substr(start, end - start));
+			if (stream < 0)
+			{
+				fprintf(stderr, "no stream %s\n", list.substr(start, end - start).c_str());
+				return 1;
+			}
+			streams.push_back(stream);
+			start = end + 1;
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < reader.streams().size(); ++i)
+		{
+			const std::string& name = reader.streams()[i];
+			if (name != "POINTCLOUD" && name != "FLOW")
+			{
+				streams.push_back((int)i);
+			}
+		}
+	}
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		size_t count = 0;
+		size_t repeats = 0;
+		for (size_t f = 0; f < reader.frames().size(); ++f)
+		{
+			count += reader.frames()[f].files[streams[i]] >= 0;
+			repeats += reader.frames()[f].repeats[streams[i]];
+		}
+		printf("  %s: %zu frames, %zu repeats\n", reader.streams()[streams[i]].c_str(), count, repeats);
+	}
+
+	std::vector<size_t> order(reader.frames().size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = i;
+	}
+	vl::DatasetPrefetcher prefetcher(reader, streams, argc > 3 ? (unsigned)atoi(argv[3]) : 0);
+	const std::chrono::steady_clock::time_point decode_start = std::chrono::steady_clock::now();
+	prefetcher.start(order);
+	vl::DatasetSample sample;
+	size_t images = 0;
+	size_t failed = 0;
+	uint64_t bytes = 0;
+	while (prefetcher.next(sample))
+	{
+		for (size_t i = 0; i < sample.images.size(); ++i)
+		{
+			if (sample.valid[i])
+			{
+				++images;
+				bytes += sample.images[i].pixels.size();
+			}
+			else if (reader.file(sample.frame_index, streams[i]))
+			{
+				++failed;
+			}
+		}
+	}
+	const double decode_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - decode_start).count();
+	printf("decoded %zu images (%zu failed) in %.3f s: %.1f frames/s, %.1f MB/s\n", images, failed, decode_seconds,
+		order.size() / decode_seconds, bytes / decode_seconds / 1e6);
+	return failed > 0 ? 2 : 0;
+}
@@ -0,0 +1,59 @@
+/* Copyright 2018, Institute for Artificial Intelligence - University of Bremen */
+
+/*
+ * Prints the actors of a scene-state log, or the trajectory of one actor as CSV.
+ *
+ *   vl_scene_trajectory <log.vlscene>
+ *   vl_scene_trajectory <log.vlscene> <actor name>
+ *   vl_scene_trajectory <log.vlscene> <category id> <instance id>
+ */
+
+#include "vl_scene_state.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s <log.vlscene> [actor name | category id instance id]\n", argv[0]);
+		return 1;
+	}
+	vl::SceneStateReader reader;
+	if (!reader.open(argv[1]))
+	{
+		fprintf(stderr, "could not open scene state log %s\n", argv[1]);
+		return 1;
+	}
+	if (!reader.has_index())
+	{
+		fprintf(stderr, "log was not closed, index rebuilt from %zu blocks\n", reader.block_count());
+	}
+
+	if (argc == 2)
+	{
+		printf("id,category_id,instance_id,category,name\n");
+		for (const vl::SceneActor& actor : reader.actors())
+		{
+			printf("%u,%u,%u,%s,%s\n", actor.id, actor.category_id, actor.instance_id, actor.category.c_str(), actor.name.c_str());
+		}
+		return 0;
+	}
+
+	const int actor = argc > 3 ? reader.find_actor((uint32_t)atoi(argv[2]), (uint32_t)atoi(argv[3])) : reader.find_actor(argv[2]);
+	std::vector<vl::ScenePose> poses;
+	if (actor < 0 || !reader.trajectory((uint32_t)actor, poses))
+	{
+		fprintf(stderr, "no trajectory for this actor\n");
+		return 1;
+	}
+	printf("frame,timestamp_ns,x,y,z,qx,qy,qz,qw,sx,sy,sz\n");
+	for (const vl::ScenePose& pose : poses)
+	{
+		printf("%llu,%lld,%.2f,%.2f,%.2f,%.6f,%.6f,%.6f,%.6f,%.4f,%.4f,%.4f\n", (unsigned long long)pose.frame, (long long)pose.timestamp_ns,
+			pose.location[0], pose.location[1], pose.location[2], pose.rotation[0], pose.rotation[1], pose.rotation[2], pose.rotation[3],
+			pose.scale[0], pose.scale[1], pose.scale[2]);
+	}
+	return 0;
+}
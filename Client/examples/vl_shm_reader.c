@@ -0,0 +1,82 @@
+/* Copyright 2018, Institute for Artificial Intelligence - University of Bremen */
+
+/*
+ * Minimal consumer of the shared memory frame feed, prints every received frame and the
+ * number of frames it had to skip.
+ *
+ *   vl_shm_reader [name] [max frames]
+ */
+
+#include "vl_shm_client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char* stream_name(uint32_t stream)
+{
+	switch (stream)
+	{
+	case VL_SHM_STREAM_COLOR: return "COLOR";
+	case VL_SHM_STREAM_MASK: return "MASK";
+	case VL_SHM_STREAM_DEPTH: return "DEPTH";
+	default: return "UNKNOWN";
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* name = argc > 1 ? argv[1] : VL_SHM_DEFAULT_NAME;
+	const long max_frames = argc > 2 ? atol(argv[2]) : -1;
+
+	vl_shm_client* client = vl_shm_open(name);
+	if (!client)
+	{
+		fprintf(stderr, "Could not attach to shared memory feed %s\n", name);
+		return 1;
+	}
+
+	uint8_t* buffer = (uint8_t*)malloc(vl_shm_max_payload(client));
+	uint64_t cursor = vl_shm_write_seq(client);
+	uint64_t dropped = 0;
+	long received = 0;
+	printf("Attached to %s: %u slots of %llu bytes\n", name, vl_shm_slot_count(client), (unsigned long long)vl_shm_max_payload(client));
+
+	while (max_frames < 0 || received < max_frames)
+	{
+		vl_shm_frame_info info;
+		const int result = vl_shm_wait_next(client, &cursor, &info, buffer, vl_shm_max_payload(client), &dropped, 5000);
+		if (result == VL_SHM_CLOSED)
+		{
+			/* The plugin re-opened the ring (e.g. larger frames) or ended the session */
+			vl_shm_close(client);
+			free(buffer);
+			client = vl_shm_open(name);
+			if (!client)
+			{
+				fprintf(stderr, "Shared memory feed %s was closed\n", name);
+				return 0;
+			}
+			buffer = (uint8_t*)malloc(vl_shm_max_payload(client));
+			cursor = 0;
+			printf("Re-attached to %s: %u slots of %llu bytes\n", name, vl_shm_slot_count(client), (unsigned long long)vl_shm_max_payload(client));
+			continue;
+		}
+		if (result == VL_SHM_EMPTY)
+		{
+			fprintf(stderr, "No frame for 5 s\n");
+			break;
+		}
+		if (result != VL_SHM_OK)
+		{
+			fprintf(stderr, "Read failed (%d)\n", result);
+			break;
+		}
+		++received;
+		printf("frame %llu %s %ux%u format %u %u bytes, dropped %llu\n", (unsigned long long)info.frame_id, stream_name(info.stream),
+			info.width, info.height, info.pixel_format, info.payload_size, (unsigned long long)dropped);
+	}
+
+	free(buffer);
+	vl_shm_close(client);
+	return 0;
+}
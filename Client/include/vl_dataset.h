@@ -0,0 +1,216 @@
+/* Copyright 2018, Institute for Artificial Intelligence - University of Bremen */
+
+/*
+ * Reader of the frames the plugin saves to Saved/viewport (<STREAM><time>.<ext>).
+ *
+ * Opening a directory builds the frame index once: from MANIFEST.csv if the session was written
+ * with the crash-safe journal (frame numbers as captured, only committed files), otherwise from
+ * the file names, grouping the streams saved in the same tick and numbering the frames in time
+ * order. Frames the change detection did not save again (<STREAM>_repeats.csv) point to the file
+ * they repeat; repeats and recovered files without a frame number join the frame with the same
+ * time stamp. Frames are ordered by session and time. Files are memory-mapped on access, so any
+ * frame of any stream can be read in any order without scanning the directory again.
+ *
+ * Images are decoded into the pixel formats of the shared memory feed (VL_SHM_FORMAT_*): raw
+ * files as stored, PNG with zlib and JPEG if the library is built with VL_DATASET_WITH_JPEG
+ * (libjpeg). DatasetPrefetcher decodes frames ahead of the consumer on a thread pool.
+ */
+
+#ifndef VL_DATASET_H
+#define VL_DATASET_H
+
+#include "vl_shm_protocol.h"
+
+#include <stddef.h>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace vl
+{
+	/* Frame number of files the manifest lists without one (recovered after a crash by older versions) or that are only repeats */
+	const uint64_t DATASET_NO_FRAME = ~(uint64_t)0;
+
+	/* How a file is stored */
+	enum DatasetCodec
+	{
+		DATASET_RAW,      /* pixels as in memory, size in the file name */
+		DATASET_PNG,
+		DATASET_JPEG,
+		DATASET_OTHER     /* point clouds, flow, anything that is not an image */
+	};
+
+	struct DatasetFile
+	{
+		std::string name;       /* file name in the dataset directory */
+		int stream;             /* index into DatasetReader::streams() */
+		int64_t timestamp_ns;   /* capture time from the file name, ns since the unix epoch (UTC) */
+		DatasetCodec codec;
+		uint32_t format;        /* VL_SHM_FORMAT_* of raw files */
+		uint32_t width;         /* raw files only, 0 otherwise */
+		uint32_t height;
+		uint32_t quality;       /* JPEG quality the file was saved with, 0 codec default or not in the manifest */
+		float scale;            /* fraction of the capture resolution the file was saved with, 1 if not in the manifest */
+	};
+
+	struct DatasetFrame
+	{
+		uint32_t session;       /* sessions appended to the same manifest, 0 without a manifest */
+		uint64_t frame;         /* capture frame number, position in time without a manifest, or DATASET_NO_FRAME */
+		int64_t timestamp_ns;   /* earliest time stamp of the files of the frame */
+		std::vector<int32_t> files;     /* file index per stream, -1 if the stream has none */
+		std::vector<bool> repeats;      /* stream was not saved again, the file belongs to an earlier frame */
+	};
+
+	struct DatasetImage
+	{
+		uint32_t width;
+		uint32_t height;
+		uint32_t format;        /* VL_SHM_FORMAT_*, 16 bit samples in native byte order */
+		std::vector<uint8_t> pixels;
+	};
+
+	/* Read only memory mapping of a whole file */
+	class MappedFile
+	{
+	public:
+		MappedFile();
+		~MappedFile();
+
+		bool open(const std::string& path);
+		void close();
+
+		const uint8_t* data() const { return data_; }
+		size_t size() const { return size_; }
+
+	private:
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+
+		const uint8_t* data_;
+		size_t size_;
+		std::vector<uint8_t> buffer_;   /* platforms without mmap read the file */
+	};
+
+	class DatasetReader
+	{
+	public:
+		DatasetReader();
+
+		bool open(const std::string& directory);
+		void close();
+
+		/* Index built from MANIFEST.csv instead of the file names */
+		bool has_manifest() const { return has_manifest_; }
+
+		const std::string& directory() const { return directory_; }
+		const std::vector<std::string>& streams() const { return streams_; }
+		const std::vector<DatasetFile>& files() const { return files_; }
+		const std::vector<DatasetFrame>& frames() const { return frames_; }
+
+		/* Stream index by name (COLOR, MASK, DEPTH, POINTCLOUD, FLOW), -1 if there is none */
+		int find_stream(const std::string& name) const;
+
+		/* Frame index by capture frame number, -1 if the frame has no files */
+		int64_t find_frame(uint64_t frame, uint32_t session = 0) const;
+
+		/* File of a stream in a frame, NULL if there is none. All accessors below are thread safe. */
+		const DatasetFile* file(size_t frame_index, int stream) const;
+
+		/* Map the file of a stream in a frame without decoding it */
+		bool map(size_t frame_index, int stream, MappedFile& out) const;
+
+		/* Decode the image of a stream in a frame */
+		bool decode(size_t frame_index, int stream, DatasetImage& out) const;
+
+		/* Decode a mapped image file */
+		static bool decode(const DatasetFile& file, const uint8_t* data, size_t size, DatasetImage& out);
+
+	private:
+		struct Entry
+		{
+			uint32_t session;
+			uint64_t frame;         /* DATASET_NO_FRAME if only the time stamp is known */
+			int64_t timestamp_ns;
+			int32_t file;
+			bool repeat;
+		};
+
+		int add_stream(const std::string& name);
+		int32_t add_file(const std::string& name);
+		bool read_manifest(std::vector<Entry>& entries);
+		void scan_directory(const std::vector<std::string>& names, std::vector<Entry>& entries);
+		void read_repeats(const std::vector<std::string>& names, std::vector<Entry>& entries);
+		void build_frames(std::vector<Entry>& entries);
+
+		std::string directory_;
+		bool has_manifest_;
+		std::vector<std::string> streams_;
+		std::vector<DatasetFile> files_;
+		std::map<std::string, int32_t> file_by_name_;
+		std::vector<DatasetFrame> frames_;
+		std::map<std::pair<uint32_t, uint64_t>, size_t> frame_by_number_;
+	};
+
+	/* Decoded images of the requested streams of one frame */
+	struct DatasetSample
+	{
+		size_t frame_index;
+		std::vector<DatasetImage> images;   /* in the order of the requested streams */
+		std::vector<bool> valid;            /* stream has an image in this frame and it could be decoded */
+	};
+
+	/*
+	 * Decodes the frames of a reader on a pool of threads, up to depth frames ahead of the consumer.
+	 * Frames are handed out in the order they were requested (e.g. shuffled for training), whichever
+	 * thread finishes first.
+	 */
+	class DatasetPrefetcher
+	{
+	public:
+		/* threads 0 uses one per core, depth 0 twice the threads */
+		DatasetPrefetcher(const DatasetReader& reader, const std::vector<int>& streams, unsigned threads = 0, size_t depth = 0);
+		~DatasetPrefetcher();
+
+		/* Start decoding the frame indices in this order, a running sequence is stopped first */
+		void start(const std::vector<size_t>& order);
+
+		/* Next frame of the sequence, waits until it is decoded; false once all were returned */
+		bool next(DatasetSample& out);
+
+		void stop();
+
+	private:
+		DatasetPrefetcher(const DatasetPrefetcher&);
+		DatasetPrefetcher& operator=(const DatasetPrefetcher&);
+
+		struct Slot
+		{
+			DatasetSample sample;
+			bool ready;
+		};
+
+		void work();
+
+		const DatasetReader& reader_;
+		std::vector<int> streams_;
+		unsigned thread_count_;
+		size_t depth_;
+
+		std::vector<std::thread> threads_;
+		std::mutex lock_;
+		std::condition_variable work_ready_;
+		std::condition_variable sample_ready_;
+		std::vector<size_t> order_;
+		std::vector<Slot> slots_;       /* ring of depth slots, sequence position % depth */
+		size_t next_dispatch_;
+		size_t next_consume_;
+		bool stopping_;
+	};
+}
+
+#endif
@@ -0,0 +1,93 @@
+/* Copyright 2018, Institute for Artificial Intelligence - University of Bremen */
+
+/*
+ * Reader of the VisionLogger scene-state log (.vlscene), see vl_scene_state_format.h for the layout.
+ *
+ * Opening a log only reads the actor table and the block index (or, for logs of crashed sessions,
+ * the record headers and changed actor lists). A trajectory is extracted by decoding just the blocks
+ * in which the actor changed; in all other frames it keeps the pose of its last sample.
+ */
+
+#ifndef VL_SCENE_STATE_H
+#define VL_SCENE_STATE_H
+
+#include "vl_scene_state_format.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace vl
+{
+	struct SceneActor
+	{
+		uint32_t id;
+		uint32_t category_id;
+		uint32_t instance_id;
+		std::string category;
+		std::string name;
+	};
+
+	struct ScenePose
+	{
+		uint64_t frame;
+		int64_t timestamp_ns;   /* ns since the unix epoch (UTC) */
+		float location[3];      /* cm, Unreal world space */
+		float rotation[4];      /* quaternion x, y, z, w */
+		float scale[3];
+	};
+
+	class SceneStateReader
+	{
+	public:
+		SceneStateReader();
+		~SceneStateReader();
+
+		bool open(const std::string& path);
+		void close();
+
+		const std::vector<SceneActor>& actors() const { return actors_; }
+
+		/* Actor id by category and instance or by name, -1 if there is none */
+		int find_actor(uint32_t category_id, uint32_t instance_id) const;
+		int find_actor(const std::string& name) const;
+
+		size_t block_count() const { return blocks_.size(); }
+
+		/* False if the log was not closed properly and the index had to be rebuilt */
+		bool has_index() const { return has_index_; }
+
+		/*
+		 * Poses of the actor in every frame of the blocks in which it changed, ascending by frame.
+		 * The pose holds until the next sample.
+		 */
+		bool trajectory(uint32_t actor_id, std::vector<ScenePose>& out);
+
+		/* Pose of the actor in a frame (the last sample at or before it), false before its first sample */
+		bool pose_at(uint32_t actor_id, uint64_t frame, ScenePose& out);
+
+	private:
+		struct Block
+		{
+			uint64_t offset;        /* file offset of the record header */
+			uint64_t first_frame;
+			uint32_t frame_count;
+		};
+
+		bool read_payload(uint64_t offset, uint32_t expected_type, std::vector<uint8_t>& payload);
+		bool read_actors(const std::vector<uint8_t>& payload);
+		bool read_index(const std::vector<uint8_t>& payload);
+		bool index_block(uint64_t offset, const std::vector<uint8_t>& payload);
+		bool decode(uint32_t block, uint32_t actor_id, std::vector<ScenePose>& out);
+
+		FILE* file_;
+		vl_scene_file_header header_;
+		bool has_index_;
+		std::vector<SceneActor> actors_;
+		std::vector<Block> blocks_;
+		std::vector<std::vector<uint32_t> > actor_blocks_;
+		std::vector<uint8_t> buffer_;
+	};
+}
+
+#endif
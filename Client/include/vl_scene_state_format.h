@@ -0,0 +1,75 @@
+/* Copyright 2018, Institute for Artificial Intelligence - University of Bremen */
+
+/*
+ * Layout of the VisionLogger scene-state log (.vlscene), the per frame transforms of all labelled actors.
+ *
+ * All integers are little endian, "varint" is LEB128 and "svarint" a zigzag encoded varint.
+ *
+ * File header (40 bytes): vl_scene_file_header.
+ *
+ * Records follow the header, each starts with a uint32 type and a uint32 payload size:
+ *
+ *  VL_SCENE_RECORD_ACTORS  varint count, then per actor: varint actor id, varint category id,
+ *                          varint instance id, varint length + UTF-8 category, varint length + UTF-8 name.
+ *                          Actor ids are dense and assigned in order of appearance.
+ *
+ *  VL_SCENE_RECORD_BLOCK   Up to block_frames consecutive frames:
+ *                          varint frame count N,
+ *                          varint first frame number, N-1 varint frame number deltas,
+ *                          svarint first time stamp (ns since session start), N-1 svarint deltas,
+ *                          varint number of changed actors C, C actor ids (first as varint, then varint deltas, ascending),
+ *                          C uint32 chunk offsets relative to the first chunk, then the chunks.
+ *                          Only actors whose quantized transform differs from their value at the end of the previous
+ *                          block (or that are new) have a chunk, all others keep their last value.
+ *                          A chunk holds VL_SCENE_COMPONENTS columns, each a varint mode followed by
+ *                          VL_SCENE_COLUMN_CONSTANT: one svarint value for all N frames, or
+ *                          VL_SCENE_COLUMN_DELTA: svarint value of the first frame, N-1 svarint deltas.
+ *
+ *  VL_SCENE_RECORD_INDEX   Written when the log is closed: varint block count, per block varint file offset delta
+ *                          (of the record start), varint first frame number delta, varint frame count; then
+ *                          varint actor count, per actor varint number of blocks and varint deltas of the
+ *                          indices of the blocks that have a chunk of the actor. The index is followed by the
+ *                          trailer, logs without trailer (crash) can be indexed by walking the record headers.
+ *
+ * Components are location x, y, z in location_step cm, rotation quaternion x, y, z, w in rotation_step
+ * (the sign is kept continuous over time) and scale x, y, z in scale_step.
+ *
+ * This header is shared between the plugin and the client library and only depends on C99.
+ */
+
+#ifndef VL_SCENE_STATE_FORMAT_H
+#define VL_SCENE_STATE_FORMAT_H
+
+#include <stdint.h>
+
+#define VL_SCENE_MAGIC 0x53534C56U /* "VLSS" */
+#define VL_SCENE_INDEX_MAGIC 0x49534C56U /* "VLSI" */
+#define VL_SCENE_VERSION 1U
+
+#define VL_SCENE_RECORD_ACTORS 1U
+#define VL_SCENE_RECORD_BLOCK 2U
+#define VL_SCENE_RECORD_INDEX 3U
+
+#define VL_SCENE_COMPONENTS 10
+#define VL_SCENE_COLUMN_CONSTANT 0U
+#define VL_SCENE_COLUMN_DELTA 1U
+
+typedef struct vl_scene_file_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t block_frames;      /* frames per block record (the last one may be shorter) */
+	uint32_t reserved;
+	int64_t session_start_ns;   /* session start, ns since the unix epoch (UTC) */
+	float location_step;        /* cm per location unit */
+	float rotation_step;        /* quaternion component per rotation unit */
+	float scale_step;           /* scale per scale unit */
+	uint32_t reserved2;
+} vl_scene_file_header;
+
+#define VL_SCENE_FILE_HEADER_SIZE 40
+/* A closed log ends with uint64 file offset of the index record and uint32 VL_SCENE_INDEX_MAGIC */
+#define VL_SCENE_TRAILER_SIZE 12
+#define VL_SCENE_RECORD_HEADER_SIZE 8
+
+#endif
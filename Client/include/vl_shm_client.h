@@ -0,0 +1,123 @@
+/* Copyright 2018, Institute for Artificial Intelligence - University of Bremen */
+
+/*
+ * Reader side of the VisionLogger shared memory frame feed (Linux/macOS).
+ *
+ * Every reader keeps its own cursor (the id of the next frame it wants), readers never write to
+ * the shared memory so any number of them can follow the same feed. A reader that falls behind
+ * by more than the ring size skips the overwritten frames and is told how many it missed.
+ *
+ * Once the producer closes the ring (session end, or a re-open after the capture size grew) reads
+ * return VL_SHM_CLOSED. Close the client and open the name again to follow the new ring, cursors
+ * start over at 0 there.
+ */
+
+#ifndef VL_SHM_CLIENT_H
+#define VL_SHM_CLIENT_H
+
+#include "vl_shm_protocol.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct vl_shm_client vl_shm_client;
+
+/* Result codes */
+#define VL_SHM_OK 0
+#define VL_SHM_EMPTY 1         /* no frame newer than the cursor yet */
+#define VL_SHM_TOO_SMALL 2     /* buffer cannot hold the payload, info is still filled in */
+#define VL_SHM_CLOSED 3        /* producer closed the ring, attach again to follow a re-opened one */
+#define VL_SHM_ERROR -1
+
+/* Attach to a feed, NULL if it does not exist or is not initialised yet */
+vl_shm_client* vl_shm_open(const char* name);
+void vl_shm_close(vl_shm_client* client);
+
+/* Ring geometry */
+uint32_t vl_shm_slot_count(const vl_shm_client* client);
+uint64_t vl_shm_max_payload(const vl_shm_client* client);
+
+/* Number of frames published so far, start a cursor here to only receive new frames */
+uint64_t vl_shm_write_seq(const vl_shm_client* client);
+
+/*
+ * Copy the frame at *cursor into buffer and advance the cursor.
+ * If the frame was already overwritten the cursor jumps to the oldest frame still in the ring and
+ * the number of skipped frames is added to *dropped (may be NULL).
+ */
+int vl_shm_read_next(vl_shm_client* client, uint64_t* cursor, vl_shm_frame_info* info, void* buffer, size_t capacity, uint64_t* dropped);
+
+/* Same as vl_shm_read_next but polls until a frame arrives or timeout_ms passed (negative waits forever) */
+int vl_shm_wait_next(vl_shm_client* client, uint64_t* cursor, vl_shm_frame_info* info, void* buffer, size_t capacity, uint64_t* dropped, int timeout_ms);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+#include <vector>
+
+namespace vl
+{
+	/* Owning C++ wrapper, frames are copied into an internal buffer sized to the ring's payload */
+	class ShmReader
+	{
+	public:
+		explicit ShmReader(const std::string& name = VL_SHM_DEFAULT_NAME)
+			: name_(name), client_(vl_shm_open(name.c_str())), cursor_(0), dropped_(0)
+		{
+			if (client_)
+			{
+				cursor_ = vl_shm_write_seq(client_);
+				buffer_.resize(vl_shm_max_payload(client_));
+			}
+		}
+		~ShmReader() { vl_shm_close(client_); }
+		ShmReader(const ShmReader&) = delete;
+		ShmReader& operator=(const ShmReader&) = delete;
+
+		bool valid() const { return client_ != nullptr; }
+
+		/* Wait for the next frame, the payload stays valid until the next call. A closed ring is followed by the re-opened one. */
+		bool next(vl_shm_frame_info& info, int timeout_ms = -1)
+		{
+			if (!client_)
+			{
+				return false;
+			}
+			int result = vl_shm_wait_next(client_, &cursor_, &info, buffer_.data(), buffer_.size(), &dropped_, timeout_ms);
+			if (result == VL_SHM_CLOSED && reopen())
+			{
+				result = vl_shm_wait_next(client_, &cursor_, &info, buffer_.data(), buffer_.size(), &dropped_, timeout_ms);
+			}
+			return result == VL_SHM_OK;
+		}
+
+		/* Attach to the ring currently published under the name, from its first frame */
+		bool reopen()
+		{
+			vl_shm_close(client_);
+			client_ = vl_shm_open(name_.c_str());
+			cursor_ = 0;
+			if (client_)
+			{
+				buffer_.resize(vl_shm_max_payload(client_));
+			}
+			return client_ != nullptr;
+		}
+
+		const uint8_t* data() const { return buffer_.data(); }
+		uint64_t dropped() const { return dropped_; }
+
+	private:
+		std::string name_;
+		vl_shm_client* client_;
+		uint64_t cursor_;
+		uint64_t dropped_;
+		std::vector<uint8_t> buffer_;
+	};
+}
+#endif
+
+#endif /* VL_SHM_CLIENT_H */
@@ -0,0 +1,132 @@
+/* Copyright 2018, Institute for Artificial Intelligence - University of Bremen */
+
+/*
+ * Layout of the VisionLogger shared memory frame feed.
+ *
+ * The plugin (single producer) publishes frames into a ring of fixed size slots inside a POSIX
+ * shared memory object. Any number of readers can follow the ring without ever blocking the
+ * producer, which always overwrites the oldest slot.
+ *
+ * Frame n (counting from 0) is written to slot n % slot_count. Every slot carries a sequence
+ * number used as a seqlock: it is 2n+1 while frame n is written and 2n+2 once it is complete.
+ * A reader that wants frame n checks for 2n+2 before and after copying the slot, anything else
+ * means the frame is not ready yet or was overwritten while copying.
+ *
+ * When the producer closes the ring (end of the session, or a re-open with a larger slot size) it
+ * clears the magic before it unmaps and unlinks the object. Attached readers keep their mapping of
+ * the old object and must attach again by name to follow a new one.
+ *
+ * This header is shared between the plugin and the client library and only depends on C99.
+ */
+
+#ifndef VL_SHM_PROTOCOL_H
+#define VL_SHM_PROTOCOL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VL_SHM_MAGIC 0x4D48534CU /* "LSHM" */
+#define VL_SHM_MAGIC_CLOSED 0U   /* producer closed the ring, no more frames follow */
+#define VL_SHM_VERSION 1U
+#define VL_SHM_DEFAULT_NAME "/visionlogger"
+
+/* Stream a frame belongs to */
+#define VL_SHM_STREAM_COLOR 0U
+#define VL_SHM_STREAM_MASK 1U
+#define VL_SHM_STREAM_DEPTH 2U
+
+/* Pixel layout of the payload, same order as EVisionPixelFormat in the plugin */
+#define VL_SHM_FORMAT_BGRA8 0U
+#define VL_SHM_FORMAT_RGB24 1U
+#define VL_SHM_FORMAT_GRAY8 2U
+#define VL_SHM_FORMAT_YUV420 3U
+#define VL_SHM_FORMAT_NV12 4U
+#define VL_SHM_FORMAT_PLANAR_RGB 5U
+/* Typed depth and label streams, not part of EVisionPixelFormat */
+#define VL_SHM_FORMAT_GRAY16 6U      /* depth in mm or label ids, native byte order */
+#define VL_SHM_FORMAT_FLOAT32 7U     /* depth in cm */
+#define VL_SHM_FORMAT_RGBA16F 8U     /* half float RGBA, depth in cm in R */
+
+/* Metadata published with every frame */
+typedef struct vl_shm_frame_info
+{
+	uint64_t frame_id;       /* capture frame number, shared by all streams of one capture */
+	int64_t timestamp_ns;    /* capture time, nanoseconds since the unix epoch (UTC) */
+	uint32_t stream;         /* VL_SHM_STREAM_* */
+	uint32_t pixel_format;   /* VL_SHM_FORMAT_* */
+	uint32_t width;
+	uint32_t height;
+	uint32_t payload_size;   /* bytes of pixel data following the slot header */
+	uint32_t reserved;
+	float location[3];       /* camera location in cm (Unreal world space) */
+	float rotation[4];       /* camera rotation quaternion x, y, z, w */
+} vl_shm_frame_info;
+
+/* Start of the shared memory object */
+typedef struct vl_shm_header
+{
+	uint32_t magic;          /* written last by the producer once the ring is initialised, cleared when it is closed */
+	uint32_t version;
+	uint32_t slot_count;
+	uint32_t header_size;    /* offset of the first slot */
+	uint64_t slot_stride;    /* distance between two slots */
+	uint64_t max_payload;    /* largest payload a slot can hold */
+	volatile uint64_t write_seq; /* number of frames published so far */
+	uint8_t padding[88];
+} vl_shm_header;
+
+/* Start of every slot, the payload follows at slot + sizeof(vl_shm_slot) */
+typedef struct vl_shm_slot
+{
+	volatile uint64_t seq;
+	uint64_t padding0;
+	vl_shm_frame_info info;
+	uint8_t padding1[128 - 16 - sizeof(vl_shm_frame_info)];
+} vl_shm_slot;
+
+#define VL_SHM_ALIGN 64U
+
+static inline uint64_t vl_shm_align(uint64_t size)
+{
+	return (size + VL_SHM_ALIGN - 1) & ~(uint64_t)(VL_SHM_ALIGN - 1);
+}
+
+/* Total size of a ring with the given geometry */
+static inline uint64_t vl_shm_total_size(uint32_t slot_count, uint64_t max_payload)
+{
+	return sizeof(vl_shm_header) + (uint64_t)slot_count * vl_shm_align(sizeof(vl_shm_slot) + max_payload);
+}
+
+static inline vl_shm_slot* vl_shm_get_slot(vl_shm_header* header, uint64_t frame)
+{
+	return (vl_shm_slot*)((uint8_t*)header + header->header_size + (frame % header->slot_count) * header->slot_stride);
+}
+
+static inline uint64_t vl_shm_load_acquire(const volatile uint64_t* value)
+{
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline uint64_t vl_shm_load_relaxed(const volatile uint64_t* value)
+{
+	return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+static inline void vl_shm_store_release(volatile uint64_t* value, uint64_t new_value)
+{
+	__atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+}
+
+static inline void vl_shm_store_relaxed(volatile uint64_t* value, uint64_t new_value)
+{
+	__atomic_store_n(value, new_value, __ATOMIC_RELAXED);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VL_SHM_PROTOCOL_H */
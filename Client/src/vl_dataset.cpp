@@ -0,0 +1,1003 @@
+/* Copyright 2018, Institute for Artificial Intelligence - University of Bremen */
+
+#include "vl_dataset.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <zlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef VL_DATASET_WITH_JPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+
+namespace
+{
+	const char* manifest_name = "MANIFEST.csv";
+	const char* repeats_suffix = "_repeats.csv";
+
+	bool ends_with(const std::string& value, const char* suffix)
+	{
+		const size_t length = strlen(suffix);
+		return value.size() >= length && value.compare(value.size() - length, length, suffix) == 0;
+	}
+
+	bool list_directory(const std::string& directory, std::vector<std::string>& names)
+	{
+#if defined(_WIN32)
+		WIN32_FIND_DATAA data;
+		HANDLE find = FindFirstFileA((directory + "\\*").c_str(), &data);
+		if (find == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		do
+		{
+			if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			{
+				names.push_back(data.cFileName);
+			}
+		} while (FindNextFileA(find, &data));
+		FindClose(find);
+#else
+		DIR* dir = opendir(directory.c_str());
+		if (!dir)
+		{
+			return false;
+		}
+		while (struct dirent* entry = readdir(dir))
+		{
+			if (entry->d_name[0] != '.')
+			{
+				names.push_back(entry->d_name);
+			}
+		}
+		closedir(dir);
+#endif
+		return true;
+	}
+
+	/* Days since 1970-01-01 of a date of the proleptic Gregorian calendar */
+	int64_t days_from_civil(int64_t year, int month, int day)
+	{
+		year -= month <= 2;
+		const int64_t era = (year >= 0 ? year : year - 399) / 400;
+		const int64_t year_of_era = year - era * 400;
+		const int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+		const int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+		return era * 146097 + day_of_era - 719468;
+	}
+
+	/* Unsigned decimal number at pos, false if there is none */
+	bool parse_number(const std::string& text, size_t& pos, uint64_t& value)
+	{
+		const size_t start = pos;
+		value = 0;
+		while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9' && pos - start < 18)
+		{
+			value = value * 10 + (uint64_t)(text[pos++] - '0');
+		}
+		return pos > start;
+	}
+
+	/* Time stamp of RawDataAsyncWorker::FormatTimeStamp (year_month_day_hour_minute_second_millisecond, UTC) */
+	bool parse_time(const std::string& text, size_t& pos, int64_t& timestamp_ns)
+	{
+		uint64_t fields[7];
+		for (int i = 0; i < 7; ++i)
+		{
+			if ((i > 0 && (pos >= text.size() || text[pos++] != '_')) || !parse_number(text, pos, fields[i]))
+			{
+				return false;
+			}
+		}
+		if (fields[1] < 1 || fields[1] > 12 || fields[2] < 1 || fields[2] > 31)
+		{
+			return false;
+		}
+		const int64_t seconds = days_from_civil((int64_t)fields[0], (int)fields[1], (int)fields[2]) * 86400 +
+			(int64_t)(fields[3] * 3600 + fields[4] * 60 + fields[5]);
+		timestamp_ns = seconds * 1000000000LL + (int64_t)fields[6] * 1000000LL;
+		return true;
+	}
+
+	/* Raw file extensions, see FPixelFormatConversion::GetFileExtension and TVisionStreamTraits */
+	bool raw_format(const std::string& extension, uint32_t& format)
+	{
+		static const struct { const char* extension; uint32_t format; } formats[] =
+		{
+			{ ".bgra", VL_SHM_FORMAT_BGRA8 },
+			{ ".rgb", VL_SHM_FORMAT_RGB24 },
+			{ ".gray", VL_SHM_FORMAT_GRAY8 },
+			{ ".yuv", VL_SHM_FORMAT_YUV420 },
+			{ ".nv12", VL_SHM_FORMAT_NV12 },
+			{ ".rgbp", VL_SHM_FORMAT_PLANAR_RGB },
+			{ ".u16", VL_SHM_FORMAT_GRAY16 },
+			{ ".f32", VL_SHM_FORMAT_FLOAT32 },
+			{ ".rgba16f", VL_SHM_FORMAT_RGBA16F },
+		};
+		for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i)
+		{
+			if (extension == formats[i].extension)
+			{
+				format = formats[i].format;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/* Bytes of a frame in a raw format, 0 for unknown formats */
+	uint64_t raw_size(uint32_t format, uint32_t width, uint32_t height)
+	{
+		const uint64_t pixels = (uint64_t)width * height;
+		const uint64_t chroma = (uint64_t)((width + 1) / 2) * ((height + 1) / 2);
+		switch (format)
+		{
+		case VL_SHM_FORMAT_BGRA8:
+		case VL_SHM_FORMAT_FLOAT32:
+			return pixels * 4;
+		case VL_SHM_FORMAT_RGB24:
+		case VL_SHM_FORMAT_PLANAR_RGB:
+			return pixels * 3;
+		case VL_SHM_FORMAT_GRAY8:
+			return pixels;
+		case VL_SHM_FORMAT_YUV420:
+		case VL_SHM_FORMAT_NV12:
+			return pixels + 2 * chroma;
+		case VL_SHM_FORMAT_GRAY16:
+			return pixels * 2;
+		case VL_SHM_FORMAT_RGBA16F:
+			return pixels * 8;
+		default:
+			return 0;
+		}
+	}
+
+	/* <STREAM><time>[_<Width>x<Height>].<ext>, false for files the plugin did not name this way */
+	bool parse_file_name(const std::string& name, std::string& stream, vl::DatasetFile& file)
+	{
+		size_t pos = 0;
+		while (pos < name.size() && ((name[pos] >= 'A' && name[pos] <= 'Z') || name[pos] == '_'))
+		{
+			++pos;
+		}
+		stream = name.substr(0, pos);
+		if (pos == 0 || !parse_time(name, pos, file.timestamp_ns))
+		{
+			return false;
+		}
+		file.width = 0;
+		file.height = 0;
+		file.format = 0;
+		file.quality = 0;
+		file.scale = 1.0f;
+		uint64_t width = 0;
+		uint64_t height = 0;
+		if (pos < name.size() && name[pos] == '_')
+		{
+			++pos;
+			if (!parse_number(name, pos, width) || pos >= name.size() || name[pos++] != 'x' || !parse_number(name, pos, height))
+			{
+				return false;
+			}
+		}
+		const std::string extension = name.substr(pos);
+		if (extension.empty() || extension[0] != '.')
+		{
+			return false;
+		}
+		if (extension == ".png")
+		{
+			file.codec = vl::DATASET_PNG;
+		}
+		else if (extension == ".jpg")
+		{
+			file.codec = vl::DATASET_JPEG;
+		}
+		else if (width > 0 && height > 0 && width <= 0xFFFF && height <= 0xFFFF && raw_format(extension, file.format))
+		{
+			file.codec = vl::DATASET_RAW;
+			file.width = (uint32_t)width;
+			file.height = (uint32_t)height;
+		}
+		else
+		{
+			file.codec = vl::DATASET_OTHER;
+		}
+		return true;
+	}
+
+	void split(const std::string& line, char separator, std::vector<std::string>& fields)
+	{
+		fields.clear();
+		size_t start = 0;
+		for (;;)
+		{
+			const size_t end = line.find(separator, start);
+			fields.push_back(line.substr(start, end == std::string::npos ? std::string::npos : end - start));
+			if (end == std::string::npos)
+			{
+				return;
+			}
+			start = end + 1;
+		}
+	}
+
+	bool read_lines(const std::string& path, std::vector<std::string>& lines)
+	{
+		vl::MappedFile file;
+		if (!file.open(path))
+		{
+			return false;
+		}
+		const char* text = (const char*)file.data();
+		size_t start = 0;
+		for (size_t i = 0; i < file.size(); ++i)
+		{
+			if (text[i] == '\n')
+			{
+				size_t end = i;
+				if (end > start && text[end - 1] == '\r')
+				{
+					--end;
+				}
+				lines.push_back(std::string(text + start, end - start));
+				start = i + 1;
+			}
+		}
+		/* A line without newline was not completely written */
+		return true;
+	}
+
+	uint32_t read_u32_be(const uint8_t* data)
+	{
+		return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+	}
+
+	uint8_t paeth(uint8_t left, uint8_t up, uint8_t up_left)
+	{
+		const int p = (int)left + up - up_left;
+		const int pa = abs(p - left);
+		const int pb = abs(p - up);
+		const int pc = abs(p - up_left);
+		return pa <= pb && pa <= pc ? left : (pb <= pc ? up : up_left);
+	}
+
+	/* Non interlaced 8 bit gray, RGB and RGBA or 16 bit gray PNGs, the formats the plugin writes */
+	bool decode_png(const uint8_t* data, size_t size, vl::DatasetImage& out)
+	{
+		static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		if (size < 33 || memcmp(data, signature, 8) != 0 || memcmp(data + 12, "IHDR", 4) != 0)
+		{
+			return false;
+		}
+		const uint32_t width = read_u32_be(data + 16);
+		const uint32_t height = read_u32_be(data + 20);
+		const uint8_t bit_depth = data[24];
+		const uint8_t color_type = data[25];
+		const uint8_t interlace = data[28];
+		uint32_t channels = 0;
+		if (bit_depth == 8 && color_type == 0)
+		{
+			channels = 1;
+			out.format = VL_SHM_FORMAT_GRAY8;
+		}
+		else if (bit_depth == 16 && color_type == 0)
+		{
+			channels = 1;
+			out.format = VL_SHM_FORMAT_GRAY16;
+		}
+		else if (bit_depth == 8 && color_type == 2)
+		{
+			channels = 3;
+			out.format = VL_SHM_FORMAT_RGB24;
+		}
+		else if (bit_depth == 8 && color_type == 6)
+		{
+			channels = 4;
+			out.format = VL_SHM_FORMAT_BGRA8;
+		}
+		if (channels == 0 || interlace != 0 || width == 0 || height == 0 || width > 0xFFFF || height > 0xFFFF)
+		{
+			return false;
+		}
+		const size_t pixel_bytes = channels * bit_depth / 8;
+		const size_t row_bytes = width * pixel_bytes;
+
+		/* The filtered rows are inflated chunk by chunk, the plugin splits large frames into many IDATs */
+		std::vector<uint8_t> filtered((row_bytes + 1) * height);
+		z_stream stream;
+		memset(&stream, 0, sizeof(stream));
+		if (inflateInit(&stream) != Z_OK)
+		{
+			return false;
+		}
+		stream.next_out = filtered.data();
+		stream.avail_out = (uInt)filtered.size();
+		int result = Z_OK;
+		size_t pos = 8;
+		while (pos + 12 <= size && result == Z_OK)
+		{
+			const uint32_t length = read_u32_be(data + pos);
+			if (length > size - pos - 12)
+			{
+				break;
+			}
+			const uint8_t* type = data + pos + 4;
+			if (memcmp(type, "IDAT", 4) == 0)
+			{
+				stream.next_in = (Bytef*)(data + pos + 8);
+				stream.avail_in = length;
+				while (stream.avail_in > 0 && result == Z_OK)
+				{
+					result = inflate(&stream, Z_NO_FLUSH);
+				}
+			}
+			else if (memcmp(type, "IEND", 4) == 0)
+			{
+				break;
+			}
+			pos += 12 + length;
+		}
+		const bool complete = stream.avail_out == 0 && (result == Z_OK || result == Z_STREAM_END);
+		inflateEnd(&stream);
+		if (!complete)
+		{
+			return false;
+		}
+
+		out.width = width;
+		out.height = height;
+		out.pixels.resize(row_bytes * height);
+		uint8_t* pixels = out.pixels.data();
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			const uint8_t filter = filtered[y * (row_bytes + 1)];
+			const uint8_t* src = &filtered[y * (row_bytes + 1) + 1];
+			uint8_t* row = pixels + y * row_bytes;
+			const uint8_t* up = y > 0 ? row - row_bytes : NULL;
+			/* The first row is filtered against zeros, Up reduces to None and Paeth to Sub */
+			const uint8_t mode = up || filter < 2 ? filter : (filter == 2 ? 0 : (filter == 4 ? 1 : filter));
+			switch (mode)
+			{
+			case 0:
+				memcpy(row, src, row_bytes);
+				break;
+			case 1:
+				memcpy(row, src, pixel_bytes);
+				for (size_t i = pixel_bytes; i < row_bytes; ++i)
+				{
+					row[i] = (uint8_t)(src[i] + row[i - pixel_bytes]);
+				}
+				break;
+			case 2:
+				for (size_t i = 0; i < row_bytes; ++i)
+				{
+					row[i] = (uint8_t)(src[i] + up[i]);
+				}
+				break;
+			case 3:
+				for (size_t i = 0; i < row_bytes; ++i)
+				{
+					const uint8_t left = i >= pixel_bytes ? row[i - pixel_bytes] : 0;
+					row[i] = (uint8_t)(src[i] + ((left + (up ? up[i] : 0)) >> 1));
+				}
+				break;
+			case 4:
+				for (size_t i = 0; i < pixel_bytes; ++i)
+				{
+					row[i] = (uint8_t)(src[i] + up[i]);
+				}
+				for (size_t i = pixel_bytes; i < row_bytes; ++i)
+				{
+					row[i] = (uint8_t)(src[i] + paeth(row[i - pixel_bytes], up[i], up[i - pixel_bytes]));
+				}
+				break;
+			default:
+				return false;
+			}
+		}
+
+		/* Samples are big endian, colors RGBA */
+		if (out.format == VL_SHM_FORMAT_GRAY16)
+		{
+			const uint16_t probe = 1;
+			if (*(const uint8_t*)&probe == 1)
+			{
+				for (size_t i = 0; i + 1 < out.pixels.size(); i += 2)
+				{
+					std::swap(pixels[i], pixels[i + 1]);
+				}
+			}
+		}
+		else if (out.format == VL_SHM_FORMAT_BGRA8)
+		{
+			for (size_t i = 0; i < out.pixels.size(); i += 4)
+			{
+				std::swap(pixels[i], pixels[i + 2]);
+			}
+		}
+		return true;
+	}
+
+#ifdef VL_DATASET_WITH_JPEG
+	struct JpegError
+	{
+		jpeg_error_mgr manager;
+		jmp_buf jump;
+	};
+
+	void jpeg_error_exit(j_common_ptr info)
+	{
+		longjmp(((JpegError*)info->err)->jump, 1);
+	}
+
+	bool decode_jpeg(const uint8_t* data, size_t size, vl::DatasetImage& out)
+	{
+		jpeg_decompress_struct info;
+		JpegError error;
+		info.err = jpeg_std_error(&error.manager);
+		error.manager.error_exit = jpeg_error_exit;
+		if (setjmp(error.jump))
+		{
+			jpeg_destroy_decompress(&info);
+			return false;
+		}
+		jpeg_create_decompress(&info);
+		jpeg_mem_src(&info, (unsigned char*)data, (unsigned long)size);
+		jpeg_read_header(&info, TRUE);
+		info.out_color_space = info.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+		jpeg_start_decompress(&info);
+		out.width = info.output_width;
+		out.height = info.output_height;
+		out.format = info.output_components == 1 ? VL_SHM_FORMAT_GRAY8 : VL_SHM_FORMAT_RGB24;
+		const size_t row_bytes = (size_t)info.output_width * info.output_components;
+		out.pixels.resize(row_bytes * info.output_height);
+		while (info.output_scanline < info.output_height)
+		{
+			JSAMPROW row = out.pixels.data() + info.output_scanline * row_bytes;
+			jpeg_read_scanlines(&info, &row, 1);
+		}
+		jpeg_finish_decompress(&info);
+		jpeg_destroy_decompress(&info);
+		return true;
+	}
+#endif
+}
+
+namespace vl
+{
+	MappedFile::MappedFile() : data_(NULL), size_(0)
+	{
+	}
+
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+	bool MappedFile::open(const std::string& path)
+	{
+		close();
+#if defined(_WIN32)
+		FILE* file = fopen(path.c_str(), "rb");
+		if (!file)
+		{
+			return false;
+		}
+		_fseeki64(file, 0, SEEK_END);
+		const int64_t size = _ftelli64(file);
+		_fseeki64(file, 0, SEEK_SET);
+		buffer_.resize(size > 0 ? (size_t)size : 0);
+		const bool ok = size > 0 && fread(buffer_.data(), 1, buffer_.size(), file) == buffer_.size();
+		fclose(file);
+		if (!ok)
+		{
+			buffer_.clear();
+			return false;
+		}
+		data_ = buffer_.data();
+		size_ = buffer_.size();
+#else
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+		struct stat info;
+		void* mapping = MAP_FAILED;
+		if (fstat(fd, &info) == 0 && info.st_size > 0)
+		{
+			mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		::close(fd);
+		if (mapping == MAP_FAILED)
+		{
+			return false;
+		}
+		/* Every file is read once from start to end, start the read ahead now */
+		madvise(mapping, (size_t)info.st_size, MADV_WILLNEED);
+		data_ = (const uint8_t*)mapping;
+		size_ = (size_t)info.st_size;
+#endif
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+#if !defined(_WIN32)
+		if (data_)
+		{
+			munmap((void*)data_, size_);
+		}
+#endif
+		data_ = NULL;
+		size_ = 0;
+		buffer_.clear();
+	}
+
+	DatasetReader::DatasetReader() : has_manifest_(false)
+	{
+	}
+
+	void DatasetReader::close()
+	{
+		directory_.clear();
+		has_manifest_ = false;
+		streams_.clear();
+		files_.clear();
+		file_by_name_.clear();
+		frames_.clear();
+		frame_by_number_.clear();
+	}
+
+	bool DatasetReader::open(const std::string& directory)
+	{
+		close();
+		std::vector<std::string> names;
+		if (!list_directory(directory, names))
+		{
+			return false;
+		}
+		std::sort(names.begin(), names.end());
+		directory_ = directory;
+		std::vector<Entry> entries;
+		has_manifest_ = read_manifest(entries);
+		if (!has_manifest_)
+		{
+			scan_directory(names, entries);
+		}
+		read_repeats(names, entries);
+		build_frames(entries);
+		return true;
+	}
+
+	int DatasetReader::add_stream(const std::string& name)
+	{
+		const int stream = find_stream(name);
+		if (stream >= 0)
+		{
+			return stream;
+		}
+		streams_.push_back(name);
+		return (int)streams_.size() - 1;
+	}
+
+	int32_t DatasetReader::add_file(const std::string& name)
+	{
+		const std::map<std::string, int32_t>::const_iterator found = file_by_name_.find(name);
+		if (found != file_by_name_.end())
+		{
+			return found->second;
+		}
+		DatasetFile file;
+		std::string stream;
+		if (!parse_file_name(name, stream, file))
+		{
+			return -1;
+		}
+		file.name = name;
+		file.stream = add_stream(stream);
+		files_.push_back(file);
+		file_by_name_[name] = (int32_t)files_.size() - 1;
+		return (int32_t)files_.size() - 1;
+	}
+
+	bool DatasetReader::read_manifest(std::vector<Entry>& entries)
+	{
+		std::vector<std::string> lines;
+		if (!read_lines(directory_ + "/" + manifest_name, lines))
+		{
+			return false;
+		}
+
+		/* Every "#" line commits the entries before it, entries after the last one may not be durable */
+		std::vector<Entry> group;
+		std::vector<std::string> fields;
+		uint32_t session_count = 0;
+		for (size_t i = 0; i < lines.size(); ++i)
+		{
+			const std::string& line = lines[i];
+			if (!line.empty() && line[0] == '#')
+			{
+				entries.insert(entries.end(), group.begin(), group.end());
+				group.clear();
+				if (line.compare(0, 9, "#session,") == 0)
+				{
+					++session_count;
+				}
+				continue;
+			}
+			/* frame,stream,file,bytes[,quality,scale], older sessions have no capture settings */
+			split(line, ',', fields);
+			if (fields.size() < 4)
+			{
+				continue;
+			}
+			Entry entry;
+			entry.file = add_file(fields[2]);
+			if (entry.file < 0)
+			{
+				continue;
+			}
+			size_t pos = 0;
+			uint64_t quality = 0;
+			if (fields.size() >= 6 && parse_number(fields[4], pos, quality) && pos == fields[4].size() && quality <= 100)
+			{
+				files_[entry.file].quality = (uint32_t)quality;
+				char* end = NULL;
+				const float scale = strtof(fields[5].c_str(), &end);
+				if (end != fields[5].c_str() && *end == '\0' && scale > 0.0f && scale <= 1.0f)
+				{
+					files_[entry.file].scale = scale;
+				}
+			}
+			pos = 0;
+			uint64_t frame = 0;
+			entry.session = session_count > 0 ? session_count - 1 : 0;
+			entry.frame = parse_number(fields[0], pos, frame) && pos == fields[0].size() ? frame : DATASET_NO_FRAME;
+			entry.timestamp_ns = files_[entry.file].timestamp_ns;
+			entry.repeat = false;
+			group.push_back(entry);
+		}
+		return true;
+	}
+
+	void DatasetReader::scan_directory(const std::vector<std::string>& names, std::vector<Entry>& entries)
+	{
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			/* Files of the journal still being written end with .tmp and have no valid extension */
+			Entry entry;
+			entry.file = ends_with(names[i], ".tmp") || ends_with(names[i], ".csv") ? -1 : add_file(names[i]);
+			if (entry.file < 0)
+			{
+				continue;
+			}
+			entry.session = 0;
+			entry.frame = DATASET_NO_FRAME;
+			entry.timestamp_ns = files_[entry.file].timestamp_ns;
+			entry.repeat = false;
+			entries.push_back(entry);
+		}
+	}
+
+	void DatasetReader::read_repeats(const std::vector<std::string>& names, std::vector<Entry>& entries)
+	{
+		/* <time>,<capture frame>,<repeated capture frame>,<repeated file> */
+		std::vector<std::string> lines;
+		std::vector<std::string> fields;
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			lines.clear();
+			if (!ends_with(names[i], repeats_suffix) || !read_lines(directory_ + "/" + names[i], lines))
+			{
+				continue;
+			}
+			for (size_t l = 0; l < lines.size(); ++l)
+			{
+				split(lines[l], ',', fields);
+				Entry entry;
+				size_t pos = 0;
+				if (fields.size() != 4 || !parse_time(fields[0], pos, entry.timestamp_ns))
+				{
+					continue;
+				}
+				entry.file = add_file(fields[3]);
+				if (entry.file < 0)
+				{
+					continue;
+				}
+				entry.session = 0;
+				entry.frame = DATASET_NO_FRAME;
+				entry.repeat = true;
+				entries.push_back(entry);
+			}
+		}
+	}
+
+	void DatasetReader::build_frames(std::vector<Entry>& entries)
+	{
+		struct FrameOrder
+		{
+			bool operator()(const DatasetFrame& a, const DatasetFrame& b) const
+			{
+				if (a.session != b.session)
+				{
+					return a.session < b.session;
+				}
+				return a.timestamp_ns != b.timestamp_ns ? a.timestamp_ns < b.timestamp_ns : a.frame < b.frame;
+			}
+		};
+
+		const size_t stream_count = streams_.size();
+		DatasetFrame empty;
+		empty.files.assign(stream_count, -1);
+		empty.repeats.assign(stream_count, false);
+
+		/* A stream keeps the file saved for the frame, a repeat only fills a gap */
+		struct Assign
+		{
+			static void file(DatasetFrame& frame, const Entry& entry, const DatasetFile& file)
+			{
+				int32_t& slot = frame.files[file.stream];
+				if (slot < 0 || (frame.repeats[file.stream] && !entry.repeat))
+				{
+					slot = entry.file;
+					frame.repeats[file.stream] = entry.repeat;
+				}
+				frame.timestamp_ns = std::min(frame.timestamp_ns, entry.timestamp_ns);
+			}
+		};
+
+		/* Numbered entries first, they define the frames and the sessions the others fall into */
+		std::map<std::pair<uint32_t, uint64_t>, size_t> numbered;
+		std::map<int64_t, size_t> by_time;
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			const Entry& entry = entries[i];
+			if (entry.frame == DATASET_NO_FRAME)
+			{
+				continue;
+			}
+			const std::pair<uint32_t, uint64_t> key(entry.session, entry.frame);
+			std::map<std::pair<uint32_t, uint64_t>, size_t>::iterator found = numbered.find(key);
+			if (found == numbered.end())
+			{
+				found = numbered.insert(std::make_pair(key, frames_.size())).first;
+				frames_.push_back(empty);
+				frames_.back().session = entry.session;
+				frames_.back().frame = entry.frame;
+				frames_.back().timestamp_ns = entry.timestamp_ns;
+			}
+			Assign::file(frames_[found->second], entry, files_[entry.file]);
+			by_time.insert(std::make_pair(entry.timestamp_ns, found->second));
+		}
+		const size_t numbered_count = frames_.size();
+
+		/* Entries with only a time stamp join the frame saved in the same tick, or start a new one */
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			const Entry& entry = entries[i];
+			if (entry.frame != DATASET_NO_FRAME)
+			{
+				continue;
+			}
+			std::map<int64_t, size_t>::iterator found = by_time.find(entry.timestamp_ns);
+			if (found == by_time.end())
+			{
+				uint32_t session = entry.session;
+				std::map<int64_t, size_t>::iterator before = by_time.upper_bound(entry.timestamp_ns);
+				if (before != by_time.begin())
+				{
+					session = frames_[(--before)->second].session;
+				}
+				found = by_time.insert(std::make_pair(entry.timestamp_ns, frames_.size())).first;
+				frames_.push_back(empty);
+				frames_.back().session = session;
+				frames_.back().frame = DATASET_NO_FRAME;
+				frames_.back().timestamp_ns = entry.timestamp_ns;
+			}
+			Assign::file(frames_[found->second], entry, files_[entry.file]);
+		}
+
+		std::sort(frames_.begin(), frames_.end(), FrameOrder());
+		for (size_t i = 0; i < frames_.size(); ++i)
+		{
+			/* Without a manifest the frames are numbered in time order */
+			if (numbered_count == 0)
+			{
+				frames_[i].frame = i;
+			}
+			if (frames_[i].frame != DATASET_NO_FRAME)
+			{
+				frame_by_number_[std::make_pair(frames_[i].session, frames_[i].frame)] = i;
+			}
+		}
+	}
+
+	int DatasetReader::find_stream(const std::string& name) const
+	{
+		for (size_t i = 0; i < streams_.size(); ++i)
+		{
+			if (streams_[i] == name)
+			{
+				return (int)i;
+			}
+		}
+		return -1;
+	}
+
+	int64_t DatasetReader::find_frame(uint64_t frame, uint32_t session) const
+	{
+		const std::map<std::pair<uint32_t, uint64_t>, size_t>::const_iterator found = frame_by_number_.find(std::make_pair(session, frame));
+		return found == frame_by_number_.end() ? -1 : (int64_t)found->second;
+	}
+
+	const DatasetFile* DatasetReader::file(size_t frame_index, int stream) const
+	{
+		if (frame_index >= frames_.size() || stream < 0 || (size_t)stream >= streams_.size())
+		{
+			return NULL;
+		}
+		const int32_t file = frames_[frame_index].files[stream];
+		return file < 0 ? NULL : &files_[file];
+	}
+
+	bool DatasetReader::map(size_t frame_index, int stream, MappedFile& out) const
+	{
+		const DatasetFile* entry = file(frame_index, stream);
+		return entry && out.open(directory_ + "/" + entry->name);
+	}
+
+	bool DatasetReader::decode(size_t frame_index, int stream, DatasetImage& out) const
+	{
+		MappedFile mapped;
+		return map(frame_index, stream, mapped) && decode(*file(frame_index, stream), mapped.data(), mapped.size(), out);
+	}
+
+	bool DatasetReader::decode(const DatasetFile& file, const uint8_t* data, size_t size, DatasetImage& out)
+	{
+		switch (file.codec)
+		{
+		case DATASET_RAW:
+			if (size != raw_size(file.format, file.width, file.height))
+			{
+				return false;
+			}
+			out.width = file.width;
+			out.height = file.height;
+			out.format = file.format;
+			out.pixels.assign(data, data + size);
+			return true;
+		case DATASET_PNG:
+			return decode_png(data, size, out);
+		case DATASET_JPEG:
+#ifdef VL_DATASET_WITH_JPEG
+			return decode_jpeg(data, size, out);
+#else
+			return false;
+#endif
+		default:
+			return false;
+		}
+	}
+
+	DatasetPrefetcher::DatasetPrefetcher(const DatasetReader& reader, const std::vector<int>& streams, unsigned threads, size_t depth)
+		: reader_(reader)
+		, streams_(streams)
+		, thread_count_(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()))
+		, depth_(depth > 0 ? depth : 2 * (size_t)thread_count_)
+		, next_dispatch_(0)
+		, next_consume_(0)
+		, stopping_(false)
+	{
+	}
+
+	DatasetPrefetcher::~DatasetPrefetcher()
+	{
+		stop();
+	}
+
+	void DatasetPrefetcher::start(const std::vector<size_t>& order)
+	{
+		stop();
+		order_ = order;
+		slots_.assign(depth_, Slot());
+		for (size_t i = 0; i < slots_.size(); ++i)
+		{
+			slots_[i].ready = false;
+		}
+		next_dispatch_ = 0;
+		next_consume_ = 0;
+		stopping_ = false;
+		for (unsigned i = 0; i < thread_count_; ++i)
+		{
+			threads_.push_back(std::thread(&DatasetPrefetcher::work, this));
+		}
+	}
+
+	void DatasetPrefetcher::stop()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			stopping_ = true;
+		}
+		work_ready_.notify_all();
+		sample_ready_.notify_all();
+		for (size_t i = 0; i < threads_.size(); ++i)
+		{
+			threads_[i].join();
+		}
+		threads_.clear();
+	}
+
+	bool DatasetPrefetcher::next(DatasetSample& out)
+	{
+		std::unique_lock<std::mutex> guard(lock_);
+		if (next_consume_ >= order_.size() || threads_.empty())
+		{
+			return false;
+		}
+		Slot& slot = slots_[next_consume_ % depth_];
+		sample_ready_.wait(guard, [&]() { return slot.ready || stopping_; });
+		if (!slot.ready)
+		{
+			return false;
+		}
+		std::swap(out, slot.sample);
+		slot.ready = false;
+		++next_consume_;
+		guard.unlock();
+		work_ready_.notify_all();
+		return true;
+	}
+
+	void DatasetPrefetcher::work()
+	{
+		DatasetSample sample;
+		for (;;)
+		{
+			size_t position;
+			{
+				/* At most depth frames ahead of the consumer, a slot is free once its last frame was taken */
+				std::unique_lock<std::mutex> guard(lock_);
+				work_ready_.wait(guard, [&]() { return stopping_ || next_dispatch_ >= order_.size() || next_dispatch_ < next_consume_ + depth_; });
+				if (stopping_ || next_dispatch_ >= order_.size())
+				{
+					return;
+				}
+				position = next_dispatch_++;
+			}
+
+			sample.frame_index = order_[position];
+			sample.images.resize(streams_.size());
+			sample.valid.assign(streams_.size(), false);
+			for (size_t i = 0; i < streams_.size(); ++i)
+			{
+				sample.valid[i] = reader_.decode(sample.frame_index, streams_[i], sample.images[i]);
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(lock_);
+				Slot& slot = slots_[position % depth_];
+				std::swap(slot.sample, sample);
+				slot.ready = true;
+			}
+			sample_ready_.notify_all();
+		}
+	}
+}
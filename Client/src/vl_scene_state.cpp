@@ -0,0 +1,458 @@
+/* Copyright 2018, Institute for Artificial Intelligence - University of Bremen */
+
+#include "vl_scene_state.h"
+
+#include <string.h>
+#include <algorithm>
+
+#if defined(_WIN32)
+#define vl_fseek _fseeki64
+#define vl_ftell _ftelli64
+#else
+#define vl_fseek fseeko
+#define vl_ftell ftello
+#endif
+
+namespace
+{
+	/* Bounds checked decoding of a record payload */
+	struct Cursor
+	{
+		const uint8_t* data;
+		size_t size;
+		size_t pos;
+		bool ok;
+
+		Cursor(const std::vector<uint8_t>& payload, size_t start = 0) : data(payload.data()), size(payload.size()), pos(start), ok(start <= payload.size()) {}
+
+		uint64_t varint()
+		{
+			uint64_t value = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				if (pos >= size)
+				{
+					ok = false;
+					return 0;
+				}
+				const uint8_t byte = data[pos++];
+				value |= (uint64_t)(byte & 0x7F) << shift;
+				if (!(byte & 0x80))
+				{
+					return value;
+				}
+			}
+			ok = false;
+			return 0;
+		}
+
+		int64_t svarint()
+		{
+			const uint64_t value = varint();
+			return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+		}
+
+		uint32_t u32()
+		{
+			if (pos + 4 > size)
+			{
+				ok = false;
+				return 0;
+			}
+			const uint32_t value = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16) | ((uint32_t)data[pos + 3] << 24);
+			pos += 4;
+			return value;
+		}
+
+		std::string string()
+		{
+			const uint64_t length = varint();
+			if (!ok || length > size - pos)
+			{
+				ok = false;
+				return std::string();
+			}
+			std::string value((const char*)data + pos, (size_t)length);
+			pos += (size_t)length;
+			return value;
+		}
+	};
+
+	bool read_u32(FILE* file, uint32_t& value)
+	{
+		uint8_t bytes[4];
+		if (fread(bytes, 1, 4, file) != 4)
+		{
+			return false;
+		}
+		value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+		return true;
+	}
+}
+
+namespace vl
+{
+	SceneStateReader::SceneStateReader() : file_(NULL), has_index_(false)
+	{
+		memset(&header_, 0, sizeof(header_));
+	}
+
+	SceneStateReader::~SceneStateReader()
+	{
+		close();
+	}
+
+	void SceneStateReader::close()
+	{
+		if (file_)
+		{
+			fclose(file_);
+			file_ = NULL;
+		}
+		has_index_ = false;
+		actors_.clear();
+		blocks_.clear();
+		actor_blocks_.clear();
+	}
+
+	bool SceneStateReader::open(const std::string& path)
+	{
+		close();
+		file_ = fopen(path.c_str(), "rb");
+		if (!file_)
+		{
+			return false;
+		}
+		if (fread(&header_, 1, VL_SCENE_FILE_HEADER_SIZE, file_) != VL_SCENE_FILE_HEADER_SIZE ||
+			header_.magic != VL_SCENE_MAGIC || header_.version != VL_SCENE_VERSION)
+		{
+			close();
+			return false;
+		}
+		vl_fseek(file_, 0, SEEK_END);
+		const uint64_t file_size = (uint64_t)vl_ftell(file_);
+
+		/* A closed log ends with the offset of its index */
+		uint64_t index_offset = 0;
+		if (file_size >= VL_SCENE_FILE_HEADER_SIZE + VL_SCENE_TRAILER_SIZE)
+		{
+			uint8_t trailer[VL_SCENE_TRAILER_SIZE];
+			vl_fseek(file_, (int64_t)(file_size - VL_SCENE_TRAILER_SIZE), SEEK_SET);
+			if (fread(trailer, 1, VL_SCENE_TRAILER_SIZE, file_) == VL_SCENE_TRAILER_SIZE)
+			{
+				uint32_t magic;
+				memcpy(&index_offset, trailer, 8);
+				memcpy(&magic, trailer + 8, 4);
+				if (magic != VL_SCENE_INDEX_MAGIC || index_offset >= file_size)
+				{
+					index_offset = 0;
+				}
+			}
+		}
+
+		/* Walk the record headers: actor records are always read, blocks only without index */
+		const uint64_t end = index_offset ? index_offset : file_size;
+		uint64_t offset = VL_SCENE_FILE_HEADER_SIZE;
+		std::vector<uint8_t> payload;
+		while (offset + VL_SCENE_RECORD_HEADER_SIZE <= end)
+		{
+			uint32_t type = 0, size = 0;
+			vl_fseek(file_, (int64_t)offset, SEEK_SET);
+			if (!read_u32(file_, type) || !read_u32(file_, size) || offset + VL_SCENE_RECORD_HEADER_SIZE + size > end)
+			{
+				/* Truncated record at the end of a crashed session */
+				break;
+			}
+			if (type == VL_SCENE_RECORD_ACTORS || (!index_offset && type == VL_SCENE_RECORD_BLOCK))
+			{
+				if (!read_payload(offset, type, payload))
+				{
+					break;
+				}
+				if (type == VL_SCENE_RECORD_ACTORS ? !read_actors(payload) : !index_block(offset, payload))
+				{
+					break;
+				}
+			}
+			offset += VL_SCENE_RECORD_HEADER_SIZE + size;
+		}
+
+		if (index_offset)
+		{
+			if (!read_payload(index_offset, VL_SCENE_RECORD_INDEX, payload) || !read_index(payload))
+			{
+				close();
+				return false;
+			}
+			has_index_ = true;
+		}
+		actor_blocks_.resize(actors_.size());
+		return true;
+	}
+
+	bool SceneStateReader::read_payload(uint64_t offset, uint32_t expected_type, std::vector<uint8_t>& payload)
+	{
+		uint32_t type = 0, size = 0;
+		vl_fseek(file_, (int64_t)offset, SEEK_SET);
+		if (!read_u32(file_, type) || !read_u32(file_, size) || type != expected_type)
+		{
+			return false;
+		}
+		payload.resize(size);
+		return size == 0 || fread(payload.data(), 1, size, file_) == size;
+	}
+
+	bool SceneStateReader::read_actors(const std::vector<uint8_t>& payload)
+	{
+		Cursor cursor(payload);
+		const uint64_t count = cursor.varint();
+		for (uint64_t i = 0; i < count && cursor.ok; ++i)
+		{
+			SceneActor actor;
+			actor.id = (uint32_t)cursor.varint();
+			actor.category_id = (uint32_t)cursor.varint();
+			actor.instance_id = (uint32_t)cursor.varint();
+			actor.category = cursor.string();
+			actor.name = cursor.string();
+			if (!cursor.ok || actor.id != actors_.size())
+			{
+				return false;
+			}
+			actors_.push_back(actor);
+		}
+		return cursor.ok;
+	}
+
+	bool SceneStateReader::read_index(const std::vector<uint8_t>& payload)
+	{
+		Cursor cursor(payload);
+		const uint64_t block_count = cursor.varint();
+		blocks_.clear();
+		Block block = { 0, 0, 0 };
+		for (uint64_t i = 0; i < block_count && cursor.ok; ++i)
+		{
+			block.offset += cursor.varint();
+			block.first_frame += cursor.varint();
+			block.frame_count = (uint32_t)cursor.varint();
+			blocks_.push_back(block);
+		}
+		const uint64_t actor_count = cursor.varint();
+		if (!cursor.ok || actor_count > actors_.size())
+		{
+			return false;
+		}
+		actor_blocks_.assign(actors_.size(), std::vector<uint32_t>());
+		for (uint64_t a = 0; a < actor_count && cursor.ok; ++a)
+		{
+			const uint64_t count = cursor.varint();
+			uint32_t index = 0;
+			for (uint64_t i = 0; i < count && cursor.ok; ++i)
+			{
+				index += (uint32_t)cursor.varint();
+				actor_blocks_[a].push_back(index);
+			}
+		}
+		return cursor.ok;
+	}
+
+	bool SceneStateReader::index_block(uint64_t offset, const std::vector<uint8_t>& payload)
+	{
+		Cursor cursor(payload);
+		Block block;
+		block.offset = offset;
+		block.frame_count = (uint32_t)cursor.varint();
+		block.first_frame = cursor.varint();
+		for (uint32_t i = 1; i < block.frame_count; ++i)
+		{
+			cursor.varint();
+		}
+		for (uint32_t i = 0; i < block.frame_count; ++i)
+		{
+			cursor.varint();
+		}
+		const uint64_t changed = cursor.varint();
+		uint32_t id = 0;
+		for (uint64_t i = 0; i < changed && cursor.ok; ++i)
+		{
+			id = (uint32_t)(i == 0 ? cursor.varint() : id + cursor.varint());
+			if (id >= actor_blocks_.size())
+			{
+				actor_blocks_.resize(id + 1);
+			}
+			actor_blocks_[id].push_back((uint32_t)blocks_.size());
+		}
+		if (!cursor.ok || block.frame_count == 0)
+		{
+			return false;
+		}
+		blocks_.push_back(block);
+		return true;
+	}
+
+	int SceneStateReader::find_actor(uint32_t category_id, uint32_t instance_id) const
+	{
+		for (size_t i = 0; i < actors_.size(); ++i)
+		{
+			if (actors_[i].category_id == category_id && actors_[i].instance_id == instance_id)
+			{
+				return (int)i;
+			}
+		}
+		return -1;
+	}
+
+	int SceneStateReader::find_actor(const std::string& name) const
+	{
+		for (size_t i = 0; i < actors_.size(); ++i)
+		{
+			if (actors_[i].name == name)
+			{
+				return (int)i;
+			}
+		}
+		return -1;
+	}
+
+	bool SceneStateReader::decode(uint32_t block_index, uint32_t actor_id, std::vector<ScenePose>& out)
+	{
+		if (block_index >= blocks_.size() || !read_payload(blocks_[block_index].offset, VL_SCENE_RECORD_BLOCK, buffer_))
+		{
+			return false;
+		}
+		Cursor cursor(buffer_);
+		const uint32_t frame_count = (uint32_t)cursor.varint();
+		if (!cursor.ok || frame_count == 0)
+		{
+			return false;
+		}
+		const size_t first = out.size();
+		out.resize(first + frame_count);
+		ScenePose* poses = &out[first];
+		uint64_t frame = cursor.varint();
+		for (uint32_t i = 0; i < frame_count; ++i)
+		{
+			frame += i == 0 ? 0 : cursor.varint();
+			poses[i].frame = frame;
+		}
+		int64_t time = 0;
+		for (uint32_t i = 0; i < frame_count; ++i)
+		{
+			time += cursor.svarint();
+			poses[i].timestamp_ns = header_.session_start_ns + time;
+		}
+
+		/* Position of the actor in the ascending changed list gives its chunk offset */
+		const uint64_t changed = cursor.varint();
+		uint32_t id = 0;
+		uint64_t position = changed;
+		for (uint64_t i = 0; i < changed && cursor.ok; ++i)
+		{
+			id = (uint32_t)(i == 0 ? cursor.varint() : id + cursor.varint());
+			if (id == actor_id)
+			{
+				position = i;
+			}
+		}
+		if (!cursor.ok || position == changed)
+		{
+			out.resize(first);
+			return false;
+		}
+		const size_t offsets = cursor.pos;
+		Cursor offset_cursor(buffer_, offsets + 4 * (size_t)position);
+		const uint32_t chunk_offset = offset_cursor.u32();
+		Cursor chunk(buffer_, offsets + 4 * (size_t)changed + chunk_offset);
+		if (!offset_cursor.ok || !chunk.ok)
+		{
+			out.resize(first);
+			return false;
+		}
+
+		const float steps[VL_SCENE_COMPONENTS] = {
+			header_.location_step, header_.location_step, header_.location_step,
+			header_.rotation_step, header_.rotation_step, header_.rotation_step, header_.rotation_step,
+			header_.scale_step, header_.scale_step, header_.scale_step };
+		for (int component = 0; component < VL_SCENE_COMPONENTS; ++component)
+		{
+			const uint64_t mode = chunk.varint();
+			int64_t value = chunk.svarint();
+			for (uint32_t i = 0; i < frame_count; ++i)
+			{
+				if (i > 0 && mode == VL_SCENE_COLUMN_DELTA)
+				{
+					value += chunk.svarint();
+				}
+				const float decoded = (float)value * steps[component];
+				if (component < 3)
+				{
+					poses[i].location[component] = decoded;
+				}
+				else if (component < 7)
+				{
+					poses[i].rotation[component - 3] = decoded;
+				}
+				else
+				{
+					poses[i].scale[component - 7] = decoded;
+				}
+			}
+		}
+		if (!chunk.ok)
+		{
+			out.resize(first);
+			return false;
+		}
+		return true;
+	}
+
+	bool SceneStateReader::trajectory(uint32_t actor_id, std::vector<ScenePose>& out)
+	{
+		out.clear();
+		if (actor_id >= actor_blocks_.size())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < actor_blocks_[actor_id].size(); ++i)
+		{
+			if (!decode(actor_blocks_[actor_id][i], actor_id, out))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool SceneStateReader::pose_at(uint32_t actor_id, uint64_t frame, ScenePose& out)
+	{
+		if (actor_id >= actor_blocks_.size())
+		{
+			return false;
+		}
+
+		/* Last block of the actor starting at or before the frame */
+		const std::vector<uint32_t>& list = actor_blocks_[actor_id];
+		size_t count = 0;
+		while (count < list.size() && blocks_[list[count]].first_frame <= frame)
+		{
+			++count;
+		}
+		if (count == 0)
+		{
+			return false;
+		}
+		std::vector<ScenePose> poses;
+		if (!decode(list[count - 1], actor_id, poses))
+		{
+			return false;
+		}
+		for (size_t i = poses.size(); i > 0; --i)
+		{
+			if (poses[i - 1].frame <= frame)
+			{
+				out = poses[i - 1];
+				return true;
+			}
+		}
+		return false;
+	}
+}
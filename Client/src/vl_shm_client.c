@@ -0,0 +1,164 @@
+/* Copyright 2018, Institute for Artificial Intelligence - University of Bremen */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "vl_shm_client.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+struct vl_shm_client
+{
+	vl_shm_header* header;
+	size_t size;
+};
+
+vl_shm_client* vl_shm_open(const char* name)
+{
+	int fd = shm_open(name ? name : VL_SHM_DEFAULT_NAME, O_RDONLY, 0);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(vl_shm_header))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void* memory = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	vl_shm_header* header = (vl_shm_header*)memory;
+	if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != VL_SHM_MAGIC || header->version != VL_SHM_VERSION ||
+		header->slot_count == 0 || vl_shm_total_size(header->slot_count, header->max_payload) > (uint64_t)st.st_size)
+	{
+		munmap(memory, (size_t)st.st_size);
+		return NULL;
+	}
+
+	vl_shm_client* client = (vl_shm_client*)malloc(sizeof(vl_shm_client));
+	if (!client)
+	{
+		munmap(memory, (size_t)st.st_size);
+		return NULL;
+	}
+	client->header = header;
+	client->size = (size_t)st.st_size;
+	return client;
+}
+
+void vl_shm_close(vl_shm_client* client)
+{
+	if (client)
+	{
+		munmap(client->header, client->size);
+		free(client);
+	}
+}
+
+uint32_t vl_shm_slot_count(const vl_shm_client* client)
+{
+	return client->header->slot_count;
+}
+
+uint64_t vl_shm_max_payload(const vl_shm_client* client)
+{
+	return client->header->max_payload;
+}
+
+uint64_t vl_shm_write_seq(const vl_shm_client* client)
+{
+	return vl_shm_load_acquire(&client->header->write_seq);
+}
+
+int vl_shm_read_next(vl_shm_client* client, uint64_t* cursor, vl_shm_frame_info* info, void* buffer, size_t capacity, uint64_t* dropped)
+{
+	vl_shm_header* header = client->header;
+	for (;;)
+	{
+		if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != VL_SHM_MAGIC)
+		{
+			return VL_SHM_CLOSED;
+		}
+		const uint64_t write_seq = vl_shm_load_acquire(&header->write_seq);
+		if (*cursor >= write_seq)
+		{
+			return VL_SHM_EMPTY;
+		}
+
+		/* Frames older than one ring length are gone, the one right at the edge may be written over right now */
+		const uint64_t oldest = write_seq > header->slot_count ? write_seq - header->slot_count + 1 : 0;
+		if (*cursor < oldest)
+		{
+			if (dropped)
+			{
+				*dropped += oldest - *cursor;
+			}
+			*cursor = oldest;
+		}
+
+		const uint64_t frame = *cursor;
+		const vl_shm_slot* slot = vl_shm_get_slot(header, frame);
+		const uint64_t expected = 2 * frame + 2;
+		if (vl_shm_load_acquire(&slot->seq) != expected)
+		{
+			/* Overwritten in the meantime, start over with the new write position */
+			continue;
+		}
+
+		vl_shm_frame_info copy;
+		memcpy(&copy, (const void*)&slot->info, sizeof(copy));
+		int result = VL_SHM_OK;
+		if (copy.payload_size > capacity)
+		{
+			result = VL_SHM_TOO_SMALL;
+		}
+		else if (copy.payload_size > 0)
+		{
+			memcpy(buffer, (const uint8_t*)slot + sizeof(vl_shm_slot), copy.payload_size);
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (vl_shm_load_relaxed(&slot->seq) != expected)
+		{
+			/* Torn copy, the producer lapped us while copying */
+			continue;
+		}
+
+		*info = copy;
+		*cursor = frame + 1;
+		return result;
+	}
+}
+
+int vl_shm_wait_next(vl_shm_client* client, uint64_t* cursor, vl_shm_frame_info* info, void* buffer, size_t capacity, uint64_t* dropped, int timeout_ms)
+{
+	const struct timespec pause = { 0, 200000 };
+	long waited_us = 0;
+	for (;;)
+	{
+		const int result = vl_shm_read_next(client, cursor, info, buffer, capacity, dropped);
+		if (result != VL_SHM_EMPTY)
+		{
+			return result;
+		}
+		if (timeout_ms >= 0 && waited_us >= (long)timeout_ms * 1000)
+		{
+			return VL_SHM_EMPTY;
+		}
+		nanosleep(&pause, NULL);
+		waited_us += pause.tv_nsec / 1000;
+	}
+}
@@ -0,0 +1,233 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "CaptureRateController.h"
+#include "RawDataAsyncWorker.h"
+#include "Runtime/Core/Public/Misc/FileHelper.h"
+
+const float FCaptureRateController::LowLoad = 0.7f;
+
+namespace
+{
+	// Step sizes of the output settings
+	const int32 QualityStep = 10;
+	const float ScaleStep = 0.125f;
+
+	// Streams whose rate is lowered first (depth, mask, color)
+	const uint32 DividerOrder[FCaptureRateController::NumStreams] = { 2, 1, 0 };
+}
+
+FCaptureRateController::FCaptureRateController(const FCaptureRateSettings& InSettings, const FString& InDir)
+	: Settings(InSettings)
+	, LogPath(InDir / TEXT("RATECONTROL.csv"))
+	, EncodeSeconds(0.0)
+	, WriteSeconds(0.0)
+	, NumBytes(0)
+	, NumSkipped(0)
+	, GameThreadSeconds(0.0)
+	, NumTicks(0)
+	, PeakInFlight(0)
+	, WindowStart(-1.0)
+	, ResolutionScale(1.0f)
+	, Load(0.0f)
+	, NumLowWindows(0)
+	, NumAdjustments(0)
+{
+	Settings.MinJpegQuality = FMath::Clamp(Settings.MinJpegQuality, 1, 100);
+	Settings.MaxJpegQuality = FMath::Clamp(Settings.MaxJpegQuality, Settings.MinJpegQuality, 100);
+	Settings.MinResolutionScale = FMath::Clamp(Settings.MinResolutionScale, 0.05f, 1.0f);
+	Settings.MaxFrameDivider = FMath::Max(Settings.MaxFrameDivider, 1);
+	Settings.MaxFramesInFlight = FMath::Max(Settings.MaxFramesInFlight, 1);
+	JpegQuality = Settings.MaxJpegQuality;
+	for (int32 Stream = 0; Stream < NumStreams; ++Stream)
+	{
+		FrameDivider[Stream] = 1;
+	}
+
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(LogPath), true);
+	if (!IFileManager::Get().FileExists(*LogPath))
+	{
+		FFileHelper::SaveStringToFile(TEXT("timestamp,frame,reason,quality,scale,color_divider,mask_divider,depth_divider,load\n"), *LogPath,
+			FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM);
+	}
+}
+
+void FCaptureRateController::ReportEncode(double Seconds, int64 InNumBytes)
+{
+	FScopeLock ScopeLock(&Lock);
+	EncodeSeconds += Seconds;
+	NumBytes += InNumBytes;
+}
+
+void FCaptureRateController::ReportWrite(double Seconds)
+{
+	FScopeLock ScopeLock(&Lock);
+	WriteSeconds += Seconds;
+}
+
+void FCaptureRateController::ReportSkipped()
+{
+	FScopeLock ScopeLock(&Lock);
+	++NumSkipped;
+}
+
+TFunction<void(bool)> FCaptureRateController::ReportEncoded(const TSharedPtr<FCaptureRateController, ESPMode::ThreadSafe>& Controller,
+	double EncodeStart, int64 NumBytes)
+{
+	if (!Controller.IsValid())
+	{
+		return nullptr;
+	}
+	// Write latency is measured until the file is complete, asynchronous backends report it from their own thread
+	const double WriteStart = FPlatformTime::Seconds();
+	Controller->ReportEncode(WriteStart - EncodeStart, NumBytes);
+	TSharedPtr<FCaptureRateController, ESPMode::ThreadSafe> RateController = Controller;
+	return [RateController, WriteStart](bool)
+	{
+		RateController->ReportWrite(FPlatformTime::Seconds() - WriteStart);
+	};
+}
+
+void FCaptureRateController::ReportGameThread(double Seconds)
+{
+	FScopeLock ScopeLock(&Lock);
+	GameThreadSeconds += Seconds;
+	++NumTicks;
+}
+
+void FCaptureRateController::Update(double Now, uint64 FrameNumber, int32 NumInFlight)
+{
+	PeakInFlight = FMath::Max(PeakInFlight, NumInFlight);
+	if (WindowStart < 0.0)
+	{
+		WindowStart = Now;
+		return;
+	}
+	const double Window = Now - WindowStart;
+	if (Window < Settings.ControlInterval || Window <= 0.0)
+	{
+		return;
+	}
+
+	// Ratio of every measurement to its budget, the highest one decides
+	const TCHAR* Reason = TEXT("workers");
+	{
+		FScopeLock ScopeLock(&Lock);
+		Load = (EncodeSeconds + WriteSeconds) / (Window * FMath::Max(Settings.WorkerBudget, 0.01f));
+		if (Settings.ByteBudget > 0.0 && NumBytes / Window / Settings.ByteBudget > Load)
+		{
+			Load = NumBytes / Window / Settings.ByteBudget;
+			Reason = TEXT("bytes");
+		}
+		if ((float)PeakInFlight / Settings.MaxFramesInFlight > Load)
+		{
+			Load = (float)PeakInFlight / Settings.MaxFramesInFlight;
+			Reason = TEXT("queue");
+		}
+		if (Settings.GameThreadBudgetMs > 0.0f && NumTicks > 0 && GameThreadSeconds * 1000.0 / NumTicks / Settings.GameThreadBudgetMs > Load)
+		{
+			Load = GameThreadSeconds * 1000.0 / NumTicks / Settings.GameThreadBudgetMs;
+			Reason = TEXT("game_thread");
+		}
+		if (NumSkipped > 0)
+		{
+			// Frames were lost, the pipeline is over budget whatever the averages say
+			Load = FMath::Max(Load, 1.0f + NumSkipped / (float)Settings.MaxFramesInFlight);
+			Reason = TEXT("skipped");
+		}
+		EncodeSeconds = 0.0;
+		WriteSeconds = 0.0;
+		NumBytes = 0;
+		NumSkipped = 0;
+		GameThreadSeconds = 0.0;
+		NumTicks = 0;
+	}
+	PeakInFlight = NumInFlight;
+	WindowStart = Now;
+
+	if (Load > 1.0f)
+	{
+		NumLowWindows = 0;
+		if (Degrade())
+		{
+			LogAdjustment(FrameNumber, Reason);
+		}
+	}
+	else if (Load < LowLoad)
+	{
+		if (++NumLowWindows >= UpgradeWindows)
+		{
+			NumLowWindows = 0;
+			if (Upgrade())
+			{
+				LogAdjustment(FrameNumber, TEXT("headroom"));
+			}
+		}
+	}
+	else
+	{
+		NumLowWindows = 0;
+	}
+}
+
+bool FCaptureRateController::ShouldCapture(uint32 StreamId, uint64 FrameNumber) const
+{
+	return FrameNumber % GetFrameDivider(StreamId) == 0;
+}
+
+bool FCaptureRateController::Degrade()
+{
+	if (JpegQuality > Settings.MinJpegQuality)
+	{
+		JpegQuality = FMath::Max(JpegQuality - QualityStep, Settings.MinJpegQuality);
+		return true;
+	}
+	if (ResolutionScale > Settings.MinResolutionScale)
+	{
+		ResolutionScale = FMath::Max(ResolutionScale - ScaleStep, Settings.MinResolutionScale);
+		return true;
+	}
+	for (uint32 Stream : DividerOrder)
+	{
+		if (FrameDivider[Stream] < Settings.MaxFrameDivider)
+		{
+			FrameDivider[Stream] = FMath::Min(FrameDivider[Stream] * 2, Settings.MaxFrameDivider);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool FCaptureRateController::Upgrade()
+{
+	// Reverse order of Degrade, the cheapest thing to give back first
+	for (int32 Index = NumStreams - 1; Index >= 0; --Index)
+	{
+		const uint32 Stream = DividerOrder[Index];
+		if (FrameDivider[Stream] > 1)
+		{
+			FrameDivider[Stream] = FMath::Max(FrameDivider[Stream] / 2, 1);
+			return true;
+		}
+	}
+	if (ResolutionScale < 1.0f)
+	{
+		ResolutionScale = FMath::Min(ResolutionScale + ScaleStep, 1.0f);
+		return true;
+	}
+	if (JpegQuality < Settings.MaxJpegQuality)
+	{
+		JpegQuality = FMath::Min(JpegQuality + QualityStep, Settings.MaxJpegQuality);
+		return true;
+	}
+	return false;
+}
+
+void FCaptureRateController::LogAdjustment(uint64 FrameNumber, const TCHAR* Reason)
+{
+	++NumAdjustments;
+	const FString Line = FString::Printf(TEXT("%s,%llu,%s,%d,%.3f,%d,%d,%d,%.3f\n"), *RawDataAsyncWorker::FormatTimeStamp(FDateTime::UtcNow()), FrameNumber,
+		Reason, JpegQuality, ResolutionScale, FrameDivider[0], FrameDivider[1], FrameDivider[2], Load);
+	FFileHelper::SaveStringToFile(Line, *LogPath, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM, &IFileManager::Get(), FILEWRITE_Append);
+	UE_LOG(LogTemp, Log, TEXT("Rate control (%s, load %.2f): quality %d, scale %.3f, frame dividers %d/%d/%d"), Reason, Load, JpegQuality,
+		ResolutionScale, FrameDivider[0], FrameDivider[1], FrameDivider[2]);
+}
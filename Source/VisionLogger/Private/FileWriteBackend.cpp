@@ -0,0 +1,47 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "FileWriteBackend.h"
+#include "IoUringFileWriteBackend.h"
+#include "Misc/FileHelper.h"
+
+TSharedPtr<IFileWriteBackend, ESPMode::ThreadSafe> IFileWriteBackend::Create(EFileWriteBackend Type, const FFileWriteBackendSettings& Settings)
+{
+	if (Type == EFileWriteBackend::IoUring)
+	{
+#if VL_HAS_IO_URING
+		TSharedPtr<FIoUringFileWriteBackend, ESPMode::ThreadSafe> IoUring = MakeShareable(new FIoUringFileWriteBackend());
+		if (IoUring->Initialize(Settings))
+		{
+			return IoUring;
+		}
+#endif
+		UE_LOG(LogTemp, Warning, TEXT("io_uring is not available, files are written with blocking calls"));
+	}
+	return MakeShareable(new FBlockingFileWriteBackend());
+}
+
+void IFileWriteBackend::Write(const TSharedPtr<IFileWriteBackend, ESPMode::ThreadSafe>& Backend, const FString& Path, TArray<uint8>&& Data,
+	TFunction<void(bool)> OnComplete)
+{
+	if (Backend.IsValid())
+	{
+		Backend->Write(Path, MoveTemp(Data), MoveTemp(OnComplete));
+	}
+	else
+	{
+		FBlockingFileWriteBackend().Write(Path, MoveTemp(Data), MoveTemp(OnComplete));
+	}
+}
+
+void FBlockingFileWriteBackend::Write(const FString& Path, TArray<uint8>&& Data, TFunction<void(bool)> OnComplete)
+{
+	const bool bSaved = FFileHelper::SaveArrayToFile(Data, *Path);
+	if (!bSaved)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not write %s"), *Path);
+	}
+	if (OnComplete)
+	{
+		OnComplete(bSaved);
+	}
+}
@@ -0,0 +1,195 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "FrameChangeDetector.h"
+#include "VisionLoggerSimd.h"
+#include "Runtime/Core/Public/Misc/FileHelper.h"
+#include "Runtime/Core/Public/Misc/ScopeLock.h"
+
+namespace
+{
+	// Sum of all bytes of NumPixels BGRA pixels
+	uint64 SumPixelBytes(const FColor* Pixels, int32 NumPixels)
+	{
+		uint64 Sum = 0;
+		int32 i = 0;
+#if VL_SIMD_X86
+		// SAD against zero adds up 8 bytes into each 64 bit half
+		const __m128i Zero = _mm_setzero_si128();
+		__m128i Acc = _mm_setzero_si128();
+		for (; i + 4 <= NumPixels; i += 4)
+		{
+			Acc = _mm_add_epi64(Acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(Pixels + i)), Zero));
+		}
+		uint64 Halves[2];
+		_mm_storeu_si128((__m128i*)Halves, Acc);
+		Sum = Halves[0] + Halves[1];
+#endif
+		for (; i < NumPixels; ++i)
+		{
+			Sum += Pixels[i].B + Pixels[i].G + Pixels[i].R + Pixels[i].A;
+		}
+		return Sum;
+	}
+}
+
+FFrameChangeDetector::FFrameChangeDetector(const FString& InStreamName, float InThreshold)
+{
+	StreamName = InStreamName;
+	Threshold = InThreshold;
+	LastNumBytes = 0;
+	LastFrame = 0;
+	bHasLast = false;
+	NumWritten = 0;
+	NumRepeated = 0;
+	SavedBytes = 0;
+}
+
+void FFrameChangeDetector::ComputeSignature(const FColor* Image, int32 Width, int32 Height, TArray<uint16>& OutSignature)
+{
+	const int32 CellsX = FMath::Min(GridSize, Width);
+	const int32 CellsY = FMath::Min(GridSize, Height);
+	OutSignature.SetNumZeroed(CellsX * CellsY);
+	if (Image == nullptr || CellsX <= 0 || CellsY <= 0)
+	{
+		return;
+	}
+
+	TArray<uint64> Sums;
+	TArray<int32> Counts;
+	Sums.SetNumZeroed(CellsX * CellsY);
+	Counts.SetNumZeroed(CellsX * CellsY);
+	for (int32 y = 0; y < Height; y += 2)
+	{
+		const int32 CellY = y * CellsY / Height;
+		const FColor* Row = Image + y * Width;
+		for (int32 CellX = 0; CellX < CellsX; ++CellX)
+		{
+			const int32 X0 = CellX * Width / CellsX;
+			const int32 X1 = (CellX + 1) * Width / CellsX;
+			Sums[CellY * CellsX + CellX] += SumPixelBytes(Row + X0, X1 - X0);
+			Counts[CellY * CellsX + CellX] += X1 - X0;
+		}
+	}
+	for (int32 i = 0; i < Sums.Num(); ++i)
+	{
+		// 4 bytes per pixel, 4 fractional bits
+		OutSignature[i] = Counts[i] > 0 ? (uint16)(Sums[i] * 4 / Counts[i]) : 0;
+	}
+}
+
+bool FFrameChangeDetector::Matches(const TArray<uint16>& Signature) const
+{
+	if (!bHasLast || LastSignature.Num() != Signature.Num())
+	{
+		return false;
+	}
+	const int32 MaxDiff = FMath::RoundToInt(Threshold * 16.0f);
+	for (int32 i = 0; i < Signature.Num(); ++i)
+	{
+		if (FMath::Abs((int32)Signature[i] - (int32)LastSignature[i]) > MaxDiff)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FFrameChangeDetector::RecordIfRepeat(uint64 FrameNumber, const TArray<uint16>& Signature, bool bPoseStatic, const FString& TimeStamp, const FString& Dir)
+{
+	FScopeLock ScopeLock(&Lock);
+	if (bHasLast && FrameNumber < LastFrame)
+	{
+		// Finished after a newer reference was taken, written as is
+		return false;
+	}
+	if (bPoseStatic && Matches(Signature))
+	{
+		++NumRepeated;
+		if (LastFileName.IsEmpty())
+		{
+			PendingRepeats.Add({ FrameNumber, LastFrame, TimeStamp, Dir });
+		}
+		else
+		{
+			AppendRepeat(FrameNumber, LastFrame, LastFileName, LastNumBytes, TimeStamp, Dir);
+		}
+		return true;
+	}
+	LastSignature = Signature;
+	LastFileName.Empty();
+	LastNumBytes = 0;
+	LastFrame = FrameNumber;
+	bHasLast = true;
+	return false;
+}
+
+void FFrameChangeDetector::RecordWritten(uint64 FrameNumber, const FString& FileName, int64 NumBytes)
+{
+	FScopeLock ScopeLock(&Lock);
+	++NumWritten;
+	if (bHasLast && FrameNumber == LastFrame)
+	{
+		LastFileName = FileName;
+		LastNumBytes = NumBytes;
+	}
+	// The reference may have been replaced already, its repeats are kept by frame number
+	for (int32 i = 0; i < PendingRepeats.Num(); ++i)
+	{
+		const FPendingRepeat& Repeat = PendingRepeats[i];
+		if (Repeat.RepeatOf == FrameNumber)
+		{
+			AppendRepeat(Repeat.FrameNumber, FrameNumber, FileName, NumBytes, Repeat.TimeStamp, Repeat.Dir);
+			PendingRepeats.RemoveAt(i--);
+		}
+	}
+}
+
+void FFrameChangeDetector::RecordFailed(uint64 FrameNumber)
+{
+	FScopeLock ScopeLock(&Lock);
+	// Its repeats have no file to point to
+	const int32 NumLost = PendingRepeats.RemoveAll([FrameNumber](const FPendingRepeat& Repeat) { return Repeat.RepeatOf == FrameNumber; });
+	if (NumLost > 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s frame %llu could not be written, %d frames repeating it are lost"), *StreamName, FrameNumber, NumLost);
+		NumRepeated -= NumLost;
+	}
+	// The next frame becomes the reference
+	if (bHasLast && FrameNumber == LastFrame)
+	{
+		bHasLast = false;
+	}
+}
+
+void FFrameChangeDetector::AppendRepeat(uint64 FrameNumber, uint64 RepeatOf, const FString& FileName, int64 NumBytes, const FString& TimeStamp, const FString& Dir)
+{
+	// Called under the lock, so concurrent repeats of the stream neither interleave nor reorder their lines
+	SavedBytes += NumBytes;
+	const FString Line = FString::Printf(TEXT("%s,%llu,%llu,%s\n"), *TimeStamp, FrameNumber, RepeatOf, *FileName);
+	const FString Path = Dir + "/" + StreamName + "_repeats.csv";
+	FFileHelper::SaveStringToFile(Line, *Path, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM, &IFileManager::Get(), FILEWRITE_Append);
+}
+
+void FFrameChangeDetector::SetThreshold(float InThreshold)
+{
+	FScopeLock ScopeLock(&Lock);
+	Threshold = InThreshold;
+}
+
+int32 FFrameChangeDetector::GetNumWritten() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return NumWritten;
+}
+
+int32 FFrameChangeDetector::GetNumRepeated() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return NumRepeated;
+}
+
+int64 FFrameChangeDetector::GetSavedBytes() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return SavedBytes;
+}
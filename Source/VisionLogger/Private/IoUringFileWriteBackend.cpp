@@ -0,0 +1,491 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "IoUringFileWriteBackend.h"
+
+#if VL_HAS_IO_URING
+
+#include "Async/Async.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/ScopeLock.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// The io_uring system calls have the same numbers on all architectures
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+// Ring ABI of <linux/io_uring.h> (Linux 5.1), the layouts are fixed by the kernel
+struct FIoUringSqe
+{
+	uint8 opcode;
+	uint8 flags;
+	uint16 ioprio;
+	int32 fd;
+	uint64 off;
+	uint64 addr;
+	uint32 len;
+	uint32 rw_flags;
+	uint64 user_data;
+	uint16 buf_index;
+	uint16 pad[3];
+	uint64 pad2[2];
+};
+
+struct FIoUringCqe
+{
+	uint64 user_data;
+	int32 res;
+	uint32 flags;
+};
+
+struct FIoUringSqOffsets
+{
+	uint32 head;
+	uint32 tail;
+	uint32 ring_mask;
+	uint32 ring_entries;
+	uint32 flags;
+	uint32 dropped;
+	uint32 array;
+	uint32 resv1;
+	uint64 resv2;
+};
+
+struct FIoUringCqOffsets
+{
+	uint32 head;
+	uint32 tail;
+	uint32 ring_mask;
+	uint32 ring_entries;
+	uint32 overflow;
+	uint32 cqes;
+	uint64 resv[2];
+};
+
+struct FIoUringParams
+{
+	uint32 sq_entries;
+	uint32 cq_entries;
+	uint32 flags;
+	uint32 sq_thread_cpu;
+	uint32 sq_thread_idle;
+	uint32 resv[5];
+	FIoUringSqOffsets sq_off;
+	FIoUringCqOffsets cq_off;
+};
+
+static_assert(sizeof(FIoUringSqe) == 64, "io_uring_sqe is 64 bytes");
+static_assert(sizeof(FIoUringCqe) == 16, "io_uring_cqe is 16 bytes");
+static_assert(sizeof(FIoUringParams) == 120, "io_uring_params is 120 bytes");
+
+static const uint8 IoUringOpWriteV = 2;
+static const uint8 IoUringOpWriteFixed = 5;
+static const uint32 IoUringEnterGetEvents = 1;
+static const uint32 IoUringRegisterBuffers = 0;
+static const uint32 IoUringUnregisterBuffers = 1;
+static const off_t IoUringOffSqRing = 0;
+static const off_t IoUringOffCqRing = 0x8000000;
+static const off_t IoUringOffSqes = 0x10000000;
+
+// Alignment of O_DIRECT offsets, lengths and buffers
+static const int64 DirectIOAlignment = 4096;
+
+// Largest length of a single write entry, longer writes continue as short writes
+static const int64 MaxWriteLength = 1 << 30;
+
+struct FIoUringWrite
+{
+	FString Path;
+	int Fd;
+
+	// Staging buffer or the data owned by the write
+	int32 BufferIndex;
+	TArray<uint8> Data;
+	uint8* Memory;
+
+	// File size, bytes to write (padded with O_DIRECT) and bytes written
+	int64 Size;
+	int64 Length;
+	int64 Offset;
+	bool bDirect;
+	iovec Vector;
+
+	TFunction<void(bool)> OnComplete;
+};
+
+FIoUringFileWriteBackend::FIoUringFileWriteBackend()
+{
+	RingFd = -1;
+	SqRing = nullptr;
+	CqRing = nullptr;
+	Sqes = nullptr;
+	SqRingSize = 0;
+	CqRingSize = 0;
+	SqesSize = 0;
+	NumUnsubmitted = 0;
+	NumReaped = 0;
+	bBuffersRegistered = false;
+	WakeEvent = nullptr;
+	Thread = nullptr;
+}
+
+FIoUringFileWriteBackend::~FIoUringFileWriteBackend()
+{
+	if (Thread)
+	{
+		Flush();
+		Stop();
+		Thread->WaitForCompletion();
+		delete Thread;
+	}
+	if (WakeEvent)
+	{
+		FPlatformProcess::ReturnSynchEventToPool(WakeEvent);
+	}
+	if (bBuffersRegistered)
+	{
+		syscall(__NR_io_uring_register, RingFd, IoUringUnregisterBuffers, nullptr, 0);
+	}
+	for (uint8* Buffer : Buffers)
+	{
+		FMemory::Free(Buffer);
+	}
+	if (Sqes)
+	{
+		munmap(Sqes, SqesSize);
+	}
+	if (CqRing)
+	{
+		munmap(CqRing, CqRingSize);
+	}
+	if (SqRing)
+	{
+		munmap(SqRing, SqRingSize);
+	}
+	if (RingFd >= 0)
+	{
+		close(RingFd);
+	}
+}
+
+bool FIoUringFileWriteBackend::Initialize(const FFileWriteBackendSettings& InSettings)
+{
+	Settings = InSettings;
+	Settings.QueueDepth = FMath::Clamp(Settings.QueueDepth, 1, 4096);
+	Settings.SubmitBatch = FMath::Clamp(Settings.SubmitBatch, 1, Settings.QueueDepth);
+	Settings.BufferSize = Align(FMath::Max<int64>(Settings.BufferSize, DirectIOAlignment), DirectIOAlignment);
+
+	FIoUringParams Params;
+	FMemory::Memzero(Params);
+	RingFd = (int)syscall(__NR_io_uring_setup, (uint32)Settings.QueueDepth, &Params);
+	if (RingFd < 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("io_uring_setup failed: %s"), UTF8_TO_TCHAR(strerror(errno)));
+		return false;
+	}
+
+	SqRingSize = Params.sq_off.array + Params.sq_entries * sizeof(uint32);
+	CqRingSize = Params.cq_off.cqes + Params.cq_entries * sizeof(FIoUringCqe);
+	SqesSize = Params.sq_entries * sizeof(FIoUringSqe);
+	SqRing = mmap(nullptr, SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IoUringOffSqRing);
+	CqRing = mmap(nullptr, CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IoUringOffCqRing);
+	void* SqeMemory = mmap(nullptr, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IoUringOffSqes);
+	SqRing = SqRing == MAP_FAILED ? nullptr : SqRing;
+	CqRing = CqRing == MAP_FAILED ? nullptr : CqRing;
+	Sqes = SqeMemory == MAP_FAILED ? nullptr : (FIoUringSqe*)SqeMemory;
+	if (!SqRing || !CqRing || !Sqes)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not map the io_uring rings"));
+		return false;
+	}
+	SqHead = (uint32*)((uint8*)SqRing + Params.sq_off.head);
+	SqTail = (uint32*)((uint8*)SqRing + Params.sq_off.tail);
+	SqMask = (uint32*)((uint8*)SqRing + Params.sq_off.ring_mask);
+	SqArray = (uint32*)((uint8*)SqRing + Params.sq_off.array);
+	CqHead = (uint32*)((uint8*)CqRing + Params.cq_off.head);
+	CqTail = (uint32*)((uint8*)CqRing + Params.cq_off.tail);
+	CqMask = (uint32*)((uint8*)CqRing + Params.cq_off.ring_mask);
+	Cqes = (FIoUringCqe*)((uint8*)CqRing + Params.cq_off.cqes);
+
+	// Registered buffers are pinned once instead of on every write, the locked memory limit may not allow it
+	TArray<iovec> Vectors;
+	for (int32 Index = 0; Index < Settings.NumBuffers; ++Index)
+	{
+		uint8* Buffer = (uint8*)FMemory::Malloc(Settings.BufferSize, DirectIOAlignment);
+		Buffers.Add(Buffer);
+		FreeBuffers.Add(Index);
+		iovec Vector;
+		Vector.iov_base = Buffer;
+		Vector.iov_len = Settings.BufferSize;
+		Vectors.Add(Vector);
+	}
+	if (Vectors.Num() > 0)
+	{
+		bBuffersRegistered = syscall(__NR_io_uring_register, RingFd, IoUringRegisterBuffers, Vectors.GetData(), (uint32)Vectors.Num()) == 0;
+		if (!bBuffersRegistered)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Could not register %d io_uring buffers (%s), writing without fixed buffers"), Vectors.Num(), UTF8_TO_TCHAR(strerror(errno)));
+		}
+	}
+
+	WakeEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	Thread = FRunnableThread::Create(this, TEXT("VisionLoggerFileWriter"), 0, TPri_AboveNormal);
+	UE_LOG(LogTemp, Log, TEXT("io_uring file output: %u entries, %d staging buffers of %lld bytes"), Params.sq_entries, Buffers.Num(), Settings.BufferSize);
+	return Thread != nullptr;
+}
+
+void FIoUringFileWriteBackend::Write(const FString& Path, TArray<uint8>&& Data, TFunction<void(bool)> OnComplete)
+{
+	// Bound the memory held by queued writes, the rings can hold every write in flight
+	while (NumInFlight.Increment() > Settings.QueueDepth)
+	{
+		NumInFlight.Decrement();
+		WakeEvent->Trigger();
+		FPlatformProcess::Sleep(0.0005f);
+	}
+
+	FIoUringWrite* Request = new FIoUringWrite();
+	Request->Path = Path;
+	Request->Fd = -1;
+	Request->Size = Data.Num();
+	Request->Offset = 0;
+	Request->OnComplete = MoveTemp(OnComplete);
+	Request->BufferIndex = AcquireBuffer(Request->Size);
+	if (Request->BufferIndex != INDEX_NONE)
+	{
+		Request->Memory = Buffers[Request->BufferIndex];
+		FMemory::Memcpy(Request->Memory, Data.GetData(), Data.Num());
+		Request->bDirect = Settings.DirectIOThreshold > 0 && Request->Size >= Settings.DirectIOThreshold;
+	}
+	else
+	{
+		Request->Data = MoveTemp(Data);
+		Request->Memory = Request->Data.GetData();
+		Request->bDirect = false;
+	}
+
+	const int Flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	if (Request->bDirect)
+	{
+		Request->Fd = open(TCHAR_TO_UTF8(*Path), Flags | O_DIRECT, 0644);
+		// Some file systems (tmpfs) do not support O_DIRECT
+		Request->bDirect = Request->Fd >= 0;
+	}
+	if (Request->Fd < 0)
+	{
+		Request->Fd = open(TCHAR_TO_UTF8(*Path), Flags, 0644);
+	}
+	if (Request->Fd < 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not open %s: %s"), *Path, UTF8_TO_TCHAR(strerror(errno)));
+		Complete(Request, false);
+		return;
+	}
+
+	// O_DIRECT writes whole blocks, the file is truncated to its size once written
+	Request->Length = Request->Size;
+	if (Request->bDirect)
+	{
+		Request->Length = Align(Request->Size, DirectIOAlignment);
+		FMemory::Memzero(Request->Memory + Request->Size, Request->Length - Request->Size);
+	}
+	if (Request->Length == 0)
+	{
+		Complete(Request, true);
+		return;
+	}
+	Queue(Request);
+	WakeEvent->Trigger();
+}
+
+void FIoUringFileWriteBackend::Flush()
+{
+	while (NumInFlight.GetValue() > 0 || NumPendingCallbacks.GetValue() > 0)
+	{
+		WakeEvent->Trigger();
+		FPlatformProcess::Sleep(0.001f);
+	}
+}
+
+void FIoUringFileWriteBackend::Stop()
+{
+	bStopping = true;
+	WakeEvent->Trigger();
+}
+
+uint32 FIoUringFileWriteBackend::Run()
+{
+	while (!bStopping || NumInFlight.GetValue() > 0)
+	{
+		uint32 ToSubmit;
+		{
+			FScopeLock Lock(&SubmitLock);
+			ToSubmit = NumUnsubmitted;
+			NumUnsubmitted = 0;
+		}
+		// Every entry the kernel consumed posts a completion, only wait if one is outstanding.
+		// Entries queued meanwhile are submitted on the next round.
+		const uint32 NumInKernel = __atomic_load_n(SqHead, __ATOMIC_ACQUIRE) - NumReaped;
+		if (ToSubmit == 0 && NumInKernel == 0)
+		{
+			WakeEvent->Wait(10);
+			continue;
+		}
+		const int Submitted = (int)syscall(__NR_io_uring_enter, RingFd, ToSubmit, 1, IoUringEnterGetEvents, nullptr, 0);
+		const uint32 Accepted = Submitted > 0 ? (uint32)Submitted : 0;
+		if (Accepted < ToSubmit)
+		{
+			FScopeLock Lock(&SubmitLock);
+			NumUnsubmitted += ToSubmit - Accepted;
+		}
+		if (Submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			UE_LOG(LogTemp, Error, TEXT("io_uring_enter failed: %s"), UTF8_TO_TCHAR(strerror(errno)));
+			FPlatformProcess::Sleep(0.001f);
+		}
+		ReapCompletions();
+	}
+	return 0;
+}
+
+void FIoUringFileWriteBackend::Queue(FIoUringWrite* Request)
+{
+	FScopeLock Lock(&SubmitLock);
+	// Every write in flight has at most one entry, the ring never overflows
+	const uint32 Tail = *SqTail;
+	const uint32 Index = Tail & *SqMask;
+	FIoUringSqe* Sqe = &Sqes[Index];
+	FMemory::Memzero(Sqe, sizeof(FIoUringSqe));
+	const int64 Remaining = FMath::Min(Request->Length - Request->Offset, MaxWriteLength);
+	Sqe->fd = Request->Fd;
+	Sqe->off = Request->Offset;
+	Sqe->user_data = (uint64)(UPTRINT)Request;
+	if (Request->BufferIndex != INDEX_NONE && bBuffersRegistered)
+	{
+		Sqe->opcode = IoUringOpWriteFixed;
+		Sqe->addr = (uint64)(UPTRINT)(Request->Memory + Request->Offset);
+		Sqe->len = (uint32)Remaining;
+		Sqe->buf_index = (uint16)Request->BufferIndex;
+	}
+	else
+	{
+		Request->Vector.iov_base = Request->Memory + Request->Offset;
+		Request->Vector.iov_len = Remaining;
+		Sqe->opcode = IoUringOpWriteV;
+		Sqe->addr = (uint64)(UPTRINT)&Request->Vector;
+		Sqe->len = 1;
+	}
+	SqArray[Index] = Index;
+	__atomic_store_n(SqTail, Tail + 1, __ATOMIC_RELEASE);
+	if (++NumUnsubmitted >= (uint32)Settings.SubmitBatch)
+	{
+		SubmitLocked();
+	}
+}
+
+void FIoUringFileWriteBackend::SubmitLocked()
+{
+	const int Submitted = (int)syscall(__NR_io_uring_enter, RingFd, NumUnsubmitted, 0, 0, nullptr, 0);
+	if (Submitted > 0)
+	{
+		NumUnsubmitted -= FMath::Min((uint32)Submitted, NumUnsubmitted);
+	}
+}
+
+void FIoUringFileWriteBackend::ReapCompletions()
+{
+	uint32 Head = *CqHead;
+	const uint32 Tail = __atomic_load_n(CqTail, __ATOMIC_ACQUIRE);
+	while (Head != Tail)
+	{
+		const FIoUringCqe* Cqe = &Cqes[Head & *CqMask];
+		FIoUringWrite* Request = (FIoUringWrite*)(UPTRINT)Cqe->user_data;
+		const int32 Result = Cqe->res;
+		++Head;
+		++NumReaped;
+
+		if (Result == -EAGAIN || Result == -EINTR)
+		{
+			Queue(Request);
+		}
+		else if (Result <= 0)
+		{
+			UE_LOG(LogTemp, Error, TEXT("Could not write %s: %s"), *Request->Path, Result < 0 ? UTF8_TO_TCHAR(strerror(-Result)) : TEXT("no progress"));
+			Complete(Request, false);
+		}
+		else
+		{
+			Request->Offset += Result;
+			if (Request->Offset < Request->Length)
+			{
+				Queue(Request);
+			}
+			else
+			{
+				Complete(Request, true);
+			}
+		}
+	}
+	__atomic_store_n(CqHead, Head, __ATOMIC_RELEASE);
+}
+
+void FIoUringFileWriteBackend::Complete(FIoUringWrite* Request, bool bSuccess)
+{
+	if (Request->Fd >= 0)
+	{
+		if (bSuccess && Request->bDirect && ftruncate(Request->Fd, Request->Size) != 0)
+		{
+			UE_LOG(LogTemp, Error, TEXT("Could not truncate %s"), *Request->Path);
+			bSuccess = false;
+		}
+		close(Request->Fd);
+	}
+	if (Request->BufferIndex != INDEX_NONE)
+	{
+		ReleaseBuffer(Request->BufferIndex);
+	}
+	TFunction<void(bool)> OnComplete = MoveTemp(Request->OnComplete);
+	delete Request;
+	if (OnComplete)
+	{
+		// Callers may rename files or commit in the callback, that must not hold up reaping the other writes.
+		// Only Flush waits for the callbacks, Write does not: a pool thread blocked in Write could starve them.
+		NumPendingCallbacks.Increment();
+		Async<void>(EAsyncExecution::ThreadPool, [this, OnComplete, bSuccess]()
+		{
+			OnComplete(bSuccess);
+			NumPendingCallbacks.Decrement();
+		});
+	}
+	NumInFlight.Decrement();
+}
+
+int32 FIoUringFileWriteBackend::AcquireBuffer(int64 NumBytes)
+{
+	FScopeLock Lock(&BufferLock);
+	if (FreeBuffers.Num() == 0 || Align(NumBytes, DirectIOAlignment) > Settings.BufferSize)
+	{
+		return INDEX_NONE;
+	}
+	return FreeBuffers.Pop(false);
+}
+
+void FIoUringFileWriteBackend::ReleaseBuffer(int32 Index)
+{
+	FScopeLock Lock(&BufferLock);
+	FreeBuffers.Add(Index);
+}
+
+#endif
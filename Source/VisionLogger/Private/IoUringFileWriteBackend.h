@@ -0,0 +1,104 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FileWriteBackend.h"
+#include "HAL/Runnable.h"
+#include "HAL/ThreadSafeBool.h"
+#include "HAL/ThreadSafeCounter.h"
+
+// The ring ABI is defined in the implementation, the kernel headers of the toolchain may predate io_uring.
+// Whether the running kernel supports it is only known at runtime, Initialize fails otherwise.
+#define VL_HAS_IO_URING PLATFORM_LINUX
+
+#if VL_HAS_IO_URING
+
+struct FIoUringSqe;
+struct FIoUringCqe;
+struct FIoUringWrite;
+
+/**
+ * Writes files through an io_uring set up with raw system calls (no liburing). Files are opened on the
+ * calling thread, their writes are queued in the submission ring and submitted in batches, a reaper
+ * thread submits what is left, waits for completions, resubmits short writes and closes the files,
+ * the completion callbacks run on the thread pool.
+ * Data is copied into page aligned staging buffers registered with the ring (WRITE_FIXED, optionally
+ * O_DIRECT) while one is free and large enough, otherwise the write owns the caller's array (WRITEV).
+ */
+class FIoUringFileWriteBackend : public IFileWriteBackend, public FRunnable
+{
+public:
+	FIoUringFileWriteBackend();
+	virtual ~FIoUringFileWriteBackend();
+
+	// Set up the ring, the staging buffers and the reaper thread, false if io_uring is not available
+	bool Initialize(const FFileWriteBackendSettings& InSettings);
+
+	virtual void Write(const FString& Path, TArray<uint8>&& Data, TFunction<void(bool)> OnComplete) override;
+	virtual void Flush() override;
+	virtual const TCHAR* GetName() const override { return TEXT("io_uring"); }
+
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+
+private:
+	// Put the remaining part of a write into the submission ring
+	void Queue(FIoUringWrite* Request);
+
+	// Hand queued entries to the kernel, called with SubmitLock held
+	void SubmitLocked();
+
+	// Handle all available completions, reaper thread only
+	void ReapCompletions();
+
+	// Close the file, free the write and report it on the thread pool
+	void Complete(FIoUringWrite* Request, bool bSuccess);
+
+	int32 AcquireBuffer(int64 NumBytes);
+	void ReleaseBuffer(int32 Index);
+
+	FFileWriteBackendSettings Settings;
+	int RingFd;
+
+	// Shared ring memory
+	void* SqRing;
+	void* CqRing;
+	FIoUringSqe* Sqes;
+	int64 SqRingSize;
+	int64 CqRingSize;
+	int64 SqesSize;
+	uint32* SqHead;
+	uint32* SqTail;
+	uint32* SqMask;
+	uint32* SqArray;
+	uint32* CqHead;
+	uint32* CqTail;
+	uint32* CqMask;
+	FIoUringCqe* Cqes;
+
+	// Entries queued in the ring but not yet submitted
+	FCriticalSection SubmitLock;
+	uint32 NumUnsubmitted;
+
+	// Writes accepted and not completed
+	FThreadSafeCounter NumInFlight;
+
+	// Completed writes whose OnComplete has not run yet on the thread pool
+	FThreadSafeCounter NumPendingCallbacks;
+
+	// Completions handled, with the consumed submission head the entries still in the kernel
+	uint32 NumReaped;
+
+	// Page aligned staging buffers and the free ones
+	FCriticalSection BufferLock;
+	TArray<uint8*> Buffers;
+	TArray<int32> FreeBuffers;
+	bool bBuffersRegistered;
+
+	FEvent* WakeEvent;
+	FRunnableThread* Thread;
+	FThreadSafeBool bStopping;
+};
+
+#endif
@@ -0,0 +1,71 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "OpticalFlowAsyncWorker.h"
+#include "RawDataAsyncWorker.h"
+#include "Runtime/Core/Public/Misc/FileHelper.h"
+#include "Runtime/Core/Public/GenericPlatform/GenericPlatformFile.h"
+#include "Runtime/Core/Public/HAL/PlatformFilemanager.h"
+
+FThreadSafeCounter FOpticalFlowAsyncWorker::NumInFlight;
+
+FOpticalFlowAsyncWorker::FOpticalFlowAsyncWorker(const TArray<FFloat16Color>& DepthA_init, const TArray<FFloat16Color>& DepthB_init, int32 Width_init, int32 Height_init,
+	float FieldOfView_init, const FTransform& PoseA_init, const FTransform& PoseB_init, uint64 FrameA_init, uint64 FrameB_init,
+	FDateTime StampA, FDateTime StampB, const FOpticalFlowSettings& Settings_init)
+{
+	DepthA = DepthA_init;
+	DepthB = DepthB_init;
+	Width = Width_init;
+	Height = Height_init;
+	FieldOfView = FieldOfView_init;
+	PoseA = PoseA_init;
+	PoseB = PoseB_init;
+	FrameA = FrameA_init;
+	FrameB = FrameB_init;
+	TimeStampA = StampA;
+	TimeStampB = StampB;
+	Settings = Settings_init;
+	NumInFlight.Increment();
+}
+
+FOpticalFlowAsyncWorker::~FOpticalFlowAsyncWorker()
+{
+	NumInFlight.Decrement();
+}
+
+int32 FOpticalFlowAsyncWorker::GetNumInFlight()
+{
+	return NumInFlight.GetValue();
+}
+
+void FOpticalFlowAsyncWorker::DoWork()
+{
+	const int32 NumPixels = Width * Height;
+	if (NumPixels <= 0 || DepthA.Num() != NumPixels || DepthB.Num() != NumPixels)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Depth frames %llu/%llu do not have %d pixels, no flow written"), FrameA, FrameB, NumPixels);
+		return;
+	}
+
+	const FPointCloudCamera CameraA = FPointCloudCamera::FromPose(PoseA, FieldOfView, Width, Height);
+	const FPointCloudCamera CameraB = FPointCloudCamera::FromPose(PoseB, FieldOfView, Width, Height);
+	TArray<uint16> Flow;
+	TArray<uint8> Mask;
+	Flow.SetNumUninitialized(3 * NumPixels);
+	Mask.SetNumUninitialized(NumPixels);
+	FOpticalFlowGenerator::ComputeFlow((const uint16*)DepthA.GetData(), (const uint16*)DepthB.GetData(), Width, Height, CameraA, CameraB,
+		Settings.MaxDepth, Settings.OcclusionTolerance, Flow.GetData(), Mask.GetData());
+
+	const FDateTime UnixEpoch(1970, 1, 1);
+	TArray<uint8> Data;
+	FOpticalFlowGenerator::Serialize(Flow, Mask, Width, Height, FrameA, FrameB,
+		(TimeStampA - UnixEpoch).GetTicks() * 100, (TimeStampB - UnixEpoch).GetTicks() * 100, Data);
+
+	FString FileDir = FPaths::ProjectSavedDir() + "/" + "viewport";
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	if (!PlatformFile.DirectoryExists(*FileDir))
+	{
+		PlatformFile.CreateDirectoryTree(*FileDir);
+	}
+	const FString FileName = TEXT("FLOW") + RawDataAsyncWorker::FormatTimeStamp(TimeStampA) + TEXT(".vlflow");
+	FSessionJournal::Save(Settings.Writer, Settings.Journal, MoveTemp(Data), FileDir, FileName, FrameA, TEXT("FLOW"));
+}
@@ -0,0 +1,261 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "OpticalFlowGenerator.h"
+#include "PixelFormatConversion.h"
+#include "VisionLoggerSimd.h"
+
+namespace
+{
+	// Rigid transform from camera A rays into camera B coordinates (x right, y up, z forward)
+	struct FFlowTransform
+	{
+		// Camera B coordinates of the right, up and forward axes of camera A
+		float Right[3];
+		float Up[3];
+		float Forward[3];
+
+		// Camera B coordinates of the origin of camera A
+		float Offset[3];
+	};
+
+	FORCEINLINE float Dot(const float A[3], const float B[3])
+	{
+		return A[0] * B[0] + A[1] * B[1] + A[2] * B[2];
+	}
+
+	FFlowTransform MakeFlowTransform(const FPointCloudCamera& A, const FPointCloudCamera& B)
+	{
+		FFlowTransform Transform;
+		const float* Axes[3] = { B.Right, B.Up, B.Forward };
+		const float Delta[3] = { A.Origin[0] - B.Origin[0], A.Origin[1] - B.Origin[1], A.Origin[2] - B.Origin[2] };
+		for (int32 i = 0; i < 3; ++i)
+		{
+			Transform.Right[i] = Dot(Axes[i], A.Right);
+			Transform.Up[i] = Dot(Axes[i], A.Up);
+			Transform.Forward[i] = Dot(Axes[i], A.Forward);
+			Transform.Offset[i] = Dot(Axes[i], Delta);
+		}
+		return Transform;
+	}
+
+	/**
+	 * Reproject one row of camera A into camera B. RowBase is the camera B direction of the row's ray without
+	 * horizontal offset, RayX the horizontal ray offsets of the columns. Writes the depth of A, the depth
+	 * in camera B and the flow of every pixel. Without bSimd every pixel takes the scalar path.
+	 */
+	void ReprojectRow(const uint16* DepthRGBAHalf, int32 Width, int32 y, const float* RayX, const float RowBase[3], const FFlowTransform& Transform,
+		const FPointCloudCamera& CameraB, bool bSimd, float* OutDepthA, float* OutDepthB, float* OutU, float* OutV)
+	{
+		const float ProjectX = CameraB.CenterX - 0.5f;
+		const float ProjectY = CameraB.CenterY - 0.5f;
+		int32 x = 0;
+#if VL_SIMD_X86
+		const int32 SimdWidth = bSimd ? Width : 0;
+		const __m128 BaseX = _mm_set1_ps(RowBase[0]);
+		const __m128 BaseY = _mm_set1_ps(RowBase[1]);
+		const __m128 BaseZ = _mm_set1_ps(RowBase[2]);
+		const __m128 RightX = _mm_set1_ps(Transform.Right[0]);
+		const __m128 RightY = _mm_set1_ps(Transform.Right[1]);
+		const __m128 RightZ = _mm_set1_ps(Transform.Right[2]);
+		const __m128 OffsetX = _mm_set1_ps(Transform.Offset[0]);
+		const __m128 OffsetY = _mm_set1_ps(Transform.Offset[1]);
+		const __m128 OffsetZ = _mm_set1_ps(Transform.Offset[2]);
+		const __m128 Focal = _mm_set1_ps(CameraB.FocalLength);
+		const __m128 CenterX = _mm_set1_ps(ProjectX);
+		const __m128 CenterY = _mm_set1_ps(ProjectY);
+		const __m128 Row = _mm_set1_ps((float)y);
+		const __m128 Four = _mm_set1_ps(4.0f);
+		__m128 Column = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+		for (; x + 4 <= SimdWidth; x += 4)
+		{
+			// Every pixel is 4 halves (8 bytes), pick the R half of 4 pixels
+			const __m128 PixelsA = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(DepthRGBAHalf + 4 * x)));
+			const __m128 PixelsB = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(DepthRGBAHalf + 4 * x + 8)));
+			const __m128i RG = _mm_castps_si128(_mm_shuffle_ps(PixelsA, PixelsB, _MM_SHUFFLE(2, 0, 2, 0)));
+			const __m128 Depth = VLHalfToFloat4(_mm_and_si128(RG, _mm_set1_epi32(0xFFFF)));
+
+			const __m128 Ray = _mm_loadu_ps(RayX + x);
+			const __m128 PointX = _mm_add_ps(OffsetX, _mm_mul_ps(Depth, _mm_add_ps(BaseX, _mm_mul_ps(Ray, RightX))));
+			const __m128 PointY = _mm_add_ps(OffsetY, _mm_mul_ps(Depth, _mm_add_ps(BaseY, _mm_mul_ps(Ray, RightY))));
+			const __m128 PointZ = _mm_add_ps(OffsetZ, _mm_mul_ps(Depth, _mm_add_ps(BaseZ, _mm_mul_ps(Ray, RightZ))));
+			const __m128 Scale = _mm_div_ps(Focal, PointZ);
+			_mm_storeu_ps(OutDepthA + x, Depth);
+			_mm_storeu_ps(OutDepthB + x, PointZ);
+			_mm_storeu_ps(OutU + x, _mm_sub_ps(_mm_add_ps(CenterX, _mm_mul_ps(PointX, Scale)), Column));
+			_mm_storeu_ps(OutV + x, _mm_sub_ps(_mm_sub_ps(CenterY, _mm_mul_ps(PointY, Scale)), Row));
+			Column = _mm_add_ps(Column, Four);
+		}
+#endif
+		for (; x < Width; ++x)
+		{
+			const float Depth = FPointCloudGenerator::HalfToFloat(DepthRGBAHalf[4 * x]);
+			const float PointX = Transform.Offset[0] + Depth * (RowBase[0] + RayX[x] * Transform.Right[0]);
+			const float PointY = Transform.Offset[1] + Depth * (RowBase[1] + RayX[x] * Transform.Right[1]);
+			const float PointZ = Transform.Offset[2] + Depth * (RowBase[2] + RayX[x] * Transform.Right[2]);
+			const float Scale = CameraB.FocalLength / PointZ;
+			OutDepthA[x] = Depth;
+			OutDepthB[x] = PointZ;
+			OutU[x] = ProjectX + PointX * Scale - (float)x;
+			OutV[x] = ProjectY - PointY * Scale - (float)y;
+		}
+	}
+
+	// Convert a row of floats to halves
+	void FloatToHalfRow(const float* Src, uint16* Dst, int32 Num, bool bSimd)
+	{
+		int32 i = 0;
+#if VL_SIMD_X86
+		const int32 SimdNum = bSimd ? Num : 0;
+		for (; i + 8 <= SimdNum; i += 8)
+		{
+			const __m128i Low = VLFloatToHalf4(_mm_loadu_ps(Src + i));
+			const __m128i High = VLFloatToHalf4(_mm_loadu_ps(Src + i + 4));
+			_mm_storeu_si128((__m128i*)(Dst + i), _mm_packs_epi32(Low, High));
+		}
+#endif
+		for (; i < Num; ++i)
+		{
+			Dst[i] = FOpticalFlowGenerator::FloatToHalf(Src[i]);
+		}
+	}
+
+	template <typename T>
+	void AppendValue(TArray<uint8>& Data, const T& Value)
+	{
+		const int32 Offset = Data.AddUninitialized(sizeof(T));
+		FMemory::Memcpy(Data.GetData() + Offset, &Value, sizeof(T));
+	}
+}
+
+uint16 FOpticalFlowGenerator::FloatToHalf(float Value)
+{
+	const uint32 SubnormalMagicBits = ((127 - 15) + (23 - 10) + 1) << 23;
+	uint32 Bits;
+	FMemory::Memcpy(&Bits, &Value, 4);
+	const uint32 Sign = Bits & 0x80000000u;
+	Bits ^= Sign;
+
+	uint16 Result;
+	if (Bits >= ((127 + 16) << 23))
+	{
+		// Overflow to inf, nan keeps a quiet nan
+		Result = Bits > (255u << 23) ? 0x7E00 : 0x7C00;
+	}
+	else if (Bits < ((127 - 14) << 23))
+	{
+		// Subnormal result, rounded by the float addition
+		float AbsValue;
+		float SubnormalMagic;
+		FMemory::Memcpy(&AbsValue, &Bits, 4);
+		FMemory::Memcpy(&SubnormalMagic, &SubnormalMagicBits, 4);
+		AbsValue += SubnormalMagic;
+		FMemory::Memcpy(&Bits, &AbsValue, 4);
+		Result = (uint16)(Bits - SubnormalMagicBits);
+	}
+	else
+	{
+		// Rebias the exponent and round the mantissa to nearest even
+		const uint32 MantissaOdd = (Bits >> 13) & 1;
+		Bits += 0xFFF - ((127 - 15) << 23);
+		Bits += MantissaOdd;
+		Result = (uint16)(Bits >> 13);
+	}
+	return Result | (uint16)(Sign >> 16);
+}
+
+void FOpticalFlowGenerator::ComputeFlow(const uint16* DepthA, const uint16* DepthB, int32 Width, int32 Height,
+	const FPointCloudCamera& CameraA, const FPointCloudCamera& CameraB, float MaxDepth, float OcclusionTolerance,
+	uint16* OutFlow, uint8* OutMask)
+{
+	if (DepthA == nullptr || DepthB == nullptr || Width <= 0 || Height <= 0)
+	{
+		return;
+	}
+	const int32 NumPixels = Width * Height;
+	const FFlowTransform Transform = MakeFlowTransform(CameraA, CameraB);
+	const float InvFocal = 1.0f / CameraA.FocalLength;
+	// Points closer than this to the plane of camera B can not be projected
+	const float MinDepth = 1.0f;
+	// The instruction set limit of the conversion kernels applies here too, tests compare the paths with it
+	const bool bSimd = FPixelFormatConversion::GetSimdLevel() != EVisionSimdLevel::Scalar;
+
+	TArray<float> RayX;
+	RayX.SetNumUninitialized(Width);
+	for (int32 x = 0; x < Width; ++x)
+	{
+		RayX[x] = (x + 0.5f - CameraA.CenterX) * InvFocal;
+	}
+
+	TArray<float> RowBuffer;
+	RowBuffer.SetNumUninitialized(5 * Width);
+	float* RowDepthA = RowBuffer.GetData();
+	float* RowDepthB = RowDepthA + Width;
+	float* RowU = RowDepthB + Width;
+	float* RowV = RowU + Width;
+	float* RowDepthChange = RowV + Width;
+	uint16* PlaneU = OutFlow;
+	uint16* PlaneV = OutFlow + NumPixels;
+	uint16* PlaneDepthChange = OutFlow + 2 * NumPixels;
+	for (int32 y = 0; y < Height; ++y)
+	{
+		const float RayY = -(y + 0.5f - CameraA.CenterY) * InvFocal;
+		const float RowBase[3] =
+		{
+			Transform.Forward[0] + RayY * Transform.Up[0],
+			Transform.Forward[1] + RayY * Transform.Up[1],
+			Transform.Forward[2] + RayY * Transform.Up[2]
+		};
+		ReprojectRow(DepthA + 4 * y * Width, Width, y, RayX.GetData(), RowBase, Transform, CameraB, bSimd, RowDepthA, RowDepthB, RowU, RowV);
+
+		// Validity and occlusion need the depth of B at the target pixel, no gather in SSE2
+		uint8* RowMask = OutMask + y * Width;
+		for (int32 x = 0; x < Width; ++x)
+		{
+			const float Depth = RowDepthA[x];
+			if (!(Depth > 0.0f && Depth <= MaxDepth) || !(RowDepthB[x] >= MinDepth))
+			{
+				RowMask[x] = 0;
+				RowU[x] = 0.0f;
+				RowV[x] = 0.0f;
+				RowDepthChange[x] = 0.0f;
+				continue;
+			}
+			RowDepthChange[x] = RowDepthB[x] - Depth;
+
+			const int32 TargetX = FMath::FloorToInt(x + RowU[x] + 0.5f);
+			const int32 TargetY = FMath::FloorToInt(y + RowV[x] + 0.5f);
+			if (TargetX < 0 || TargetX >= Width || TargetY < 0 || TargetY >= Height)
+			{
+				RowMask[x] = FlowMaskValid | FlowMaskOutOfView;
+				continue;
+			}
+			const float VisibleDepth = FPointCloudGenerator::HalfToFloat(DepthB[4 * (TargetY * Width + TargetX)]);
+			const bool bOccluded = !(RowDepthB[x] <= VisibleDepth * (1.0f + OcclusionTolerance));
+			RowMask[x] = bOccluded ? (FlowMaskValid | FlowMaskOccluded) : FlowMaskValid;
+		}
+
+		FloatToHalfRow(RowU, PlaneU + y * Width, Width, bSimd);
+		FloatToHalfRow(RowV, PlaneV + y * Width, Width, bSimd);
+		FloatToHalfRow(RowDepthChange, PlaneDepthChange + y * Width, Width, bSimd);
+	}
+}
+
+void FOpticalFlowGenerator::Serialize(const TArray<uint16>& Flow, const TArray<uint8>& Mask, int32 Width, int32 Height,
+	uint64 FrameA, uint64 FrameB, int64 TimeStampA, int64 TimeStampB, TArray<uint8>& OutData)
+{
+	OutData.Reset();
+	AppendValue<uint32>(OutData, 0x4C464C56);
+	AppendValue<uint16>(OutData, 1);
+	AppendValue<uint16>(OutData, 3);
+	AppendValue<uint32>(OutData, Width);
+	AppendValue<uint32>(OutData, Height);
+	AppendValue<uint64>(OutData, FrameA);
+	AppendValue<uint64>(OutData, FrameB);
+	AppendValue<int64>(OutData, TimeStampA);
+	AppendValue<int64>(OutData, TimeStampB);
+
+	int32 Offset = OutData.AddUninitialized(Flow.Num() * sizeof(uint16));
+	FMemory::Memcpy(OutData.GetData() + Offset, Flow.GetData(), Flow.Num() * sizeof(uint16));
+	Offset = OutData.AddUninitialized(Mask.Num());
+	FMemory::Memcpy(OutData.GetData() + Offset, Mask.GetData(), Mask.Num());
+}
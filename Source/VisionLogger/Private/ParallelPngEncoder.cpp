@@ -0,0 +1,258 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "ParallelPngEncoder.h"
+#include "Async/ParallelFor.h"
+#include "HAL/PlatformMisc.h"
+#include "zlib.h"
+
+namespace
+{
+	const uint8 PngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+	// zlib header of a 32 KB window stream, the stripes below form its body
+	const uint8 ZlibHeader[2] = { 0x78, 0x01 };
+
+	// Deflate window, every stripe is primed with this much of the data before it
+	const int32 DeflateWindow = 32 * 1024;
+
+	// PNG row filters
+	const uint8 FilterNone = 0;
+	const uint8 FilterUp = 2;
+
+	void PutBigEndian(uint8* Out, uint32 Value)
+	{
+		Out[0] = (uint8)(Value >> 24);
+		Out[1] = (uint8)(Value >> 16);
+		Out[2] = (uint8)(Value >> 8);
+		Out[3] = (uint8)Value;
+	}
+
+	void AppendBigEndian(TArray<uint8>& Out, uint32 Value)
+	{
+		uint8 Bytes[4];
+		PutBigEndian(Bytes, Value);
+		Out.Append(Bytes, 4);
+	}
+
+	// Chunk with its length, type, data and the CRC over type and data
+	void AppendChunk(TArray<uint8>& Out, const char* Type, const uint8* Data, int32 Length)
+	{
+		AppendBigEndian(Out, Length);
+		Out.Append((const uint8*)Type, 4);
+		Out.Append(Data, Length);
+		uLong Crc = crc32(0, (const Bytef*)Type, 4);
+		if (Length > 0)
+		{
+			// crc32 restarts for a null buffer
+			Crc = crc32(Crc, Data, Length);
+		}
+		AppendBigEndian(Out, (uint32)Crc);
+	}
+
+	// Deflated stripe with the checksums the file is assembled from
+	struct FPngStripe
+	{
+		TArray<uint8> Compressed;
+		int64 RawLength;
+		uLong Adler;
+		uLong Crc;
+		bool bCompressed;
+	};
+
+	bool DeflateStripe(const uint8* Raw, int64 Length, int64 Offset, int32 Level, bool bLast, FPngStripe& Out)
+	{
+		z_stream Stream;
+		FMemory::Memzero(Stream);
+		if (deflateInit2(&Stream, Level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			return false;
+		}
+		if (Offset > 0)
+		{
+			const int64 DictionaryLength = FMath::Min<int64>(Offset, DeflateWindow);
+			deflateSetDictionary(&Stream, Raw - DictionaryLength, (uInt)DictionaryLength);
+		}
+
+		// Not last stripes end with a sync flush: byte aligned, no final block
+		const int Flush = bLast ? Z_FINISH : Z_SYNC_FLUSH;
+		Out.Compressed.SetNumUninitialized(deflateBound(&Stream, Length) + 64);
+		Stream.next_in = (Bytef*)Raw;
+		Stream.avail_in = (uInt)Length;
+		bool bDone = false;
+		while (!bDone)
+		{
+			if (Stream.total_out == (uLong)Out.Compressed.Num())
+			{
+				Out.Compressed.SetNumUninitialized(Out.Compressed.Num() + Out.Compressed.Num() / 2 + 64);
+			}
+			Stream.next_out = Out.Compressed.GetData() + Stream.total_out;
+			Stream.avail_out = (uInt)(Out.Compressed.Num() - Stream.total_out);
+			const int Result = deflate(&Stream, Flush);
+			if (Result != Z_OK && Result != Z_STREAM_END && !(Result == Z_BUF_ERROR && Stream.avail_out == 0))
+			{
+				break;
+			}
+			bDone = bLast ? Result == Z_STREAM_END : Stream.avail_in == 0 && Stream.avail_out != 0;
+		}
+		Out.Compressed.SetNum(Stream.total_out, false);
+		deflateEnd(&Stream);
+		return bDone;
+	}
+}
+
+int32 FParallelPngEncoder::GetDefaultNumStripes(int32 Height)
+{
+	return FMath::Clamp(Height / MinStripeRows, 1, FPlatformMisc::NumberOfCoresIncludingHyperthreads());
+}
+
+bool FParallelPngEncoder::EncodeBGRA(const FColor* Pixels, int32 Width, int32 Height, int32 NumStripes, int32 Level, TArray<uint8>& OutPng)
+{
+	return Encode((const uint8*)Pixels, Width, Height, 3, 8, NumStripes, Level, OutPng);
+}
+
+bool FParallelPngEncoder::EncodeGray(const uint8* Pixels, int32 Width, int32 Height, int32 NumStripes, int32 Level, TArray<uint8>& OutPng)
+{
+	return Encode(Pixels, Width, Height, 1, 8, NumStripes, Level, OutPng);
+}
+
+bool FParallelPngEncoder::EncodeGray16(const uint16* Pixels, int32 Width, int32 Height, int32 NumStripes, int32 Level, TArray<uint8>& OutPng)
+{
+	return Encode((const uint8*)Pixels, Width, Height, 1, 16, NumStripes, Level, OutPng);
+}
+
+bool FParallelPngEncoder::Encode(const uint8* Pixels, int32 Width, int32 Height, int32 Channels, int32 BitDepth, int32 NumStripes, int32 Level, TArray<uint8>& OutPng)
+{
+	OutPng.Reset();
+	if (Width <= 0 || Height <= 0 || Pixels == nullptr)
+	{
+		return false;
+	}
+	Level = FMath::Clamp(Level, 0, 9);
+	const int32 SampleBytes = BitDepth / 8;
+	const int64 RowBytes = (int64)Width * Channels * SampleBytes + 1;
+	const int64 InStride = (int64)Width * (Channels == 3 ? 4 : SampleBytes);
+	const int32 RowsPerStripe = FMath::DivideAndRoundUp(Height, FMath::Clamp(NumStripes > 0 ? NumStripes : GetDefaultNumStripes(Height), 1, Height));
+	NumStripes = FMath::DivideAndRoundUp(Height, RowsPerStripe);
+
+	// Filter every row against the unfiltered row above, rows do not depend on each other
+	TArray<uint8> Filtered;
+	Filtered.SetNumUninitialized(RowBytes * Height);
+	ParallelFor(NumStripes, [&](int32 Stripe)
+	{
+		const int32 EndRow = FMath::Min((Stripe + 1) * RowsPerStripe, Height);
+		for (int32 Row = Stripe * RowsPerStripe; Row < EndRow; ++Row)
+		{
+			const uint8* In = Pixels + Row * InStride;
+			const uint8* Above = Row > 0 ? In - InStride : nullptr;
+			uint8* Out = Filtered.GetData() + Row * RowBytes;
+			*Out++ = Above ? FilterUp : FilterNone;
+			if (Channels == 3)
+			{
+				for (int32 X = 0; X < Width; ++X, In += 4, Out += 3)
+				{
+					const uint8 AboveB = Above ? Above[4 * X + 0] : 0;
+					const uint8 AboveG = Above ? Above[4 * X + 1] : 0;
+					const uint8 AboveR = Above ? Above[4 * X + 2] : 0;
+					Out[0] = In[2] - AboveR;
+					Out[1] = In[1] - AboveG;
+					Out[2] = In[0] - AboveB;
+				}
+			}
+			else if (SampleBytes == 2)
+			{
+				// Native little endian samples, high byte first in the file
+				const uint16* In16 = (const uint16*)In;
+				const uint16* Above16 = (const uint16*)Above;
+				for (int32 X = 0; X < Width; ++X, Out += 2)
+				{
+					const uint16 AboveSample = Above16 ? Above16[X] : 0;
+					Out[0] = (uint8)(In16[X] >> 8) - (uint8)(AboveSample >> 8);
+					Out[1] = (uint8)In16[X] - (uint8)AboveSample;
+				}
+			}
+			else
+			{
+				for (int32 X = 0; X < Width; ++X)
+				{
+					Out[X] = In[X] - (Above ? Above[X] : 0);
+				}
+			}
+		}
+	});
+
+	// Deflate the stripes concurrently, each task also checksums its part of the file
+	TArray<FPngStripe> Stripes;
+	Stripes.SetNum(NumStripes);
+	ParallelFor(NumStripes, [&](int32 Stripe)
+	{
+		FPngStripe& Out = Stripes[Stripe];
+		const int64 Begin = (int64)Stripe * RowsPerStripe * RowBytes;
+		const int64 End = (int64)FMath::Min((Stripe + 1) * RowsPerStripe, Height) * RowBytes;
+		const uint8* Raw = Filtered.GetData() + Begin;
+		Out.RawLength = End - Begin;
+		Out.Adler = adler32(adler32(0, Z_NULL, 0), Raw, (uInt)Out.RawLength);
+		Out.bCompressed = DeflateStripe(Raw, Out.RawLength, Begin, Level, Stripe == NumStripes - 1, Out);
+		Out.Crc = crc32(crc32(0, Z_NULL, 0), (const Bytef*)"IDAT", 4);
+		if (Stripe == 0)
+		{
+			Out.Crc = crc32(Out.Crc, ZlibHeader, sizeof(ZlibHeader));
+		}
+		Out.Crc = crc32(Out.Crc, Out.Compressed.GetData(), Out.Compressed.Num());
+	});
+
+	uLong Adler = Stripes[0].Adler;
+	int64 CompressedSize = 0;
+	for (int32 Stripe = 0; Stripe < NumStripes; ++Stripe)
+	{
+		if (!Stripes[Stripe].bCompressed)
+		{
+			UE_LOG(LogTemp, Error, TEXT("Could not deflate stripe %d of a %dx%d PNG"), Stripe, Width, Height);
+			return false;
+		}
+		if (Stripe > 0)
+		{
+			Adler = adler32_combine(Adler, Stripes[Stripe].Adler, Stripes[Stripe].RawLength);
+		}
+		CompressedSize += Stripes[Stripe].Compressed.Num();
+	}
+
+	// Signature, header, one IDAT per stripe (zlib header in the first, Adler-32 at the end of the last), end
+	OutPng.Reserve(CompressedSize + NumStripes * 12 + 64);
+	OutPng.Append(PngSignature, sizeof(PngSignature));
+	uint8 Header[13];
+	PutBigEndian(Header, Width);
+	PutBigEndian(Header + 4, Height);
+	Header[8] = (uint8)BitDepth;
+	Header[9] = Channels == 3 ? 2 : 0;
+	Header[10] = 0;
+	Header[11] = 0;
+	Header[12] = 0;
+	AppendChunk(OutPng, "IHDR", Header, sizeof(Header));
+	for (int32 Stripe = 0; Stripe < NumStripes; ++Stripe)
+	{
+		const FPngStripe& Part = Stripes[Stripe];
+		const bool bFirst = Stripe == 0;
+		const bool bLast = Stripe == NumStripes - 1;
+		uLong Crc = Part.Crc;
+		uint8 Trailer[4];
+		PutBigEndian(Trailer, (uint32)Adler);
+		if (bLast)
+		{
+			Crc = crc32(Crc, Trailer, sizeof(Trailer));
+		}
+		AppendBigEndian(OutPng, Part.Compressed.Num() + (bFirst ? sizeof(ZlibHeader) : 0) + (bLast ? sizeof(Trailer) : 0));
+		OutPng.Append((const uint8*)"IDAT", 4);
+		if (bFirst)
+		{
+			OutPng.Append(ZlibHeader, sizeof(ZlibHeader));
+		}
+		OutPng.Append(Part.Compressed.GetData(), Part.Compressed.Num());
+		if (bLast)
+		{
+			OutPng.Append(Trailer, sizeof(Trailer));
+		}
+		AppendBigEndian(OutPng, (uint32)Crc);
+	}
+	AppendChunk(OutPng, "IEND", nullptr, 0);
+	return true;
+}
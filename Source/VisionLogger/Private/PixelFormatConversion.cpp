@@ -0,0 +1,588 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "PixelFormatConversion.h"
+#include "VisionLoggerSimd.h"
+#include <atomic>
+
+namespace
+{
+	// Luma weights (out of 256) applied to B, G, R and the offset added after the shift
+	struct FLumaWeights
+	{
+		int32 B;
+		int32 G;
+		int32 R;
+		int32 Offset;
+	};
+
+	// Full range gray, weights sum up to 256
+	const FLumaWeights GrayWeights = { 29, 150, 77, 0 };
+
+	// BT.601 limited range luma
+	const FLumaWeights LumaWeights = { 25, 129, 66, 16 };
+
+	EVisionSimdLevel DetectSimdLevel()
+	{
+#if VL_SIMD_X86
+		uint32 Regs[4] = { 0, 0, 0, 0 };
+#if defined(_MSC_VER)
+		int Info[4];
+		__cpuid(Info, 0);
+		const int32 MaxLeaf = Info[0];
+		__cpuid(Info, 1);
+		Regs[2] = Info[2];
+#else
+		uint32 MaxLeaf = __get_cpuid_max(0, nullptr);
+		__get_cpuid(1, &Regs[0], &Regs[1], &Regs[2], &Regs[3]);
+#endif
+		const bool bSSSE3 = (Regs[2] & (1u << 9)) != 0;
+		const bool bOSXSave = (Regs[2] & (1u << 27)) != 0;
+		const bool bAVX = (Regs[2] & (1u << 28)) != 0;
+		if (!bSSSE3)
+		{
+			return EVisionSimdLevel::Scalar;
+		}
+
+		bool bAVX2 = false;
+		if (bOSXSave && bAVX && MaxLeaf >= 7)
+		{
+#if defined(_MSC_VER)
+			__cpuidex(Info, 7, 0);
+			const uint32 ExtFeatures = Info[1];
+			const uint64 XCR0 = _xgetbv(0);
+#else
+			uint32 ExtRegs[4] = { 0, 0, 0, 0 };
+			__cpuid_count(7, 0, ExtRegs[0], ExtRegs[1], ExtRegs[2], ExtRegs[3]);
+			const uint32 ExtFeatures = ExtRegs[1];
+			uint32 XCR0Lo, XCR0Hi;
+			__asm__ volatile("xgetbv" : "=a"(XCR0Lo), "=d"(XCR0Hi) : "c"(0));
+			const uint64 XCR0 = ((uint64)XCR0Hi << 32) | XCR0Lo;
+#endif
+			// The OS has to save the YMM registers on context switches
+			bAVX2 = (ExtFeatures & (1u << 5)) != 0 && (XCR0 & 0x6) == 0x6;
+		}
+		return bAVX2 ? EVisionSimdLevel::AVX2 : EVisionSimdLevel::SSE;
+#else
+		return EVisionSimdLevel::Scalar;
+#endif
+	}
+
+	const EVisionSimdLevel SupportedSimdLevel = DetectSimdLevel();
+
+	// Lowered by SetMaxSimdLevel while workers convert, every conversion reads it once
+	std::atomic<EVisionSimdLevel> ActiveSimdLevel(SupportedSimdLevel);
+
+	EVisionSimdLevel LoadSimdLevel()
+	{
+		return ActiveSimdLevel.load(std::memory_order_relaxed);
+	}
+
+	/* Scalar reference kernels */
+
+	void LumaScalar(const FColor* Src, uint8* Dst, int32 NumPixels, const FLumaWeights& W)
+	{
+		for (int32 i = 0; i < NumPixels; ++i)
+		{
+			const FColor& P = Src[i];
+			Dst[i] = (uint8)(((W.B * P.B + W.G * P.G + W.R * P.R + 128) >> 8) + W.Offset);
+		}
+	}
+
+	void RGB24Scalar(const FColor* Src, uint8* Dst, int32 NumPixels)
+	{
+		for (int32 i = 0; i < NumPixels; ++i)
+		{
+			Dst[3 * i + 0] = Src[i].R;
+			Dst[3 * i + 1] = Src[i].G;
+			Dst[3 * i + 2] = Src[i].B;
+		}
+	}
+
+	void PlanarScalar(const FColor* Src, uint8* DstR, uint8* DstG, uint8* DstB, int32 NumPixels)
+	{
+		for (int32 i = 0; i < NumPixels; ++i)
+		{
+			DstR[i] = Src[i].R;
+			DstG[i] = Src[i].G;
+			DstB[i] = Src[i].B;
+		}
+	}
+
+	FORCEINLINE uint8 ChromaU(int32 R, int32 G, int32 B)
+	{
+		return (uint8)(((-38 * R - 74 * G + 112 * B + 128) >> 8) + 128);
+	}
+
+	FORCEINLINE uint8 ChromaV(int32 R, int32 G, int32 B)
+	{
+		return (uint8)(((112 * R - 94 * G - 18 * B + 128) >> 8) + 128);
+	}
+
+	// Average the (up to) 2x2 block starting at X, Y and write its chroma to DstU[Index * Step] / DstV[Index * Step]
+	void ChromaBlockScalar(const FColor* Src, int32 Width, int32 Height, int32 X, int32 Y, uint8* DstU, uint8* DstV, int32 Index, int32 Step)
+	{
+		int32 SumR = 0, SumG = 0, SumB = 0, Count = 0;
+		for (int32 dy = 0; dy < 2 && Y + dy < Height; ++dy)
+		{
+			for (int32 dx = 0; dx < 2 && X + dx < Width; ++dx)
+			{
+				const FColor& P = Src[(Y + dy) * Width + X + dx];
+				SumR += P.R;
+				SumG += P.G;
+				SumB += P.B;
+				++Count;
+			}
+		}
+		const int32 R = (SumR + Count / 2) / Count;
+		const int32 G = (SumG + Count / 2) / Count;
+		const int32 B = (SumB + Count / 2) / Count;
+		DstU[Index * Step] = ChromaU(R, G, B);
+		DstV[Index * Step] = ChromaV(R, G, B);
+	}
+
+	// Chroma for the blocks of one chroma row starting at block FirstBlock
+	void ChromaRowScalar(const FColor* Src, int32 Width, int32 Height, int32 Y, int32 FirstBlock, uint8* DstU, uint8* DstV, int32 Step)
+	{
+		const int32 ChromaWidth = (Width + 1) / 2;
+		for (int32 cx = FirstBlock; cx < ChromaWidth; ++cx)
+		{
+			ChromaBlockScalar(Src, Width, Height, 2 * cx, Y, DstU, DstV, cx, Step);
+		}
+	}
+
+#if VL_SIMD_X86
+	/* SSE kernels */
+
+	// Split 4 BGRA pixels into one 32 bit lane per pixel and channel
+	FORCEINLINE void SplitChannels(__m128i Pixels, __m128i& B, __m128i& G, __m128i& R)
+	{
+		const __m128i ByteMask = _mm_set1_epi32(0xFF);
+		B = _mm_and_si128(Pixels, ByteMask);
+		G = _mm_and_si128(_mm_srli_epi32(Pixels, 8), ByteMask);
+		R = _mm_and_si128(_mm_srli_epi32(Pixels, 16), ByteMask);
+	}
+
+	// Weighted sum of 8 pixels in 16 bit lanes, the sum never exceeds 16 bit unsigned so wrapping multiplies are exact
+	FORCEINLINE __m128i Luma8(__m128i B, __m128i G, __m128i R, const FLumaWeights& W)
+	{
+		__m128i Sum = _mm_add_epi16(_mm_mullo_epi16(B, _mm_set1_epi16((int16)W.B)), _mm_mullo_epi16(G, _mm_set1_epi16((int16)W.G)));
+		Sum = _mm_add_epi16(Sum, _mm_mullo_epi16(R, _mm_set1_epi16((int16)W.R)));
+		Sum = _mm_srli_epi16(_mm_add_epi16(Sum, _mm_set1_epi16(128)), 8);
+		return _mm_add_epi16(Sum, _mm_set1_epi16((int16)W.Offset));
+	}
+
+	void LumaSSE(const FColor* Src, uint8* Dst, int32 NumPixels, const FLumaWeights& W)
+	{
+		int32 i = 0;
+		for (; i + 16 <= NumPixels; i += 16)
+		{
+			__m128i B[4], G[4], R[4];
+			for (int32 k = 0; k < 4; ++k)
+			{
+				SplitChannels(_mm_loadu_si128((const __m128i*)(Src + i + 4 * k)), B[k], G[k], R[k]);
+			}
+			const __m128i Lo = Luma8(_mm_packs_epi32(B[0], B[1]), _mm_packs_epi32(G[0], G[1]), _mm_packs_epi32(R[0], R[1]), W);
+			const __m128i Hi = Luma8(_mm_packs_epi32(B[2], B[3]), _mm_packs_epi32(G[2], G[3]), _mm_packs_epi32(R[2], R[3]), W);
+			_mm_storeu_si128((__m128i*)(Dst + i), _mm_packus_epi16(Lo, Hi));
+		}
+		LumaScalar(Src + i, Dst + i, NumPixels - i, W);
+	}
+
+	void PlanarSSE(const FColor* Src, uint8* DstR, uint8* DstG, uint8* DstB, int32 NumPixels)
+	{
+		int32 i = 0;
+		for (; i + 16 <= NumPixels; i += 16)
+		{
+			__m128i B[4], G[4], R[4];
+			for (int32 k = 0; k < 4; ++k)
+			{
+				SplitChannels(_mm_loadu_si128((const __m128i*)(Src + i + 4 * k)), B[k], G[k], R[k]);
+			}
+			_mm_storeu_si128((__m128i*)(DstR + i), _mm_packus_epi16(_mm_packs_epi32(R[0], R[1]), _mm_packs_epi32(R[2], R[3])));
+			_mm_storeu_si128((__m128i*)(DstG + i), _mm_packus_epi16(_mm_packs_epi32(G[0], G[1]), _mm_packs_epi32(G[2], G[3])));
+			_mm_storeu_si128((__m128i*)(DstB + i), _mm_packus_epi16(_mm_packs_epi32(B[0], B[1]), _mm_packs_epi32(B[2], B[3])));
+		}
+		PlanarScalar(Src + i, DstR + i, DstG + i, DstB + i, NumPixels - i);
+	}
+
+	VL_TARGET_SSSE3 void RGB24SSSE3(const FColor* Src, uint8* Dst, int32 NumPixels)
+	{
+		const __m128i Shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+		int32 i = 0;
+		// Every store writes 16 bytes of which 12 are valid, stop early enough to never write past the end
+		for (; i + 6 <= NumPixels; i += 4)
+		{
+			const __m128i Pixels = _mm_loadu_si128((const __m128i*)(Src + i));
+			_mm_storeu_si128((__m128i*)(Dst + 3 * i), _mm_shuffle_epi8(Pixels, Shuffle));
+		}
+		RGB24Scalar(Src + i, Dst + 3 * i, NumPixels - i);
+	}
+
+	// Averaged channels of 4 horizontally adjacent 2x2 blocks, as 16 bit lanes (upper half duplicated)
+	FORCEINLINE void Average2x2(const FColor* Row0, const FColor* Row1, __m128i& B, __m128i& G, __m128i& R)
+	{
+		__m128i B0, G0, R0, B1, G1, R1, B2, G2, R2, B3, G3, R3;
+		SplitChannels(_mm_loadu_si128((const __m128i*)Row0), B0, G0, R0);
+		SplitChannels(_mm_loadu_si128((const __m128i*)(Row0 + 4)), B1, G1, R1);
+		SplitChannels(_mm_loadu_si128((const __m128i*)Row1), B2, G2, R2);
+		SplitChannels(_mm_loadu_si128((const __m128i*)(Row1 + 4)), B3, G3, R3);
+		const __m128i Ones = _mm_set1_epi16(1);
+		const __m128i Round = _mm_set1_epi32(2);
+		// Vertical sum in 16 bit, horizontal pair sum with madd into 32 bit
+		__m128i SumB = _mm_madd_epi16(_mm_add_epi16(_mm_packs_epi32(B0, B1), _mm_packs_epi32(B2, B3)), Ones);
+		__m128i SumG = _mm_madd_epi16(_mm_add_epi16(_mm_packs_epi32(G0, G1), _mm_packs_epi32(G2, G3)), Ones);
+		__m128i SumR = _mm_madd_epi16(_mm_add_epi16(_mm_packs_epi32(R0, R1), _mm_packs_epi32(R2, R3)), Ones);
+		SumB = _mm_srli_epi32(_mm_add_epi32(SumB, Round), 2);
+		SumG = _mm_srli_epi32(_mm_add_epi32(SumG, Round), 2);
+		SumR = _mm_srli_epi32(_mm_add_epi32(SumR, Round), 2);
+		B = _mm_packs_epi32(SumB, SumB);
+		G = _mm_packs_epi32(SumG, SumG);
+		R = _mm_packs_epi32(SumR, SumR);
+	}
+
+	// Chroma of one block row, every iteration consumes 8x2 pixels and produces 4 U and 4 V values
+	void ChromaRowSSE(const FColor* Src, int32 Width, int32 Height, int32 Y, uint8* DstU, uint8* DstV, int32 Step)
+	{
+		if (Y + 1 >= Height)
+		{
+			ChromaRowScalar(Src, Width, Height, Y, 0, DstU, DstV, Step);
+			return;
+		}
+		const FColor* Row0 = Src + Y * Width;
+		const FColor* Row1 = Row0 + Width;
+		const __m128i Offset = _mm_set1_epi16(128);
+		int32 x = 0;
+		for (; x + 8 <= Width; x += 8)
+		{
+			__m128i B, G, R;
+			Average2x2(Row0 + x, Row1 + x, B, G, R);
+			__m128i U = _mm_add_epi16(_mm_mullo_epi16(R, _mm_set1_epi16(-38)), _mm_mullo_epi16(G, _mm_set1_epi16(-74)));
+			U = _mm_add_epi16(U, _mm_mullo_epi16(B, _mm_set1_epi16(112)));
+			U = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(U, Offset), 8), Offset);
+			__m128i V = _mm_add_epi16(_mm_mullo_epi16(R, _mm_set1_epi16(112)), _mm_mullo_epi16(G, _mm_set1_epi16(-94)));
+			V = _mm_add_epi16(V, _mm_mullo_epi16(B, _mm_set1_epi16(-18)));
+			V = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(V, Offset), 8), Offset);
+
+			const int32 PackedU = _mm_cvtsi128_si32(_mm_packus_epi16(U, U));
+			const int32 PackedV = _mm_cvtsi128_si32(_mm_packus_epi16(V, V));
+			const int32 Block = x / 2;
+			if (Step == 1)
+			{
+				FMemory::Memcpy(DstU + Block, &PackedU, 4);
+				FMemory::Memcpy(DstV + Block, &PackedV, 4);
+			}
+			else
+			{
+				for (int32 k = 0; k < 4; ++k)
+				{
+					DstU[(Block + k) * Step] = (uint8)(PackedU >> (8 * k));
+					DstV[(Block + k) * Step] = (uint8)(PackedV >> (8 * k));
+				}
+			}
+		}
+		ChromaRowScalar(Src, Width, Height, Y, x / 2, DstU, DstV, Step);
+	}
+
+	/* AVX2 kernels */
+
+	VL_TARGET_AVX2 FORCEINLINE void SplitChannels256(__m256i Pixels, __m256i& B, __m256i& G, __m256i& R)
+	{
+		const __m256i ByteMask = _mm256_set1_epi32(0xFF);
+		B = _mm256_and_si256(Pixels, ByteMask);
+		G = _mm256_and_si256(_mm256_srli_epi32(Pixels, 8), ByteMask);
+		R = _mm256_and_si256(_mm256_srli_epi32(Pixels, 16), ByteMask);
+	}
+
+	VL_TARGET_AVX2 FORCEINLINE __m256i Luma16(__m256i B, __m256i G, __m256i R, const FLumaWeights& W)
+	{
+		__m256i Sum = _mm256_add_epi16(_mm256_mullo_epi16(B, _mm256_set1_epi16((int16)W.B)), _mm256_mullo_epi16(G, _mm256_set1_epi16((int16)W.G)));
+		Sum = _mm256_add_epi16(Sum, _mm256_mullo_epi16(R, _mm256_set1_epi16((int16)W.R)));
+		Sum = _mm256_srli_epi16(_mm256_add_epi16(Sum, _mm256_set1_epi16(128)), 8);
+		return _mm256_add_epi16(Sum, _mm256_set1_epi16((int16)W.Offset));
+	}
+
+	VL_TARGET_AVX2 void LumaAVX2(const FColor* Src, uint8* Dst, int32 NumPixels, const FLumaWeights& W)
+	{
+		// The packs work per 128 bit lane, this restores the pixel order afterwards
+		const __m256i Order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+		int32 i = 0;
+		for (; i + 32 <= NumPixels; i += 32)
+		{
+			__m256i B[4], G[4], R[4];
+			for (int32 k = 0; k < 4; ++k)
+			{
+				SplitChannels256(_mm256_loadu_si256((const __m256i*)(Src + i + 8 * k)), B[k], G[k], R[k]);
+			}
+			const __m256i Lo = Luma16(_mm256_packs_epi32(B[0], B[1]), _mm256_packs_epi32(G[0], G[1]), _mm256_packs_epi32(R[0], R[1]), W);
+			const __m256i Hi = Luma16(_mm256_packs_epi32(B[2], B[3]), _mm256_packs_epi32(G[2], G[3]), _mm256_packs_epi32(R[2], R[3]), W);
+			const __m256i Packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(Lo, Hi), Order);
+			_mm256_storeu_si256((__m256i*)(Dst + i), Packed);
+		}
+		LumaSSE(Src + i, Dst + i, NumPixels - i, W);
+	}
+
+	VL_TARGET_AVX2 void PlanarAVX2(const FColor* Src, uint8* DstR, uint8* DstG, uint8* DstB, int32 NumPixels)
+	{
+		const __m256i Order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+		int32 i = 0;
+		for (; i + 32 <= NumPixels; i += 32)
+		{
+			__m256i B[4], G[4], R[4];
+			for (int32 k = 0; k < 4; ++k)
+			{
+				SplitChannels256(_mm256_loadu_si256((const __m256i*)(Src + i + 8 * k)), B[k], G[k], R[k]);
+			}
+			const __m256i PackedR = _mm256_packus_epi16(_mm256_packs_epi32(R[0], R[1]), _mm256_packs_epi32(R[2], R[3]));
+			const __m256i PackedG = _mm256_packus_epi16(_mm256_packs_epi32(G[0], G[1]), _mm256_packs_epi32(G[2], G[3]));
+			const __m256i PackedB = _mm256_packus_epi16(_mm256_packs_epi32(B[0], B[1]), _mm256_packs_epi32(B[2], B[3]));
+			_mm256_storeu_si256((__m256i*)(DstR + i), _mm256_permutevar8x32_epi32(PackedR, Order));
+			_mm256_storeu_si256((__m256i*)(DstG + i), _mm256_permutevar8x32_epi32(PackedG, Order));
+			_mm256_storeu_si256((__m256i*)(DstB + i), _mm256_permutevar8x32_epi32(PackedB, Order));
+		}
+		PlanarSSE(Src + i, DstR + i, DstG + i, DstB + i, NumPixels - i);
+	}
+
+	VL_TARGET_AVX2 void RGB24AVX2(const FColor* Src, uint8* Dst, int32 NumPixels)
+	{
+		const __m256i Shuffle = _mm256_setr_epi8(
+			2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+			2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+		// Move the 12 valid bytes of the upper lane right behind the 12 of the lower lane
+		const __m256i Compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+		int32 i = 0;
+		// 24 valid bytes per 32 byte store
+		for (; i + 11 <= NumPixels; i += 8)
+		{
+			const __m256i Pixels = _mm256_loadu_si256((const __m256i*)(Src + i));
+			const __m256i Packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(Pixels, Shuffle), Compact);
+			_mm256_storeu_si256((__m256i*)(Dst + 3 * i), Packed);
+		}
+		RGB24SSSE3(Src + i, Dst + 3 * i, NumPixels - i);
+	}
+#endif
+
+	void Luma(const FColor* Src, uint8* Dst, int32 NumPixels, const FLumaWeights& W)
+	{
+#if VL_SIMD_X86
+		const EVisionSimdLevel Level = LoadSimdLevel();
+		if (Level == EVisionSimdLevel::AVX2)
+		{
+			LumaAVX2(Src, Dst, NumPixels, W);
+			return;
+		}
+		if (Level == EVisionSimdLevel::SSE)
+		{
+			LumaSSE(Src, Dst, NumPixels, W);
+			return;
+		}
+#endif
+		LumaScalar(Src, Dst, NumPixels, W);
+	}
+
+	void Luma(const FColor* Src, int32 Width, int32 Height, uint8* DstY)
+	{
+		Luma(Src, DstY, Width * Height, LumaWeights);
+	}
+
+	// Chroma planes for all block rows, Step is 1 for I420 and 2 for the interleaved NV12 plane
+	void Chroma(const FColor* Src, int32 Width, int32 Height, uint8* DstU, uint8* DstV, int32 Step)
+	{
+		const int32 ChromaWidth = (Width + 1) / 2;
+		const bool bSimd = LoadSimdLevel() != EVisionSimdLevel::Scalar;
+		for (int32 y = 0; y < Height; y += 2)
+		{
+			const int32 RowOffset = (y / 2) * ChromaWidth * Step;
+#if VL_SIMD_X86
+			if (bSimd)
+			{
+				ChromaRowSSE(Src, Width, Height, y, DstU + RowOffset, DstV + RowOffset, Step);
+				continue;
+			}
+#endif
+			ChromaRowScalar(Src, Width, Height, y, 0, DstU + RowOffset, DstV + RowOffset, Step);
+		}
+	}
+}
+
+int32 FPixelFormatConversion::GetConvertedSize(EVisionPixelFormat Format, int32 Width, int32 Height)
+{
+	const int32 NumPixels = Width * Height;
+	const int32 NumChroma = ((Width + 1) / 2) * ((Height + 1) / 2);
+	switch (Format)
+	{
+	case EVisionPixelFormat::BGRA8:
+		return NumPixels * 4;
+	case EVisionPixelFormat::RGB24:
+	case EVisionPixelFormat::PlanarRGB:
+		return NumPixels * 3;
+	case EVisionPixelFormat::Gray8:
+		return NumPixels;
+	case EVisionPixelFormat::YUV420:
+	case EVisionPixelFormat::NV12:
+		return NumPixels + 2 * NumChroma;
+	default:
+		return 0;
+	}
+}
+
+const TCHAR* FPixelFormatConversion::GetFileExtension(EVisionPixelFormat Format)
+{
+	switch (Format)
+	{
+	case EVisionPixelFormat::BGRA8:
+		return TEXT(".bgra");
+	case EVisionPixelFormat::RGB24:
+		return TEXT(".rgb");
+	case EVisionPixelFormat::Gray8:
+		return TEXT(".gray");
+	case EVisionPixelFormat::YUV420:
+		return TEXT(".yuv");
+	case EVisionPixelFormat::NV12:
+		return TEXT(".nv12");
+	case EVisionPixelFormat::PlanarRGB:
+		return TEXT(".rgbp");
+	default:
+		return TEXT(".raw");
+	}
+}
+
+bool FPixelFormatConversion::Convert(EVisionPixelFormat Format, const FColor* Src, int32 Width, int32 Height, TArray<uint8>& Out)
+{
+	if (Src == nullptr || Width <= 0 || Height <= 0)
+	{
+		return false;
+	}
+	const int32 NumPixels = Width * Height;
+	Out.SetNumUninitialized(GetConvertedSize(Format, Width, Height), false);
+	uint8* Dst = Out.GetData();
+
+	switch (Format)
+	{
+	case EVisionPixelFormat::BGRA8:
+		FMemory::Memcpy(Dst, Src, NumPixels * sizeof(FColor));
+		return true;
+	case EVisionPixelFormat::RGB24:
+		BGRAToRGB24(Src, Dst, NumPixels);
+		return true;
+	case EVisionPixelFormat::Gray8:
+		BGRAToGray8(Src, Dst, NumPixels);
+		return true;
+	case EVisionPixelFormat::PlanarRGB:
+		BGRAToPlanarRGB(Src, Dst, Dst + NumPixels, Dst + 2 * NumPixels, NumPixels);
+		return true;
+	case EVisionPixelFormat::YUV420:
+	{
+		const int32 NumChroma = ((Width + 1) / 2) * ((Height + 1) / 2);
+		BGRAToYUV420(Src, Width, Height, Dst, Dst + NumPixels, Dst + NumPixels + NumChroma);
+		return true;
+	}
+	case EVisionPixelFormat::NV12:
+		BGRAToNV12(Src, Width, Height, Dst, Dst + NumPixels);
+		return true;
+	default:
+		return false;
+	}
+}
+
+void FPixelFormatConversion::Resize(const FColor* Src, int32 Width, int32 Height, int32 OutWidth, int32 OutHeight, bool bNearest, TArray<FColor>& Out)
+{
+	Out.SetNumUninitialized(OutWidth * OutHeight, false);
+	FColor* Dst = Out.GetData();
+	for (int32 Y = 0; Y < OutHeight; ++Y)
+	{
+		// Source rows covered by this output row, at least one
+		const int32 Y0 = (int32)((int64)Y * Height / OutHeight);
+		const int32 Y1 = FMath::Max(Y0 + 1, (int32)((int64)(Y + 1) * Height / OutHeight));
+		for (int32 X = 0; X < OutWidth; ++X, ++Dst)
+		{
+			const int32 X0 = (int32)((int64)X * Width / OutWidth);
+			const int32 X1 = FMath::Max(X0 + 1, (int32)((int64)(X + 1) * Width / OutWidth));
+			if (bNearest)
+			{
+				*Dst = Src[((Y0 + Y1) / 2) * Width + (X0 + X1) / 2];
+				continue;
+			}
+			uint32 Sum[4] = { 0, 0, 0, 0 };
+			for (int32 SrcY = Y0; SrcY < Y1; ++SrcY)
+			{
+				const FColor* Row = Src + SrcY * Width;
+				for (int32 SrcX = X0; SrcX < X1; ++SrcX)
+				{
+					Sum[0] += Row[SrcX].B;
+					Sum[1] += Row[SrcX].G;
+					Sum[2] += Row[SrcX].R;
+					Sum[3] += Row[SrcX].A;
+				}
+			}
+			const uint32 Count = (Y1 - Y0) * (X1 - X0);
+			const uint32 Half = Count / 2;
+			Dst->B = (uint8)((Sum[0] + Half) / Count);
+			Dst->G = (uint8)((Sum[1] + Half) / Count);
+			Dst->R = (uint8)((Sum[2] + Half) / Count);
+			Dst->A = (uint8)((Sum[3] + Half) / Count);
+		}
+	}
+}
+
+void FPixelFormatConversion::BGRAToRGB24(const FColor* Src, uint8* Dst, int32 NumPixels)
+{
+#if VL_SIMD_X86
+	const EVisionSimdLevel Level = LoadSimdLevel();
+	if (Level == EVisionSimdLevel::AVX2)
+	{
+		RGB24AVX2(Src, Dst, NumPixels);
+		return;
+	}
+	if (Level == EVisionSimdLevel::SSE)
+	{
+		RGB24SSSE3(Src, Dst, NumPixels);
+		return;
+	}
+#endif
+	RGB24Scalar(Src, Dst, NumPixels);
+}
+
+void FPixelFormatConversion::BGRAToGray8(const FColor* Src, uint8* Dst, int32 NumPixels)
+{
+	Luma(Src, Dst, NumPixels, GrayWeights);
+}
+
+void FPixelFormatConversion::BGRAToPlanarRGB(const FColor* Src, uint8* DstR, uint8* DstG, uint8* DstB, int32 NumPixels)
+{
+#if VL_SIMD_X86
+	const EVisionSimdLevel Level = LoadSimdLevel();
+	if (Level == EVisionSimdLevel::AVX2)
+	{
+		PlanarAVX2(Src, DstR, DstG, DstB, NumPixels);
+		return;
+	}
+	if (Level == EVisionSimdLevel::SSE)
+	{
+		PlanarSSE(Src, DstR, DstG, DstB, NumPixels);
+		return;
+	}
+#endif
+	PlanarScalar(Src, DstR, DstG, DstB, NumPixels);
+}
+
+void FPixelFormatConversion::BGRAToYUV420(const FColor* Src, int32 Width, int32 Height, uint8* DstY, uint8* DstU, uint8* DstV)
+{
+	Luma(Src, Width, Height, DstY);
+	Chroma(Src, Width, Height, DstU, DstV, 1);
+}
+
+void FPixelFormatConversion::BGRAToNV12(const FColor* Src, int32 Width, int32 Height, uint8* DstY, uint8* DstUV)
+{
+	Luma(Src, Width, Height, DstY);
+	Chroma(Src, Width, Height, DstUV, DstUV + 1, 2);
+}
+
+EVisionSimdLevel FPixelFormatConversion::GetSimdLevel()
+{
+	return LoadSimdLevel();
+}
+
+void FPixelFormatConversion::SetMaxSimdLevel(EVisionSimdLevel Level)
+{
+	ActiveSimdLevel.store(FMath::Min(Level, SupportedSimdLevel), std::memory_order_relaxed);
+}
@@ -0,0 +1,93 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "PointCloudAsyncWorker.h"
+#include "RawDataAsyncWorker.h"
+#include "Runtime/Core/Public/Misc/FileHelper.h"
+#include "Runtime/Core/Public/GenericPlatform/GenericPlatformFile.h"
+#include "Runtime/Core/Public/HAL/PlatformFilemanager.h"
+
+FThreadSafeCounter FPointCloudAsyncWorker::NumInFlight;
+
+FPointCloudAsyncWorker::FPointCloudAsyncWorker(const TArray<FFloat16Color>& Depth_init, const TArray<FColor>& Colors_init, const TArray<FColor>& Mask_init,
+	const TMap<uint32, uint16>& ColorToLabel_init, int32 Width_init, int32 Height_init, float FieldOfView_init,
+	const FTransform& CameraPose_init, uint64 FrameNumber_init, FDateTime Stamp, const FPointCloudSettings& Settings_init)
+{
+	Depth = Depth_init;
+	Colors = Colors_init;
+	Mask = Mask_init;
+	ColorToLabel = ColorToLabel_init;
+	Width = Width_init;
+	Height = Height_init;
+	FieldOfView = FieldOfView_init;
+	CameraPose = CameraPose_init;
+	FrameNumber = FrameNumber_init;
+	TimeStamp = Stamp;
+	Settings = Settings_init;
+	NumInFlight.Increment();
+}
+
+FPointCloudAsyncWorker::~FPointCloudAsyncWorker()
+{
+	NumInFlight.Decrement();
+}
+
+int32 FPointCloudAsyncWorker::GetNumInFlight()
+{
+	return NumInFlight.GetValue();
+}
+
+void FPointCloudAsyncWorker::DoWork()
+{
+	const int32 NumPixels = Width * Height;
+	if (NumPixels <= 0 || Depth.Num() != NumPixels)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Depth frame %llu has %d pixels, expected %d, no point cloud written"), FrameNumber, Depth.Num(), NumPixels);
+		return;
+	}
+
+	const FPointCloudCamera Camera = FPointCloudCamera::FromPose(CameraPose, FieldOfView, Width, Height);
+	FPointCloud Points;
+	FPointCloudGenerator::BackProject((const uint16*)Depth.GetData(), Width, Height, Camera, Settings.MaxDepth, Points);
+	if (Colors.Num() == NumPixels)
+	{
+		FPointCloudGenerator::AttachColors(Colors.GetData(), Points);
+	}
+	if (Mask.Num() == NumPixels && ColorToLabel.Num() > 0)
+	{
+		FPointCloudGenerator::AttachLabels(Mask.GetData(), ColorToLabel, Points);
+	}
+
+	FPointCloud Downsampled;
+	const FPointCloud* Cloud = &Points;
+	if (Settings.VoxelSize > 0.0f)
+	{
+		FPointCloudGenerator::VoxelDownsample(Points, Settings.VoxelSize, Downsampled);
+		Cloud = &Downsampled;
+	}
+
+	TArray<uint8> Data;
+	FString Extension;
+	if (Settings.Format == EPointCloudFormat::Compact)
+	{
+		const FQuat Rotation = CameraPose.GetRotation();
+		const float RotationXYZW[4] = { Rotation.X, Rotation.Y, Rotation.Z, Rotation.W };
+		const int64 TimeStampNs = (TimeStamp - FDateTime(1970, 1, 1)).GetTicks() * 100;
+		FPointCloudGenerator::SerializeCompact(*Cloud, FrameNumber, TimeStampNs, Camera, RotationXYZW, Settings.VoxelSize, Settings.MaxDepth, Data);
+		Extension = TEXT(".vlpc");
+	}
+	else
+	{
+		FPointCloudGenerator::SerializePLY(*Cloud, Data);
+		Extension = TEXT(".ply");
+	}
+
+	FString FileDir = FPaths::ProjectSavedDir() + "/" + "viewport";
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	if (!PlatformFile.DirectoryExists(*FileDir))
+	{
+		PlatformFile.CreateDirectoryTree(*FileDir);
+	}
+	const FString FileName = TEXT("POINTCLOUD") + RawDataAsyncWorker::FormatTimeStamp(TimeStamp) + Extension;
+	UE_LOG(LogTemp, Log, TEXT("Point cloud of frame %llu: %d of %d points written"), FrameNumber, Cloud->Num(), Points.Num());
+	FSessionJournal::Save(Settings.Writer, Settings.Journal, MoveTemp(Data), FileDir, FileName, FrameNumber, TEXT("POINTCLOUD"));
+}
@@ -0,0 +1,436 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "PointCloudGenerator.h"
+#include "VisionLoggerSimd.h"
+
+namespace
+{
+	// Voxel accumulator of the downsampler
+	struct FVoxelCell
+	{
+		uint64 Key;
+		float SumX;
+		float SumY;
+		float SumZ;
+		uint32 SumR;
+		uint32 SumG;
+		uint32 SumB;
+		uint32 Count;
+		uint16 Label;
+	};
+
+	// Voxel coordinates are offset into 21 bits per axis
+	const int64 VoxelOffset = 1 << 20;
+	const int64 VoxelMask = (1 << 21) - 1;
+
+	FORCEINLINE uint64 VoxelKey(float X, float Y, float Z, float InvVoxelSize)
+	{
+		const int64 IX = FMath::Clamp<int64>((int64)FMath::FloorToFloat(X * InvVoxelSize) + VoxelOffset, 0, VoxelMask);
+		const int64 IY = FMath::Clamp<int64>((int64)FMath::FloorToFloat(Y * InvVoxelSize) + VoxelOffset, 0, VoxelMask);
+		const int64 IZ = FMath::Clamp<int64>((int64)FMath::FloorToFloat(Z * InvVoxelSize) + VoxelOffset, 0, VoxelMask);
+		return (uint64)IX | ((uint64)IY << 21) | ((uint64)IZ << 42);
+	}
+
+	FORCEINLINE uint32 HashVoxel(uint64 Key, int32 Bits)
+	{
+		return (uint32)((Key * 0x9E3779B97F4A7C15ull) >> (64 - Bits));
+	}
+
+	template <typename T>
+	void AppendValue(TArray<uint8>& Data, const T& Value)
+	{
+		const int32 Offset = Data.AddUninitialized(sizeof(T));
+		FMemory::Memcpy(Data.GetData() + Offset, &Value, sizeof(T));
+	}
+
+	void AppendText(TArray<uint8>& Data, const char* Text)
+	{
+		const int32 Length = FCStringAnsi::Strlen(Text);
+		const int32 Offset = Data.AddUninitialized(Length);
+		FMemory::Memcpy(Data.GetData() + Offset, Text, Length);
+	}
+
+	/**
+	 * Back-project one image row into the X/Y/Z row buffers, RowBase is the row's ray direction without
+	 * horizontal offset, RayX the precomputed horizontal offsets of the columns.
+	 */
+	void BackProjectRow(const uint16* DepthRGBAHalf, int32 Width, const float* RayX, const float RowBase[3], const FPointCloudCamera& Camera,
+		float* OutDepth, float* OutX, float* OutY, float* OutZ)
+	{
+		int32 x = 0;
+#if VL_SIMD_X86
+		const __m128 BaseX = _mm_set1_ps(RowBase[0]);
+		const __m128 BaseY = _mm_set1_ps(RowBase[1]);
+		const __m128 BaseZ = _mm_set1_ps(RowBase[2]);
+		const __m128 RightX = _mm_set1_ps(Camera.Right[0]);
+		const __m128 RightY = _mm_set1_ps(Camera.Right[1]);
+		const __m128 RightZ = _mm_set1_ps(Camera.Right[2]);
+		const __m128 OriginX = _mm_set1_ps(Camera.Origin[0]);
+		const __m128 OriginY = _mm_set1_ps(Camera.Origin[1]);
+		const __m128 OriginZ = _mm_set1_ps(Camera.Origin[2]);
+		for (; x + 4 <= Width; x += 4)
+		{
+			// Every pixel is 4 halves (8 bytes), pick the R half of 4 pixels
+			const __m128 PixelsA = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(DepthRGBAHalf + 4 * x)));
+			const __m128 PixelsB = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(DepthRGBAHalf + 4 * x + 8)));
+			const __m128i RG = _mm_castps_si128(_mm_shuffle_ps(PixelsA, PixelsB, _MM_SHUFFLE(2, 0, 2, 0)));
+			const __m128 Depth = VLHalfToFloat4(_mm_and_si128(RG, _mm_set1_epi32(0xFFFF)));
+
+			const __m128 Ray = _mm_loadu_ps(RayX + x);
+			const __m128 DirX = _mm_add_ps(BaseX, _mm_mul_ps(Ray, RightX));
+			const __m128 DirY = _mm_add_ps(BaseY, _mm_mul_ps(Ray, RightY));
+			const __m128 DirZ = _mm_add_ps(BaseZ, _mm_mul_ps(Ray, RightZ));
+			_mm_storeu_ps(OutDepth + x, Depth);
+			_mm_storeu_ps(OutX + x, _mm_add_ps(OriginX, _mm_mul_ps(Depth, DirX)));
+			_mm_storeu_ps(OutY + x, _mm_add_ps(OriginY, _mm_mul_ps(Depth, DirY)));
+			_mm_storeu_ps(OutZ + x, _mm_add_ps(OriginZ, _mm_mul_ps(Depth, DirZ)));
+		}
+#endif
+		for (; x < Width; ++x)
+		{
+			const float Depth = FPointCloudGenerator::HalfToFloat(DepthRGBAHalf[4 * x]);
+			OutDepth[x] = Depth;
+			OutX[x] = Camera.Origin[0] + Depth * (RowBase[0] + RayX[x] * Camera.Right[0]);
+			OutY[x] = Camera.Origin[1] + Depth * (RowBase[1] + RayX[x] * Camera.Right[1]);
+			OutZ[x] = Camera.Origin[2] + Depth * (RowBase[2] + RayX[x] * Camera.Right[2]);
+		}
+	}
+}
+
+FPointCloudCamera FPointCloudCamera::FromPose(const FTransform& Pose, float FOVDegrees, int32 Width, int32 Height)
+{
+	FPointCloudCamera Camera;
+	const FVector Location = Pose.GetLocation();
+	const FVector Forward = Pose.GetUnitAxis(EAxis::X);
+	const FVector Right = Pose.GetUnitAxis(EAxis::Y);
+	const FVector Up = Pose.GetUnitAxis(EAxis::Z);
+	for (int32 i = 0; i < 3; ++i)
+	{
+		Camera.Origin[i] = Location[i];
+		Camera.Forward[i] = Forward[i];
+		Camera.Right[i] = Right[i];
+		Camera.Up[i] = Up[i];
+	}
+	Camera.FocalLength = Width * 0.5f / FMath::Tan(FMath::DegreesToRadians(FOVDegrees) * 0.5f);
+	Camera.CenterX = Width * 0.5f;
+	Camera.CenterY = Height * 0.5f;
+	return Camera;
+}
+
+float FPointCloudCamera::GetMaxRayLength() const
+{
+	const float CornerX = CenterX / FocalLength;
+	const float CornerY = CenterY / FocalLength;
+	return FMath::Sqrt(1.0f + CornerX * CornerX + CornerY * CornerY);
+}
+
+void FPointCloud::Reset()
+{
+	X.Reset();
+	Y.Reset();
+	Z.Reset();
+	Colors.Reset();
+	Labels.Reset();
+	PixelIndices.Reset();
+}
+
+float FPointCloudGenerator::HalfToFloat(uint16 Half)
+{
+	const uint32 ShiftedExp = 0x7C00 << 13;
+	uint32 Bits = (Half & 0x7FFF) << 13;
+	const uint32 Exp = Bits & ShiftedExp;
+	Bits += (127 - 15) << 23;
+	float Result;
+	if (Exp == ShiftedExp)
+	{
+		// Inf or nan
+		Bits += (128 - 16) << 23;
+		FMemory::Memcpy(&Result, &Bits, 4);
+	}
+	else if (Exp == 0)
+	{
+		// Zero or denormal, renormalize through a float subtraction
+		Bits += 1 << 23;
+		const uint32 MagicBits = 113 << 23;
+		float Magic;
+		FMemory::Memcpy(&Result, &Bits, 4);
+		FMemory::Memcpy(&Magic, &MagicBits, 4);
+		Result -= Magic;
+	}
+	else
+	{
+		FMemory::Memcpy(&Result, &Bits, 4);
+	}
+	uint32 ResultBits;
+	FMemory::Memcpy(&ResultBits, &Result, 4);
+	ResultBits |= (uint32)(Half & 0x8000) << 16;
+	FMemory::Memcpy(&Result, &ResultBits, 4);
+	return Result;
+}
+
+void FPointCloudGenerator::BackProject(const uint16* DepthRGBAHalf, int32 Width, int32 Height, const FPointCloudCamera& Camera, float MaxDepth, FPointCloud& Out)
+{
+	Out.Reset();
+	if (DepthRGBAHalf == nullptr || Width <= 0 || Height <= 0)
+	{
+		return;
+	}
+	const int32 NumPixels = Width * Height;
+	Out.X.Reserve(NumPixels);
+	Out.Y.Reserve(NumPixels);
+	Out.Z.Reserve(NumPixels);
+	Out.PixelIndices.Reserve(NumPixels);
+
+	// Horizontal ray offset of every column, shared by all rows
+	const float InvFocal = 1.0f / Camera.FocalLength;
+	TArray<float> RayX;
+	RayX.SetNumUninitialized(Width);
+	for (int32 x = 0; x < Width; ++x)
+	{
+		RayX[x] = (x + 0.5f - Camera.CenterX) * InvFocal;
+	}
+
+	TArray<float> RowBuffer;
+	RowBuffer.SetNumUninitialized(4 * Width);
+	float* RowDepth = RowBuffer.GetData();
+	float* RowX = RowDepth + Width;
+	float* RowY = RowX + Width;
+	float* RowZ = RowY + Width;
+	for (int32 y = 0; y < Height; ++y)
+	{
+		// Image rows go down, the camera up axis goes up
+		const float RayY = -(y + 0.5f - Camera.CenterY) * InvFocal;
+		const float RowBase[3] =
+		{
+			Camera.Forward[0] + RayY * Camera.Up[0],
+			Camera.Forward[1] + RayY * Camera.Up[1],
+			Camera.Forward[2] + RayY * Camera.Up[2]
+		};
+		BackProjectRow(DepthRGBAHalf + 4 * y * Width, Width, RayX.GetData(), RowBase, Camera, RowDepth, RowX, RowY, RowZ);
+
+		for (int32 x = 0; x < Width; ++x)
+		{
+			// Also rejects nan, sky pixels are cut off by MaxDepth
+			if (RowDepth[x] > 0.0f && RowDepth[x] <= MaxDepth)
+			{
+				Out.X.Add(RowX[x]);
+				Out.Y.Add(RowY[x]);
+				Out.Z.Add(RowZ[x]);
+				Out.PixelIndices.Add(y * Width + x);
+			}
+		}
+	}
+}
+
+void FPointCloudGenerator::AttachColors(const FColor* Image, FPointCloud& Cloud)
+{
+	Cloud.Colors.SetNumUninitialized(Cloud.PixelIndices.Num());
+	for (int32 i = 0; i < Cloud.PixelIndices.Num(); ++i)
+	{
+		Cloud.Colors[i] = Image[Cloud.PixelIndices[i]];
+	}
+}
+
+void FPointCloudGenerator::AttachLabels(const FColor* Mask, const TMap<uint32, uint16>& ColorToLabel, FPointCloud& Cloud)
+{
+	Cloud.Labels.SetNumUninitialized(Cloud.PixelIndices.Num());
+	uint32 LastColor = 0;
+	uint16 LastLabel = PointCloudNoLabel;
+	bool bHasLast = false;
+	for (int32 i = 0; i < Cloud.PixelIndices.Num(); ++i)
+	{
+		// Neighbouring pixels mostly share the object, skip the map lookup for runs of the same color
+		FColor Color = Mask[Cloud.PixelIndices[i]];
+		Color.A = 255;
+		const uint32 Packed = Color.DWColor();
+		if (!bHasLast || Packed != LastColor)
+		{
+			const uint16* Label = ColorToLabel.Find(Packed);
+			LastLabel = Label ? *Label : PointCloudNoLabel;
+			LastColor = Packed;
+			bHasLast = true;
+		}
+		Cloud.Labels[i] = LastLabel;
+	}
+}
+
+void FPointCloudGenerator::VoxelDownsample(const FPointCloud& In, float VoxelSize, FPointCloud& Out)
+{
+	Out.Reset();
+	const int32 NumPoints = In.Num();
+	if (NumPoints == 0 || VoxelSize <= 0.0f)
+	{
+		Out.X = In.X;
+		Out.Y = In.Y;
+		Out.Z = In.Z;
+		Out.Colors = In.Colors;
+		Out.Labels = In.Labels;
+		return;
+	}
+	const bool bColors = In.Colors.Num() == NumPoints;
+	const bool bLabels = In.Labels.Num() == NumPoints;
+	const float InvVoxelSize = 1.0f / VoxelSize;
+
+	// Open addressing table with at least twice as many slots as points
+	int32 Bits = 4;
+	while ((1 << Bits) < 2 * NumPoints)
+	{
+		++Bits;
+	}
+	const uint32 SlotMask = (1u << Bits) - 1;
+	TArray<int32> Slots;
+	Slots.Init(INDEX_NONE, 1 << Bits);
+	TArray<FVoxelCell> Cells;
+	Cells.Reserve(NumPoints / 4);
+
+	for (int32 i = 0; i < NumPoints; ++i)
+	{
+		const uint64 Key = VoxelKey(In.X[i], In.Y[i], In.Z[i], InvVoxelSize);
+		uint32 Slot = HashVoxel(Key, Bits);
+		while (Slots[Slot] != INDEX_NONE && Cells[Slots[Slot]].Key != Key)
+		{
+			Slot = (Slot + 1) & SlotMask;
+		}
+		if (Slots[Slot] == INDEX_NONE)
+		{
+			FVoxelCell NewCell;
+			FMemory::Memzero(NewCell);
+			NewCell.Key = Key;
+			NewCell.Label = bLabels ? In.Labels[i] : PointCloudNoLabel;
+			Slots[Slot] = Cells.Add(NewCell);
+		}
+		FVoxelCell& Cell = Cells[Slots[Slot]];
+		Cell.SumX += In.X[i];
+		Cell.SumY += In.Y[i];
+		Cell.SumZ += In.Z[i];
+		if (bColors)
+		{
+			Cell.SumR += In.Colors[i].R;
+			Cell.SumG += In.Colors[i].G;
+			Cell.SumB += In.Colors[i].B;
+		}
+		++Cell.Count;
+	}
+
+	const int32 NumCells = Cells.Num();
+	Out.X.SetNumUninitialized(NumCells);
+	Out.Y.SetNumUninitialized(NumCells);
+	Out.Z.SetNumUninitialized(NumCells);
+	if (bColors)
+	{
+		Out.Colors.SetNumUninitialized(NumCells);
+	}
+	if (bLabels)
+	{
+		Out.Labels.SetNumUninitialized(NumCells);
+	}
+	for (int32 i = 0; i < NumCells; ++i)
+	{
+		const FVoxelCell& Cell = Cells[i];
+		const float InvCount = 1.0f / Cell.Count;
+		Out.X[i] = Cell.SumX * InvCount;
+		Out.Y[i] = Cell.SumY * InvCount;
+		Out.Z[i] = Cell.SumZ * InvCount;
+		if (bColors)
+		{
+			Out.Colors[i] = FColor((uint8)((Cell.SumR + Cell.Count / 2) / Cell.Count), (uint8)((Cell.SumG + Cell.Count / 2) / Cell.Count), (uint8)((Cell.SumB + Cell.Count / 2) / Cell.Count), 255);
+		}
+		if (bLabels)
+		{
+			Out.Labels[i] = Cell.Label;
+		}
+	}
+}
+
+void FPointCloudGenerator::SerializePLY(const FPointCloud& Cloud, TArray<uint8>& OutData)
+{
+	const int32 NumPoints = Cloud.Num();
+	const bool bColors = Cloud.Colors.Num() == NumPoints && NumPoints > 0;
+	const bool bLabels = Cloud.Labels.Num() == NumPoints && NumPoints > 0;
+	const int32 PointSize = 12 + (bColors ? 3 : 0) + (bLabels ? 2 : 0);
+
+	char Header[512];
+	FCStringAnsi::Snprintf(Header, sizeof(Header), "ply\nformat binary_little_endian 1.0\nelement vertex %d\nproperty float x\nproperty float y\nproperty float z\n%s%send_header\n",
+		NumPoints,
+		bColors ? "property uchar red\nproperty uchar green\nproperty uchar blue\n" : "",
+		bLabels ? "property ushort label\n" : "");
+
+	OutData.Reset();
+	AppendText(OutData, Header);
+	int32 Offset = OutData.AddUninitialized(NumPoints * PointSize);
+	uint8* Dst = OutData.GetData() + Offset;
+	for (int32 i = 0; i < NumPoints; ++i)
+	{
+		FMemory::Memcpy(Dst, &Cloud.X[i], 4);
+		FMemory::Memcpy(Dst + 4, &Cloud.Y[i], 4);
+		FMemory::Memcpy(Dst + 8, &Cloud.Z[i], 4);
+		Dst += 12;
+		if (bColors)
+		{
+			Dst[0] = Cloud.Colors[i].R;
+			Dst[1] = Cloud.Colors[i].G;
+			Dst[2] = Cloud.Colors[i].B;
+			Dst += 3;
+		}
+		if (bLabels)
+		{
+			FMemory::Memcpy(Dst, &Cloud.Labels[i], 2);
+			Dst += 2;
+		}
+	}
+}
+
+void FPointCloudGenerator::SerializeCompact(const FPointCloud& Cloud, uint64 FrameNumber, int64 TimeStampNs, const FPointCloudCamera& Camera,
+	const float Rotation[4], float VoxelSize, float MaxDepth, TArray<uint8>& OutData)
+{
+	const int32 NumPoints = Cloud.Num();
+	const bool bColors = Cloud.Colors.Num() == NumPoints && NumPoints > 0;
+	const bool bLabels = Cloud.Labels.Num() == NumPoints && NumPoints > 0;
+
+	// 1 cm steps as long as the farthest point still fits into 16 bit, off axis points are farther than their plane depth
+	const float Quantization = FMath::Max(1.0f, FMath::CeilToFloat(MaxDepth * Camera.GetMaxRayLength() / 32767.0f));
+	const float InvQuantization = 1.0f / Quantization;
+
+	OutData.Reset();
+	AppendValue<uint32>(OutData, 0x43504C56);
+	AppendValue<uint16>(OutData, 1);
+	AppendValue<uint16>(OutData, (bColors ? 1 : 0) | (bLabels ? 2 : 0));
+	AppendValue<uint32>(OutData, NumPoints);
+	AppendValue<float>(OutData, Quantization);
+	AppendValue<uint64>(OutData, FrameNumber);
+	AppendValue<int64>(OutData, TimeStampNs);
+	for (int32 i = 0; i < 3; ++i)
+	{
+		AppendValue<float>(OutData, Camera.Origin[i]);
+	}
+	for (int32 i = 0; i < 4; ++i)
+	{
+		AppendValue<float>(OutData, Rotation[i]);
+	}
+	AppendValue<float>(OutData, VoxelSize);
+
+	int32 Offset = OutData.AddUninitialized(NumPoints * 6);
+	int16* Positions = (int16*)(OutData.GetData() + Offset);
+	for (int32 i = 0; i < NumPoints; ++i)
+	{
+		Positions[3 * i + 0] = (int16)FMath::Clamp(FMath::RoundToInt((Cloud.X[i] - Camera.Origin[0]) * InvQuantization), -32767, 32767);
+		Positions[3 * i + 1] = (int16)FMath::Clamp(FMath::RoundToInt((Cloud.Y[i] - Camera.Origin[1]) * InvQuantization), -32767, 32767);
+		Positions[3 * i + 2] = (int16)FMath::Clamp(FMath::RoundToInt((Cloud.Z[i] - Camera.Origin[2]) * InvQuantization), -32767, 32767);
+	}
+	if (bColors)
+	{
+		Offset = OutData.AddUninitialized(NumPoints * 3);
+		uint8* Colors = OutData.GetData() + Offset;
+		for (int32 i = 0; i < NumPoints; ++i)
+		{
+			Colors[3 * i + 0] = Cloud.Colors[i].R;
+			Colors[3 * i + 1] = Cloud.Colors[i].G;
+			Colors[3 * i + 2] = Cloud.Colors[i].B;
+		}
+	}
+	if (bLabels)
+	{
+		Offset = OutData.AddUninitialized(NumPoints * 2);
+		FMemory::Memcpy(OutData.GetData() + Offset, Cloud.Labels.GetData(), NumPoints * 2);
+	}
+}
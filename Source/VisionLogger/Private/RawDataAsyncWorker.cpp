@@ -4,9 +4,12 @@
 #include "Runtime/Core/Public/Misc/FileHelper.h"
 #include "Runtime/Core/Public/GenericPlatform/GenericPlatformFile.h"
 #include "Runtime/Core/Public/HAL/PlatformFilemanager.h"
+#include "Runtime/Core/Public/Misc/ScopeExit.h"
 
+FThreadSafeCounter RawDataAsyncWorker::NumInFlight;
 
-RawDataAsyncWorker::RawDataAsyncWorker(TArray<FColor>& Image_init, TSharedPtr<IImageWrapper>& ImageWrapperRef, FDateTime Stamp, FString Name, int Width_init, int Height_init)
+RawDataAsyncWorker::RawDataAsyncWorker(TArray<FColor>& Image_init, TSharedPtr<IImageWrapper>& ImageWrapperRef, FDateTime Stamp, FString Name, int Width_init, int Height_init,
+	const FVisionStreamOutput& Output_init, const FVisionFrameInfo& FrameInfo_init)
 {
 	Width = Width_init;
 	Height = Height_init;
@@ -14,14 +17,22 @@ RawDataAsyncWorker::RawDataAsyncWorker(TArray<FColor>& Image_init, TSharedPtr<II
 	ImageName = Name;
 	ImageWrapper= ImageWrapperRef;
     Image= Image_init;
-	
+	Output = Output_init;
+	FrameInfo = FrameInfo_init;
+	NumInFlight.Increment();
 }
 
 RawDataAsyncWorker::~RawDataAsyncWorker()
 {
+	NumInFlight.Decrement();
 	UE_LOG(LogTemp, Warning, TEXT("Task Deleted"));
 }
 
+int32 RawDataAsyncWorker::GetNumInFlight()
+{
+	return NumInFlight.GetValue();
+}
+
 TStatId RawDataAsyncWorker::GetStatId() const
 {
 	return TStatId();
@@ -41,28 +52,155 @@ void RawDataAsyncWorker::SetLogToImage()
 {
 }
 
-void RawDataAsyncWorker::SaveImage(TArray<FColor>& image, TSharedPtr<IImageWrapper>& ImageWrapper, FDateTime Stamp, FString ImageName, int Width, int Height)
+FString RawDataAsyncWorker::FormatTimeStamp(const FDateTime& Stamp)
 {
-	// get the time stamp
-	FString TimeStamp = FString::FromInt(Stamp.GetYear()) + "_" + FString::FromInt(Stamp.GetMonth()) + "_" + FString::FromInt(Stamp.GetDay())
+	return FString::FromInt(Stamp.GetYear()) + "_" + FString::FromInt(Stamp.GetMonth()) + "_" + FString::FromInt(Stamp.GetDay())
 		+ "_" + FString::FromInt(Stamp.GetHour()) + "_" + FString::FromInt(Stamp.GetMinute()) + "_" + FString::FromInt(Stamp.GetSecond()) + "_" +
 		FString::FromInt(Stamp.GetMillisecond());
+}
+
+void RawDataAsyncWorker::SaveImage(TArray<FColor>& image, TSharedPtr<IImageWrapper>& ImageWrapper, FDateTime Stamp, FString ImageName, int Width, int Height)
+{
+	// get the time stamp
+	FString TimeStamp = FormatTimeStamp(Stamp);
+	const double StartTime = FPlatformTime::Seconds();
 	UE_LOG(LogTemp, Warning, TEXT("Height %i,Width %i"), Height, Width);
-	// initial Image Wrapper
-	TArray<uint8> ImgData;
-	ImageWrapper->SetRaw(image.GetData(), image.GetAllocatedSize(), Width, Height, ERGBFormat::BGRA, 8);
-	ImgData = ImageWrapper->GetCompressed();
+	const EVisionPixelFormat PixelFormat = Output.PixelFormat;
+	TSharedPtr<FFrameChangeDetector, ESPMode::ThreadSafe>& ChangeDetector = Output.ChangeDetector;
 
+	// Convert at most once, both the live feed and the disk output use the converted layout
+	TArray<uint8> Converted;
+	bool bConverted = PixelFormat == EVisionPixelFormat::BGRA8;
+	auto ConvertOnce = [&]()
+	{
+		if (!bConverted)
+		{
+			bConverted = FPixelFormatConversion::Convert(PixelFormat, image.GetData(), Width, Height, Converted);
+			if (!bConverted)
+			{
+				UE_LOG(LogTemp, Error, TEXT("Could not convert %s to the requested pixel format"), *ImageName);
+			}
+		}
+		return bConverted;
+	};
 
+	if (Output.SharedMemorySink.IsValid() && ConvertOnce())
+	{
+		const bool bRaw = PixelFormat == EVisionPixelFormat::BGRA8;
+		const void* Pixels = bRaw ? (const void*)image.GetData() : (const void*)Converted.GetData();
+		const int64 NumBytes = bRaw ? image.Num() * sizeof(FColor) : Converted.Num();
+		Output.SharedMemorySink->Publish(Output.StreamId, FrameInfo.FrameNumber, Stamp, FrameInfo.CameraPose, (uint32)PixelFormat, Width, Height, Pixels, NumBytes);
+	}
+
+	if (!Output.bSaveToDisk)
+	{
+		return;
+	}
 
-	//save image in local disk as image
-	FString FileName = ImageName + TimeStamp + ".jpg";
 	FString FileDir = FPaths::ProjectSavedDir() + "/" + "viewport";
 	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
 	if (!PlatformFile.DirectoryExists(*FileDir)) {
 		PlatformFile.CreateDirectoryTree(*FileDir);
 
 	}
-	FString AbsolutePath = FileDir + "/" + FileName;
-	FFileHelper::SaveArrayToFile(ImgData, *AbsolutePath);
+
+	// Replace near duplicates of the reference frame by a repeat record while the camera does not move
+	bool bWriteIssued = false;
+	if (ChangeDetector.IsValid())
+	{
+		TArray<uint16> Signature;
+		FFrameChangeDetector::ComputeSignature(image.GetData(), Width, Height, Signature);
+		if (ChangeDetector->RecordIfRepeat(FrameInfo.FrameNumber, Signature, FrameInfo.bPoseStatic, TimeStamp, FileDir))
+		{
+			return;
+		}
+	}
+	ON_SCOPE_EXIT
+	{
+		// Frames repeating this one must not point to a file that was never written, issued writes report from OnWritten
+		if (ChangeDetector.IsValid() && !bWriteIssued)
+		{
+			ChangeDetector->RecordFailed(FrameInfo.FrameNumber);
+		}
+	};
+
+	// Rate control saves the frame smaller, the live feed and the change detection keep the full frame
+	if (FrameInfo.ResolutionScale < 1.0f)
+	{
+		const int32 ScaledWidth = FMath::Max(1, FMath::RoundToInt(Width * FrameInfo.ResolutionScale));
+		const int32 ScaledHeight = FMath::Max(1, FMath::RoundToInt(Height * FrameInfo.ResolutionScale));
+		TArray<FColor> Scaled;
+		FPixelFormatConversion::Resize(image.GetData(), Width, Height, ScaledWidth, ScaledHeight, Output.bExactPixels, Scaled);
+		image = MoveTemp(Scaled);
+		Width = ScaledWidth;
+		Height = ScaledHeight;
+		Converted.Reset();
+		bConverted = PixelFormat == EVisionPixelFormat::BGRA8;
+	}
+
+	// Color layouts share the encoders of the typed streams, other layouts are stored raw
+	FVisionEncodeSettings Settings;
+	Settings.Codec = Output.Codec;
+	Settings.PngLevel = Output.PngLevel;
+	Settings.EncodeStripes = Output.EncodeStripes;
+	Settings.JpegQuality = FrameInfo.JpegQuality;
+	Settings.ImageWrapper = ImageWrapper.Get();
+	TArray<uint8> ImgData;
+	FString Suffix;
+	if (PixelFormat == EVisionPixelFormat::BGRA8)
+	{
+		if (!TVisionStreamTraits<FColor>::Encode(image.GetData(), Width, Height, Settings, ImgData, Suffix))
+		{
+			return;
+		}
+	}
+	else
+	{
+		if (!ConvertOnce())
+		{
+			return;
+		}
+		if (PixelFormat == EVisionPixelFormat::Gray8)
+		{
+			if (!TVisionStreamTraits<uint8>::Encode(Converted.GetData(), Width, Height, Settings, ImgData, Suffix))
+			{
+				return;
+			}
+		}
+		else
+		{
+			// Layouts without codec support are stored raw, the size is part of the name
+			ImgData = MoveTemp(Converted);
+			Suffix = FVisionEncodeSettings::GetRawSuffix(FPixelFormatConversion::GetFileExtension(PixelFormat), Width, Height);
+		}
+	}
+	const FString FileName = ImageName + TimeStamp + Suffix;
+
+	//save image in local disk as image
+	const int64 NumBytes = ImgData.Num();
+	TFunction<void(bool)> OnWritten = FCaptureRateController::ReportEncoded(Output.RateController, StartTime, NumBytes);
+	if (ChangeDetector.IsValid())
+	{
+		// Asynchronous backends complete the write later, repeats are only recorded once the file exists
+		TSharedPtr<FFrameChangeDetector, ESPMode::ThreadSafe> Detector = ChangeDetector;
+		const uint64 FrameNumber = FrameInfo.FrameNumber;
+		TFunction<void(bool)> ReportWrite = MoveTemp(OnWritten);
+		OnWritten = [Detector, FrameNumber, FileName, NumBytes, ReportWrite](bool bSuccess)
+		{
+			if (ReportWrite)
+			{
+				ReportWrite(bSuccess);
+			}
+			if (bSuccess)
+			{
+				Detector->RecordWritten(FrameNumber, FileName, NumBytes);
+			}
+			else
+			{
+				Detector->RecordFailed(FrameNumber);
+			}
+		};
+	}
+	bWriteIssued = true;
+	FSessionJournal::Save(Output.Writer, Output.Journal, MoveTemp(ImgData), FileDir, FileName, FrameInfo.GetJournalFrame(), ImageName, MoveTemp(OnWritten));
 }
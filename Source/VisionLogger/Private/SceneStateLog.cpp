@@ -0,0 +1,375 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "SceneStateLog.h"
+#include "GameFramework/Actor.h"
+#include "HAL/FileManager.h"
+#include "Async/Async.h"
+#include "vl_scene_state_format.h"
+
+const float FSceneStateWriter::LocationStep = 0.01f;
+const float FSceneStateWriter::RotationStep = 1.0e-6f;
+const float FSceneStateWriter::ScaleStep = 1.0e-4f;
+
+struct FSceneStateBlock
+{
+	TArray<uint64> FrameNumbers;
+	TArray<int64> TimeStamps;
+
+	// Changed actors in order of their first change and their components, frame major
+	TArray<int32> ActorIds;
+	TArray<TArray<int32>> Values;
+};
+
+namespace
+{
+	void AppendVarint(TArray<uint8>& Data, uint64 Value)
+	{
+		while (Value >= 0x80)
+		{
+			Data.Add((uint8)(Value | 0x80));
+			Value >>= 7;
+		}
+		Data.Add((uint8)Value);
+	}
+
+	void AppendSignedVarint(TArray<uint8>& Data, int64 Value)
+	{
+		AppendVarint(Data, ((uint64)Value << 1) ^ (uint64)(Value >> 63));
+	}
+
+	void AppendUint32(TArray<uint8>& Data, uint32 Value)
+	{
+		for (int32 i = 0; i < 4; ++i)
+		{
+			Data.Add((uint8)(Value >> (8 * i)));
+		}
+	}
+
+	void AppendString(TArray<uint8>& Data, const FString& Value)
+	{
+		FTCHARToUTF8 Utf8(*Value);
+		AppendVarint(Data, Utf8.Length());
+		Data.Append((const uint8*)Utf8.Get(), Utf8.Length());
+	}
+
+	// Quantize a transform, the quaternion sign follows the previous sample to keep the deltas small
+	void QuantizeTransform(const FTransform& Transform, const int32 Previous[VL_SCENE_COMPONENTS], int32* Out)
+	{
+		const FVector Location = Transform.GetLocation();
+		FQuat Rotation = Transform.GetRotation();
+		const FVector Scale = Transform.GetScale3D();
+		Out[0] = FMath::RoundToInt(Location.X / FSceneStateWriter::LocationStep);
+		Out[1] = FMath::RoundToInt(Location.Y / FSceneStateWriter::LocationStep);
+		Out[2] = FMath::RoundToInt(Location.Z / FSceneStateWriter::LocationStep);
+		const int64 Dot = (int64)Previous[3] * FMath::RoundToInt(Rotation.X / FSceneStateWriter::RotationStep)
+			+ (int64)Previous[4] * FMath::RoundToInt(Rotation.Y / FSceneStateWriter::RotationStep)
+			+ (int64)Previous[5] * FMath::RoundToInt(Rotation.Z / FSceneStateWriter::RotationStep)
+			+ (int64)Previous[6] * FMath::RoundToInt(Rotation.W / FSceneStateWriter::RotationStep);
+		if (Dot < 0)
+		{
+			Rotation = Rotation * -1.0f;
+		}
+		Out[3] = FMath::RoundToInt(Rotation.X / FSceneStateWriter::RotationStep);
+		Out[4] = FMath::RoundToInt(Rotation.Y / FSceneStateWriter::RotationStep);
+		Out[5] = FMath::RoundToInt(Rotation.Z / FSceneStateWriter::RotationStep);
+		Out[6] = FMath::RoundToInt(Rotation.W / FSceneStateWriter::RotationStep);
+		Out[7] = FMath::RoundToInt(Scale.X / FSceneStateWriter::ScaleStep);
+		Out[8] = FMath::RoundToInt(Scale.Y / FSceneStateWriter::ScaleStep);
+		Out[9] = FMath::RoundToInt(Scale.Z / FSceneStateWriter::ScaleStep);
+	}
+
+	// Block record payload, see vl_scene_state_format.h
+	void EncodeBlock(FSceneStateBlock& Block, TArray<uint8>& Payload)
+	{
+		const int32 NumFrames = Block.FrameNumbers.Num();
+		AppendVarint(Payload, NumFrames);
+		AppendVarint(Payload, Block.FrameNumbers[0]);
+		for (int32 i = 1; i < NumFrames; ++i)
+		{
+			AppendVarint(Payload, Block.FrameNumbers[i] - Block.FrameNumbers[i - 1]);
+		}
+		AppendSignedVarint(Payload, Block.TimeStamps[0]);
+		for (int32 i = 1; i < NumFrames; ++i)
+		{
+			AppendSignedVarint(Payload, Block.TimeStamps[i] - Block.TimeStamps[i - 1]);
+		}
+
+		// Readers look actors up by id, store them ascending
+		TArray<int32> Order;
+		Order.SetNumUninitialized(Block.ActorIds.Num());
+		for (int32 i = 0; i < Order.Num(); ++i)
+		{
+			Order[i] = i;
+		}
+		Order.Sort([&Block](int32 A, int32 B) { return Block.ActorIds[A] < Block.ActorIds[B]; });
+
+		TArray<uint8> Chunks;
+		TArray<uint32> Offsets;
+		Offsets.Reserve(Order.Num());
+		for (int32 Slot : Order)
+		{
+			Offsets.Add(Chunks.Num());
+			const int32* Values = Block.Values[Slot].GetData();
+			for (int32 Component = 0; Component < VL_SCENE_COMPONENTS; ++Component)
+			{
+				bool bConstant = true;
+				for (int32 Frame = 1; Frame < NumFrames && bConstant; ++Frame)
+				{
+					bConstant = Values[Frame * VL_SCENE_COMPONENTS + Component] == Values[Component];
+				}
+				AppendVarint(Chunks, bConstant ? VL_SCENE_COLUMN_CONSTANT : VL_SCENE_COLUMN_DELTA);
+				AppendSignedVarint(Chunks, Values[Component]);
+				if (!bConstant)
+				{
+					for (int32 Frame = 1; Frame < NumFrames; ++Frame)
+					{
+						AppendSignedVarint(Chunks, (int64)Values[Frame * VL_SCENE_COMPONENTS + Component] - Values[(Frame - 1) * VL_SCENE_COMPONENTS + Component]);
+					}
+				}
+			}
+		}
+
+		AppendVarint(Payload, Order.Num());
+		int32 LastId = 0;
+		for (int32 i = 0; i < Order.Num(); ++i)
+		{
+			const int32 Id = Block.ActorIds[Order[i]];
+			AppendVarint(Payload, i == 0 ? Id : Id - LastId);
+			LastId = Id;
+		}
+		for (uint32 Offset : Offsets)
+		{
+			AppendUint32(Payload, Offset);
+		}
+		Payload.Append(Chunks);
+	}
+}
+
+FSceneStateWriter::FSceneStateWriter()
+{
+	Archive = nullptr;
+	SessionStartNs = 0;
+	BlockFrames = 64;
+	NumFrames = 0;
+	EncodeSeconds = 0.0;
+}
+
+FSceneStateWriter::~FSceneStateWriter()
+{
+	Close();
+}
+
+bool FSceneStateWriter::Open(const FString& Path, const FDateTime& SessionStart, int32 InBlockFrames)
+{
+	Close();
+	Archive = IFileManager::Get().CreateFileWriter(*Path);
+	if (Archive == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not create scene state log %s"), *Path);
+		return false;
+	}
+	BlockFrames = FMath::Max(1, InBlockFrames);
+	SessionStartNs = (SessionStart - FDateTime(1970, 1, 1)).GetTicks() * 100;
+	NumFrames = 0;
+	EncodeSeconds = 0.0;
+
+	uint32 Magic = VL_SCENE_MAGIC;
+	uint32 Version = VL_SCENE_VERSION;
+	uint32 Frames = BlockFrames;
+	uint32 Reserved = 0;
+	float Location = LocationStep;
+	float Rotation = RotationStep;
+	float Scale = ScaleStep;
+	*Archive << Magic << Version << Frames << Reserved << SessionStartNs << Location << Rotation << Scale << Reserved;
+	Block = MakeShareable(new FSceneStateBlock());
+	return true;
+}
+
+void FSceneStateWriter::Close()
+{
+	if (Archive == nullptr)
+	{
+		return;
+	}
+	FlushBlock();
+	if (PendingBlock.IsValid())
+	{
+		PendingBlock.Wait();
+	}
+
+	// Index of the blocks of every actor, followed by the trailer pointing at it
+	TArray<uint8> Payload;
+	AppendVarint(Payload, BlockOffsets.Num());
+	for (int32 i = 0; i < BlockOffsets.Num(); ++i)
+	{
+		AppendVarint(Payload, i == 0 ? BlockOffsets[i] : BlockOffsets[i] - BlockOffsets[i - 1]);
+		AppendVarint(Payload, i == 0 ? BlockFirstFrames[i] : BlockFirstFrames[i] - BlockFirstFrames[i - 1]);
+		AppendVarint(Payload, BlockFrameCounts[i]);
+	}
+	AppendVarint(Payload, ActorBlocks.Num());
+	for (const TArray<int32>& Blocks : ActorBlocks)
+	{
+		AppendVarint(Payload, Blocks.Num());
+		for (int32 i = 0; i < Blocks.Num(); ++i)
+		{
+			AppendVarint(Payload, i == 0 ? Blocks[i] : Blocks[i] - Blocks[i - 1]);
+		}
+	}
+	uint64 IndexOffset = Archive->Tell();
+	WriteRecord(VL_SCENE_RECORD_INDEX, Payload);
+	uint32 IndexMagic = VL_SCENE_INDEX_MAGIC;
+	*Archive << IndexOffset << IndexMagic;
+
+	Archive->Close();
+	delete Archive;
+	Archive = nullptr;
+	UE_LOG(LogTemp, Warning, TEXT("Scene state log closed after %llu frames of %d actors in %d blocks"), NumFrames, Actors.Num(), BlockOffsets.Num());
+
+	Actors.Empty();
+	BlockStartValues.Empty();
+	LatestValues.Empty();
+	UnwrittenActors.Empty();
+	Block.Reset();
+	BlockSlots.Empty();
+	BlockOffsets.Empty();
+	BlockFirstFrames.Empty();
+	BlockFrameCounts.Empty();
+	ActorBlocks.Empty();
+}
+
+void FSceneStateWriter::AddActors(const TArray<FSceneStateActor>& NewActors)
+{
+	if (Archive == nullptr || NewActors.Num() == 0)
+	{
+		return;
+	}
+
+	// The actor record only ever reaches the file before the first block that uses the ids
+	TArray<uint8> Payload;
+	AppendVarint(Payload, NewActors.Num());
+	for (const FSceneStateActor& Actor : NewActors)
+	{
+		const int32 Id = Actors.Add(Actor.Actor);
+		AppendVarint(Payload, Id);
+		AppendVarint(Payload, Actor.CategoryId);
+		AppendVarint(Payload, Actor.InstanceId);
+		AppendString(Payload, Actor.Category);
+		AppendString(Payload, Actor.Actor.IsValid() ? Actor.Actor->GetName() : FString());
+	}
+	BlockStartValues.AddZeroed(NewActors.Num() * VL_SCENE_COMPONENTS);
+	LatestValues.AddZeroed(NewActors.Num() * VL_SCENE_COMPONENTS);
+	for (int32 i = 0; i < NewActors.Num(); ++i)
+	{
+		UnwrittenActors.Add(true);
+		BlockSlots.Add(INDEX_NONE);
+	}
+	ActorBlocks.AddDefaulted(NewActors.Num());
+
+	// Records are written in order, wait until the encoder task is done with the archive
+	if (PendingBlock.IsValid())
+	{
+		PendingBlock.Wait();
+	}
+	WriteRecord(VL_SCENE_RECORD_ACTORS, Payload);
+}
+
+void FSceneStateWriter::WriteFrame(uint64 FrameNumber, const FDateTime& Stamp)
+{
+	if (Archive == nullptr)
+	{
+		return;
+	}
+	const int32 Frame = Block->FrameNumbers.Num();
+	Block->FrameNumbers.Add(FrameNumber);
+	Block->TimeStamps.Add((Stamp - FDateTime(1970, 1, 1)).GetTicks() * 100 - SessionStartNs);
+
+	int32 Sample[VL_SCENE_COMPONENTS];
+	for (int32 Id = 0; Id < Actors.Num(); ++Id)
+	{
+		int32* Latest = &LatestValues[Id * VL_SCENE_COMPONENTS];
+		AActor* Actor = Actors[Id].Get();
+		if (Actor)
+		{
+			QuantizeTransform(Actor->GetActorTransform(), Latest, Sample);
+		}
+		else
+		{
+			// Destroyed actors keep their last transform
+			FMemory::Memcpy(Sample, Latest, sizeof(Sample));
+		}
+
+		int32 Slot = BlockSlots[Id];
+		if (Slot == INDEX_NONE)
+		{
+			const int32* Start = &BlockStartValues[Id * VL_SCENE_COMPONENTS];
+			if (!UnwrittenActors[Id] && FMemory::Memcmp(Sample, Start, sizeof(Sample)) == 0)
+			{
+				continue;
+			}
+
+			// First change in this block, the frames before hold the value of the block start
+			// (actors registered during the block start with their first sample)
+			const int32* Hold = UnwrittenActors[Id] ? Sample : Start;
+			Slot = Block->ActorIds.Add(Id);
+			BlockSlots[Id] = Slot;
+			Block->Values.AddDefaulted();
+			TArray<int32>& Values = Block->Values[Slot];
+			Values.Reserve(BlockFrames * VL_SCENE_COMPONENTS);
+			for (int32 Previous = 0; Previous < Frame; ++Previous)
+			{
+				Values.Append(Hold, VL_SCENE_COMPONENTS);
+			}
+		}
+		Block->Values[Slot].Append(Sample, VL_SCENE_COMPONENTS);
+		FMemory::Memcpy(Latest, Sample, sizeof(Sample));
+	}
+
+	++NumFrames;
+	if (Block->FrameNumbers.Num() >= BlockFrames)
+	{
+		FlushBlock();
+	}
+}
+
+void FSceneStateWriter::FlushBlock()
+{
+	if (!Block.IsValid() || Block->FrameNumbers.Num() == 0)
+	{
+		return;
+	}
+
+	const int32 BlockIndex = BlockFirstFrames.Num();
+	BlockFirstFrames.Add(Block->FrameNumbers[0]);
+	BlockFrameCounts.Add(Block->FrameNumbers.Num());
+	for (int32 Id : Block->ActorIds)
+	{
+		ActorBlocks[Id].Add(BlockIndex);
+		BlockSlots[Id] = INDEX_NONE;
+		UnwrittenActors[Id] = false;
+		FMemory::Memcpy(&BlockStartValues[Id * VL_SCENE_COMPONENTS], &LatestValues[Id * VL_SCENE_COMPONENTS], VL_SCENE_COMPONENTS * sizeof(int32));
+	}
+
+	// Encoding many moving actors takes a few ms, keep it off the game thread but write the blocks in order
+	if (PendingBlock.IsValid())
+	{
+		PendingBlock.Wait();
+	}
+	TSharedPtr<FSceneStateBlock, ESPMode::ThreadSafe> Encoded = Block;
+	PendingBlock = Async<void>(EAsyncExecution::ThreadPool, [this, Encoded]()
+	{
+		const double Start = FPlatformTime::Seconds();
+		TArray<uint8> Payload;
+		EncodeBlock(*Encoded, Payload);
+		EncodeSeconds += FPlatformTime::Seconds() - Start;
+		BlockOffsets.Add(Archive->Tell());
+		WriteRecord(VL_SCENE_RECORD_BLOCK, Payload);
+	});
+	Block = MakeShareable(new FSceneStateBlock());
+}
+
+void FSceneStateWriter::WriteRecord(uint32 Type, const TArray<uint8>& Payload)
+{
+	uint32 Size = Payload.Num();
+	*Archive << Type << Size;
+	Archive->Serialize(const_cast<uint8*>(Payload.GetData()), Payload.Num());
+}
@@ -0,0 +1,412 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "SessionJournal.h"
+#include "RawDataAsyncWorker.h"
+#include "Async/Async.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/ScopeLock.h"
+
+#if PLATFORM_LINUX || PLATFORM_MAC
+#include <fcntl.h>
+#include <unistd.h>
+#define VL_HAS_POSIX_SYNC 1
+#define VL_HAS_WINDOWS_SYNC 0
+#elif PLATFORM_WINDOWS
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#define VL_HAS_POSIX_SYNC 0
+#define VL_HAS_WINDOWS_SYNC 1
+#else
+#define VL_HAS_POSIX_SYNC 0
+#define VL_HAS_WINDOWS_SYNC 0
+#endif
+
+const TCHAR* FSessionJournal::ManifestName = TEXT("MANIFEST.csv");
+const TCHAR* FSessionJournal::TempSuffix = TEXT(".tmp");
+
+namespace
+{
+	int OpenFile(const FString& Path, bool bAppend)
+	{
+#if VL_HAS_POSIX_SYNC
+		return open(TCHAR_TO_UTF8(*Path), bAppend ? (O_WRONLY | O_APPEND | O_CREAT) : O_RDONLY, 0644);
+#elif VL_HAS_WINDOWS_SYNC
+		// _commit needs write access
+		return _wopen(*Path, bAppend ? (_O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY) : (_O_RDWR | _O_BINARY), _S_IREAD | _S_IWRITE);
+#else
+		return -1;
+#endif
+	}
+
+	void CloseFile(int Fd)
+	{
+#if VL_HAS_POSIX_SYNC
+		close(Fd);
+#elif VL_HAS_WINDOWS_SYNC
+		_close(Fd);
+#endif
+	}
+
+	bool SyncFile(int Fd)
+	{
+#if PLATFORM_LINUX
+		return fdatasync(Fd) == 0;
+#elif VL_HAS_POSIX_SYNC
+		return fsync(Fd) == 0;
+#elif VL_HAS_WINDOWS_SYNC
+		return _commit(Fd) == 0;
+#else
+		return false;
+#endif
+	}
+
+	bool AppendToFile(int Fd, const FString& Text)
+	{
+		FTCHARToUTF8 Utf8(*Text);
+		const char* Data = (const char*)Utf8.Get();
+		int64 Remaining = Utf8.Length();
+		while (Remaining > 0)
+		{
+#if VL_HAS_POSIX_SYNC
+			const int64 Written = write(Fd, Data, Remaining);
+#elif VL_HAS_WINDOWS_SYNC
+			const int64 Written = _write(Fd, Data, (unsigned int)Remaining);
+#else
+			const int64 Written = -1;
+#endif
+			if (Written <= 0)
+			{
+				return false;
+			}
+			Data += Written;
+			Remaining -= Written;
+		}
+		return true;
+	}
+
+	// Make the data of the files durable, one syncfs for all of them where available
+	bool SyncFiles(const FString& Dir, const TArray<FString>& FileNames)
+	{
+#if PLATFORM_LINUX
+		const int DirFd = open(TCHAR_TO_UTF8(*Dir), O_RDONLY | O_DIRECTORY);
+		if (DirFd < 0)
+		{
+			return false;
+		}
+		const bool bSynced = syncfs(DirFd) == 0;
+		close(DirFd);
+		return bSynced;
+#elif VL_HAS_POSIX_SYNC || VL_HAS_WINDOWS_SYNC
+		bool bSynced = true;
+		for (const FString& FileName : FileNames)
+		{
+			const int Fd = OpenFile(Dir / FileName, false);
+			bSynced &= Fd >= 0 && SyncFile(Fd);
+			if (Fd >= 0)
+			{
+				CloseFile(Fd);
+			}
+		}
+		return bSynced;
+#else
+		return false;
+#endif
+	}
+
+	// Make the renames in Dir durable
+	bool SyncDirectory(const FString& Dir)
+	{
+#if VL_HAS_POSIX_SYNC
+		const int DirFd = open(TCHAR_TO_UTF8(*Dir), O_RDONLY);
+		const bool bSynced = DirFd >= 0 && fsync(DirFd) == 0;
+		if (DirFd >= 0)
+		{
+			close(DirFd);
+		}
+		return bSynced;
+#elif VL_HAS_WINDOWS_SYNC
+		// A directory can not be flushed through the CRT, NTFS logs the renames in its journal
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// Files written through the journal, logs appended in place (manifest, repeats, rate control, scene state) are not listed
+	bool IsJournaledFile(const FString& FileName)
+	{
+		return !FileName.EndsWith(TEXT(".csv")) && !FileName.EndsWith(TEXT(".vlscene"));
+	}
+
+	// frame,stream,file,bytes,quality,scale
+	const TCHAR* ManifestHeader = TEXT("#frame,stream,file,bytes,quality,scale\n");
+
+	FString FormatEntry(const FJournalFrame& Frame, const FString& Stream, const FString& FileName, int64 NumBytes)
+	{
+		return FString::Printf(TEXT("%llu,%s,%s,%lld,%d,%.3f\n"), Frame.FrameNumber, *Stream, *FileName, NumBytes, Frame.JpegQuality, Frame.ResolutionScale);
+	}
+
+	int64 UnixTimeNs()
+	{
+		return (FDateTime::UtcNow() - FDateTime(1970, 1, 1)).GetTicks() * 100;
+	}
+}
+
+FSessionJournal::FSessionJournal(const FString& InDir, int32 InCommitFiles, float InCommitInterval)
+{
+	Dir = InDir;
+	CommitFiles = FMath::Max(InCommitFiles, 1);
+	CommitInterval = FMath::Max(InCommitInterval, 0.0f);
+	LastCommitTime = FPlatformTime::Seconds();
+	ManifestFd = -1;
+	NumCommitted = 0;
+	NumCommits = 0;
+}
+
+FSessionJournal::~FSessionJournal()
+{
+	Close();
+}
+
+bool FSessionJournal::Open()
+{
+	FScopeLock CommitScope(&CommitLock);
+	IFileManager::Get().MakeDirectory(*Dir, true);
+	const FString ManifestPath = Dir / ManifestName;
+	const bool bNewManifest = IFileManager::Get().FileSize(*ManifestPath) <= 0;
+	ManifestFd = OpenFile(ManifestPath, true);
+	if (ManifestFd < 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not open the session manifest %s"), *ManifestPath);
+		return false;
+	}
+	FString Header = bNewManifest ? ManifestHeader : TEXT("");
+	Header += FString::Printf(TEXT("#session,%s\n"), *RawDataAsyncWorker::FormatTimeStamp(FDateTime::UtcNow()));
+	if (!AppendToFile(ManifestFd, Header) || !SyncFile(ManifestFd))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Session manifest %s is not synced, files are not durable"), *ManifestPath);
+	}
+	LastCommitTime = FPlatformTime::Seconds();
+	return true;
+}
+
+void FSessionJournal::Close()
+{
+	Commit();
+	FScopeLock CommitScope(&CommitLock);
+	if (ManifestFd >= 0)
+	{
+		CloseFile(ManifestFd);
+		ManifestFd = -1;
+		UE_LOG(LogTemp, Log, TEXT("Session manifest closed: %lld files in %d commits"), NumCommitted, NumCommits);
+	}
+}
+
+void FSessionJournal::WriteFile(const TSharedPtr<IFileWriteBackend, ESPMode::ThreadSafe>& Writer, TArray<uint8>&& Data, const FString& FileName,
+	const FJournalFrame& Frame, const FString& Stream, TFunction<void(bool)> OnWritten)
+{
+	// The write keeps the journal alive until it completed
+	TSharedRef<FSessionJournal, ESPMode::ThreadSafe> Self = AsShared();
+	const int64 NumBytes = Data.Num();
+	IFileWriteBackend::Write(Writer, Dir / FileName + TempSuffix, MoveTemp(Data), [Self, FileName, Frame, Stream, NumBytes, OnWritten](bool bWritten)
+	{
+		if (bWritten)
+		{
+			Self->FileWritten(FileName, Frame, Stream, NumBytes);
+		}
+		else
+		{
+			IFileManager::Get().Delete(*(Self->Dir / FileName + TempSuffix));
+		}
+		if (OnWritten)
+		{
+			OnWritten(bWritten);
+		}
+	});
+}
+
+void FSessionJournal::FileWritten(const FString& FileName, const FJournalFrame& Frame, const FString& Stream, int64 NumBytes)
+{
+	// The file keeps its temporary name until the commit made its data durable
+	bool bDue;
+	{
+		FScopeLock PendingScope(&PendingLock);
+		Pending.Emplace(FileName, Stream, Frame, NumBytes);
+		bDue = Pending.Num() >= CommitFiles;
+	}
+	if (bDue)
+	{
+		ScheduleCommit();
+	}
+}
+
+void FSessionJournal::CommitIfDue()
+{
+	bool bDue;
+	{
+		FScopeLock PendingScope(&PendingLock);
+		bDue = Pending.Num() > 0 && FPlatformTime::Seconds() - LastCommitTime >= CommitInterval;
+	}
+	if (bDue)
+	{
+		ScheduleCommit();
+	}
+}
+
+void FSessionJournal::ScheduleCommit()
+{
+	if (bCommitScheduled.AtomicSet(true))
+	{
+		return;
+	}
+	// The task keeps the journal alive until it ran
+	TSharedRef<FSessionJournal, ESPMode::ThreadSafe> Self = AsShared();
+	Async<void>(EAsyncExecution::ThreadPool, [Self]()
+	{
+		// Files pending from now on need another commit
+		Self->bCommitScheduled = false;
+		Self->Commit();
+	});
+}
+
+void FSessionJournal::Commit()
+{
+	FScopeLock CommitScope(&CommitLock);
+	TArray<FJournalEntry> Batch;
+	{
+		FScopeLock PendingScope(&PendingLock);
+		Batch = MoveTemp(Pending);
+		Pending.Reset();
+		LastCommitTime = FPlatformTime::Seconds();
+	}
+	if (Batch.Num() == 0 || ManifestFd < 0)
+	{
+		return;
+	}
+
+	// Data first: a final name must never point to data that is not durable
+	TArray<FString> TempNames;
+	for (const FJournalEntry& Entry : Batch)
+	{
+		TempNames.Add(Entry.FileName + TempSuffix);
+	}
+	bool bSynced = SyncFiles(Dir, TempNames);
+
+	FString Text;
+	int32 NumRenamed = 0;
+	for (const FJournalEntry& Entry : Batch)
+	{
+		const FString FinalPath = Dir / Entry.FileName;
+		const FString TempPath = FinalPath + TempSuffix;
+		// Same directory, the move is a rename
+		if (!IFileManager::Get().Move(*FinalPath, *TempPath, true, true))
+		{
+			UE_LOG(LogTemp, Error, TEXT("Could not rename %s"), *TempPath);
+			IFileManager::Get().Delete(*TempPath);
+			continue;
+		}
+		Text += FormatEntry(Entry.Frame, Entry.Stream, Entry.FileName, Entry.NumBytes);
+		++NumRenamed;
+	}
+
+	// Names next: an entry must never be durable before its file
+	bSynced &= SyncDirectory(Dir);
+	Text += FString::Printf(TEXT("#commit,%d,%lld\n"), NumRenamed, UnixTimeNs());
+	if (!AppendToFile(ManifestFd, Text) || !SyncFile(ManifestFd) || !bSynced)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not sync %d files of the session manifest, they may not survive a power loss"), NumRenamed);
+	}
+	NumCommitted += NumRenamed;
+	++NumCommits;
+}
+
+int32 FSessionJournal::Recover(const FString& Dir)
+{
+	if (!IFileManager::Get().DirectoryExists(*Dir))
+	{
+		return 0;
+	}
+
+	// Entries up to the last "#" line are durable, a torn group after it is dropped
+	const FString ManifestPath = Dir / ManifestName;
+	TArray<uint8> Bytes;
+	FFileHelper::LoadFileToArray(Bytes, *ManifestPath, FILEREAD_Silent);
+	TSet<FString> Listed;
+	TArray<FString> GroupFiles;
+	int32 CommittedEnd = 0;
+	int32 LineStart = 0;
+	for (int32 Index = 0; Index < Bytes.Num(); ++Index)
+	{
+		if (Bytes[Index] != '\n')
+		{
+			continue;
+		}
+		FUTF8ToTCHAR Converted((const ANSICHAR*)Bytes.GetData() + LineStart, Index - LineStart);
+		const FString Line(Converted.Length(), Converted.Get());
+		LineStart = Index + 1;
+		if (Line.StartsWith(TEXT("#")))
+		{
+			Listed.Append(GroupFiles);
+			GroupFiles.Reset();
+			CommittedEnd = LineStart;
+			continue;
+		}
+		// Manifests of older sessions have no quality and scale columns
+		TArray<FString> Fields;
+		if (Line.ParseIntoArray(Fields, TEXT(","), false) >= 4)
+		{
+			GroupFiles.Add(Fields[2]);
+		}
+	}
+	if (CommittedEnd < Bytes.Num())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Dropping %d uncommitted bytes of the session manifest"), Bytes.Num() - CommittedEnd);
+		Bytes.SetNum(CommittedEnd);
+		const FString TempPath = ManifestPath + TempSuffix;
+		if (!FFileHelper::SaveArrayToFile(Bytes, *TempPath) || !IFileManager::Get().Move(*ManifestPath, *TempPath, true, true))
+		{
+			UE_LOG(LogTemp, Error, TEXT("Could not truncate the session manifest %s"), *ManifestPath);
+			return 0;
+		}
+	}
+
+	// A temporary file was written after the last durable commit, its data may be incomplete. Unlisted final names
+	// are left out as well: they were renamed by a commit that did not reach the manifest or written without the
+	// journal, nothing tells a complete file from one torn by a power loss, so they are kept but not listed.
+	TArray<FString> FileNames;
+	IFileManager::Get().FindFiles(FileNames, *(Dir / TEXT("*")), true, false);
+	int32 NumDiscarded = 0;
+	int32 NumUnlisted = 0;
+	for (const FString& FileName : FileNames)
+	{
+		if (FileName.EndsWith(TempSuffix))
+		{
+			IFileManager::Get().Delete(*(Dir / FileName));
+			++NumDiscarded;
+		}
+		else if (IsJournaledFile(FileName) && !Listed.Contains(FileName))
+		{
+			++NumUnlisted;
+		}
+	}
+	if (NumDiscarded > 0 || NumUnlisted > 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Recovered %s: %d partial files discarded, %d unverified files not listed in the manifest"), *Dir, NumDiscarded, NumUnlisted);
+	}
+	return NumDiscarded;
+}
+
+void FSessionJournal::Save(const TSharedPtr<IFileWriteBackend, ESPMode::ThreadSafe>& Writer, const TSharedPtr<FSessionJournal, ESPMode::ThreadSafe>& Journal,
+	TArray<uint8>&& Data, const FString& Dir, const FString& FileName, const FJournalFrame& Frame, const FString& Stream, TFunction<void(bool)> OnWritten)
+{
+	if (Journal.IsValid())
+	{
+		Journal->WriteFile(Writer, MoveTemp(Data), FileName, Frame, Stream, MoveTemp(OnWritten));
+	}
+	else
+	{
+		IFileWriteBackend::Write(Writer, Dir / FileName, MoveTemp(Data), MoveTemp(OnWritten));
+	}
+}
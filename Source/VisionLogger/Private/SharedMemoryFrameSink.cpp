@@ -0,0 +1,180 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "SharedMemoryFrameSink.h"
+#include "PixelFormatConversion.h"
+#include "Runtime/Core/Public/Misc/ScopeLock.h"
+
+#if PLATFORM_LINUX || PLATFORM_MAC
+#include "vl_shm_protocol.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VL_HAS_POSIX_SHM 1
+#else
+#define VL_HAS_POSIX_SHM 0
+#endif
+
+#if VL_HAS_POSIX_SHM
+static_assert((uint32)EVisionPixelFormat::PlanarRGB == VL_SHM_FORMAT_PLANAR_RGB, "Shared memory pixel formats must follow EVisionPixelFormat");
+
+namespace
+{
+	// Tell attached readers that no more frames follow in this ring, then drop the mapping
+	void CloseRing(void* Memory, int64 MappedSize)
+	{
+		__atomic_store_n(&((vl_shm_header*)Memory)->magic, VL_SHM_MAGIC_CLOSED, __ATOMIC_RELEASE);
+		munmap(Memory, MappedSize);
+	}
+}
+#endif
+
+FSharedMemoryFrameSink::FSharedMemoryFrameSink()
+{
+	Memory = nullptr;
+	MappedSize = 0;
+}
+
+FSharedMemoryFrameSink::~FSharedMemoryFrameSink()
+{
+	Close();
+}
+
+bool FSharedMemoryFrameSink::Open(const FString& Name, int32 NumSlots, int64 MaxFrameBytes)
+{
+#if VL_HAS_POSIX_SHM
+	const FString NewName = Name.StartsWith(TEXT("/")) ? Name : TEXT("/") + Name;
+	const uint64 TotalSize = vl_shm_total_size(NumSlots, MaxFrameBytes);
+
+	// Readers of a previous ring keep their mapping until they see it closed, new readers attach to the fresh object
+	shm_unlink(TCHAR_TO_UTF8(*NewName));
+	const int Fd = shm_open(TCHAR_TO_UTF8(*NewName), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (Fd < 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not create shared memory %s"), *NewName);
+		Close();
+		return false;
+	}
+	if (ftruncate(Fd, TotalSize) != 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not resize shared memory %s to %llu bytes"), *NewName, TotalSize);
+		close(Fd);
+		shm_unlink(TCHAR_TO_UTF8(*NewName));
+		Close();
+		return false;
+	}
+	void* Mapped = mmap(nullptr, TotalSize, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+	close(Fd);
+	if (Mapped == MAP_FAILED)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not map shared memory %s"), *NewName);
+		shm_unlink(TCHAR_TO_UTF8(*NewName));
+		Close();
+		return false;
+	}
+
+	vl_shm_header* Header = (vl_shm_header*)Mapped;
+	FMemory::Memzero(Header, sizeof(vl_shm_header));
+	Header->version = VL_SHM_VERSION;
+	Header->slot_count = NumSlots;
+	Header->header_size = sizeof(vl_shm_header);
+	Header->slot_stride = vl_shm_align(sizeof(vl_shm_slot) + MaxFrameBytes);
+	Header->max_payload = MaxFrameBytes;
+	// Readers only attach once the magic is visible
+	__atomic_store_n(&Header->magic, VL_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	// The replaced ring is closed only now, readers that see it closed find the new one under the name
+	FScopeLock ScopeLock(&ProducerLock);
+	if (Memory)
+	{
+		CloseRing(Memory, MappedSize);
+		if (ShmName != NewName)
+		{
+			shm_unlink(TCHAR_TO_UTF8(*ShmName));
+		}
+	}
+	ShmName = NewName;
+	Memory = Mapped;
+	MappedSize = TotalSize;
+	UE_LOG(LogTemp, Warning, TEXT("Publishing frames to shared memory %s (%d slots, %lld bytes each)"), *ShmName, NumSlots, MaxFrameBytes);
+	return true;
+#else
+	UE_LOG(LogTemp, Error, TEXT("The shared memory frame feed is only available on Linux and Mac"));
+	return false;
+#endif
+}
+
+void FSharedMemoryFrameSink::Close()
+{
+#if VL_HAS_POSIX_SHM
+	FScopeLock ScopeLock(&ProducerLock);
+	if (Memory)
+	{
+		// Attached readers stop waiting for frames of this ring
+		CloseRing(Memory, MappedSize);
+		shm_unlink(TCHAR_TO_UTF8(*ShmName));
+		Memory = nullptr;
+		MappedSize = 0;
+	}
+#endif
+}
+
+bool FSharedMemoryFrameSink::Publish(uint32 Stream, uint64 FrameId, const FDateTime& TimeStamp, const FTransform& CameraPose,
+	uint32 PixelFormat, int32 Width, int32 Height, const void* Data, int64 NumBytes)
+{
+#if VL_HAS_POSIX_SHM
+	FScopeLock ScopeLock(&ProducerLock);
+	if (Memory == nullptr)
+	{
+		return false;
+	}
+	vl_shm_header* Header = (vl_shm_header*)Memory;
+	if (NumBytes > (int64)Header->max_payload)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Frame of %lld bytes does not fit into a shared memory slot"), NumBytes);
+		return false;
+	}
+
+	const uint64 Frame = vl_shm_load_relaxed(&Header->write_seq);
+	vl_shm_slot* Slot = vl_shm_get_slot(Header, Frame);
+
+	// Odd sequence tells readers the slot is being written
+	vl_shm_store_relaxed(&Slot->seq, 2 * Frame + 1);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	vl_shm_frame_info& Info = Slot->info;
+	Info.frame_id = FrameId;
+	Info.timestamp_ns = (TimeStamp - FDateTime(1970, 1, 1)).GetTicks() * 100;
+	Info.stream = Stream;
+	Info.pixel_format = PixelFormat;
+	Info.width = Width;
+	Info.height = Height;
+	Info.payload_size = (uint32)NumBytes;
+	Info.reserved = 0;
+	const FVector Location = CameraPose.GetLocation();
+	const FQuat Rotation = CameraPose.GetRotation();
+	Info.location[0] = Location.X;
+	Info.location[1] = Location.Y;
+	Info.location[2] = Location.Z;
+	Info.rotation[0] = Rotation.X;
+	Info.rotation[1] = Rotation.Y;
+	Info.rotation[2] = Rotation.Z;
+	Info.rotation[3] = Rotation.W;
+	FMemory::Memcpy((uint8*)Slot + sizeof(vl_shm_slot), Data, NumBytes);
+
+	vl_shm_store_release(&Slot->seq, 2 * Frame + 2);
+	vl_shm_store_release(&Header->write_seq, Frame + 1);
+	return true;
+#else
+	return false;
+#endif
+}
+
+uint64 FSharedMemoryFrameSink::GetNumPublished() const
+{
+#if VL_HAS_POSIX_SHM
+	return Memory ? vl_shm_load_acquire(&((const vl_shm_header*)Memory)->write_seq) : 0;
+#else
+	return 0;
+#endif
+}
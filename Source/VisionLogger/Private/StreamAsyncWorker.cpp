@@ -0,0 +1,5 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "StreamAsyncWorker.h"
+
+FThreadSafeCounter FStreamAsyncWorkerStats::NumInFlight;
@@ -0,0 +1,152 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "StreamTraits.h"
+#include "PixelFormatConversion.h"
+#include "Runtime/ImageWrapper/Public/IImageWrapper.h"
+
+namespace
+{
+	// Category index of every pixel, runs of the same color share the map lookup
+	template<typename LabelType>
+	void ColorsToLabels(const FColor* Src, int32 NumPixels, const TMap<uint32, uint16>& ColorToLabel, LabelType NoLabel, LabelType* Dst)
+	{
+		uint32 LastColor = 0;
+		LabelType LastLabel = NoLabel;
+		bool bHasLast = false;
+		for (int32 i = 0; i < NumPixels; ++i)
+		{
+			FColor Color = Src[i];
+			Color.A = 255;
+			const uint32 Packed = Color.DWColor();
+			if (!bHasLast || Packed != LastColor)
+			{
+				// Categories that do not fit the label type count as unlabelled
+				const uint16* Label = ColorToLabel.Find(Packed);
+				LastLabel = Label && *Label < NoLabel ? (LabelType)*Label : NoLabel;
+				LastColor = Packed;
+				bHasLast = true;
+			}
+			Dst[i] = LastLabel;
+		}
+	}
+
+	template<typename SampleType>
+	void EncodeRaw(const SampleType* Pixels, int32 NumPixels, TArray<uint8>& Out)
+	{
+		Out.SetNumUninitialized(NumPixels * sizeof(SampleType));
+		FMemory::Memcpy(Out.GetData(), Pixels, Out.Num());
+	}
+
+	bool EncodeJpeg(const void* Pixels, int64 NumBytes, int32 Width, int32 Height, ERGBFormat Format, const FVisionEncodeSettings& Settings, TArray<uint8>& Out)
+	{
+		if (Settings.ImageWrapper == nullptr || !Settings.ImageWrapper->SetRaw(Pixels, NumBytes, Width, Height, Format, 8))
+		{
+			UE_LOG(LogTemp, Error, TEXT("No JPEG encoder for a %dx%d frame"), Width, Height);
+			return false;
+		}
+		Out = Settings.ImageWrapper->GetCompressed(Settings.JpegQuality);
+		return Out.Num() > 0;
+	}
+}
+
+void TVisionStreamTraits<FColor>::Convert(const FColor* Src, int32 NumPixels, const FVisionStreamConversion& Conversion, FColor* Dst)
+{
+	FMemory::Memcpy(Dst, Src, NumPixels * sizeof(FColor));
+}
+
+bool TVisionStreamTraits<FColor>::Encode(const FColor* Pixels, int32 Width, int32 Height, const FVisionEncodeSettings& Settings, TArray<uint8>& Out, FString& OutSuffix)
+{
+	switch (Settings.Codec)
+	{
+	case EVisionImageCodec::PNG:
+		// Large frames are split into stripes compressed on all cores
+		OutSuffix = TEXT(".png");
+		return FParallelPngEncoder::EncodeBGRA(Pixels, Width, Height, Settings.EncodeStripes, Settings.PngLevel, Out);
+	case EVisionImageCodec::JPEG:
+		OutSuffix = TEXT(".jpg");
+		return EncodeJpeg(Pixels, (int64)Width * Height * sizeof(FColor), Width, Height, ERGBFormat::BGRA, Settings, Out);
+	default:
+		EncodeRaw(Pixels, Width * Height, Out);
+		OutSuffix = FVisionEncodeSettings::GetRawSuffix(FPixelFormatConversion::GetFileExtension(EVisionPixelFormat::BGRA8), Width, Height);
+		return true;
+	}
+}
+
+void TVisionStreamTraits<FFloat16Color>::Convert(const FFloat16Color* Src, int32 NumPixels, const FVisionStreamConversion& Conversion, FFloat16Color* Dst)
+{
+	FMemory::Memcpy(Dst, Src, NumPixels * sizeof(FFloat16Color));
+}
+
+bool TVisionStreamTraits<FFloat16Color>::Encode(const FFloat16Color* Pixels, int32 Width, int32 Height, const FVisionEncodeSettings& Settings, TArray<uint8>& Out, FString& OutSuffix)
+{
+	// No image codec for half floats
+	EncodeRaw(Pixels, Width * Height, Out);
+	OutSuffix = FVisionEncodeSettings::GetRawSuffix(TEXT(".rgba16f"), Width, Height);
+	return true;
+}
+
+void TVisionStreamTraits<float>::Convert(const FFloat16Color* Src, int32 NumPixels, const FVisionStreamConversion& Conversion, float* Dst)
+{
+	for (int32 i = 0; i < NumPixels; ++i)
+	{
+		Dst[i] = Src[i].R.GetFloat();
+	}
+}
+
+bool TVisionStreamTraits<float>::Encode(const float* Pixels, int32 Width, int32 Height, const FVisionEncodeSettings& Settings, TArray<uint8>& Out, FString& OutSuffix)
+{
+	EncodeRaw(Pixels, Width * Height, Out);
+	OutSuffix = FVisionEncodeSettings::GetRawSuffix(TEXT(".f32"), Width, Height);
+	return true;
+}
+
+void TVisionStreamTraits<uint16>::Convert(const FFloat16Color* Src, int32 NumPixels, const FVisionStreamConversion& Conversion, uint16* Dst)
+{
+	for (int32 i = 0; i < NumPixels; ++i)
+	{
+		// cm to mm, saturated at 65.535 m, invalid depth is 0
+		const float Millimeters = Src[i].R.GetFloat() * 10.0f;
+		Dst[i] = Millimeters > 0.0f ? (Millimeters < 65535.0f ? (uint16)(Millimeters + 0.5f) : 65535) : 0;
+	}
+}
+
+void TVisionStreamTraits<uint16>::Convert(const FColor* Src, int32 NumPixels, const FVisionStreamConversion& Conversion, uint16* Dst)
+{
+	ColorsToLabels<uint16>(Src, NumPixels, Conversion.ColorToLabel, NoLabel, Dst);
+}
+
+bool TVisionStreamTraits<uint16>::Encode(const uint16* Pixels, int32 Width, int32 Height, const FVisionEncodeSettings& Settings, TArray<uint8>& Out, FString& OutSuffix)
+{
+	if (Settings.Codec == EVisionImageCodec::Raw)
+	{
+		EncodeRaw(Pixels, Width * Height, Out);
+		OutSuffix = FVisionEncodeSettings::GetRawSuffix(TEXT(".u16"), Width, Height);
+		return true;
+	}
+	// Labels and depth must stay exact, JPEG is replaced by PNG
+	OutSuffix = TEXT(".png");
+	return FParallelPngEncoder::EncodeGray16(Pixels, Width, Height, Settings.EncodeStripes, Settings.PngLevel, Out);
+}
+
+void TVisionStreamTraits<uint8>::Convert(const FColor* Src, int32 NumPixels, const FVisionStreamConversion& Conversion, uint8* Dst)
+{
+	ColorsToLabels<uint8>(Src, NumPixels, Conversion.ColorToLabel, NoLabel, Dst);
+}
+
+bool TVisionStreamTraits<uint8>::Encode(const uint8* Pixels, int32 Width, int32 Height, const FVisionEncodeSettings& Settings, TArray<uint8>& Out, FString& OutSuffix)
+{
+	switch (Settings.Codec)
+	{
+	case EVisionImageCodec::PNG:
+		OutSuffix = TEXT(".png");
+		return FParallelPngEncoder::EncodeGray(Pixels, Width, Height, Settings.EncodeStripes, Settings.PngLevel, Out);
+	case EVisionImageCodec::JPEG:
+		// Gray can still be handed to the image codec, only a quarter of the bytes is compressed
+		OutSuffix = TEXT(".jpg");
+		return EncodeJpeg(Pixels, (int64)Width * Height, Width, Height, ERGBFormat::Gray, Settings, Out);
+	default:
+		EncodeRaw(Pixels, Width * Height, Out);
+		OutSuffix = FVisionEncodeSettings::GetRawSuffix(FPixelFormatConversion::GetFileExtension(EVisionPixelFormat::Gray8), Width, Height);
+		return true;
+	}
+}
@@ -0,0 +1,85 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/Paths.h"
+#include "HAL/FileManager.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "Async/ParallelFor.h"
+#include "FileWriteBackend.h"
+#include "VisionLoggerTestUtils.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisionFileWriteBackendBenchmark, "VisionLogger.Benchmark.FileWriteBackend", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+bool FVisionFileWriteBackendBenchmark::RunTest(const FString& Parameters)
+{
+	struct FWriteCase
+	{
+		const TCHAR* Name;
+		EFileWriteBackend Type;
+		int64 DirectIOThreshold;
+	};
+	const FWriteCase Cases[] = {
+		{ TEXT("Blocking"), EFileWriteBackend::Blocking, 0 },
+		{ TEXT("io_uring"), EFileWriteBackend::IoUring, 0 },
+		{ TEXT("io_uring O_DIRECT"), EFileWriteBackend::IoUring, 64 * 1024 }
+	};
+	// Small files like compressed masks and a raw 1080p BGRA frame
+	const int64 FileSizes[] = { 64 * 1024, 8 * 1024 * 1024 };
+	const int64 BytesPerSize = 512 * 1024 * 1024;
+	const FString Dir = FPaths::ProjectSavedDir() / TEXT("VisionLoggerBenchmark");
+
+	for (int64 FileSize : FileSizes)
+	{
+		const int32 NumFiles = (int32)(BytesPerSize / FileSize);
+		TArray<uint8> Frame;
+		Frame.SetNumUninitialized((int32)FileSize);
+		uint32 Seed = 7;
+		for (uint8& Byte : Frame)
+		{
+			Byte = (uint8)VisionLoggerTest::NextRandom(Seed);
+		}
+
+		for (const FWriteCase& Case : Cases)
+		{
+			FFileWriteBackendSettings Settings;
+			Settings.DirectIOThreshold = Case.DirectIOThreshold;
+			TSharedPtr<IFileWriteBackend, ESPMode::ThreadSafe> Backend = IFileWriteBackend::Create(Case.Type, Settings);
+			if (Case.Type != EFileWriteBackend::Blocking && FCString::Strcmp(Backend->GetName(), TEXT("io_uring")) != 0)
+			{
+				AddWarning(FString::Printf(TEXT("%s is not available, not measured"), Case.Name));
+				continue;
+			}
+			IFileManager::Get().DeleteDirectory(*Dir, false, true);
+			IFileManager::Get().MakeDirectory(*Dir, true);
+
+			// Frames are written from the thread pool like the async workers do, each write owns a copy of the frame
+			FThreadSafeCounter NumFailed;
+			const double Start = FPlatformTime::Seconds();
+			ParallelFor(NumFiles, [&](int32 Index)
+			{
+				TArray<uint8> Data(Frame);
+				Backend->Write(Dir / FString::Printf(TEXT("%06d.bin"), Index), MoveTemp(Data), [&NumFailed](bool bSuccess)
+				{
+					if (!bSuccess)
+					{
+						NumFailed.Increment();
+					}
+				});
+			});
+			Backend->Flush();
+			const double Elapsed = FPlatformTime::Seconds() - Start;
+			Backend.Reset();
+
+			TestEqual(FString::Printf(TEXT("%s failed writes"), Case.Name), NumFailed.GetValue(), 0);
+			UE_LOG(LogTemp, Display, TEXT("%-18s %5d x %5lld KB %8.1f MB/s %8.1f files/s"), Case.Name, NumFiles, FileSize / 1024,
+				(double)NumFiles * FileSize / Elapsed / 1e6, NumFiles / Elapsed);
+		}
+	}
+	IFileManager::Get().DeleteDirectory(*Dir, false, true);
+	return true;
+}
+
+#endif
@@ -0,0 +1,181 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "OpticalFlowGenerator.h"
+#include "PixelFormatConversion.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	const float FlowMaxDepth = 10000.0f;
+	const float FlowOcclusionTolerance = 0.01f;
+
+	// Slanted floor with a box in front of it, the top rows are sky beyond the maximum depth
+	void MakeFlowDepth(int32 Width, int32 Height, TArray<FFloat16Color>& Out)
+	{
+		Out.SetNumUninitialized(Width * Height);
+		for (int32 Y = 0; Y < Height; ++Y)
+		{
+			for (int32 X = 0; X < Width; ++X)
+			{
+				float Centimeters = Y < Height / 6 ? 2.0f * FlowMaxDepth : 400.0f + 7.0f * X + 3.0f * Y;
+				if (FMath::Abs(X - Width / 2) < Width / 6 && FMath::Abs(Y - Height / 2) < Height / 5)
+				{
+					Centimeters = 250.0f;
+				}
+				FFloat16Color& Pixel = Out[Y * Width + X];
+				Pixel.R = Centimeters;
+				Pixel.G = 0.0f;
+				Pixel.B = 0.0f;
+				Pixel.A = 1.0f;
+			}
+		}
+	}
+
+	void ComputeFlow(const TArray<FFloat16Color>& DepthA, const TArray<FFloat16Color>& DepthB, int32 Width, int32 Height,
+		const FTransform& PoseA, const FTransform& PoseB, TArray<uint16>& OutFlow, TArray<uint8>& OutMask)
+	{
+		const FPointCloudCamera CameraA = FPointCloudCamera::FromPose(PoseA, 90.0f, Width, Height);
+		const FPointCloudCamera CameraB = FPointCloudCamera::FromPose(PoseB, 90.0f, Width, Height);
+		OutFlow.SetNumUninitialized(3 * Width * Height);
+		OutMask.SetNumUninitialized(Width * Height);
+		FOpticalFlowGenerator::ComputeFlow((const uint16*)DepthA.GetData(), (const uint16*)DepthB.GetData(), Width, Height, CameraA, CameraB,
+			FlowMaxDepth, FlowOcclusionTolerance, OutFlow.GetData(), OutMask.GetData());
+	}
+
+	// Restores the instruction set the kernels used before the test
+	struct FFlowSimdLevelScope
+	{
+		EVisionSimdLevel Saved;
+		FFlowSimdLevelScope() : Saved(FPixelFormatConversion::GetSimdLevel()) {}
+		~FFlowSimdLevelScope() { FPixelFormatConversion::SetMaxSimdLevel(Saved); }
+	};
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisionOpticalFlowTest, "VisionLogger.OpticalFlow.KnownPoseChange", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FVisionOpticalFlowTest::RunTest(const FString& Parameters)
+{
+	// Odd size, every row ends in a scalar tail after the 4 pixel blocks
+	const int32 Width = 67;
+	const int32 Height = 41;
+	const float Step = 10.0f;
+	TArray<FFloat16Color> Depth;
+	MakeFlowDepth(Width, Height, Depth);
+
+	// The camera moves Step cm to the right: static points move left by focal length * Step / depth, rows and depths stay
+	const FTransform PoseA = FTransform::Identity;
+	const FTransform PoseB(FVector(0.0f, Step, 0.0f));
+	const float FocalLength = FPointCloudCamera::FromPose(PoseA, 90.0f, Width, Height).FocalLength;
+	const int32 NumPixels = Width * Height;
+
+	FFlowSimdLevelScope LevelScope;
+	FPixelFormatConversion::SetMaxSimdLevel(EVisionSimdLevel::Scalar);
+	TArray<uint16> ScalarFlow;
+	TArray<uint8> ScalarMask;
+	ComputeFlow(Depth, Depth, Width, Height, PoseA, PoseB, ScalarFlow, ScalarMask);
+
+	int32 NumValid = 0;
+	int32 NumWrong = 0;
+	for (int32 Y = 0; Y < Height; ++Y)
+	{
+		for (int32 X = 0; X < Width; ++X)
+		{
+			const int32 Index = Y * Width + X;
+			const float Centimeters = Depth[Index].R.GetFloat();
+			const bool bHasDepth = Centimeters <= FlowMaxDepth;
+			if (bHasDepth != ((ScalarMask[Index] & FlowMaskValid) != 0))
+			{
+				NumWrong++;
+				continue;
+			}
+			if (!bHasDepth)
+			{
+				continue;
+			}
+			++NumValid;
+			const float ExpectedU = -FocalLength * Step / Centimeters;
+			const float U = FPointCloudGenerator::HalfToFloat(ScalarFlow[Index]);
+			const float V = FPointCloudGenerator::HalfToFloat(ScalarFlow[NumPixels + Index]);
+			const float DepthChange = FPointCloudGenerator::HalfToFloat(ScalarFlow[2 * NumPixels + Index]);
+			// Pixels landing right at the image border may round either way
+			const float TargetX = X + ExpectedU + 0.5f;
+			const bool bOutOfViewWrong = FMath::Abs(TargetX) > 0.05f && (TargetX < 0.0f) != ((ScalarMask[Index] & FlowMaskOutOfView) != 0);
+			if (FMath::Abs(U - ExpectedU) > 0.01f + FMath::Abs(ExpectedU) / 500.0f || FMath::Abs(V) > 0.01f || FMath::Abs(DepthChange) > 0.5f || bOutOfViewWrong)
+			{
+				if (NumWrong++ < 10)
+				{
+					AddError(FString::Printf(TEXT("Pixel %d,%d: flow %.3f,%.3f depth change %.2f mask %d, expected %.3f,0"), X, Y, U, V, DepthChange, ScalarMask[Index], ExpectedU));
+				}
+			}
+		}
+	}
+	TestTrue(TEXT("Sky and scene pixels"), NumValid > 0 && NumValid < NumPixels);
+	TestEqual(TEXT("Pixels differing from the known pose change"), NumWrong, 0);
+
+	// The SSE path has to match the scalar one bit for bit, including the mask
+	FPixelFormatConversion::SetMaxSimdLevel(EVisionSimdLevel::SSE);
+	if (FPixelFormatConversion::GetSimdLevel() != EVisionSimdLevel::SSE)
+	{
+		AddWarning(TEXT("SSE is not supported by this CPU, not compared"));
+		return true;
+	}
+	const FTransform Poses[] = { PoseB, FTransform(FRotator(2.0f, 3.0f, 1.0f), FVector(-20.0f, 5.0f, 3.0f)) };
+	for (const FTransform& Pose : Poses)
+	{
+		FPixelFormatConversion::SetMaxSimdLevel(EVisionSimdLevel::Scalar);
+		ComputeFlow(Depth, Depth, Width, Height, PoseA, Pose, ScalarFlow, ScalarMask);
+		FPixelFormatConversion::SetMaxSimdLevel(EVisionSimdLevel::SSE);
+		TArray<uint16> SimdFlow;
+		TArray<uint8> SimdMask;
+		ComputeFlow(Depth, Depth, Width, Height, PoseA, Pose, SimdFlow, SimdMask);
+		TestTrue(FString::Printf(TEXT("SSE flow matches the scalar flow for %s"), *Pose.ToHumanReadableString()), SimdFlow == ScalarFlow);
+		TestTrue(FString::Printf(TEXT("SSE mask matches the scalar mask for %s"), *Pose.ToHumanReadableString()), SimdMask == ScalarMask);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisionOpticalFlowBenchmark, "VisionLogger.Benchmark.OpticalFlow", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+bool FVisionOpticalFlowBenchmark::RunTest(const FString& Parameters)
+{
+	// One worker has to keep up with 30 Hz at 640x480
+	const FIntPoint Sizes[] = { FIntPoint(640, 480), FIntPoint(1280, 720) };
+	const double TargetSeconds = 1.0 / 30.0;
+	const int32 NumRuns = 10;
+	const FTransform PoseB(FRotator(0.5f, 1.0f, 0.0f), FVector(3.0f, 2.0f, 1.0f));
+	FFlowSimdLevelScope LevelScope;
+	for (const FIntPoint& Size : Sizes)
+	{
+		TArray<FFloat16Color> Depth;
+		MakeFlowDepth(Size.X, Size.Y, Depth);
+		TArray<uint16> Flow;
+		TArray<uint8> Mask;
+		for (EVisionSimdLevel Level : { EVisionSimdLevel::Scalar, EVisionSimdLevel::SSE })
+		{
+			FPixelFormatConversion::SetMaxSimdLevel(Level);
+			if (FPixelFormatConversion::GetSimdLevel() != Level)
+			{
+				continue;
+			}
+			double Best = MAX_dbl;
+			for (int32 Run = 0; Run < NumRuns; ++Run)
+			{
+				const double Start = FPlatformTime::Seconds();
+				ComputeFlow(Depth, Depth, Size.X, Size.Y, FTransform::Identity, PoseB, Flow, Mask);
+				Best = FMath::Min(Best, FPlatformTime::Seconds() - Start);
+			}
+			UE_LOG(LogTemp, Display, TEXT("%dx%d flow %-6s %7.2f ms/frame %6.1f frames/s"), Size.X, Size.Y,
+				Level == EVisionSimdLevel::Scalar ? TEXT("Scalar") : TEXT("SSE"), Best * 1000.0, 1.0 / Best);
+			if (Size.X == 640 && Level != EVisionSimdLevel::Scalar && Best > TargetSeconds)
+			{
+				AddWarning(FString::Printf(TEXT("640x480 flow takes %.2f ms, more than a 30 Hz frame"), Best * 1000.0));
+			}
+		}
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,74 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "ParallelPngEncoder.h"
+#include "VisionLoggerTestUtils.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisionPngEncoderBenchmark, "VisionLogger.Benchmark.ParallelPngEncoder", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+bool FVisionPngEncoderBenchmark::RunTest(const FString& Parameters)
+{
+	const int32 Width = 3840;
+	const int32 Height = 2160;
+	const int32 Level = 3;
+	const int32 NumRuns = 3;
+	const int32 StripeCounts[] = { 1, 2, 4, 8 };
+
+	// Gradients with some noise, closer to a rendered frame than pure noise which does not compress
+	TArray<FColor> Frame;
+	Frame.SetNumUninitialized(Width * Height);
+	uint32 Seed = 11;
+	for (int32 Y = 0; Y < Height; ++Y)
+	{
+		for (int32 X = 0; X < Width; ++X)
+		{
+			const uint32 Noise = VisionLoggerTest::NextRandom(Seed) & 7;
+			Frame[Y * Width + X] = FColor((uint8)(X * 255 / Width + Noise), (uint8)(Y * 255 / Height), (uint8)((X + Y) / 24 + Noise), 255);
+		}
+	}
+
+	// The speedup is bounded by the cores of the machine
+	UE_LOG(LogTemp, Display, TEXT("%d logical cores"), FPlatformMisc::NumberOfCoresIncludingHyperthreads());
+	double SingleStripeSeconds = 0.0;
+	TArray<uint8> Png;
+	for (int32 NumStripes : StripeCounts)
+	{
+		// Best of a few runs, the first one also sizes the output
+		double Best = MAX_dbl;
+		bool bEncoded = true;
+		for (int32 Run = 0; Run < NumRuns; ++Run)
+		{
+			const double Start = FPlatformTime::Seconds();
+			bEncoded &= FParallelPngEncoder::EncodeBGRA(Frame.GetData(), Width, Height, NumStripes, Level, Png);
+			Best = FMath::Min(Best, FPlatformTime::Seconds() - Start);
+		}
+		if (!TestTrue(FString::Printf(TEXT("%d stripes encoded"), NumStripes), bEncoded))
+		{
+			continue;
+		}
+		if (NumStripes == 1)
+		{
+			SingleStripeSeconds = Best;
+		}
+
+		// The stripes have to decode to the source frame
+		VisionLoggerTest::FDecodedPng Decoded;
+		bool bMatches = VisionLoggerTest::DecodePng(Png, Decoded) && Decoded.Width == Width && Decoded.Height == Height
+			&& Decoded.BitDepth == 8 && Decoded.Channels == 3;
+		for (int32 i = 0; bMatches && i < Frame.Num(); ++i)
+		{
+			const uint8* Rgb = &Decoded.Samples[i * 3];
+			bMatches = Rgb[0] == Frame[i].R && Rgb[1] == Frame[i].G && Rgb[2] == Frame[i].B;
+		}
+		TestTrue(FString::Printf(TEXT("%d stripes decode to the source frame"), NumStripes), bMatches);
+
+		UE_LOG(LogTemp, Display, TEXT("%dx%d PNG level %d, %d stripes: %7.1f ms, %5.2fx, %.1f MB"), Width, Height, Level, NumStripes,
+			Best * 1000.0, SingleStripeSeconds > 0.0 ? SingleStripeSeconds / Best : 0.0, Png.Num() / 1e6);
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,186 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "PixelFormatConversion.h"
+#include "VisionLoggerTestUtils.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	const EVisionPixelFormat ConvertedFormats[] = { EVisionPixelFormat::RGB24, EVisionPixelFormat::Gray8, EVisionPixelFormat::PlanarRGB,
+		EVisionPixelFormat::YUV420, EVisionPixelFormat::NV12 };
+
+	const TCHAR* SimdLevelNames[] = { TEXT("Scalar"), TEXT("SSE"), TEXT("AVX2") };
+
+	// Bytes after the converted frame that no kernel may touch
+	const int32 GuardBytes = 64;
+	const uint8 GuardValue = 0xA5;
+
+	const TCHAR* GetFormatName(EVisionPixelFormat Format)
+	{
+		switch (Format)
+		{
+		case EVisionPixelFormat::RGB24: return TEXT("RGB24");
+		case EVisionPixelFormat::Gray8: return TEXT("Gray8");
+		case EVisionPixelFormat::PlanarRGB: return TEXT("PlanarRGB");
+		case EVisionPixelFormat::YUV420: return TEXT("YUV420");
+		case EVisionPixelFormat::NV12: return TEXT("NV12");
+		default: return TEXT("BGRA8");
+		}
+	}
+
+	void MakeFrame(int32 Width, int32 Height, uint32 Seed, TArray<FColor>& Out)
+	{
+		Out.SetNumUninitialized(Width * Height);
+		for (FColor& Pixel : Out)
+		{
+			const uint32 Value = VisionLoggerTest::NextRandom(Seed);
+			Pixel = FColor((uint8)Value, (uint8)(Value >> 8), (uint8)(Value >> 16), (uint8)(Value >> 4));
+		}
+		// Saturated pixels exercise the rounding and clamping of the luma and chroma kernels
+		if (Out.Num() > 1)
+		{
+			Out[0] = FColor(255, 255, 255, 255);
+			Out[Out.Num() - 1] = FColor(0, 0, 0, 0);
+		}
+	}
+
+	// Calls the kernel of the format directly, like Convert but into a buffer with guard bytes behind the frame
+	void ConvertGuarded(EVisionPixelFormat Format, const FColor* Src, int32 Width, int32 Height, TArray<uint8>& Out)
+	{
+		const int32 NumPixels = Width * Height;
+		const int32 NumChroma = ((Width + 1) / 2) * ((Height + 1) / 2);
+		Out.Init(GuardValue, FPixelFormatConversion::GetConvertedSize(Format, Width, Height) + GuardBytes);
+		uint8* Dst = Out.GetData();
+		switch (Format)
+		{
+		case EVisionPixelFormat::RGB24:
+			FPixelFormatConversion::BGRAToRGB24(Src, Dst, NumPixels);
+			break;
+		case EVisionPixelFormat::Gray8:
+			FPixelFormatConversion::BGRAToGray8(Src, Dst, NumPixels);
+			break;
+		case EVisionPixelFormat::PlanarRGB:
+			FPixelFormatConversion::BGRAToPlanarRGB(Src, Dst, Dst + NumPixels, Dst + 2 * NumPixels, NumPixels);
+			break;
+		case EVisionPixelFormat::YUV420:
+			FPixelFormatConversion::BGRAToYUV420(Src, Width, Height, Dst, Dst + NumPixels, Dst + NumPixels + NumChroma);
+			break;
+		case EVisionPixelFormat::NV12:
+			FPixelFormatConversion::BGRAToNV12(Src, Width, Height, Dst, Dst + NumPixels);
+			break;
+		default:
+			break;
+		}
+	}
+
+	// Restores the instruction set the kernels used before the test
+	struct FSimdLevelScope
+	{
+		EVisionSimdLevel Saved;
+		FSimdLevelScope() : Saved(FPixelFormatConversion::GetSimdLevel()) {}
+		~FSimdLevelScope() { FPixelFormatConversion::SetMaxSimdLevel(Saved); }
+	};
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisionSimdConversionTest, "VisionLogger.PixelFormatConversion.SimdMatchesScalar", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FVisionSimdConversionTest::RunTest(const FString& Parameters)
+{
+	FSimdLevelScope LevelScope;
+	for (EVisionSimdLevel Level : { EVisionSimdLevel::SSE, EVisionSimdLevel::AVX2 })
+	{
+		FPixelFormatConversion::SetMaxSimdLevel(Level);
+		if (FPixelFormatConversion::GetSimdLevel() != Level)
+		{
+			AddWarning(FString::Printf(TEXT("%s is not supported by this CPU, not compared"), SimdLevelNames[(int32)Level]));
+			continue;
+		}
+
+		// Every size up to 64 covers the tails after the 4, 8 and 16 pixel blocks and odd chroma rows and columns
+		int32 NumMismatches = 0;
+		TArray<FColor> Frame;
+		TArray<uint8> Expected;
+		TArray<uint8> Actual;
+		for (int32 Height = 1; Height <= 64; ++Height)
+		{
+			for (int32 Width = 1; Width <= 64; ++Width)
+			{
+				MakeFrame(Width, Height, Width * 131 + Height, Frame);
+				for (EVisionPixelFormat Format : ConvertedFormats)
+				{
+					FPixelFormatConversion::SetMaxSimdLevel(EVisionSimdLevel::Scalar);
+					ConvertGuarded(Format, Frame.GetData(), Width, Height, Expected);
+					FPixelFormatConversion::SetMaxSimdLevel(Level);
+					ConvertGuarded(Format, Frame.GetData(), Width, Height, Actual);
+					// Guard bytes are compared too, a kernel writing past the frame differs from the scalar one
+					if (Actual != Expected && NumMismatches++ < 10)
+					{
+						AddError(FString::Printf(TEXT("%s %s differs from the scalar kernel at %dx%d"), SimdLevelNames[(int32)Level], GetFormatName(Format), Width, Height));
+					}
+				}
+			}
+		}
+		TestEqual(FString::Printf(TEXT("%s frames differing from the scalar kernels"), SimdLevelNames[(int32)Level]), NumMismatches, 0);
+	}
+
+	// The scalar kernels themselves stay within the frame
+	FPixelFormatConversion::SetMaxSimdLevel(EVisionSimdLevel::Scalar);
+	TArray<FColor> Frame;
+	TArray<uint8> Out;
+	MakeFrame(7, 5, 1, Frame);
+	for (EVisionPixelFormat Format : ConvertedFormats)
+	{
+		ConvertGuarded(Format, Frame.GetData(), 7, 5, Out);
+		bool bGuardIntact = true;
+		for (int32 i = Out.Num() - GuardBytes; i < Out.Num(); ++i)
+		{
+			bGuardIntact &= Out[i] == GuardValue;
+		}
+		TestTrue(FString::Printf(TEXT("Scalar %s stays within the frame"), GetFormatName(Format)), bGuardIntact);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisionConversionBenchmark, "VisionLogger.Benchmark.PixelFormatConversion", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+bool FVisionConversionBenchmark::RunTest(const FString& Parameters)
+{
+	// Throughput of every kernel at every supported instruction set on a 1080p frame, in GB/s of BGRA input
+	const int32 Width = 1920;
+	const int32 Height = 1080;
+	const double MinSeconds = 0.25;
+	FSimdLevelScope LevelScope;
+	TArray<FColor> Frame;
+	MakeFrame(Width, Height, 3, Frame);
+	TArray<uint8> Out;
+	for (EVisionPixelFormat Format : ConvertedFormats)
+	{
+		for (EVisionSimdLevel Level : { EVisionSimdLevel::Scalar, EVisionSimdLevel::SSE, EVisionSimdLevel::AVX2 })
+		{
+			FPixelFormatConversion::SetMaxSimdLevel(Level);
+			if (FPixelFormatConversion::GetSimdLevel() != Level)
+			{
+				continue;
+			}
+			// One untimed run allocates the output
+			FPixelFormatConversion::Convert(Format, Frame.GetData(), Width, Height, Out);
+			int32 NumRuns = 0;
+			const double Start = FPlatformTime::Seconds();
+			double Elapsed = 0.0;
+			do
+			{
+				FPixelFormatConversion::Convert(Format, Frame.GetData(), Width, Height, Out);
+				++NumRuns;
+				Elapsed = FPlatformTime::Seconds() - Start;
+			} while (Elapsed < MinSeconds);
+			const double GBps = (double)Frame.Num() * sizeof(FColor) * NumRuns / Elapsed / 1e9;
+			UE_LOG(LogTemp, Display, TEXT("%-10s %-6s %7.3f ms/frame %6.2f GB/s"), GetFormatName(Format), SimdLevelNames[(int32)Level], Elapsed * 1000.0 / NumRuns, GBps);
+		}
+	}
+	return true;
+}
+
+#endif
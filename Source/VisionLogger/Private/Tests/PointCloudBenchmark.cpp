@@ -0,0 +1,116 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "PointCloudGenerator.h"
+#include "VisionLoggerTestUtils.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	// Shortest of NumRuns calls of Function in seconds
+	template<typename FunctionType>
+	double BestOf(int32 NumRuns, FunctionType Function)
+	{
+		double Best = MAX_dbl;
+		for (int32 Run = 0; Run < NumRuns; ++Run)
+		{
+			const double Start = FPlatformTime::Seconds();
+			Function();
+			Best = FMath::Min(Best, FPlatformTime::Seconds() - Start);
+		}
+		return Best;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisionPointCloudBenchmark, "VisionLogger.Benchmark.PointCloud", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+bool FVisionPointCloudBenchmark::RunTest(const FString& Parameters)
+{
+	const int32 Width = 1280;
+	const int32 Height = 720;
+	const float MaxDepth = 10000.0f;
+	const int32 NumRuns = 5;
+
+	// Floor below the horizon, a wall above it and a box in the middle, the top rows are sky beyond MaxDepth
+	TArray<FFloat16Color> Depth;
+	TArray<FColor> Colors;
+	Depth.SetNumUninitialized(Width * Height);
+	Colors.SetNumUninitialized(Width * Height);
+	uint32 Seed = 5;
+	int32 NumValid = 0;
+	for (int32 Y = 0; Y < Height; ++Y)
+	{
+		for (int32 X = 0; X < Width; ++X)
+		{
+			float Centimeters = Y < Height / 8 ? 2.0f * MaxDepth : 3000.0f;
+			if (Y > Height / 2)
+			{
+				Centimeters = FMath::Min(3000.0f, 150.0f * Height / (2.0f * Y - Height) * 10.0f);
+			}
+			if (FMath::Abs(X - Width / 2) < Width / 8 && FMath::Abs(Y - Height / 2) < Height / 6)
+			{
+				Centimeters = 600.0f + (X % 64);
+			}
+			FFloat16Color& Pixel = Depth[Y * Width + X];
+			Pixel.R = Centimeters;
+			Pixel.G = 0.0f;
+			Pixel.B = 0.0f;
+			Pixel.A = 1.0f;
+			NumValid += Pixel.R.GetFloat() <= MaxDepth;
+			const uint32 Value = VisionLoggerTest::NextRandom(Seed);
+			Colors[Y * Width + X] = FColor((uint8)Value, (uint8)(Value >> 8), (uint8)(Value >> 16), 255);
+		}
+	}
+
+	const FPointCloudCamera Camera = FPointCloudCamera::FromPose(FTransform::Identity, 90.0f, Width, Height);
+	const float Rotation[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	FPointCloud Points;
+	const double BackProjectSeconds = BestOf(NumRuns, [&]()
+	{
+		FPointCloudGenerator::BackProject((const uint16*)Depth.GetData(), Width, Height, Camera, MaxDepth, Points);
+	});
+	TestEqual(TEXT("Back-projected points"), Points.Num(), NumValid);
+	const double ColorSeconds = BestOf(NumRuns, [&]()
+	{
+		FPointCloudGenerator::AttachColors(Colors.GetData(), Points);
+	});
+	UE_LOG(LogTemp, Display, TEXT("%dx%d depth, %d points: back-projection %6.2f ms (%.1f Mpoints/s), colors %6.2f ms"), Width, Height,
+		Points.Num(), BackProjectSeconds * 1000.0, Points.Num() / BackProjectSeconds / 1e6, ColorSeconds * 1000.0);
+
+	TArray<uint8> Data;
+	for (float VoxelSize : { 0.0f, 2.0f, 10.0f })
+	{
+		FPointCloud Downsampled;
+		const FPointCloud* Cloud = &Points;
+		double DownsampleSeconds = 0.0;
+		if (VoxelSize > 0.0f)
+		{
+			DownsampleSeconds = BestOf(NumRuns, [&]()
+			{
+				FPointCloudGenerator::VoxelDownsample(Points, VoxelSize, Downsampled);
+			});
+			TestTrue(FString::Printf(TEXT("%.0f cm voxels reduce the points"), VoxelSize), Downsampled.Num() > 0 && Downsampled.Num() < Points.Num());
+			Cloud = &Downsampled;
+		}
+
+		const double CompactSeconds = BestOf(NumRuns, [&]()
+		{
+			FPointCloudGenerator::SerializeCompact(*Cloud, 1, 0, Camera, Rotation, VoxelSize, MaxDepth, Data);
+		});
+		// 64 byte header, 16 bit positions and 8 bit colors
+		TestEqual(FString::Printf(TEXT("Compact size at %.0f cm voxels"), VoxelSize), (int64)Data.Num(), 64 + 9 * (int64)Cloud->Num());
+		const int32 CompactBytes = Data.Num();
+		const double PlySeconds = BestOf(NumRuns, [&]()
+		{
+			FPointCloudGenerator::SerializePLY(*Cloud, Data);
+		});
+
+		UE_LOG(LogTemp, Display, TEXT("voxel %4.1f cm, %7d points: downsample %6.2f ms, compact %6.2f ms (%.1f MB), PLY %6.2f ms (%.1f MB)"),
+			VoxelSize, Cloud->Num(), DownsampleSeconds * 1000.0, CompactSeconds * 1000.0, CompactBytes / 1e6, PlySeconds * 1000.0, Data.Num() / 1e6);
+	}
+	return true;
+}
+
+#endif
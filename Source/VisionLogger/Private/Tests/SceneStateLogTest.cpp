@@ -0,0 +1,223 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/Paths.h"
+#include "HAL/FileManager.h"
+#include "Engine/World.h"
+#include "GameFramework/Actor.h"
+#include "Components/SceneComponent.h"
+#include "SceneStateLog.h"
+#include "vl_scene_state.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+// The reader is not part of the module, the tests decode the logs with the client library itself
+#include "../../../../Client/src/vl_scene_state.cpp"
+
+namespace
+{
+	const int32 SceneTestBlockFrames = 64;
+
+	// Transient world with movable actors to log
+	struct FSceneStateTestWorld
+	{
+		UWorld* World;
+		TArray<AActor*> Actors;
+
+		explicit FSceneStateTestWorld(int32 NumActors)
+		{
+			World = UWorld::CreateWorld(EWorldType::Game, false);
+			Actors.Reserve(NumActors);
+			for (int32 i = 0; i < NumActors; ++i)
+			{
+				AActor* Actor = World->SpawnActor<AActor>();
+				USceneComponent* Root = NewObject<USceneComponent>(Actor);
+				Root->SetMobility(EComponentMobility::Movable);
+				Actor->SetRootComponent(Root);
+				Root->RegisterComponent();
+				Actor->SetActorLocation(FVector(i, 2.0f * i, 100.0f));
+				Actors.Add(Actor);
+			}
+		}
+
+		~FSceneStateTestWorld()
+		{
+			World->DestroyWorld(false);
+			World->RemoveFromRoot();
+		}
+
+		// Every MoveEvery-th actor moves half a centimeter along X and turns around Z
+		void Move(int32 Frame, int32 MoveEvery)
+		{
+			for (int32 i = 0; i < Actors.Num(); i += MoveEvery)
+			{
+				Actors[i]->SetActorLocationAndRotation(Actors[i]->GetActorLocation() + FVector(0.5f, 0.0f, 0.0f),
+					FQuat(FVector::UpVector, 0.02f * Frame));
+			}
+		}
+
+		TArray<FSceneStateActor> Labels() const
+		{
+			TArray<FSceneStateActor> Labelled;
+			for (int32 i = 0; i < Actors.Num(); ++i)
+			{
+				FSceneStateActor Label;
+				Label.Actor = Actors[i];
+				Label.CategoryId = i % 7;
+				Label.InstanceId = i / 7;
+				Label.Category = TEXT("Box");
+				Labelled.Add(Label);
+			}
+			return Labelled;
+		}
+	};
+
+	FDateTime SceneTestStamp(const FDateTime& Start, int32 Frame)
+	{
+		// 30 Hz in 100 ns ticks
+		return FDateTime(Start.GetTicks() + Frame * 333333);
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisionSceneStateRoundTripTest, "VisionLogger.SceneState.RoundTrip", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FVisionSceneStateRoundTripTest::RunTest(const FString& Parameters)
+{
+	// Two full blocks and a partial one
+	const int32 NumActors = 50;
+	const int32 NumFrames = 150;
+	const int32 MoveEvery = 10;
+	const int32 MovingId = 20;
+	const int32 StaticId = 21;
+	const FString Path = FPaths::ProjectSavedDir() / TEXT("VisionLoggerTest") / TEXT("RoundTrip.vlscene");
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(Path), true);
+
+	FSceneStateTestWorld Scene(NumActors);
+	const FDateTime Start(2018, 1, 1);
+	TArray<FTransform> Truth;
+	{
+		FSceneStateWriter Writer;
+		if (!TestTrue(TEXT("Log opened"), Writer.Open(Path, Start, SceneTestBlockFrames)))
+		{
+			return false;
+		}
+		Writer.AddActors(Scene.Labels());
+		for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+		{
+			Scene.Move(Frame, MoveEvery);
+			Truth.Add(Scene.Actors[MovingId]->GetActorTransform());
+			Writer.WriteFrame(1000 + 2 * Frame, SceneTestStamp(Start, Frame));
+		}
+		Writer.Close();
+	}
+
+	vl::SceneStateReader Reader;
+	if (!TestTrue(TEXT("Log read"), Reader.open(TCHAR_TO_UTF8(*Path))))
+	{
+		return false;
+	}
+	TestTrue(TEXT("Log has an index"), Reader.has_index());
+	TestEqual(TEXT("Blocks"), (int32)Reader.block_count(), (NumFrames + SceneTestBlockFrames - 1) / SceneTestBlockFrames);
+	TestEqual(TEXT("Actors"), (int32)Reader.actors().size(), NumActors);
+	TestEqual(TEXT("Actor by category and instance"), Reader.find_actor(MovingId % 7, MovingId / 7), MovingId);
+	TestEqual(TEXT("Actor by name"), Reader.find_actor(TCHAR_TO_UTF8(*Scene.Actors[MovingId]->GetName())), MovingId);
+
+	// The moving actor has a sample in every frame, within half a quantization step of the logged transform
+	std::vector<vl::ScenePose> Poses;
+	TestTrue(TEXT("Trajectory decoded"), Reader.trajectory(MovingId, Poses));
+	TestEqual(TEXT("Trajectory samples"), (int32)Poses.size(), NumFrames);
+	const int64 StartNs = (Start - FDateTime(1970, 1, 1)).GetTicks() * 100;
+	const float LocationTolerance = FSceneStateWriter::LocationStep * 0.5f + 1.0e-3f;
+	const float RotationTolerance = FSceneStateWriter::RotationStep * 2.0f;
+	int32 NumWrong = 0;
+	for (int32 Frame = 0; Frame < (int32)Poses.size() && Frame < NumFrames; ++Frame)
+	{
+		const vl::ScenePose& Pose = Poses[Frame];
+		const FVector Location = Truth[Frame].GetLocation();
+		const FQuat Rotation = Truth[Frame].GetRotation();
+		// q and -q are the same rotation
+		const float Sign = Rotation.X * Pose.rotation[0] + Rotation.Y * Pose.rotation[1] + Rotation.Z * Pose.rotation[2] + Rotation.W * Pose.rotation[3] < 0.0f ? -1.0f : 1.0f;
+		const bool bMatches = Pose.frame == (uint64)(1000 + 2 * Frame) && Pose.timestamp_ns == StartNs + Frame * 33333300LL
+			&& FMath::Abs(Pose.location[0] - Location.X) <= LocationTolerance
+			&& FMath::Abs(Pose.location[1] - Location.Y) <= LocationTolerance
+			&& FMath::Abs(Pose.location[2] - Location.Z) <= LocationTolerance
+			&& FMath::Abs(Sign * Pose.rotation[0] - Rotation.X) <= RotationTolerance
+			&& FMath::Abs(Sign * Pose.rotation[1] - Rotation.Y) <= RotationTolerance
+			&& FMath::Abs(Sign * Pose.rotation[2] - Rotation.Z) <= RotationTolerance
+			&& FMath::Abs(Sign * Pose.rotation[3] - Rotation.W) <= RotationTolerance
+			&& FMath::Abs(Pose.scale[0] - 1.0f) <= FSceneStateWriter::ScaleStep;
+		if (!bMatches && NumWrong++ < 10)
+		{
+			AddError(FString::Printf(TEXT("Frame %d: logged %llu at %.3f,%.3f,%.3f, expected %d at %s"), Frame, Pose.frame,
+				Pose.location[0], Pose.location[1], Pose.location[2], 1000 + 2 * Frame, *Location.ToString()));
+		}
+	}
+	TestEqual(TEXT("Samples differing from the actor"), NumWrong, 0);
+
+	// A static actor is only stored in the first block and holds its pose
+	TestTrue(TEXT("Static trajectory decoded"), Reader.trajectory(StaticId, Poses));
+	TestEqual(TEXT("Static trajectory samples"), (int32)Poses.size(), SceneTestBlockFrames);
+	vl::ScenePose Held;
+	TestTrue(TEXT("Static pose in the last frame"), Reader.pose_at(StaticId, 1000 + 2 * (NumFrames - 1), Held));
+	TestTrue(TEXT("Static location held"), FMath::Abs(Held.location[1] - 2.0f * StaticId) <= LocationTolerance);
+
+	Reader.close();
+	IFileManager::Get().Delete(*Path);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisionSceneStateBenchmark, "VisionLogger.Benchmark.SceneState", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+bool FVisionSceneStateBenchmark::RunTest(const FString& Parameters)
+{
+	// Sampling runs on the game thread every captured frame, it has to stay well below a 30 Hz frame
+	const int32 NumActors = 10000;
+	const int32 NumFrames = 4 * SceneTestBlockFrames;
+	const int32 MoveEveryCases[] = { 100, 10, 1 };
+	const double TargetSeconds = 1.0 / 30.0;
+	const FString Path = FPaths::ProjectSavedDir() / TEXT("VisionLoggerBenchmark") / TEXT("SceneState.vlscene");
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(Path), true);
+
+	FSceneStateTestWorld Scene(NumActors);
+	const FDateTime Start(2018, 1, 1);
+	for (int32 MoveEvery : MoveEveryCases)
+	{
+		FSceneStateWriter Writer;
+		if (!TestTrue(TEXT("Log opened"), Writer.Open(Path, Start, SceneTestBlockFrames)))
+		{
+			return false;
+		}
+		Writer.AddActors(Scene.Labels());
+
+		// Moving the actors is not part of the measurement
+		double WriteSeconds = 0.0;
+		double WorstFrame = 0.0;
+		for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+		{
+			Scene.Move(Frame, MoveEvery);
+			const double FrameStart = FPlatformTime::Seconds();
+			Writer.WriteFrame(Frame, SceneTestStamp(Start, Frame));
+			const double Elapsed = FPlatformTime::Seconds() - FrameStart;
+			WriteSeconds += Elapsed;
+			WorstFrame = FMath::Max(WorstFrame, Elapsed);
+		}
+		const double CloseStart = FPlatformTime::Seconds();
+		Writer.Close();
+		const double CloseSeconds = FPlatformTime::Seconds() - CloseStart;
+		const int64 FileSize = IFileManager::Get().FileSize(*Path);
+
+		const int32 NumBlocks = NumFrames / SceneTestBlockFrames;
+		UE_LOG(LogTemp, Display, TEXT("%d actors, %5d moving: WriteFrame %6.3f ms/frame (worst %6.3f ms), EncodeBlock %7.2f ms/block, close %6.2f ms, %.1f KB/frame"),
+			NumActors, (NumActors + MoveEvery - 1) / MoveEvery, WriteSeconds / NumFrames * 1000.0, WorstFrame * 1000.0,
+			Writer.GetEncodeSeconds() / NumBlocks * 1000.0, CloseSeconds * 1000.0, FileSize / 1024.0 / NumFrames);
+		if (MoveEvery >= 100 && WriteSeconds / NumFrames > 0.1 * TargetSeconds)
+		{
+			AddWarning(FString::Printf(TEXT("Logging %d actors takes %.2f ms per frame, more than a tenth of a 30 Hz frame"), NumActors, WriteSeconds / NumFrames * 1000.0));
+		}
+	}
+	IFileManager::Get().Delete(*Path);
+	return true;
+}
+
+#endif
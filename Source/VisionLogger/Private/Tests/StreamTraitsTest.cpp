@@ -0,0 +1,301 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "HAL/FileManager.h"
+#include "StreamAsyncWorker.h"
+#include "VisionLoggerTestUtils.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	const int32 TestWidth = 37;
+	const int32 TestHeight = 23;
+
+	// Mask colors are packed with full alpha, the read back alpha is ignored
+	uint32 PackMaskColor(FColor Color)
+	{
+		Color.A = 255;
+		return Color.DWColor();
+	}
+
+	FFloat16Color MakeDepth(float Centimeters)
+	{
+		FFloat16Color Pixel;
+		Pixel.R = Centimeters;
+		Pixel.G = 0.0f;
+		Pixel.B = 0.0f;
+		Pixel.A = 1.0f;
+		return Pixel;
+	}
+
+	template<typename PixelType>
+	bool SamePixels(const TArray<PixelType>& A, const TArray<PixelType>& B)
+	{
+		return A.Num() == B.Num() && FMemory::Memcmp(A.GetData(), B.GetData(), A.Num() * sizeof(PixelType)) == 0;
+	}
+
+	// Samples of a decoded gray PNG in the stored type, only label and depth types are saved as PNG
+	template<typename PixelType>
+	bool PngToPixels(const VisionLoggerTest::FDecodedPng& Png, TArray<PixelType>& Out)
+	{
+		return false;
+	}
+
+	template<>
+	bool PngToPixels<uint8>(const VisionLoggerTest::FDecodedPng& Png, TArray<uint8>& Out)
+	{
+		Out = Png.Samples;
+		return Png.BitDepth == 8 && Png.Channels == 1;
+	}
+
+	template<>
+	bool PngToPixels<uint16>(const VisionLoggerTest::FDecodedPng& Png, TArray<uint16>& Out)
+	{
+		// 16 bit PNG samples are big endian
+		Out.SetNumUninitialized(Png.Samples.Num() / 2);
+		for (int32 i = 0; i < Out.Num(); ++i)
+		{
+			Out[i] = (uint16)((Png.Samples[2 * i] << 8) | Png.Samples[2 * i + 1]);
+		}
+		return Png.BitDepth == 16 && Png.Channels == 1;
+	}
+
+	/**
+	 * Saves one synthetic frame with the stream worker of SourceType to PixelType (synchronously, blocking
+	 * write, raw codec unless given) and compares the written file with the traits conversion of the frame,
+	 * scaled with ResizeNearest if a scale is given. The file is deleted afterwards.
+	 */
+	template<typename SourceType, typename PixelType>
+	bool RunWorker(FAutomationTestBase& Test, const TCHAR* What, const TArray<SourceType>& Source, const FVisionStreamConversion& Conversion, float Scale,
+		EVisionImageCodec Codec = EVisionImageCodec::Raw)
+	{
+		typedef TVisionStreamTraits<PixelType> FTraits;
+		const FDateTime Stamp(2018, 5, 3, 10, 20, 1, 234);
+		const FString StreamName = TEXT("VLTEST");
+
+		FVisionStreamOutput Output;
+		Output.Codec = Codec;
+		Output.EncodeStripes = 2;
+		FVisionFrameInfo FrameInfo;
+		FrameInfo.FrameNumber = 7;
+		FrameInfo.ResolutionScale = Scale;
+		TStreamAsyncWorker<SourceType, PixelType> Worker(Source, Conversion, Stamp, StreamName, TestWidth, TestHeight, Output, FrameInfo);
+		Worker.DoWork();
+
+		TArray<PixelType> Expected;
+		Expected.SetNumUninitialized(Source.Num());
+		FTraits::Convert(Source.GetData(), Source.Num(), Conversion, Expected.GetData());
+		int32 OutWidth = TestWidth;
+		int32 OutHeight = TestHeight;
+		if (Scale < 1.0f)
+		{
+			OutWidth = FMath::Max(1, FMath::RoundToInt(TestWidth * Scale));
+			OutHeight = FMath::Max(1, FMath::RoundToInt(TestHeight * Scale));
+			TArray<PixelType> Scaled;
+			TStreamAsyncWorker<SourceType, PixelType>::ResizeNearest(Expected.GetData(), TestWidth, TestHeight, OutWidth, OutHeight, Scaled);
+			Expected = MoveTemp(Scaled);
+		}
+
+		// The file name follows from the encoder of the type
+		FVisionEncodeSettings Settings;
+		Settings.Codec = Codec;
+		TArray<uint8> Encoded;
+		FString Suffix;
+		FTraits::Encode(Expected.GetData(), OutWidth, OutHeight, Settings, Encoded, Suffix);
+		const FString Path = FPaths::ProjectSavedDir() / TEXT("viewport") / StreamName + RawDataAsyncWorker::FormatTimeStamp(Stamp) + Suffix;
+		TArray<uint8> Written;
+		const bool bLoaded = FFileHelper::LoadFileToArray(Written, *Path);
+		IFileManager::Get().Delete(*Path);
+		if (!Test.TestTrue(FString::Printf(TEXT("%s: %s written"), What, *Path), bLoaded))
+		{
+			return false;
+		}
+
+		TArray<PixelType> Decoded;
+		if (Suffix.EndsWith(TEXT(".png")))
+		{
+			VisionLoggerTest::FDecodedPng Png;
+			if (!Test.TestTrue(FString::Printf(TEXT("%s: PNG decodes"), What), VisionLoggerTest::DecodePng(Written, Png) && PngToPixels(Png, Decoded))
+				|| !Test.TestEqual(FString::Printf(TEXT("%s: PNG size"), What), Png.Width * Png.Height, OutWidth * OutHeight))
+			{
+				return false;
+			}
+		}
+		else
+		{
+			Decoded.SetNumUninitialized(Written.Num() / sizeof(PixelType));
+			FMemory::Memcpy(Decoded.GetData(), Written.GetData(), Decoded.Num() * sizeof(PixelType));
+		}
+		return Test.TestTrue(FString::Printf(TEXT("%s: written pixels match the converted frame"), What), SamePixels(Decoded, Expected));
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisionStreamTraitsDepthTest, "VisionLogger.StreamTraits.Depth", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FVisionStreamTraitsDepthTest::RunTest(const FString& Parameters)
+{
+	const FVisionStreamConversion Conversion;
+	const float Centimeters[] = { -5.0f, 0.0f, 0.1f, 1.25f, 1.5f, 100.0f, 6000.0f, 7000.0f, 60000.0f };
+	const uint16 Millimeters[] = { 0, 0, 1, 13, 15, 1000, 60000, 65535, 65535 };
+	const int32 NumValues = ARRAY_COUNT(Centimeters);
+
+	TArray<FFloat16Color> Source;
+	for (int32 i = 0; i < NumValues; ++i)
+	{
+		Source.Add(MakeDepth(Centimeters[i]));
+	}
+	TArray<uint16> Depth16;
+	Depth16.SetNumUninitialized(NumValues);
+	TVisionStreamTraits<uint16>::Convert(Source.GetData(), NumValues, Conversion, Depth16.GetData());
+	TArray<float> Depth32;
+	Depth32.SetNumUninitialized(NumValues);
+	TVisionStreamTraits<float>::Convert(Source.GetData(), NumValues, Conversion, Depth32.GetData());
+	for (int32 i = 0; i < NumValues; ++i)
+	{
+		// Rounded to the nearest mm, saturated at 65.535 m, negative depth is invalid
+		TestEqual(FString::Printf(TEXT("%g cm in mm"), Centimeters[i]), (int32)Depth16[i], (int32)Millimeters[i]);
+		TestEqual(FString::Printf(TEXT("%g cm as float"), Centimeters[i]), Depth32[i], Source[i].R.GetFloat());
+	}
+
+	// Whole frames through the workers of all depth types, full size and scaled
+	TArray<FFloat16Color> Frame;
+	uint32 Random = 1;
+	for (int32 i = 0; i < TestWidth * TestHeight; ++i)
+	{
+		Frame.Add(MakeDepth((VisionLoggerTest::NextRandom(Random) % 800000) / 100.0f));
+	}
+	for (float Scale : { 1.0f, 0.5f })
+	{
+		RunWorker<FFloat16Color, FFloat16Color>(*this, TEXT("Half float depth"), Frame, Conversion, Scale);
+		RunWorker<FFloat16Color, float>(*this, TEXT("Float depth"), Frame, Conversion, Scale);
+		RunWorker<FFloat16Color, uint16>(*this, TEXT("Raw mm depth"), Frame, Conversion, Scale);
+		RunWorker<FFloat16Color, uint16>(*this, TEXT("PNG mm depth"), Frame, Conversion, Scale, EVisionImageCodec::PNG);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisionStreamTraitsLabelTest, "VisionLogger.StreamTraits.Labels", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FVisionStreamTraitsLabelTest::RunTest(const FString& Parameters)
+{
+	const FColor Red(255, 0, 0, 255);
+	const FColor Green(0, 255, 0, 255);
+	const FColor Blue(0, 0, 255, 255);
+	const FColor Wide(10, 20, 30, 255);
+	const FColor Edge(40, 50, 60, 255);
+	const FColor Unknown(1, 2, 3, 255);
+	FVisionStreamConversion Conversion;
+	Conversion.ColorToLabel.Add(PackMaskColor(Red), 0);
+	Conversion.ColorToLabel.Add(PackMaskColor(Green), 7);
+	Conversion.ColorToLabel.Add(PackMaskColor(Blue), 254);
+	// Fits 16 bit but not 8 bit labels
+	Conversion.ColorToLabel.Add(PackMaskColor(Wide), 300);
+	// Equal to the no label value of 8 bit labels
+	Conversion.ColorToLabel.Add(PackMaskColor(Edge), 255);
+
+	// Runs of one color, an unknown color between them and a read back alpha that is not 255
+	FColor GreenAlpha = Green;
+	GreenAlpha.A = 17;
+	const FColor Colors[] = { Red, Red, Green, GreenAlpha, Unknown, Unknown, Green, Blue, Wide, Edge, Red };
+	const uint8 Labels8[] = { 0, 0, 7, 7, 0xFF, 0xFF, 7, 254, 0xFF, 0xFF, 0 };
+	const uint16 Labels16[] = { 0, 0, 7, 7, 0xFFFF, 0xFFFF, 7, 254, 300, 255, 0 };
+	const int32 NumValues = ARRAY_COUNT(Colors);
+
+	uint8 Out8[ARRAY_COUNT(Colors)];
+	uint16 Out16[ARRAY_COUNT(Colors)];
+	TVisionStreamTraits<uint8>::Convert(Colors, NumValues, Conversion, Out8);
+	TVisionStreamTraits<uint16>::Convert(Colors, NumValues, Conversion, Out16);
+	for (int32 i = 0; i < NumValues; ++i)
+	{
+		TestEqual(FString::Printf(TEXT("8 bit label of pixel %d"), i), (int32)Out8[i], (int32)Labels8[i]);
+		TestEqual(FString::Printf(TEXT("16 bit label of pixel %d"), i), (int32)Out16[i], (int32)Labels16[i]);
+	}
+	TestEqual(TEXT("8 bit no label value"), (int32)TVisionStreamTraits<uint8>::NoLabel, 0xFF);
+	TestEqual(TEXT("16 bit no label value"), (int32)TVisionStreamTraits<uint16>::NoLabel, 0xFFFF);
+
+	// Whole frames through the workers of all mask and color types
+	TArray<FColor> Frame;
+	uint32 Random = 2;
+	for (int32 i = 0; i < TestWidth * TestHeight; ++i)
+	{
+		Frame.Add(Colors[VisionLoggerTest::NextRandom(Random) % NumValues]);
+	}
+	for (float Scale : { 1.0f, 0.5f })
+	{
+		RunWorker<FColor, FColor>(*this, TEXT("Raw colors"), Frame, Conversion, Scale);
+		RunWorker<FColor, uint8>(*this, TEXT("Raw 8 bit labels"), Frame, Conversion, Scale);
+		RunWorker<FColor, uint8>(*this, TEXT("PNG 8 bit labels"), Frame, Conversion, Scale, EVisionImageCodec::PNG);
+		RunWorker<FColor, uint16>(*this, TEXT("Raw 16 bit labels"), Frame, Conversion, Scale);
+		RunWorker<FColor, uint16>(*this, TEXT("PNG 16 bit labels"), Frame, Conversion, Scale, EVisionImageCodec::PNG);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisionStreamTraitsPng16Test, "VisionLogger.StreamTraits.Png16ByteOrder", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FVisionStreamTraitsPng16Test::RunTest(const FString& Parameters)
+{
+	// Samples whose bytes differ, a swapped order shows in every pixel
+	TArray<uint16> Pixels;
+	for (int32 i = 0; i < TestWidth * TestHeight; ++i)
+	{
+		Pixels.Add((uint16)(0x1234 + i * 0x0101));
+	}
+	for (int32 NumStripes : { 1, 3 })
+	{
+		TArray<uint8> Png;
+		VisionLoggerTest::FDecodedPng Decoded;
+		if (!TestTrue(TEXT("16 bit PNG encodes"), FParallelPngEncoder::EncodeGray16(Pixels.GetData(), TestWidth, TestHeight, NumStripes, 6, Png))
+			|| !TestTrue(TEXT("16 bit PNG decodes"), VisionLoggerTest::DecodePng(Png, Decoded)))
+		{
+			return false;
+		}
+		TestEqual(TEXT("Bit depth"), Decoded.BitDepth, 16);
+		TestEqual(TEXT("Channels"), Decoded.Channels, 1);
+		bool bBigEndian = Decoded.Samples.Num() == Pixels.Num() * 2;
+		for (int32 i = 0; bBigEndian && i < Pixels.Num(); ++i)
+		{
+			bBigEndian = Decoded.Samples[2 * i] == (Pixels[i] >> 8) && Decoded.Samples[2 * i + 1] == (Pixels[i] & 0xFF);
+		}
+		TestTrue(FString::Printf(TEXT("Samples are big endian with %d stripes"), NumStripes), bBigEndian);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisionStreamResizeNearestTest, "VisionLogger.StreamTraits.ResizeNearest", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FVisionStreamResizeNearestTest::RunTest(const FString& Parameters)
+{
+	typedef TStreamAsyncWorker<FColor, uint16> FWorker;
+
+	// Pixel value is its index, the output holds the source index of every pixel
+	TArray<uint16> Source;
+	for (int32 i = 0; i < 8 * 6; ++i)
+	{
+		Source.Add((uint16)i);
+	}
+	TArray<uint16> Out;
+
+	// Halving takes the lower right pixel of every 2x2 block, the one at its center
+	FWorker::ResizeNearest(Source.GetData(), 4, 4, 2, 2, Out);
+	const uint16 Half[] = { 5, 7, 13, 15 };
+	TestTrue(TEXT("4x4 to 2x2"), Out.Num() == 4 && FMemory::Memcmp(Out.GetData(), Half, sizeof(Half)) == 0);
+
+	// Odd sizes: source columns 1, 4, 6 of 8 and rows 1, 4 of 6
+	FWorker::ResizeNearest(Source.GetData(), 8, 6, 3, 2, Out);
+	const uint16 Odd[] = { 9, 12, 14, 33, 36, 38 };
+	TestTrue(TEXT("8x6 to 3x2"), Out.Num() == 6 && FMemory::Memcmp(Out.GetData(), Odd, sizeof(Odd)) == 0);
+
+	// Same size is a copy, a single output pixel takes the center
+	FWorker::ResizeNearest(Source.GetData(), 8, 6, 8, 6, Out);
+	TestTrue(TEXT("8x6 unchanged"), SamePixels(Out, Source));
+	FWorker::ResizeNearest(Source.GetData(), 8, 6, 1, 1, Out);
+	TestTrue(TEXT("8x6 to 1x1"), Out.Num() == 1 && Out[0] == 3 * 8 + 4);
+	return true;
+}
+
+#endif
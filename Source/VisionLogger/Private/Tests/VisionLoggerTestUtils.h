@@ -0,0 +1,127 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "zlib.h"
+
+// Helpers shared by the automation tests and benchmarks of the plugin
+namespace VisionLoggerTest
+{
+	// Decoded PNG, samples in the byte order of the file (16 bit samples big endian)
+	struct FDecodedPng
+	{
+		int32 Width;
+		int32 Height;
+		int32 BitDepth;
+		int32 Channels;
+		TArray<uint8> Samples;
+
+		FDecodedPng()
+			: Width(0)
+			, Height(0)
+			, BitDepth(0)
+			, Channels(0)
+		{}
+	};
+
+	inline uint32 ReadBigEndian(const uint8* In)
+	{
+		return ((uint32)In[0] << 24) | ((uint32)In[1] << 16) | ((uint32)In[2] << 8) | In[3];
+	}
+
+	inline uint8 PaethPredictor(int32 A, int32 B, int32 C)
+	{
+		const int32 P = A + B - C;
+		const int32 PA = FMath::Abs(P - A);
+		const int32 PB = FMath::Abs(P - B);
+		const int32 PC = FMath::Abs(P - C);
+		return (uint8)(PA <= PB && PA <= PC ? A : (PB <= PC ? B : C));
+	}
+
+	// Non interlaced gray (0) and RGB (2) PNGs of 8 or 16 bit, all row filters, checksums of the chunks are not verified
+	inline bool DecodePng(const TArray<uint8>& Png, FDecodedPng& Out)
+	{
+		static const uint8 Signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		if (Png.Num() < 8 || FMemory::Memcmp(Png.GetData(), Signature, 8) != 0)
+		{
+			return false;
+		}
+		TArray<uint8> Compressed;
+		bool bHeader = false;
+		bool bEnd = false;
+		for (int32 Pos = 8; Pos + 12 <= Png.Num() && !bEnd;)
+		{
+			const uint32 Length = ReadBigEndian(&Png[Pos]);
+			const uint8* Type = &Png[Pos + 4];
+			const uint8* Data = &Png[Pos + 8];
+			if ((int64)Pos + 12 + Length > Png.Num())
+			{
+				return false;
+			}
+			if (FMemory::Memcmp(Type, "IHDR", 4) == 0 && Length == 13)
+			{
+				Out.Width = (int32)ReadBigEndian(Data);
+				Out.Height = (int32)ReadBigEndian(Data + 4);
+				Out.BitDepth = Data[8];
+				Out.Channels = Data[9] == 0 ? 1 : (Data[9] == 2 ? 3 : 0);
+				bHeader = Data[10] == 0 && Data[11] == 0 && Data[12] == 0;
+			}
+			else if (FMemory::Memcmp(Type, "IDAT", 4) == 0)
+			{
+				Compressed.Append(Data, Length);
+			}
+			else if (FMemory::Memcmp(Type, "IEND", 4) == 0)
+			{
+				bEnd = true;
+			}
+			Pos += 12 + Length;
+		}
+		if (!bHeader || !bEnd || Out.Channels == 0 || (Out.BitDepth != 8 && Out.BitDepth != 16) || Out.Width <= 0 || Out.Height <= 0)
+		{
+			return false;
+		}
+
+		const int32 PixelBytes = Out.Channels * Out.BitDepth / 8;
+		const int32 RowBytes = Out.Width * PixelBytes;
+		TArray<uint8> Filtered;
+		Filtered.SetNumUninitialized((RowBytes + 1) * Out.Height);
+		uLongf FilteredSize = Filtered.Num();
+		if (uncompress(Filtered.GetData(), &FilteredSize, Compressed.GetData(), Compressed.Num()) != Z_OK || FilteredSize != (uLongf)Filtered.Num())
+		{
+			return false;
+		}
+
+		Out.Samples.SetNumZeroed(RowBytes * Out.Height);
+		for (int32 Y = 0; Y < Out.Height; ++Y)
+		{
+			const uint8 Filter = Filtered[Y * (RowBytes + 1)];
+			const uint8* In = &Filtered[Y * (RowBytes + 1) + 1];
+			uint8* Row = &Out.Samples[Y * RowBytes];
+			const uint8* Prior = Y > 0 ? Row - RowBytes : nullptr;
+			for (int32 i = 0; i < RowBytes; ++i)
+			{
+				const int32 A = i >= PixelBytes ? Row[i - PixelBytes] : 0;
+				const int32 B = Prior ? Prior[i] : 0;
+				const int32 C = Prior && i >= PixelBytes ? Prior[i - PixelBytes] : 0;
+				switch (Filter)
+				{
+				case 0: Row[i] = In[i]; break;
+				case 1: Row[i] = (uint8)(In[i] + A); break;
+				case 2: Row[i] = (uint8)(In[i] + B); break;
+				case 3: Row[i] = (uint8)(In[i] + (A + B) / 2); break;
+				case 4: Row[i] = (uint8)(In[i] + PaethPredictor(A, B, C)); break;
+				default: return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	// Reproducible pseudo random numbers for synthetic frames
+	inline uint32 NextRandom(uint32& State)
+	{
+		State = State * 1664525u + 1013904223u;
+		return State >> 8;
+	}
+}
@@ -0,0 +1,198 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#include "TrajectoryLog.h"
+#include "GameFramework/Actor.h"
+#include "HAL/FileManager.h"
+
+FTrajectoryWriter::FTrajectoryWriter()
+{
+	Archive = nullptr;
+	NumTicks = 0;
+}
+
+FTrajectoryWriter::~FTrajectoryWriter()
+{
+	Close();
+}
+
+bool FTrajectoryWriter::Open(const FString& Path, const FDateTime& SessionStart)
+{
+	Close();
+	Archive = IFileManager::Get().CreateFileWriter(*Path);
+	if (Archive == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not create trajectory log %s"), *Path);
+		return false;
+	}
+	uint32 Magic = TrajectoryLog::Magic;
+	uint32 Version = TrajectoryLog::Version;
+	int64 StartTicks = SessionStart.GetTicks();
+	*Archive << Magic << Version << StartTicks;
+	return true;
+}
+
+void FTrajectoryWriter::Close()
+{
+	if (Archive)
+	{
+		Archive->Close();
+		delete Archive;
+		Archive = nullptr;
+		UE_LOG(LogTemp, Warning, TEXT("Trajectory log closed after %d ticks"), NumTicks);
+	}
+	ActorIds.Empty();
+	LastTransforms.Empty();
+}
+
+void FTrajectoryWriter::WriteTick(double Time, float DeltaTime, const FVector& CameraLocation, const FQuat& CameraRotation, const TArray<TWeakObjectPtr<AActor>>& Actors)
+{
+	if (Archive == nullptr)
+	{
+		return;
+	}
+
+	TArray<FTrajectoryActorPose> Moved;
+	for (const TWeakObjectPtr<AActor>& ActorPtr : Actors)
+	{
+		AActor* Actor = ActorPtr.Get();
+		if (Actor == nullptr || Actor->IsPendingKill())
+		{
+			continue;
+		}
+		const FTransform Transform = Actor->GetActorTransform();
+		int32* Id = ActorIds.Find(Actor->GetName());
+		if (Id == nullptr)
+		{
+			// First appearance, write the name record before the tick that uses the id
+			int32 NewId = LastTransforms.Add(Transform);
+			ActorIds.Add(Actor->GetName(), NewId);
+			uint8 Type = TrajectoryLog::NameRecord;
+			FString Name = Actor->GetName();
+			*Archive << Type << NewId << Name;
+			Moved.Add({ NewId, Transform });
+		}
+		else if (!LastTransforms[*Id].Equals(Transform, KINDA_SMALL_NUMBER))
+		{
+			LastTransforms[*Id] = Transform;
+			Moved.Add({ *Id, Transform });
+		}
+	}
+
+	uint8 Type = TrajectoryLog::TickRecord;
+	FVector Location = CameraLocation;
+	FQuat Rotation = CameraRotation;
+	int32 NumActors = Moved.Num();
+	*Archive << Type << Time << DeltaTime << Location << Rotation << NumActors;
+	for (FTrajectoryActorPose& Pose : Moved)
+	{
+		FVector ActorLocation = Pose.Transform.GetLocation();
+		FQuat ActorRotation = Pose.Transform.GetRotation();
+		FVector ActorScale = Pose.Transform.GetScale3D();
+		*Archive << Pose.ActorId << ActorLocation << ActorRotation << ActorScale;
+	}
+	++NumTicks;
+}
+
+FTrajectoryReader::FTrajectoryReader()
+{
+	Archive = nullptr;
+}
+
+FTrajectoryReader::~FTrajectoryReader()
+{
+	Close();
+}
+
+bool FTrajectoryReader::Open(const FString& Path)
+{
+	Close();
+	Archive = IFileManager::Get().CreateFileReader(*Path);
+	if (Archive == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not open trajectory log %s"), *Path);
+		return false;
+	}
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	int64 StartTicks = 0;
+	*Archive << Magic << Version << StartTicks;
+	if (Magic != TrajectoryLog::Magic || Version != TrajectoryLog::Version)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s is not a trajectory log of version %d"), *Path, TrajectoryLog::Version);
+		Close();
+		return false;
+	}
+	SessionStart = FDateTime(StartTicks);
+	return true;
+}
+
+void FTrajectoryReader::Close()
+{
+	if (Archive)
+	{
+		Archive->Close();
+		delete Archive;
+		Archive = nullptr;
+	}
+	ActorNames.Empty();
+}
+
+bool FTrajectoryReader::ReadTick(FTrajectoryTick& OutTick)
+{
+	while (Archive && !Archive->AtEnd())
+	{
+		uint8 Type = 0;
+		*Archive << Type;
+		if (Type == TrajectoryLog::NameRecord)
+		{
+			int32 Id = 0;
+			FString Name;
+			*Archive << Id << Name;
+			if (Archive->IsError() || Id < 0 || Id > TrajectoryLog::MaxActorId)
+			{
+				return Fail(TEXT("actor name record"));
+			}
+			if (Id >= ActorNames.Num())
+			{
+				ActorNames.SetNum(Id + 1);
+			}
+			ActorNames[Id] = Name;
+		}
+		else if (Type == TrajectoryLog::TickRecord)
+		{
+			int32 NumActors = 0;
+			*Archive << OutTick.Time << OutTick.DeltaTime << OutTick.CameraLocation << OutTick.CameraRotation << NumActors;
+			// A truncated last record (e.g. after a crash) ends the log
+			if (Archive->IsError() || NumActors < 0 || NumActors > TrajectoryLog::MaxActorId + 1 ||
+				NumActors * TrajectoryLog::ActorPoseSize > Archive->TotalSize() - Archive->Tell())
+			{
+				return Fail(TEXT("tick record"));
+			}
+			OutTick.Actors.SetNum(NumActors);
+			for (FTrajectoryActorPose& Pose : OutTick.Actors)
+			{
+				FVector Location, Scale;
+				FQuat Rotation;
+				*Archive << Pose.ActorId << Location << Rotation << Scale;
+				if (Archive->IsError() || Pose.ActorId < 0 || Pose.ActorId > TrajectoryLog::MaxActorId)
+				{
+					return Fail(TEXT("actor pose"));
+				}
+				Pose.Transform = FTransform(Rotation, Location, Scale);
+			}
+			return true;
+		}
+		else
+		{
+			return Fail(TEXT("unknown record type"));
+		}
+	}
+	return false;
+}
+
+bool FTrajectoryReader::Fail(const TCHAR* Record)
+{
+	UE_LOG(LogTemp, Error, TEXT("Trajectory log is corrupt or truncated at offset %lld (%s), replay stops"), Archive->Tell(), Record);
+	Close();
+	return false;
+}
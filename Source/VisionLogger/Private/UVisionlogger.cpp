@@ -3,10 +3,87 @@
 #include "UVisionlogger.h"
 #include "ConstructorHelpers.h"
 #include "Engine.h"
+#include "Misc/App.h"
+#include "HAL/IConsoleManager.h"
 #include <algorithm>
 #include <sstream>
 #include <chrono>
 
+// Point clouds and flow frames queued or being generated before new frames are skipped
+static const int32 MaxPointCloudsInFlight = 4;
+static const int32 MaxFlowFramesInFlight = 4;
+
+namespace
+{
+	// Console commands change every vision logger of the world
+	void ForEachVisionLogger(UWorld* World, TFunctionRef<void(AUVisionlogger*)> Apply)
+	{
+		if (World == nullptr)
+		{
+			return;
+		}
+		for (TActorIterator<AUVisionlogger> LoggerItr(World); LoggerItr; ++LoggerItr)
+		{
+			Apply(*LoggerItr);
+		}
+	}
+
+	void ResolutionCommand(const TArray<FString>& Args, UWorld* World)
+	{
+		if (Args.Num() != 2)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Usage: VisionLogger.Resolution <Width> <Height>"));
+			return;
+		}
+		const int32 NewWidth = FCString::Atoi(*Args[0]);
+		const int32 NewHeight = FCString::Atoi(*Args[1]);
+		ForEachVisionLogger(World, [NewWidth, NewHeight](AUVisionlogger* Logger) { Logger->SetResolution(NewWidth, NewHeight); });
+	}
+
+	void StreamsCommand(const TArray<FString>& Args, UWorld* World)
+	{
+		if (Args.Num() != 3)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Usage: VisionLogger.Streams <Color 0|1> <Mask 0|1> <Depth 0|1>"));
+			return;
+		}
+		const bool bColor = Args[0].ToBool();
+		const bool bMask = Args[1].ToBool();
+		const bool bDepth = Args[2].ToBool();
+		ForEachVisionLogger(World, [bColor, bMask, bDepth](AUVisionlogger* Logger) { Logger->SetCaptureStreams(bColor, bMask, bDepth); });
+	}
+
+	void FrameRateCommand(const TArray<FString>& Args, UWorld* World)
+	{
+		if (Args.Num() != 1)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Usage: VisionLogger.FrameRate <Frames per second, 0 pauses>"));
+			return;
+		}
+		const float NewFramerate = FCString::Atof(*Args[0]);
+		ForEachVisionLogger(World, [NewFramerate](AUVisionlogger* Logger) { Logger->SetFramerate(NewFramerate); });
+	}
+
+	void ChangeThresholdCommand(const TArray<FString>& Args, UWorld* World)
+	{
+		if (Args.Num() != 1)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Usage: VisionLogger.ChangeThreshold <Gray levels per cell>"));
+			return;
+		}
+		const float NewThreshold = FCString::Atof(*Args[0]);
+		ForEachVisionLogger(World, [NewThreshold](AUVisionlogger* Logger) { Logger->SetContentChangeThreshold(NewThreshold); });
+	}
+}
+
+static FAutoConsoleCommandWithWorldAndArgs VisionLoggerResolutionCommand(TEXT("VisionLogger.Resolution"),
+	TEXT("Change the capture size: VisionLogger.Resolution <Width> <Height>"), FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&ResolutionCommand));
+static FAutoConsoleCommandWithWorldAndArgs VisionLoggerStreamsCommand(TEXT("VisionLogger.Streams"),
+	TEXT("Enable or disable streams: VisionLogger.Streams <Color 0|1> <Mask 0|1> <Depth 0|1>"), FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&StreamsCommand));
+static FAutoConsoleCommandWithWorldAndArgs VisionLoggerFrameRateCommand(TEXT("VisionLogger.FrameRate"),
+	TEXT("Change the capture rate: VisionLogger.FrameRate <Frames per second, 0 pauses>"), FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&FrameRateCommand));
+static FAutoConsoleCommandWithWorldAndArgs VisionLoggerChangeThresholdCommand(TEXT("VisionLogger.ChangeThreshold"),
+	TEXT("Change the content change threshold: VisionLogger.ChangeThreshold <Gray levels per cell>"), FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&ChangeThresholdCommand));
 
 // Sets default values
 AUVisionlogger::AUVisionlogger()
@@ -29,6 +106,61 @@ AUVisionlogger::AUVisionlogger()
 	bCaptureColorImage = false;
 	bCaptureMaskImage = false;
 	bCaptureDepthImage = false;
+	ColorPixelFormat = EVisionPixelFormat::BGRA8;
+	MaskPixelFormat = EVisionPixelFormat::BGRA8;
+	DepthPixelFormat = EVisionPixelFormat::BGRA8;
+	DepthValueFormat = EVisionDepthValues::Visualization;
+	MaskValueFormat = EVisionMaskValues::Colors;
+	ImageCodec = EVisionImageCodec::JPEG;
+	PngCompressionLevel = 3;
+	PngEncodeStripes = 0;
+	bSkipStaticFrames = false;
+	StaticPositionTolerance = 0.5f;
+	StaticRotationTolerance = 0.1f;
+	ContentChangeThreshold = 1.0f;
+	bHasReadPose = false;
+	bReadPoseStatic = false;
+	TrajectoryMode = ETrajectoryMode::Off;
+	TrajectoryFile = TEXT("Trajectory.vltraj");
+	ReplayTimeStep = 1.0f / 30.0f;
+	bReplayReady = false;
+	bReplayFinished = false;
+	NumReplayedTicks = 0;
+	bPublishSharedMemory = false;
+	SharedMemoryName = TEXT("/visionlogger");
+	SharedMemorySlots = 8;
+	NextFrameNumber = 0;
+	bGeneratePointCloud = false;
+	PointCloudFormat = EPointCloudFormat::PLY;
+	PointCloudVoxelSize = 0.0f;
+	PointCloudMaxDepth = 10000.0f;
+	bColorPointCloud = true;
+	bLabelPointCloud = true;
+	bGenerateOpticalFlow = false;
+	OpticalFlowMaxDepth = 10000.0f;
+	OcclusionTolerance = 0.02f;
+	bHasFlowFrameA = false;
+	bRecordSceneState = false;
+	SceneStateBlockFrames = 64;
+	FileWriteBackend = EFileWriteBackend::Blocking;
+	FileWriteQueueDepth = 64;
+	DirectIOMinSizeKB = 0;
+	bCrashSafeJournal = false;
+	JournalCommitFiles = 64;
+	JournalCommitInterval = 1.0f;
+	bAdaptiveRateControl = false;
+	WorkerBudget = 4.0f;
+	ByteBudgetMBps = 0.0f;
+	GameThreadBudgetMs = 5.0f;
+	MaxFramesInFlight = 8;
+	MinJpegQuality = 50;
+	MaxJpegQuality = 85;
+	MinResolutionScale = 0.5f;
+	MaxFrameDivider = 4;
+	ControlInterval = 1.0f;
+	ImageWrapperModule = nullptr;
+	bInitialized = false;
+	bObjectsColored = false;
 	bInitialAsyncTask = true;
 	bColorFirsttick = true;
 	bMaskFirsttick = true;
@@ -94,6 +226,14 @@ AUVisionlogger::AUVisionlogger()
 void AUVisionlogger::BeginPlay()
 {
 	Super::BeginPlay();
+	if (TrajectoryMode == ETrajectoryMode::Record)
+	{
+		StartTrajectoryRecording();
+	}
+	else if (TrajectoryMode == ETrajectoryMode::Replay)
+	{
+		StartTrajectoryReplay();
+	}
 	FTimerHandle TimerHandle;
 	GetWorld()->GetTimerManager().SetTimer(TimerHandle, this, &AUVisionlogger::Initial, 1.0f , false);
 	
@@ -103,26 +243,75 @@ void AUVisionlogger::BeginPlay()
 void AUVisionlogger::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
+	if (TrajectoryMode == ETrajectoryMode::Replay)
+	{
+		if (bReplayReady)
+		{
+			ReplayTick();
+		}
+		return;
+	}
 	FVector Position = GetWorld()->GetFirstPlayerController()->PlayerCameraManager->GetCameraLocation();
 	FRotator Rotation = GetWorld()->GetFirstPlayerController()->PlayerCameraManager->GetCameraRotation();
 	ColorImgCaptureComp->SetWorldLocationAndRotation(Position, Rotation);
 	MaskImgCaptureComp->SetWorldLocationAndRotation(Position, Rotation);
 	DepthImgCaptureComp->SetWorldLocationAndRotation(Position, Rotation);
 
+	if (TrajectoryWriter.IsValid())
+	{
+		TrajectoryWriter->WriteTick(GetWorld()->GetTimeSeconds(), DeltaTime, Position, Rotation.Quaternion(), TrajectoryActors);
+	}
 }
 
 void AUVisionlogger::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
 	Super::EndPlay(EndPlayReason);
+	GetWorld()->GetTimerManager().ClearTimer(CaptureTimerHandle);
+	bInitialized = false;
+	WaitForWorkers();
+	ReportChangeDetection();
+	if (RateController.IsValid())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Rate control made %d adjustments, last load %.2f"), RateController->GetNumAdjustments(), RateController->GetLoad());
+		RateController.Reset();
+	}
+	TrajectoryWriter.Reset();
+	TrajectoryReader.Reset();
+	SceneStateWriter.Reset();
+	if (FileWriter.IsValid())
+	{
+		FileWriter->Flush();
+	}
+	if (Journal.IsValid())
+	{
+		Journal->Close();
+		Journal.Reset();
+	}
+	FileWriter.Reset();
+	if (SharedMemorySink.IsValid())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Published %llu frames to shared memory"), SharedMemorySink->GetNumPublished());
+		SharedMemorySink->Close();
+		SharedMemorySink.Reset();
+	}
+	if (TrajectoryMode == ETrajectoryMode::Replay)
+	{
+		FApp::SetUseFixedTimeStep(false);
+	}
 	//StopAsyncTask(ColorAsyncWorker);
 }
 
 void AUVisionlogger::Initial()
 {
+	// Recording only logs poses, the streams are captured when replaying
+	if (TrajectoryMode == ETrajectoryMode::Record)
+	{
+		return;
+	}
+
 	if (bSaveAsImage)
 	{
-		static IImageWrapperModule& ImageWrapperModule = FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
-		ImageWrapper = ImageWrapperModule.CreateImageWrapper(EImageFormat::JPEG);
+		ImageWrapperModule = &FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
 	}
 
 	if (bImageSameSize)
@@ -130,69 +319,474 @@ void AUVisionlogger::Initial()
 		ColorViewport = GetWorld()->GetGameViewport()->Viewport;
 		Width = ColorViewport->GetRenderTargetTextureSizeXY().X;
 		Height = ColorViewport->GetRenderTargetTextureSizeXY().Y;
-		ColorImgCaptureComp->TextureTarget->InitAutoFormat(Width, Height);
-		MaskImgCaptureComp->TextureTarget->InitAutoFormat(Width, Height);
-		DepthImgCaptureComp->TextureTarget->InitAutoFormat(Width, Height);
-
 	}
-	ColorImgCaptureComp->TextureTarget->InitAutoFormat(Width, Height);
-	MaskImgCaptureComp->TextureTarget->InitAutoFormat(Width, Height);
-	DepthImgCaptureComp->TextureTarget->InitAutoFormat(Width, Height);
-	// Initializing buffers for reading images from the GPU
-	ColorImage.AddZeroed(Width*Height);
-	MaskImage.AddZeroed(Width*Height);
-	DepthImage.AddZeroed(Width*Height);
+	if (NeedsFloatDepth())
+	{
+		// Plane distance to the camera in cm, the LDR depth images are normalized from it
+		DepthImgCaptureComp->CaptureSource = ESceneCaptureSource::SCS_SceneDepth;
+	}
+	// Render targets and read back buffers of the enabled streams
+	UpdateCaptureTargets();
 	GEngine->AddOnScreenDebugMessage(-1, 5.f, FColor::Red, FString::Printf(TEXT("Image Size: x: %i, y: %i"), Width, Height));
 
-	if (bCaptureColorImage) {
-		
-		ColorImgCaptureComp->TextureTarget->TargetGamma = 1;	
-		ColorImgCaptureComp->SetHiddenInGame(false);
-		ColorImgCaptureComp->Activate();
+	if (bPublishSharedMemory)
+	{
+		SharedMemorySink = MakeShareable(new FSharedMemoryFrameSink());
+		if (!SharedMemorySink->Open(SharedMemoryName, SharedMemorySlots, GetMaxFrameBytes()))
+		{
+			SharedMemorySink.Reset();
+		}
 	}
 
+	CreateFileWriter();
 
-	if (bCaptureMaskImage)
+	if (bCrashSafeJournal && (bSaveAsImage || bGeneratePointCloud || bGenerateOpticalFlow))
 	{
-		if (ColorAllObjects()) {
-			UE_LOG(LogTemp, Warning, TEXT("All the objects has colored"));
+		// Clean up after a crashed session before new files are written
+		const FString FileDir = FPaths::ProjectSavedDir() / TEXT("viewport");
+		FSessionJournal::Recover(FileDir);
+		Journal = MakeShareable(new FSessionJournal(FileDir, JournalCommitFiles, JournalCommitInterval));
+		if (!Journal->Open())
+		{
+			Journal.Reset();
 		}
-		MaskImgCaptureComp->SetHiddenInGame(false);
-		MaskImgCaptureComp->Activate();
 	}
 
-	if (bCaptureDepthImage)
+	if (bAdaptiveRateControl && bSaveAsImage)
+	{
+		FCaptureRateSettings RateSettings;
+		RateSettings.WorkerBudget = WorkerBudget;
+		RateSettings.ByteBudget = ByteBudgetMBps * 1024.0 * 1024.0;
+		RateSettings.GameThreadBudgetMs = GameThreadBudgetMs;
+		RateSettings.MaxFramesInFlight = MaxFramesInFlight;
+		// PNG is lossless, only resolution and rate are adjusted
+		RateSettings.MinJpegQuality = ImageCodec == EVisionImageCodec::JPEG ? MinJpegQuality : MaxJpegQuality;
+		RateSettings.MaxJpegQuality = MaxJpegQuality;
+		RateSettings.MinResolutionScale = MinResolutionScale;
+		RateSettings.MaxFrameDivider = MaxFrameDivider;
+		RateSettings.ControlInterval = ControlInterval;
+		RateController = MakeShareable(new FCaptureRateController(RateSettings, FPaths::ProjectSavedDir() / TEXT("viewport")));
+	}
+
+	// Output settings handed to the workers of each stream
+	ColorOutput.StreamId = 0;
+	ColorOutput.PixelFormat = ColorPixelFormat;
+	MaskOutput.StreamId = 1;
+	MaskOutput.PixelFormat = MaskPixelFormat;
+	MaskOutput.bExactPixels = true;
+	DepthOutput.StreamId = 2;
+	DepthOutput.PixelFormat = DepthPixelFormat;
+	for (FVisionStreamOutput* Output : { &ColorOutput, &MaskOutput, &DepthOutput })
+	{
+		Output->bSaveToDisk = bSaveAsImage;
+		Output->Codec = ImageCodec;
+		Output->PngLevel = PngCompressionLevel;
+		Output->EncodeStripes = PngEncodeStripes;
+		Output->SharedMemorySink = SharedMemorySink;
+		Output->Journal = Journal;
+		Output->RateController = RateController;
+	}
+	if (bSkipStaticFrames)
+	{
+		ColorOutput.ChangeDetector = MakeShareable(new FFrameChangeDetector(TEXT("COLOR"), ContentChangeThreshold));
+		MaskOutput.ChangeDetector = MakeShareable(new FFrameChangeDetector(TEXT("MASK"), ContentChangeThreshold));
+		DepthOutput.ChangeDetector = MakeShareable(new FFrameChangeDetector(TEXT("DEPTH"), ContentChangeThreshold));
+	}
+
+	ColorImgCaptureComp->TextureTarget->TargetGamma = 1;
+	if (bCaptureMaskImage)
+	{
+		ColorMaskObjects();
+	}
+	if (bRecordSceneState)
 	{
-		DepthImgCaptureComp->SetHiddenInGame(false);
-		DepthImgCaptureComp->Activate();
+		StartSceneStateLog();
 	}
+	UpdateCaptureComponents();
+
 
+	if (TrajectoryMode == ETrajectoryMode::Replay)
+	{
+		// Captures are triggered per replayed tick instead of every rendered frame
+		ColorImgCaptureComp->bCaptureEveryFrame = false;
+		MaskImgCaptureComp->bCaptureEveryFrame = false;
+		DepthImgCaptureComp->bCaptureEveryFrame = false;
+		bReplayReady = TrajectoryReader.IsValid();
+		bInitialized = true;
+		return;
+	}
 
 	// Call the timer 
+	bInitialized = true;
 	SetFramerate(FrameRate);
 }
 
-void AUVisionlogger::SetFramerate(const float NewFramerate)
+void AUVisionlogger::SetFramerate(float NewFramerate)
 {
+	FrameRate = NewFramerate;
+	// Before Initial the rate is only stored, replay captures every replayed tick
+	if (!bInitialized || TrajectoryMode == ETrajectoryMode::Replay)
+	{
+		return;
+	}
+	FTimerManager& TimerManager = GetWorld()->GetTimerManager();
+	TimerManager.ClearTimer(CaptureTimerHandle);
 	if (NewFramerate > 0.0f)
 	{
 		// Update Camera on custom timer tick (does not guarantees the UpdateRate value,
 		// since it will be eventually triggered from the game thread tick
+		TimerManager.SetTimer(CaptureTimerHandle, this, &AUVisionlogger::TimerTick, 1/NewFramerate, true);
+	}
+}
+
+void AUVisionlogger::SetResolution(int32 NewWidth, int32 NewHeight)
+{
+	if (NewWidth <= 0 || NewHeight <= 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Invalid capture size %dx%d"), NewWidth, NewHeight);
+		return;
+	}
+	// An explicit size replaces the viewport size
+	bImageSameSize = false;
+	if ((uint32)NewWidth == Width && (uint32)NewHeight == Height)
+	{
+		return;
+	}
+	if (!bInitialized)
+	{
+		Width = NewWidth;
+		Height = NewHeight;
+		return;
+	}
+
+	DrainPendingFrames();
+	const int64 OldFrameBytes = GetMaxFrameBytes();
+	Width = NewWidth;
+	Height = NewHeight;
+	UpdateCaptureTargets();
+	GrowFrameBuffers(OldFrameBytes);
+	UE_LOG(LogTemp, Warning, TEXT("Capture size changed to %dx%d"), Width, Height);
+}
+
+int64 AUVisionlogger::GetMaxFrameBytes() const
+{
+	// Typed streams publish and write their stored pixel type, half float depth takes 8 bytes per pixel
+	const int64 NumPixels = (int64)Width * Height;
+	int64 MaxBytes = NumPixels * sizeof(FColor);
+	if (bCaptureColorImage)
+	{
+		MaxBytes = FMath::Max<int64>(MaxBytes, FPixelFormatConversion::GetConvertedSize(ColorPixelFormat, Width, Height));
+	}
+	if (bCaptureMaskImage)
+	{
+		switch (MaskValueFormat)
+		{
+		case EVisionMaskValues::LabelIds8:
+			MaxBytes = FMath::Max<int64>(MaxBytes, NumPixels * sizeof(uint8));
+			break;
+		case EVisionMaskValues::LabelIds16:
+			MaxBytes = FMath::Max<int64>(MaxBytes, NumPixels * sizeof(uint16));
+			break;
+		default:
+			MaxBytes = FMath::Max<int64>(MaxBytes, FPixelFormatConversion::GetConvertedSize(MaskPixelFormat, Width, Height));
+			break;
+		}
+	}
+	if (bCaptureDepthImage)
+	{
+		switch (DepthValueFormat)
+		{
+		case EVisionDepthValues::Millimeters:
+			MaxBytes = FMath::Max<int64>(MaxBytes, NumPixels * sizeof(uint16));
+			break;
+		case EVisionDepthValues::Centimeters:
+			MaxBytes = FMath::Max<int64>(MaxBytes, NumPixels * sizeof(float));
+			break;
+		case EVisionDepthValues::HalfFloat:
+			MaxBytes = FMath::Max<int64>(MaxBytes, NumPixels * sizeof(FFloat16Color));
+			break;
+		default:
+			MaxBytes = FMath::Max<int64>(MaxBytes, FPixelFormatConversion::GetConvertedSize(DepthPixelFormat, Width, Height));
+			break;
+		}
+	}
+	return MaxBytes;
+}
+
+void AUVisionlogger::GrowFrameBuffers(int64 OldFrameBytes)
+{
+	// Larger frames no longer fit the shared memory slots and the staging buffers of the writer
+	const int64 FrameBytes = GetMaxFrameBytes();
+	if (FrameBytes <= OldFrameBytes)
+	{
+		return;
+	}
+	if (SharedMemorySink.IsValid() && !SharedMemorySink->Open(SharedMemoryName, SharedMemorySlots, FrameBytes))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not resize the shared memory slots, frames of %dx%d are not published"), Width, Height);
+	}
+	if (FileWriter.IsValid())
+	{
+		FileWriter->Flush();
+	}
+	CreateFileWriter();
+}
+
+void AUVisionlogger::SetCaptureStreams(bool bColor, bool bMask, bool bDepth)
+{
+	if (bColor == bCaptureColorImage && bMask == bCaptureMaskImage && bDepth == bCaptureDepthImage)
+	{
+		return;
+	}
+	if (!bInitialized)
+	{
+		bCaptureColorImage = bColor;
+		bCaptureMaskImage = bMask;
+		bCaptureDepthImage = bDepth;
+		return;
+	}
+
+	DrainPendingFrames();
+	const int64 OldFrameBytes = GetMaxFrameBytes();
+	bCaptureColorImage = bColor;
+	bCaptureMaskImage = bMask;
+	bCaptureDepthImage = bDepth;
+	if (bCaptureMaskImage)
+	{
+		ColorMaskObjects();
+	}
+	UpdateCaptureTargets();
+	UpdateCaptureComponents();
+	GrowFrameBuffers(OldFrameBytes);
+	UE_LOG(LogTemp, Warning, TEXT("Capturing color %d, mask %d, depth %d"), bCaptureColorImage, bCaptureMaskImage, bCaptureDepthImage);
+}
+
+void AUVisionlogger::SetContentChangeThreshold(float NewThreshold)
+{
+	ContentChangeThreshold = FMath::Max(NewThreshold, 0.0f);
+	// Frames compared from now on use the new threshold, the reference frames are kept
+	for (FVisionStreamOutput* Output : { &ColorOutput, &MaskOutput, &DepthOutput })
+	{
+		if (Output->ChangeDetector.IsValid())
+		{
+			Output->ChangeDetector->SetThreshold(ContentChangeThreshold);
+		}
+	}
+}
+
+void AUVisionlogger::UpdateCaptureTargets()
+{
+	UpdateStreamTarget(ColorImgCaptureComp, ColorImage, bCaptureColorImage, false);
+	UpdateStreamTarget(MaskImgCaptureComp, MaskImage, bCaptureMaskImage, false);
+	UpdateStreamTarget(DepthImgCaptureComp, DepthImage, bCaptureDepthImage || NeedsFloatDepth(), NeedsFloatDepth());
+	if (NeedsFloatDepth())
+	{
+		DepthFloatImage.SetNumZeroed(Width * Height);
+	}
+}
+
+void AUVisionlogger::UpdateStreamTarget(USceneCaptureComponent2D* CaptureComp, TArray<FColor>& Image, bool bEnabled, bool bFloat)
+{
+	if (!bEnabled)
+	{
+		// Disabled streams keep no read back memory, their target is resized once they are enabled again
+		Image.Empty();
+		return;
+	}
+	UTextureRenderTarget2D* Target = CaptureComp->TextureTarget;
+	const EPixelFormat Format = bFloat ? PF_FloatRGBA : PF_Unknown;
+	if (Target->SizeX != (int32)Width || Target->SizeY != (int32)Height || Target->OverrideFormat != Format)
+	{
+		if (bFloat)
+		{
+			Target->InitCustomFormat(Width, Height, PF_FloatRGBA, true);
+		}
+		else
+		{
+			Target->InitAutoFormat(Width, Height);
+		}
+	}
+	Image.SetNumZeroed(Width * Height);
+}
+
+void AUVisionlogger::UpdateCaptureComponents()
+{
+	const bool bActive[] = { bCaptureColorImage, bCaptureMaskImage, bCaptureDepthImage || NeedsFloatDepth() };
+	USceneCaptureComponent2D* Components[] = { ColorImgCaptureComp, MaskImgCaptureComp, DepthImgCaptureComp };
+	for (int32 Stream = 0; Stream < 3; ++Stream)
+	{
+		// Inactive components do not capture, disabled streams cost no GPU time
+		Components[Stream]->SetHiddenInGame(!bActive[Stream]);
+		if (bActive[Stream])
+		{
+			Components[Stream]->Activate();
+		}
+		else
+		{
+			Components[Stream]->Deactivate();
+		}
+	}
+}
+
+void AUVisionlogger::ColorMaskObjects()
+{
+	if (bObjectsColored)
+	{
+		return;
+	}
+	if (ColorAllObjects()) {
+		UE_LOG(LogTemp, Warning, TEXT("All the objects has colored"));
+	}
+	for (const TPair<FString, uint32>& Category : ObjectToColor)
+	{
+		FColor MaskColor = ObjectColors[Category.Value];
+		MaskColor.A = 255;
+		MaskColorToLabel.Add(MaskColor.DWColor(), (uint16)Category.Value);
+	}
+	bObjectsColored = true;
+}
+
+void AUVisionlogger::CreateFileWriter()
+{
+	// Staging buffers hold an unencoded frame, larger files (point clouds) are written from their own memory
+	FFileWriteBackendSettings WriterSettings;
+	WriterSettings.QueueDepth = FileWriteQueueDepth;
+	WriterSettings.NumBuffers = FMath::Min(FileWriteQueueDepth, 8);
+	WriterSettings.BufferSize = GetMaxFrameBytes();
+	WriterSettings.DirectIOThreshold = (int64)DirectIOMinSizeKB * 1024;
+	FileWriter = IFileWriteBackend::Create(FileWriteBackend, WriterSettings);
+	for (FVisionStreamOutput* Output : { &ColorOutput, &MaskOutput, &DepthOutput })
+	{
+		Output->Writer = FileWriter;
+	}
+}
+
+void AUVisionlogger::DrainPendingFrames()
+{
+	// Frames still being read back have the old configuration, save them before the buffers change
+	FlushRenderingCommands();
+	const FDateTime Stamp = FDateTime::UtcNow();
+	if (bSaveAsImage || SharedMemorySink.IsValid())
+	{
+		if (bCaptureColorImage && !bColorFirsttick)
+		{
+			InitAsyncTask(ColorImage, Stamp, TEXT("COLOR"), Width, Height, ColorOutput, ReadFrameInfo, true);
+		}
+		if (bCaptureMaskImage && !bMaskFirsttick)
+		{
+			SaveMaskFrame(Stamp, ReadFrameInfo, true);
+		}
+		if (bCaptureDepthImage && !bDepthFirsttick)
+		{
+			SaveDepthFrame(Stamp, ReadFrameInfo, true);
+		}
+	}
+	if (bGeneratePointCloud && !bDepthFirsttick)
+	{
+		GeneratePointCloud(Stamp, ReadFrameInfo, true);
+	}
+	if (bGenerateOpticalFlow && !bDepthFirsttick)
+	{
+		GenerateOpticalFlow(Stamp, ReadFrameInfo, true);
+	}
+	WaitForWorkers();
+
+	// The next tick starts a new read back, flow does not span the change
+	bColorFirsttick = true;
+	bMaskFirsttick = true;
+	bDepthFirsttick = true;
+	bColorSave = false;
+	bMaskSave = false;
+	bDepthSave = false;
+	bHasFlowFrameA = false;
+}
+
+void AUVisionlogger::WaitForWorkers() const
+{
+	while (GetNumFramesInFlight() > 0 || FPointCloudAsyncWorker::GetNumInFlight() > 0 || FOpticalFlowAsyncWorker::GetNumInFlight() > 0)
+	{
+		FPlatformProcess::Sleep(0.001f);
+	}
+}
 
-		FTimerHandle TimerHandle;
-		GetWorld()->GetTimerManager().SetTimer(TimerHandle, this, &AUVisionlogger::TimerTick, 1/NewFramerate, true);
+int32 AUVisionlogger::GetNumFramesInFlight()
+{
+	return RawDataAsyncWorker::GetNumInFlight() + FStreamAsyncWorkerStats::GetNumInFlight();
+}
 
+bool AUVisionlogger::AcquireFrameSlot(const FString& Name, const FVisionStreamOutput& Output, const FVisionFrameInfo& Info, bool bWaitForWorkers) const
+{
+	if (Output.RateController.IsValid() && !Output.RateController->ShouldCapture(Output.StreamId, Info.FrameNumber))
+	{
+		return false;
 	}
+	while (GetNumFramesInFlight() >= MaxFramesInFlight)
+	{
+		if (!bWaitForWorkers)
+		{
+			UE_LOG(LogTemp, Error, TEXT("%d frames still in flight, skipping %s frame %llu"), MaxFramesInFlight, *Name, Info.FrameNumber);
+			if (Output.RateController.IsValid())
+			{
+				Output.RateController->ReportSkipped();
+			}
+			return false;
+		}
+		FPlatformProcess::Sleep(0.001f);
+	}
+	return true;
 }
 
-void AUVisionlogger::InitAsyncTask(FAsyncTask<RawDataAsyncWorker>* AsyncWorker, TArray<FColor>& image, FDateTime Stamp,FString Name,int Width,int Height)
+void AUVisionlogger::SaveMaskFrame(FDateTime Stamp, const FVisionFrameInfo& Info, bool bWaitForWorkers)
 {
-			
-	AsyncWorker = new FAsyncTask<RawDataAsyncWorker>(image, ImageWrapper, Stamp, Name, Width, Height);
-	AsyncWorker->StartBackgroundTask();
-	AsyncWorker->EnsureCompletion();
-			
+	switch (MaskValueFormat)
+	{
+	case EVisionMaskValues::LabelIds8:
+		InitStreamTask<FColor, uint8>(MaskImage, Stamp, TEXT("MASK"), MaskOutput, Info, bWaitForWorkers);
+		break;
+	case EVisionMaskValues::LabelIds16:
+		InitStreamTask<FColor, uint16>(MaskImage, Stamp, TEXT("MASK"), MaskOutput, Info, bWaitForWorkers);
+		break;
+	default:
+		InitAsyncTask(MaskImage, Stamp, TEXT("MASK"), Width, Height, MaskOutput, Info, bWaitForWorkers);
+		break;
+	}
+}
 
+void AUVisionlogger::SaveDepthFrame(FDateTime Stamp, const FVisionFrameInfo& Info, bool bWaitForWorkers)
+{
+	switch (DepthValueFormat)
+	{
+	case EVisionDepthValues::Millimeters:
+		InitStreamTask<FFloat16Color, uint16>(DepthFloatImage, Stamp, TEXT("DEPTH"), DepthOutput, Info, bWaitForWorkers);
+		break;
+	case EVisionDepthValues::Centimeters:
+		InitStreamTask<FFloat16Color, float>(DepthFloatImage, Stamp, TEXT("DEPTH"), DepthOutput, Info, bWaitForWorkers);
+		break;
+	case EVisionDepthValues::HalfFloat:
+		InitStreamTask<FFloat16Color, FFloat16Color>(DepthFloatImage, Stamp, TEXT("DEPTH"), DepthOutput, Info, bWaitForWorkers);
+		break;
+	default:
+		InitAsyncTask(DepthImage, Stamp, TEXT("DEPTH"), Width, Height, DepthOutput, Info, bWaitForWorkers);
+		break;
+	}
+}
+
+bool AUVisionlogger::InitAsyncTask(TArray<FColor>& image, FDateTime Stamp, FString Name, int Width, int Height,
+	const FVisionStreamOutput& Output, const FVisionFrameInfo& Info, bool bWaitForWorkers)
+{
+	if (!AcquireFrameSlot(Name, Output, Info, bWaitForWorkers))
+	{
+		return false;
+	}
+
+	// Every task encodes with its own wrapper, the workers run concurrently
+	TSharedPtr<IImageWrapper> TaskImageWrapper;
+	if (ImageWrapperModule != nullptr)
+	{
+		TaskImageWrapper = ImageWrapperModule->CreateImageWrapper(EImageFormat::JPEG);
+	}
+	(new FAutoDeleteAsyncTask<RawDataAsyncWorker>(image, TaskImageWrapper, Stamp, Name, Width, Height, Output, Info))->StartBackgroundTask();
+	return true;
 }
 
 void AUVisionlogger::CurrentAsyncTask(FAsyncTask<RawDataAsyncWorker>* AsyncWorker)
@@ -224,27 +818,48 @@ void AUVisionlogger::StopAsyncTask(FAsyncTask<RawDataAsyncWorker>* AsyncWorker)
 
 void AUVisionlogger::TimerTick()
 {
+	const double TickStart = FPlatformTime::Seconds();
 	FDateTime Stamp = FDateTime::UtcNow();
+	// The frames saved now were read back on the previous tick
+	const FVisionFrameInfo SavedFrame = ReadFrameInfo;
+	const bool bWriteFrames = bSaveAsImage || SharedMemorySink.IsValid();
+	bool bReadFrame = false;
+
+	// Color and mask were read before the depth, once its fence completed the frames of all streams are complete.
+	// Dispatch before they are read again.
+	if (bGeneratePointCloud && !bDepthFirsttick && DepthPixelFence.IsFenceComplete())
+	{
+		GeneratePointCloud(Stamp, SavedFrame, false);
+	}
+	if (bGenerateOpticalFlow && !bDepthFirsttick && DepthPixelFence.IsFenceComplete())
+	{
+		GenerateOpticalFlow(Stamp, SavedFrame, false);
+	}
 	
 	if (bCaptureColorImage)
 	{		
 		if (!bColorFirsttick && ColorPixelFence.IsFenceComplete()) {
-			if (bSaveAsImage) {
+			if (bWriteFrames) {
 				
-				InitAsyncTask(ColorAsyncWorker, ColorImage, Stamp, TEXT("COLOR"), Width, Height);
+				InitAsyncTask(ColorImage, Stamp, TEXT("COLOR"), Width, Height, ColorOutput, SavedFrame, false);
+			}
+			// The point clouds take their colors from the last read back as well
+			if (bWriteFrames || (bGeneratePointCloud && bColorPointCloud))
+			{
 				bColorSave = true;
 			}
-			StopAsyncTask(ColorAsyncWorker);
 		}
 		if (bColorFirsttick)
 		{
 			ProcessColorImg();
 			bColorFirsttick = false;
+			bReadFrame = true;
 		}
 		else if (bColorSave)
 		{
 			ProcessColorImg();
 			bColorSave = false;
+			bReadFrame = true;
 		}	
 		UE_LOG(LogTemp, Warning, TEXT("Read Color Image"));
 	}
@@ -252,51 +867,367 @@ void AUVisionlogger::TimerTick()
 	if (bCaptureMaskImage)
 	{
 		if (!bMaskFirsttick && MaskPixelFence.IsFenceComplete()) {
-			if (bSaveAsImage)
+			if (bWriteFrames)
+			{
+				SaveMaskFrame(Stamp, SavedFrame, false);
+			}
+			if (bWriteFrames || (bGeneratePointCloud && bLabelPointCloud))
 			{
-				InitAsyncTask(MaskAsyncWorker, MaskImage, Stamp, TEXT("MASK"), Width, Height);
 				bMaskSave = true;
 			}
-			StopAsyncTask(MaskAsyncWorker);
 		}
 		if (bMaskFirsttick)
 		{
 			ProcessMaskImg();
 			bMaskFirsttick = false;
+			bReadFrame = true;
 		}
 		else if (bMaskSave)
 		{
 			ProcessMaskImg();
 			bMaskSave = false;
+			bReadFrame = true;
 		}
 		UE_LOG(LogTemp, Warning, TEXT("Read Mask Image"));
 		
 	}
 
-	if (bCaptureDepthImage)
+	if (bCaptureDepthImage || NeedsFloatDepth())
 	{
 		if (!bDepthFirsttick && DepthPixelFence.IsFenceComplete())
 		{
-			if (bSaveAsImage)
+			if (bWriteFrames && bCaptureDepthImage)
+			{
+				SaveDepthFrame(Stamp, SavedFrame, false);
+			}
+			if (bWriteFrames || NeedsFloatDepth())
 			{
-				InitAsyncTask(DepthAsyncWorker, DepthImage, Stamp, TEXT("DEPTH"), Width, Height);
 				bDepthSave = true;
 			}
-			StopAsyncTask(DepthAsyncWorker);
 		}
 		if (bDepthFirsttick)
 		{
 			ProcessDepthImg();
 			bDepthFirsttick = false;
+			bReadFrame = true;
 		}
 		else if (bDepthSave)
 		{
 			ProcessDepthImg();
-			bMaskSave = false;
+			bDepthSave = false;
+			bReadFrame = true;
 		}	
 		UE_LOG(LogTemp, Warning, TEXT("Read Depth Image"));
 		
 	}
+
+	// Remember pose and frame number of the frames read back now, they are saved on the next tick
+	if (bReadFrame)
+	{
+		UpdatePoseStatic();
+		ReadFrameInfo.FrameNumber = NextFrameNumber++;
+		ReadFrameInfo.CameraPose = LastReadPose;
+		ReadFrameInfo.bPoseStatic = bReadPoseStatic;
+		ReadFrameInfo.JpegQuality = RateController.IsValid() ? RateController->GetJpegQuality() : 0;
+		ReadFrameInfo.ResolutionScale = RateController.IsValid() ? RateController->GetResolutionScale() : 1.0f;
+		if (SceneStateWriter.IsValid())
+		{
+			SceneStateWriter->WriteFrame(ReadFrameInfo.FrameNumber, Stamp);
+		}
+	}
+	if (Journal.IsValid())
+	{
+		Journal->CommitIfDue();
+	}
+	if (RateController.IsValid())
+	{
+		const double Now = FPlatformTime::Seconds();
+		RateController->ReportGameThread(Now - TickStart);
+		RateController->Update(Now, SavedFrame.FrameNumber, GetNumFramesInFlight());
+	}
+}
+
+bool AUVisionlogger::NeedsFloatDepth() const
+{
+	return bGeneratePointCloud || bGenerateOpticalFlow || (bCaptureDepthImage && DepthValueFormat != EVisionDepthValues::Visualization);
+}
+
+void AUVisionlogger::GeneratePointCloud(FDateTime Stamp, const FVisionFrameInfo& Info, bool bWaitForWorkers)
+{
+	while (FPointCloudAsyncWorker::GetNumInFlight() >= MaxPointCloudsInFlight)
+	{
+		if (!bWaitForWorkers)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("%d point clouds still in flight, skipping frame %llu"), MaxPointCloudsInFlight, Info.FrameNumber);
+			return;
+		}
+		FPlatformProcess::Sleep(0.001f);
+	}
+
+	FPointCloudSettings Settings;
+	Settings.VoxelSize = PointCloudVoxelSize;
+	Settings.MaxDepth = PointCloudMaxDepth;
+	Settings.Format = PointCloudFormat;
+	Settings.Journal = Journal;
+	Settings.Writer = FileWriter;
+	const TArray<FColor> NoPixels;
+	const TArray<FColor>& PointColors = bColorPointCloud && bCaptureColorImage ? ColorImage : NoPixels;
+	const TArray<FColor>& PointMask = bLabelPointCloud && bCaptureMaskImage ? MaskImage : NoPixels;
+	(new FAutoDeleteAsyncTask<FPointCloudAsyncWorker>(DepthFloatImage, PointColors, PointMask, MaskColorToLabel, Width, Height,
+		DepthImgCaptureComp->FOVAngle, Info.CameraPose, Info.FrameNumber, Stamp, Settings))->StartBackgroundTask();
+}
+
+void AUVisionlogger::GenerateOpticalFlow(FDateTime Stamp, const FVisionFrameInfo& Info, bool bWaitForWorkers)
+{
+	if (bHasFlowFrameA)
+	{
+		while (FOpticalFlowAsyncWorker::GetNumInFlight() >= MaxFlowFramesInFlight && bWaitForWorkers)
+		{
+			FPlatformProcess::Sleep(0.001f);
+		}
+		if (FOpticalFlowAsyncWorker::GetNumInFlight() < MaxFlowFramesInFlight)
+		{
+			FOpticalFlowSettings Settings;
+			Settings.MaxDepth = OpticalFlowMaxDepth;
+			Settings.OcclusionTolerance = OcclusionTolerance;
+			Settings.Journal = Journal;
+			Settings.Writer = FileWriter;
+			(new FAutoDeleteAsyncTask<FOpticalFlowAsyncWorker>(FlowDepthA, DepthFloatImage, Width, Height, DepthImgCaptureComp->FOVAngle,
+				FlowFrameA.CameraPose, Info.CameraPose, FlowFrameA.FrameNumber, Info.FrameNumber, FlowStampA, Stamp, Settings))->StartBackgroundTask();
+		}
+		else
+		{
+			UE_LOG(LogTemp, Warning, TEXT("%d flow frames still in flight, skipping flow of frame %llu"), MaxFlowFramesInFlight, FlowFrameA.FrameNumber);
+		}
+	}
+
+	// The depth of this frame starts the next flow frame
+	FlowDepthA = DepthFloatImage;
+	FlowFrameA = Info;
+	FlowStampA = Stamp;
+	bHasFlowFrameA = true;
+}
+
+void AUVisionlogger::StartSceneStateLog()
+{
+	const FDateTime Now = FDateTime::UtcNow();
+	const FString Path = FPaths::ProjectSavedDir() / TEXT("viewport") / (TEXT("SCENESTATE") + RawDataAsyncWorker::FormatTimeStamp(Now) + TEXT(".vlscene"));
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(Path), true);
+	SceneStateWriter = MakeUnique<FSceneStateWriter>();
+	if (!SceneStateWriter->Open(Path, Now, SceneStateBlockFrames))
+	{
+		SceneStateWriter.Reset();
+		return;
+	}
+
+	// Same categories as the mask colors, instances are numbered in actor order
+	TMap<uint32, uint32> NumInstances;
+	TArray<FSceneStateActor> Labelled;
+	for (TActorIterator<AActor> ActItr(GetWorld()); ActItr; ++ActItr)
+	{
+		TArray<UMeshComponent*> MeshComponents;
+		ActItr->GetComponents<UMeshComponent>(MeshComponents);
+		if (MeshComponents.Num() == 0)
+		{
+			continue;
+		}
+		const FString CategoryName = ActItr->GetName().Left(7);
+		if (!ObjectToColor.Contains(CategoryName))
+		{
+			ObjectToColor.Add(CategoryName, ColorsUsed);
+			++ColorsUsed;
+		}
+		FSceneStateActor Entry;
+		Entry.Actor = *ActItr;
+		Entry.CategoryId = ObjectToColor[CategoryName];
+		Entry.InstanceId = NumInstances.FindOrAdd(Entry.CategoryId)++;
+		Entry.Category = CategoryName;
+		Labelled.Add(Entry);
+	}
+	SceneStateWriter->AddActors(Labelled);
+	UE_LOG(LogTemp, Warning, TEXT("Logging the scene state of %d labelled actors to %s"), Labelled.Num(), *Path);
+}
+
+void AUVisionlogger::UpdatePoseStatic()
+{
+	const FTransform Pose = ColorImgCaptureComp->GetComponentTransform();
+	if (bHasReadPose)
+	{
+		const float Moved = FVector::Dist(Pose.GetLocation(), LastReadPose.GetLocation());
+		const float Turned = FMath::RadiansToDegrees(Pose.GetRotation().AngularDistance(LastReadPose.GetRotation()));
+		bReadPoseStatic = Moved <= StaticPositionTolerance && Turned <= StaticRotationTolerance;
+	}
+	LastReadPose = Pose;
+	bHasReadPose = true;
+}
+
+FString AUVisionlogger::GetTrajectoryPath() const
+{
+	if (FPaths::IsRelative(TrajectoryFile))
+	{
+		return FPaths::ProjectSavedDir() / TEXT("Trajectories") / TrajectoryFile;
+	}
+	return TrajectoryFile;
+}
+
+void AUVisionlogger::StartTrajectoryRecording()
+{
+	const FString Path = GetTrajectoryPath();
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(Path), true);
+	TrajectoryWriter = MakeUnique<FTrajectoryWriter>();
+	if (!TrajectoryWriter->Open(Path, FDateTime::UtcNow()))
+	{
+		TrajectoryWriter.Reset();
+		return;
+	}
+
+	// Only movable actors can change their transform during the session
+	for (TActorIterator<AActor> ActItr(GetWorld()); ActItr; ++ActItr)
+	{
+		USceneComponent* Root = ActItr->GetRootComponent();
+		if (*ActItr != this && Root && Root->Mobility == EComponentMobility::Movable)
+		{
+			TrajectoryActors.Add(*ActItr);
+		}
+	}
+	UE_LOG(LogTemp, Warning, TEXT("Recording trajectory of %d movable actors to %s"), TrajectoryActors.Num(), *Path);
+}
+
+void AUVisionlogger::StartTrajectoryReplay()
+{
+	const FString Path = GetTrajectoryPath();
+	TrajectoryReader = MakeUnique<FTrajectoryReader>();
+	if (!TrajectoryReader->Open(Path))
+	{
+		TrajectoryReader.Reset();
+		return;
+	}
+
+	// Step the world with a fixed time step and without waiting for real time
+	FApp::SetUseFixedTimeStep(true);
+	FApp::SetFixedDeltaTime(ReplayTimeStep);
+	UE_LOG(LogTemp, Warning, TEXT("Replaying trajectory %s"), *Path);
+}
+
+void AUVisionlogger::ReplayTick()
+{
+	FTrajectoryTick Frame;
+	if (!TrajectoryReader->ReadTick(Frame))
+	{
+		if (!bReplayFinished)
+		{
+			bReplayFinished = true;
+			UE_LOG(LogTemp, Warning, TEXT("Trajectory replay finished after %d ticks"), NumReplayedTicks);
+			GEngine->AddOnScreenDebugMessage(-1, 5.f, FColor::Green, FString::Printf(TEXT("Replay finished: %d ticks"), NumReplayedTicks));
+		}
+		return;
+	}
+
+	for (const FTrajectoryActorPose& Pose : Frame.Actors)
+	{
+		if (AActor* Actor = FindReplayActor(Pose.ActorId))
+		{
+			Actor->SetActorTransform(Pose.Transform, false, nullptr, ETeleportType::TeleportPhysics);
+		}
+	}
+	ColorImgCaptureComp->SetWorldLocationAndRotation(Frame.CameraLocation, Frame.CameraRotation);
+	MaskImgCaptureComp->SetWorldLocationAndRotation(Frame.CameraLocation, Frame.CameraRotation);
+	DepthImgCaptureComp->SetWorldLocationAndRotation(Frame.CameraLocation, Frame.CameraRotation);
+
+	// Render and read back synchronously, the replay has no real time constraints
+	if (bCaptureColorImage)
+	{
+		ColorImgCaptureComp->CaptureScene();
+		ProcessColorImg();
+	}
+	if (bCaptureMaskImage)
+	{
+		MaskImgCaptureComp->CaptureScene();
+		ProcessMaskImg();
+	}
+	if (bCaptureDepthImage || NeedsFloatDepth())
+	{
+		DepthImgCaptureComp->CaptureScene();
+		ProcessDepthImg();
+	}
+	FlushRenderingCommands();
+
+	const FDateTime Stamp = TrajectoryReader->GetSessionStart() + FTimespan::FromSeconds(Frame.Time);
+	FVisionFrameInfo ReplayFrame;
+	ReplayFrame.FrameNumber = NumReplayedTicks;
+	ReplayFrame.CameraPose = FTransform(Frame.CameraRotation, Frame.CameraLocation);
+	// The capture components already hold the replayed pose, compared with the one of the previous replayed tick
+	UpdatePoseStatic();
+	ReplayFrame.bPoseStatic = bReadPoseStatic;
+	if (SceneStateWriter.IsValid())
+	{
+		SceneStateWriter->WriteFrame(ReplayFrame.FrameNumber, Stamp);
+	}
+	if (bGeneratePointCloud)
+	{
+		GeneratePointCloud(Stamp, ReplayFrame, true);
+	}
+	if (bGenerateOpticalFlow)
+	{
+		GenerateOpticalFlow(Stamp, ReplayFrame, true);
+	}
+	if (bSaveAsImage || SharedMemorySink.IsValid())
+	{
+		if (bCaptureColorImage)
+		{
+			InitAsyncTask(ColorImage, Stamp, TEXT("COLOR"), Width, Height, ColorOutput, ReplayFrame, true);
+		}
+		if (bCaptureMaskImage)
+		{
+			SaveMaskFrame(Stamp, ReplayFrame, true);
+		}
+		if (bCaptureDepthImage)
+		{
+			SaveDepthFrame(Stamp, ReplayFrame, true);
+		}
+	}
+	if (Journal.IsValid())
+	{
+		Journal->CommitIfDue();
+	}
+	++NumReplayedTicks;
+}
+
+AActor* AUVisionlogger::FindReplayActor(int32 ActorId)
+{
+	if (TWeakObjectPtr<AActor>* Cached = ReplayActors.Find(ActorId))
+	{
+		return Cached->Get();
+	}
+	if (ReplayActorsByName.Num() == 0)
+	{
+		for (TActorIterator<AActor> ActItr(GetWorld()); ActItr; ++ActItr)
+		{
+			ReplayActorsByName.Add(ActItr->GetName(), *ActItr);
+		}
+	}
+	const FString Name = TrajectoryReader->GetActorName(ActorId);
+	TWeakObjectPtr<AActor>* Found = ReplayActorsByName.Find(Name);
+	if (Found == nullptr)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Logged actor %s does not exist in this level"), *Name);
+	}
+	AActor* Actor = Found ? Found->Get() : nullptr;
+	ReplayActors.Add(ActorId, Actor);
+	return Actor;
+}
+
+void AUVisionlogger::ReportChangeDetection() const
+{
+	const TSharedPtr<FFrameChangeDetector, ESPMode::ThreadSafe> Detectors[] = { ColorOutput.ChangeDetector, MaskOutput.ChangeDetector, DepthOutput.ChangeDetector };
+	for (const TSharedPtr<FFrameChangeDetector, ESPMode::ThreadSafe>& Detector : Detectors)
+	{
+		if (Detector.IsValid() && Detector->GetNumWritten() + Detector->GetNumRepeated() > 0)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("%s: %d frames written, %d static frames skipped, %.2f MB saved"), *Detector->GetStreamName(),
+				Detector->GetNumWritten(), Detector->GetNumRepeated(), Detector->GetSavedBytes() / (1024.0 * 1024.0));
+		}
+	}
 }
 
 bool AUVisionlogger::ConnectMongo(FString & MongoIp, int & MongoPort, FString & MongoDBName, FString & MongoCollection)
@@ -354,7 +1285,18 @@ void AUVisionlogger::ProcessMaskImg()
 void AUVisionlogger::ProcessDepthImg()
 {
 	FTextureRenderTargetResource* DepthRenderResource = DepthImgCaptureComp->TextureTarget->GameThread_GetRenderTargetResource();	
-	ReadPixels(DepthRenderResource, DepthImage);
+	if (NeedsFloatDepth())
+	{
+		ReadFloatPixels(DepthRenderResource, DepthFloatImage);
+		if (bCaptureDepthImage && DepthValueFormat == EVisionDepthValues::Visualization)
+		{
+			ReadPixels(DepthRenderResource, DepthImage, FReadSurfaceDataFlags(RCM_MinMax, CubeFace_MAX));
+		}
+	}
+	else
+	{
+		ReadPixels(DepthRenderResource, DepthImage);
+	}
 	DepthPixelFence.BeginFence();
 }
 
@@ -435,6 +1377,43 @@ void AUVisionlogger::ReadPixels(FTextureRenderTargetResource *& RenderResource,
 		});
 }
 
+void AUVisionlogger::ReadFloatPixels(FTextureRenderTargetResource *& RenderResource, TArray<FFloat16Color>& OutImageData, FIntRect InRect)
+{
+	// Read the render target surface data back as half floats
+	if (InRect == FIntRect(0, 0, 0, 0))
+	{
+		InRect = FIntRect(0, 0, RenderResource->GetSizeXY().X, RenderResource->GetSizeXY().Y);
+	}
+	struct FReadSurfaceFloatContext
+	{
+		FRenderTarget* SrcRenderTarget;
+		TArray<FFloat16Color>* OutData;
+		FIntRect Rect;
+	};
+
+	OutImageData.Reset();
+	FReadSurfaceFloatContext ReadSurfaceContext =
+	{
+		RenderResource,
+		&OutImageData,
+		InRect
+	};
+
+	ENQUEUE_UNIQUE_RENDER_COMMAND_ONEPARAMETER(
+		ReadSurfaceFloatCommand,
+		FReadSurfaceFloatContext, Context, ReadSurfaceContext,
+		{
+			RHICmdList.ReadSurfaceFloatData(
+				Context.SrcRenderTarget->GetRenderTargetTexture(),
+				Context.Rect,
+				*Context.OutData,
+				CubeFace_PosX,
+				0,
+				0
+			);
+		});
+}
+
 bool AUVisionlogger::ColorAllObjects()
 {
 	uint32_t NumberOfActors = 0;
@@ -0,0 +1,68 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+// Common setup for the SSE/AVX2 kernels, SSE2 is always available on x86 targets,
+// newer instruction sets are enabled per function and only called after a CPUID check
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define VL_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC allows all intrinsics without per function target flags
+#define VL_TARGET_SSSE3
+#define VL_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define VL_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define VL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define VL_SIMD_X86 0
+#endif
+
+#if VL_SIMD_X86
+// Half to float for the low 16 bits of each 32 bit lane, handles denormals, inf and nan like FPointCloudGenerator::HalfToFloat
+static FORCEINLINE __m128 VLHalfToFloat4(__m128i Half)
+{
+	const __m128i ShiftedExp = _mm_set1_epi32(0x7C00 << 13);
+	const __m128 Magic = _mm_castsi128_ps(_mm_set1_epi32(113 << 23));
+	const __m128i ExpMant = _mm_slli_epi32(_mm_and_si128(Half, _mm_set1_epi32(0x7FFF)), 13);
+	const __m128i Exp = _mm_and_si128(ExpMant, ShiftedExp);
+	__m128i Result = _mm_add_epi32(ExpMant, _mm_set1_epi32((127 - 15) << 23));
+	const __m128i InfNan = _mm_cmpeq_epi32(Exp, ShiftedExp);
+	Result = _mm_add_epi32(Result, _mm_and_si128(InfNan, _mm_set1_epi32((128 - 16) << 23)));
+	const __m128i Denormal = _mm_cmpeq_epi32(Exp, _mm_setzero_si128());
+	const __m128i Renormalized = _mm_castps_si128(_mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(Result, _mm_set1_epi32(1 << 23))), Magic));
+	Result = _mm_or_si128(_mm_and_si128(Denormal, Renormalized), _mm_andnot_si128(Denormal, Result));
+	Result = _mm_or_si128(Result, _mm_slli_epi32(_mm_and_si128(Half, _mm_set1_epi32(0x8000)), 16));
+	return _mm_castsi128_ps(Result);
+}
+
+// Float to half with round to nearest even in the low 16 bits of each 32 bit lane (sign extended), like FOpticalFlowGenerator::FloatToHalf
+static FORCEINLINE __m128i VLFloatToHalf4(__m128 Value)
+{
+	const __m128i SubnormalMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+	const __m128 Sign = _mm_and_ps(Value, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+	const __m128 AbsValue = _mm_xor_ps(Value, Sign);
+	const __m128i AbsBits = _mm_castps_si128(AbsValue);
+
+	// Overflow to inf, nan keeps a quiet nan
+	const __m128i IsNan = _mm_castps_si128(_mm_cmpunord_ps(AbsValue, AbsValue));
+	const __m128i InfOrNan = _mm_or_si128(_mm_and_si128(IsNan, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7C00));
+	const __m128i IsRegular = _mm_cmpgt_epi32(_mm_set1_epi32((127 + 16) << 23), AbsBits);
+
+	// Results below the smallest normal half are rounded by the float addition
+	const __m128i IsSubnormal = _mm_cmpgt_epi32(_mm_set1_epi32((127 - 14) << 23), AbsBits);
+	const __m128i Subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(AbsValue, _mm_castsi128_ps(SubnormalMagic))), SubnormalMagic);
+
+	// Rebias the exponent and round the mantissa to nearest even
+	const __m128i MantissaOdd = _mm_srai_epi32(_mm_slli_epi32(AbsBits, 31 - 13), 31);
+	const __m128i Normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(AbsBits, _mm_set1_epi32(0xFFF - ((127 - 15) << 23))), MantissaOdd), 13);
+
+	const __m128i Finite = _mm_or_si128(_mm_and_si128(IsSubnormal, Subnormal), _mm_andnot_si128(IsSubnormal, Normal));
+	__m128i Result = _mm_or_si128(_mm_and_si128(IsRegular, Finite), _mm_andnot_si128(IsRegular, InfOrNan));
+	Result = _mm_or_si128(Result, _mm_srli_epi32(_mm_castps_si128(Sign), 16));
+	return _mm_srai_epi32(_mm_slli_epi32(Result, 16), 16);
+}
+#endif
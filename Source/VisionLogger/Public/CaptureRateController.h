@@ -0,0 +1,120 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Budgets the saving pipeline is held to and the bounds of the output settings
+struct FCaptureRateSettings
+{
+	// Worker seconds per second the encoding and writing of all streams may take (cores)
+	float WorkerBudget;
+
+	// Encoded bytes per second, 0 for no limit
+	double ByteBudget;
+
+	// Game thread time of one capture tick in ms, 0 for no limit
+	float GameThreadBudgetMs;
+
+	// Frames queued or being saved before new frames are skipped
+	int32 MaxFramesInFlight;
+
+	// JPEG quality range, equal bounds keep the quality fixed
+	int32 MinJpegQuality;
+	int32 MaxJpegQuality;
+
+	// Smallest fraction of the capture resolution the frames are saved with
+	float MinResolutionScale;
+
+	// Largest N of "save every Nth frame" per stream
+	int32 MaxFrameDivider;
+
+	// Seconds over which the load is measured before the next adjustment
+	float ControlInterval;
+
+	FCaptureRateSettings()
+		: WorkerBudget(4.0f)
+		, ByteBudget(0.0)
+		, GameThreadBudgetMs(0.0f)
+		, MaxFramesInFlight(8)
+		, MinJpegQuality(50)
+		, MaxJpegQuality(85)
+		, MinResolutionScale(0.5f)
+		, MaxFrameDivider(4)
+		, ControlInterval(1.0f)
+	{}
+};
+
+/**
+ * Feedback controller that keeps the saving pipeline within its budgets. The workers report encode
+ * time, bytes and write latency, the game thread reports its own time and the frames in flight. Every
+ * ControlInterval the load (highest ratio of a measurement to its budget, a skipped frame counts as
+ * overload) is evaluated: above 1 the output is degraded by one step (JPEG quality, then resolution,
+ * then the rate of depth, mask and color), below LowLoad for UpgradeWindows windows in a row the last
+ * degradation is undone. Every adjustment is appended to <Dir>/RATECONTROL.csv.
+ */
+class VISIONLOGGER_API FCaptureRateController
+{
+public:
+	FCaptureRateController(const FCaptureRateSettings& InSettings, const FString& InDir);
+
+	// Worker side, thread safe
+	void ReportEncode(double Seconds, int64 NumBytes);
+	void ReportWrite(double Seconds);
+	void ReportSkipped();
+
+	// Report the encode time since EncodeStart, the returned write callback reports the write latency (empty without a controller)
+	static TFunction<void(bool)> ReportEncoded(const TSharedPtr<FCaptureRateController, ESPMode::ThreadSafe>& Controller, double EncodeStart, int64 NumBytes);
+
+	// Game thread time of one capture tick
+	void ReportGameThread(double Seconds);
+
+	// Sample the frames in flight and adjust once the control window is over, game thread
+	void Update(double Now, uint64 FrameNumber, int32 NumInFlight);
+
+	// Frame of the stream (0 color, 1 mask, 2 depth) is saved at the current rate
+	bool ShouldCapture(uint32 StreamId, uint64 FrameNumber) const;
+
+	int32 GetJpegQuality() const { return JpegQuality; }
+	float GetResolutionScale() const { return ResolutionScale; }
+	int32 GetFrameDivider(uint32 StreamId) const { return StreamId < NumStreams ? FrameDivider[StreamId] : 1; }
+	float GetLoad() const { return Load; }
+	int32 GetNumAdjustments() const { return NumAdjustments; }
+
+	static const int32 NumStreams = 3;
+
+	// Load below which the output is upgraded again and the windows it has to stay there
+	static const float LowLoad;
+	static const int32 UpgradeWindows = 3;
+
+private:
+	// One step down or up, false if the bounds are reached
+	bool Degrade();
+	bool Upgrade();
+
+	// Append the current settings to the log
+	void LogAdjustment(uint64 FrameNumber, const TCHAR* Reason);
+
+	FCaptureRateSettings Settings;
+	FString LogPath;
+
+	// Measurements of the current window, the worker side under Lock
+	FCriticalSection Lock;
+	double EncodeSeconds;
+	double WriteSeconds;
+	int64 NumBytes;
+	int32 NumSkipped;
+	double GameThreadSeconds;
+	int32 NumTicks;
+	int32 PeakInFlight;
+	double WindowStart;
+
+	// Output settings, read by the game thread when frames are dispatched
+	int32 JpegQuality;
+	float ResolutionScale;
+	int32 FrameDivider[NumStreams];
+
+	float Load;
+	int32 NumLowWindows;
+	int32 NumAdjustments;
+};
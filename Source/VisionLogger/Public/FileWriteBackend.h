@@ -0,0 +1,77 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Function.h"
+#include "FileWriteBackend.generated.h"
+
+// How the output files are written to disk
+UENUM(BlueprintType)
+enum class EFileWriteBackend : uint8
+{
+	// open/write/close on the calling worker thread
+	Blocking	UMETA(DisplayName = "Blocking"),
+	// Batched asynchronous writes through an io_uring (Linux 5.1+), falls back to Blocking elsewhere
+	IoUring		UMETA(DisplayName = "io_uring (Linux)")
+};
+
+// Settings of the asynchronous backend
+struct FFileWriteBackendSettings
+{
+	// Writes in flight before Write blocks the caller
+	int32 QueueDepth;
+
+	// Queued writes that are submitted together
+	int32 SubmitBatch;
+
+	// Registered staging buffers and their size, larger files are written from their own memory
+	int32 NumBuffers;
+	int64 BufferSize;
+
+	// Files of at least this size are written with O_DIRECT from a registered buffer, 0 disables it
+	int64 DirectIOThreshold;
+
+	FFileWriteBackendSettings()
+		: QueueDepth(64)
+		, SubmitBatch(8)
+		, NumBuffers(16)
+		, BufferSize(16 * 1024 * 1024)
+		, DirectIOThreshold(0)
+	{}
+};
+
+/**
+ * Destination of the files of all streams. A write owns its data, OnComplete runs once the file
+ * is closed, either on the calling thread (blocking) or on a thread pool thread (asynchronous
+ * backends, never on the thread that reaps completions). Flush also waits for the callbacks.
+ */
+class VISIONLOGGER_API IFileWriteBackend
+{
+public:
+	virtual ~IFileWriteBackend() {}
+
+	// Create or replace the file at Path with Data
+	virtual void Write(const FString& Path, TArray<uint8>&& Data, TFunction<void(bool)> OnComplete) = 0;
+
+	// Block until every write issued so far completed and its OnComplete ran
+	virtual void Flush() = 0;
+
+	virtual const TCHAR* GetName() const = 0;
+
+	// Backend of the requested type, the blocking one if it is not available on this machine
+	static TSharedPtr<IFileWriteBackend, ESPMode::ThreadSafe> Create(EFileWriteBackend Type, const FFileWriteBackendSettings& Settings = FFileWriteBackendSettings());
+
+	// Write through Backend if there is one, blocking otherwise
+	static void Write(const TSharedPtr<IFileWriteBackend, ESPMode::ThreadSafe>& Backend, const FString& Path, TArray<uint8>&& Data,
+		TFunction<void(bool)> OnComplete);
+};
+
+// FFileHelper::SaveArrayToFile on the calling thread
+class VISIONLOGGER_API FBlockingFileWriteBackend : public IFileWriteBackend
+{
+public:
+	virtual void Write(const FString& Path, TArray<uint8>&& Data, TFunction<void(bool)> OnComplete) override;
+	virtual void Flush() override {}
+	virtual const TCHAR* GetName() const override { return TEXT("Blocking"); }
+};
@@ -0,0 +1,76 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Tracks the last written frame of one stream and decides on the writer side whether a new
+ * frame is a near duplicate of it. Duplicates are replaced by a "repeat of frame N" record.
+ */
+class VISIONLOGGER_API FFrameChangeDetector
+{
+public:
+	FFrameChangeDetector(const FString& InStreamName, float InThreshold);
+
+	// Downsampled content signature, mean byte value (x16) of every grid cell, every second row is sampled
+	static void ComputeSignature(const FColor* Image, int32 Width, int32 Height, TArray<uint16>& OutSignature);
+
+	/**
+	 * Decides atomically whether a frame is a repeat of the reference frame. A repeat is recorded in
+	 * <Dir>/<Stream>_repeats.csv and true returned. Otherwise the caller writes the frame and reports
+	 * it with RecordWritten or RecordFailed; a newer frame with other content becomes the reference at
+	 * once, so concurrent workers compare against it before it is written. Frames finishing out of
+	 * order never move the reference back to an older frame.
+	 */
+	bool RecordIfRepeat(uint64 FrameNumber, const TArray<uint16>& Signature, bool bPoseStatic, const FString& TimeStamp, const FString& Dir);
+
+	// A frame RecordIfRepeat did not take as repeat was written (from the write completion), repeats waiting for its file name are recorded
+	void RecordWritten(uint64 FrameNumber, const FString& FileName, int64 NumBytes);
+
+	// A frame RecordIfRepeat did not take as repeat could not be written
+	void RecordFailed(uint64 FrameNumber);
+
+	// Change the tolerance in gray levels per grid cell
+	void SetThreshold(float InThreshold);
+
+	const FString& GetStreamName() const { return StreamName; }
+	int32 GetNumWritten() const;
+	int32 GetNumRepeated() const;
+	int64 GetSavedBytes() const;
+
+	// Number of grid cells per axis
+	static const int32 GridSize = 32;
+
+private:
+	struct FPendingRepeat
+	{
+		uint64 FrameNumber;
+		uint64 RepeatOf;
+		FString TimeStamp;
+		FString Dir;
+	};
+
+	bool Matches(const TArray<uint16>& Signature) const;
+	void AppendRepeat(uint64 FrameNumber, uint64 RepeatOf, const FString& FileName, int64 NumBytes, const FString& TimeStamp, const FString& Dir);
+
+	FString StreamName;
+	float Threshold;
+	mutable FCriticalSection Lock;
+
+	// Signature, file name and size of the reference frame, the file name is empty until it is written
+	TArray<uint16> LastSignature;
+	FString LastFileName;
+	int64 LastNumBytes;
+
+	// Capture frame number of the reference frame, valid once there is one
+	uint64 LastFrame;
+	bool bHasLast;
+
+	// Repeats of reference frames that were not written yet
+	TArray<FPendingRepeat> PendingRepeats;
+
+	int32 NumWritten;
+	int32 NumRepeated;
+	int64 SavedBytes;
+};
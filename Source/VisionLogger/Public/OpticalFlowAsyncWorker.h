@@ -0,0 +1,67 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Runtime/Core/Public/Async/AsyncWork.h"
+#include "SessionJournal.h"
+#include "OpticalFlowGenerator.h"
+
+// Settings of the optical flow stage, shared by all frames of a session
+struct FOpticalFlowSettings
+{
+	// Depth in cm beyond which pixels get no flow (sky, far background)
+	float MaxDepth;
+
+	// Relative depth difference up to which a reprojected pixel still counts as visible
+	float OcclusionTolerance;
+
+	// Optional crash safe journal the files are written through
+	TSharedPtr<FSessionJournal, ESPMode::ThreadSafe> Journal;
+
+	// File output backend, blocking writes if not set
+	TSharedPtr<IFileWriteBackend, ESPMode::ThreadSafe> Writer;
+
+	FOpticalFlowSettings()
+		: MaxDepth(10000.0f)
+		, OcclusionTolerance(0.02f)
+	{}
+};
+
+/**
+ * Computes the forward flow between two consecutive depth frames and writes it to
+ * Saved/viewport/FLOW<time stamp of the first frame>.vlflow.
+ */
+class VISIONLOGGER_API FOpticalFlowAsyncWorker : public FNonAbandonableTask
+{
+private:
+	TArray<FFloat16Color> DepthA;
+	TArray<FFloat16Color> DepthB;
+	int32 Width;
+	int32 Height;
+	float FieldOfView;
+	FTransform PoseA;
+	FTransform PoseB;
+	uint64 FrameA;
+	uint64 FrameB;
+	FDateTime TimeStampA;
+	FDateTime TimeStampB;
+	FOpticalFlowSettings Settings;
+
+public:
+	FOpticalFlowAsyncWorker(const TArray<FFloat16Color>& DepthA_init, const TArray<FFloat16Color>& DepthB_init, int32 Width_init, int32 Height_init,
+		float FieldOfView_init, const FTransform& PoseA_init, const FTransform& PoseB_init, uint64 FrameA_init, uint64 FrameB_init,
+		FDateTime StampA, FDateTime StampB, const FOpticalFlowSettings& Settings_init);
+	~FOpticalFlowAsyncWorker();
+	FORCEINLINE TStatId GetStatId() const
+	{
+		RETURN_QUICK_DECLARE_CYCLE_STAT(FOpticalFlowAsyncWorker, STATGROUP_ThreadPoolAsyncTasks);
+	}
+	void DoWork();
+
+	// Number of flow frames queued or being computed
+	static int32 GetNumInFlight();
+
+private:
+	static FThreadSafeCounter NumInFlight;
+};
@@ -0,0 +1,47 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PointCloudGenerator.h"
+
+// Per pixel state of a flow frame
+enum EOpticalFlowMask : uint8
+{
+	// The pixel has depth and lands in front of the next camera, flow and depth change are set
+	FlowMaskValid = 1,
+	// The pixel lands outside of the next image
+	FlowMaskOutOfView = 2,
+	// Something nearer covers the pixel in the next image
+	FlowMaskOccluded = 4
+};
+
+/**
+ * Ground truth optical flow and scene flow of static geometry. Every pixel of the first frame is back-projected
+ * with its depth and reprojected into the camera of the second frame, the flow is the pixel displacement and
+ * the scene flow component is the change of the camera space depth. Moving actors are not compensated.
+ * The SSE path is limited like the conversion kernels, by FPixelFormatConversion::SetMaxSimdLevel.
+ */
+class VISIONLOGGER_API FOpticalFlowGenerator
+{
+public:
+	/**
+	 * Forward flow from frame A to frame B. Depths are the R channel of Width * Height RGBA half floats.
+	 * OutFlow receives the U, V (pixels) and depth change (cm) planes as half floats (3 * Width * Height),
+	 * OutMask one EOpticalFlowMask combination per pixel. A pixel counts as occluded when it lands more than
+	 * OcclusionTolerance (relative) behind the depth of frame B.
+	 */
+	static void ComputeFlow(const uint16* DepthA, const uint16* DepthB, int32 Width, int32 Height,
+		const FPointCloudCamera& CameraA, const FPointCloudCamera& CameraB, float MaxDepth, float OcclusionTolerance,
+		uint16* OutFlow, uint8* OutMask);
+
+	/**
+	 * Flow file: 48 byte header (magic 'VLFL', version, number of planes, width, height, frame numbers of A and B,
+	 * timestamps of A and B in ns since the unix epoch), the U, V and depth change half float planes, then the mask.
+	 */
+	static void Serialize(const TArray<uint16>& Flow, const TArray<uint8>& Mask, int32 Width, int32 Height,
+		uint64 FrameA, uint64 FrameB, int64 TimeStampA, int64 TimeStampB, TArray<uint8>& OutData);
+
+	// Encode a half float, rounds to nearest even
+	static uint16 FloatToHalf(float Value);
+};
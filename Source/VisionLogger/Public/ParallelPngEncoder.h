@@ -0,0 +1,46 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ParallelPngEncoder.generated.h"
+
+// Codec of the streams that are saved as images (BGRA and Gray8 layouts)
+UENUM(BlueprintType)
+enum class EVisionImageCodec : uint8
+{
+	// Lossy, single threaded image wrapper encode
+	JPEG		UMETA(DisplayName = "JPEG"),
+	// Lossless, horizontal stripes are compressed in parallel
+	PNG			UMETA(DisplayName = "PNG (parallel)"),
+	// Uncompressed samples, the frame size is part of the file name
+	Raw			UMETA(DisplayName = "Raw (uncompressed)")
+};
+
+/**
+ * PNG encoder that splits a frame into horizontal stripes and deflates them concurrently. Rows are
+ * filtered first (Up filter), then every stripe is compressed as its own raw deflate stream primed
+ * with the last 32 KB of the stripe before it, ended with a sync flush and written as one IDAT chunk.
+ * The stripes concatenate to a single zlib stream, its Adler-32 is combined from the stripe checksums.
+ */
+class VISIONLOGGER_API FParallelPngEncoder
+{
+public:
+	// 8 bit RGB PNG of BGRA pixels (alpha dropped)
+	static bool EncodeBGRA(const FColor* Pixels, int32 Width, int32 Height, int32 NumStripes, int32 Level, TArray<uint8>& OutPng);
+
+	// 8 bit gray PNG
+	static bool EncodeGray(const uint8* Pixels, int32 Width, int32 Height, int32 NumStripes, int32 Level, TArray<uint8>& OutPng);
+
+	// 16 bit gray PNG (label ids, depth in mm), samples are swapped to the big endian order of PNG
+	static bool EncodeGray16(const uint16* Pixels, int32 Width, int32 Height, int32 NumStripes, int32 Level, TArray<uint8>& OutPng);
+
+	// Stripes used for NumStripes 0: one per core, but at least MinStripeRows rows each
+	static int32 GetDefaultNumStripes(int32 Height);
+
+	static const int32 MinStripeRows = 32;
+
+private:
+	// Channels is 3 for BGRA input (swizzled to RGB) or 1 for gray input of BitDepth 8 or 16
+	static bool Encode(const uint8* Pixels, int32 Width, int32 Height, int32 Channels, int32 BitDepth, int32 NumStripes, int32 Level, TArray<uint8>& OutPng);
+};
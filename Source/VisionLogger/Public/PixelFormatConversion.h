@@ -0,0 +1,66 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PixelFormatConversion.generated.h"
+
+// Pixel layout a stream is converted to before it is encoded or stored
+UENUM(BlueprintType)
+enum class EVisionPixelFormat : uint8
+{
+	// 4 bytes per pixel, as read back from the GPU
+	BGRA8		UMETA(DisplayName = "BGRA (unconverted)"),
+	// 3 bytes per pixel, interleaved R, G, B
+	RGB24		UMETA(DisplayName = "RGB24"),
+	// 1 byte per pixel luminance
+	Gray8		UMETA(DisplayName = "Gray8"),
+	// Planar Y, U, V with 2x2 subsampled chroma (I420)
+	YUV420		UMETA(DisplayName = "YUV420 (I420)"),
+	// Planar Y followed by interleaved 2x2 subsampled U/V
+	NV12		UMETA(DisplayName = "NV12"),
+	// Channel planar R, G, B (one full resolution plane per channel)
+	PlanarRGB	UMETA(DisplayName = "Planar RGB")
+};
+
+// Instruction set used by the conversion kernels
+enum class EVisionSimdLevel : uint8
+{
+	Scalar,
+	SSE,
+	AVX2
+};
+
+/**
+ * Converts BGRA frames read back from the render targets into compact layouts.
+ * Every kernel has a scalar reference implementation and SSE/AVX2 variants that produce
+ * bit-identical output, the fastest one supported by the CPU is picked at runtime.
+ */
+class VISIONLOGGER_API FPixelFormatConversion
+{
+public:
+	// Number of bytes a Width x Height frame occupies in the given format
+	static int32 GetConvertedSize(EVisionPixelFormat Format, int32 Width, int32 Height);
+
+	// File extension used when the format is stored without an image codec
+	static const TCHAR* GetFileExtension(EVisionPixelFormat Format);
+
+	// Convert Src (Width * Height pixels) into Out, Out is resized to GetConvertedSize
+	static bool Convert(EVisionPixelFormat Format, const FColor* Src, int32 Width, int32 Height, TArray<uint8>& Out);
+
+	// Scale Src to OutWidth x OutHeight, every output pixel is the mean of the source pixels it covers or, with bNearest (labels), the one at its center
+	static void Resize(const FColor* Src, int32 Width, int32 Height, int32 OutWidth, int32 OutHeight, bool bNearest, TArray<FColor>& Out);
+
+	// Individual kernels, Dst must hold GetConvertedSize bytes of the respective format
+	static void BGRAToRGB24(const FColor* Src, uint8* Dst, int32 NumPixels);
+	static void BGRAToGray8(const FColor* Src, uint8* Dst, int32 NumPixels);
+	static void BGRAToPlanarRGB(const FColor* Src, uint8* DstR, uint8* DstG, uint8* DstB, int32 NumPixels);
+	static void BGRAToYUV420(const FColor* Src, int32 Width, int32 Height, uint8* DstY, uint8* DstU, uint8* DstV);
+	static void BGRAToNV12(const FColor* Src, int32 Width, int32 Height, uint8* DstY, uint8* DstUV);
+
+	// Highest instruction set the kernels are currently allowed to use
+	static EVisionSimdLevel GetSimdLevel();
+
+	// Limit the kernels to an instruction set (clamped to what the CPU supports), used to compare against the scalar path
+	static void SetMaxSimdLevel(EVisionSimdLevel Level);
+};
@@ -0,0 +1,71 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Runtime/Core/Public/Async/AsyncWork.h"
+#include "SessionJournal.h"
+#include "PointCloudGenerator.h"
+
+// Settings of the point cloud stage, shared by all frames of a session
+struct FPointCloudSettings
+{
+	// Edge length of the downsampling voxels in cm, 0 keeps every point
+	float VoxelSize;
+
+	// Depth in cm beyond which pixels are dropped (sky, far background)
+	float MaxDepth;
+
+	// Output file format
+	EPointCloudFormat Format;
+
+	// Optional crash safe journal the files are written through
+	TSharedPtr<FSessionJournal, ESPMode::ThreadSafe> Journal;
+
+	// File output backend, blocking writes if not set
+	TSharedPtr<IFileWriteBackend, ESPMode::ThreadSafe> Writer;
+
+	FPointCloudSettings()
+		: VoxelSize(0.0f)
+		, MaxDepth(10000.0f)
+		, Format(EPointCloudFormat::PLY)
+	{}
+};
+
+/**
+ * Back-projects one depth frame into a world space point cloud, optionally colors and labels
+ * it from the color and mask frames of the same read back, and writes it to Saved/viewport.
+ */
+class VISIONLOGGER_API FPointCloudAsyncWorker : public FNonAbandonableTask
+{
+private:
+	TArray<FFloat16Color> Depth;
+	TArray<FColor> Colors;
+	TArray<FColor> Mask;
+	TMap<uint32, uint16> ColorToLabel;
+	int32 Width;
+	int32 Height;
+	float FieldOfView;
+	FTransform CameraPose;
+	uint64 FrameNumber;
+	FDateTime TimeStamp;
+	FPointCloudSettings Settings;
+
+public:
+	// Colors and Mask may be empty to skip coloring or labelling, both must otherwise hold Width * Height pixels
+	FPointCloudAsyncWorker(const TArray<FFloat16Color>& Depth_init, const TArray<FColor>& Colors_init, const TArray<FColor>& Mask_init,
+		const TMap<uint32, uint16>& ColorToLabel_init, int32 Width_init, int32 Height_init, float FieldOfView_init,
+		const FTransform& CameraPose_init, uint64 FrameNumber_init, FDateTime Stamp, const FPointCloudSettings& Settings_init);
+	~FPointCloudAsyncWorker();
+	FORCEINLINE TStatId GetStatId() const
+	{
+		RETURN_QUICK_DECLARE_CYCLE_STAT(FPointCloudAsyncWorker, STATGROUP_ThreadPoolAsyncTasks);
+	}
+	void DoWork();
+
+	// Number of point clouds queued or being generated
+	static int32 GetNumInFlight();
+
+private:
+	static FThreadSafeCounter NumInFlight;
+};
@@ -0,0 +1,91 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PointCloudGenerator.generated.h"
+
+// File format of the generated point clouds
+UENUM(BlueprintType)
+enum class EPointCloudFormat : uint8
+{
+	// Binary little endian PLY, readable by most 3D tools
+	PLY			UMETA(DisplayName = "Binary PLY"),
+	// Quantized 16 bit positions relative to the camera, see FPointCloudGenerator::SerializeCompact
+	Compact		UMETA(DisplayName = "Compact (.vlpc)")
+};
+
+// Pinhole camera used for back-projection, axes follow Unreal (X forward, Y right, Z up)
+struct FPointCloudCamera
+{
+	float Origin[3];
+	float Forward[3];
+	float Right[3];
+	float Up[3];
+
+	// Focal length and principal point in pixels
+	float FocalLength;
+	float CenterX;
+	float CenterY;
+
+	// Camera of a Width x Height image with horizontal field of view FOVDegrees at Pose
+	static FPointCloudCamera FromPose(const FTransform& Pose, float FOVDegrees, int32 Width, int32 Height);
+
+	// Length of the ray through an image corner per unit of plane depth, points lie within depth times this of the origin
+	float GetMaxRayLength() const;
+};
+
+// Points in structure of arrays layout, Colors and Labels are either empty or one per point
+struct FPointCloud
+{
+	TArray<float> X;
+	TArray<float> Y;
+	TArray<float> Z;
+	TArray<FColor> Colors;
+	TArray<uint16> Labels;
+
+	// Pixel every point was back-projected from, empty after downsampling
+	TArray<int32> PixelIndices;
+
+	int32 Num() const { return X.Num(); }
+	void Reset();
+};
+
+// Label of pixels whose mask color does not belong to any object category
+const uint16 PointCloudNoLabel = 0xFFFF;
+
+/**
+ * Writer side point cloud generation from a plane depth image (cm).
+ * The back-projection and half float decoding are vectorized with SSE2, the downsampler
+ * accumulates points in a hashed voxel grid with open addressing.
+ */
+class VISIONLOGGER_API FPointCloudGenerator
+{
+public:
+	// World space points of all pixels with 0 < depth <= MaxDepth, Depth is the R channel of Width * Height RGBA half floats
+	static void BackProject(const uint16* DepthRGBAHalf, int32 Width, int32 Height, const FPointCloudCamera& Camera, float MaxDepth, FPointCloud& Out);
+
+	// Copy the color of every point's source pixel
+	static void AttachColors(const FColor* Image, FPointCloud& Cloud);
+
+	// Look up the label of every point's source pixel by its mask color (packed with FColor::DWColor)
+	static void AttachLabels(const FColor* Mask, const TMap<uint32, uint16>& ColorToLabel, FPointCloud& Cloud);
+
+	// One point per occupied voxel at the centroid of its points, colors are averaged, the first label wins
+	static void VoxelDownsample(const FPointCloud& In, float VoxelSize, FPointCloud& Out);
+
+	// Binary little endian PLY with x, y, z floats and optional red, green, blue and label
+	static void SerializePLY(const FPointCloud& Cloud, TArray<uint8>& OutData);
+
+	/**
+	 * Compact format: 64 byte header (magic 'VLPC', version, flags, point count, quantization step in cm,
+	 * frame number, timestamp in ns since the unix epoch, camera origin and rotation, voxel size), then
+	 * int16 x, y, z per point relative to the camera origin in quantization steps, followed by the r, g, b
+	 * block (flag 1) and the uint16 label block (flag 2).
+	 */
+	static void SerializeCompact(const FPointCloud& Cloud, uint64 FrameNumber, int64 TimeStampNs, const FPointCloudCamera& Camera,
+		const float Rotation[4], float VoxelSize, float MaxDepth, TArray<uint8>& OutData);
+
+	// Decode a half float
+	static float HalfToFloat(uint16 Half);
+};
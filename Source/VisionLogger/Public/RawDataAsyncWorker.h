@@ -6,6 +6,86 @@
 #include "Runtime/Core/Public/Async/AsyncWork.h"
 #include "Runtime/ImageWrapper/Public/IImageWrapper.h"
 #include "Runtime/ImageWrapper/Public/IImageWrapperModule.h"
+#include "PixelFormatConversion.h"
+#include "ParallelPngEncoder.h"
+#include "StreamTraits.h"
+#include "FrameChangeDetector.h"
+#include "SharedMemoryFrameSink.h"
+#include "SessionJournal.h"
+#include "CaptureRateController.h"
+
+// Where and in which layout the frames of one stream are written
+struct FVisionStreamOutput
+{
+	// Stream id published with the frame (0 color, 1 mask, 2 depth)
+	uint32 StreamId;
+
+	// Layout the frame is converted to before it is encoded or published
+	EVisionPixelFormat PixelFormat;
+
+	// Encode and write the frame to Saved/viewport
+	bool bSaveToDisk;
+
+	// Codec of the BGRA and Gray8 layouts, PNG level (0-9) and stripes encoded in parallel (0 one per core)
+	EVisionImageCodec Codec;
+	int32 PngLevel;
+	int32 EncodeStripes;
+
+	// Pixel values are labels (mask colors), scaled frames take the nearest pixel instead of the mean
+	bool bExactPixels;
+
+	// Optional writer side duplicate detection
+	TSharedPtr<FFrameChangeDetector, ESPMode::ThreadSafe> ChangeDetector;
+
+	// Optional live feed for local consumer processes
+	TSharedPtr<FSharedMemoryFrameSink, ESPMode::ThreadSafe> SharedMemorySink;
+
+	// Optional crash safe journal the files are written through
+	TSharedPtr<FSessionJournal, ESPMode::ThreadSafe> Journal;
+
+	// File output backend, blocking writes if not set
+	TSharedPtr<IFileWriteBackend, ESPMode::ThreadSafe> Writer;
+
+	// Optional rate control the encode and write times are reported to
+	TSharedPtr<FCaptureRateController, ESPMode::ThreadSafe> RateController;
+
+	FVisionStreamOutput()
+		: StreamId(0)
+		, PixelFormat(EVisionPixelFormat::BGRA8)
+		, bSaveToDisk(true)
+		, Codec(EVisionImageCodec::JPEG)
+		, PngLevel(3)
+		, EncodeStripes(0)
+		, bExactPixels(false)
+	{}
+};
+
+// Capture state of the frame handed to the worker
+struct FVisionFrameInfo
+{
+	// Capture frame number, shared by all streams read back in the same tick
+	uint64 FrameNumber;
+
+	// Pose of the capture components when the frame was read back
+	FTransform CameraPose;
+
+	// Camera did not move since the previous read back
+	bool bPoseStatic;
+
+	// JPEG quality (0 codec default) and fraction of the capture resolution the frame is saved with
+	int32 JpegQuality;
+	float ResolutionScale;
+
+	FVisionFrameInfo()
+		: FrameNumber(0)
+		, bPoseStatic(false)
+		, JpegQuality(0)
+		, ResolutionScale(1.0f)
+	{}
+
+	// Frame number and capture settings listed with the saved file in the manifest
+	FJournalFrame GetJournalFrame() const { return FJournalFrame(FrameNumber, JpegQuality, ResolutionScale); }
+};
 
 /**
  * 
@@ -19,11 +99,23 @@ private:
 	FString ImageName;
 	TSharedPtr<IImageWrapper> ImageWrapper;
 	TArray<FColor> Image;
+	FVisionStreamOutput Output;
+	FVisionFrameInfo FrameInfo;
 public:
-	RawDataAsyncWorker(TArray<FColor>& Image_init, TSharedPtr<IImageWrapper>& ImageWrapperRef, FDateTime Stamp, FString Name, int Width_init, int Height_init);
+	RawDataAsyncWorker(TArray<FColor>& Image_init, TSharedPtr<IImageWrapper>& ImageWrapperRef, FDateTime Stamp, FString Name, int Width_init, int Height_init,
+		const FVisionStreamOutput& Output_init = FVisionStreamOutput(), const FVisionFrameInfo& FrameInfo_init = FVisionFrameInfo());
 	~RawDataAsyncWorker();
 	FORCEINLINE TStatId GetStatId() const;
 	void DoWork();
 	void SetLogToImage();
 	void SaveImage(TArray<FColor>&image, TSharedPtr<IImageWrapper> &ImageWrapper, FDateTime Stamp, FString ImageName, int Width,int Height);
+
+	// Time stamp part of the file names (year_month_day_hour_minute_second_millisecond)
+	static FString FormatTimeStamp(const FDateTime& Stamp);
+
+	// Number of frames queued or being saved
+	static int32 GetNumInFlight();
+
+private:
+	static FThreadSafeCounter NumInFlight;
 };
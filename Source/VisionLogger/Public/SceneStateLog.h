@@ -0,0 +1,90 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+
+// Labelled actor whose transform is logged every captured frame
+struct VISIONLOGGER_API FSceneStateActor
+{
+	TWeakObjectPtr<AActor> Actor;
+
+	// Object category (index of the mask color) and running number of the actor within its category
+	uint32 CategoryId;
+	uint32 InstanceId;
+	FString Category;
+};
+
+// Frames and changed actors of one block, encoded on a worker thread
+struct FSceneStateBlock;
+
+/**
+ * Writes the scene-state log (.vlscene, layout in Client/include/vl_scene_state_format.h).
+ * Frames are grouped into blocks, within a block every actor that changed is stored column wise with
+ * delta encoded quantized components. Actors that did not change cost nothing, the index written on
+ * Close lists the blocks of every actor so a reader can extract one trajectory without scanning the log.
+ */
+class VISIONLOGGER_API FSceneStateWriter
+{
+public:
+	FSceneStateWriter();
+	~FSceneStateWriter();
+
+	// Create the log file, fails if it cannot be opened
+	bool Open(const FString& Path, const FDateTime& SessionStart, int32 InBlockFrames);
+
+	// Encode the last block, write the index and close the file
+	void Close();
+	bool IsOpen() const { return Archive != nullptr; }
+
+	// Register actors, they get consecutive ids in the order they are added
+	void AddActors(const TArray<FSceneStateActor>& NewActors);
+
+	// Sample the transforms of all registered actors for one captured frame, game thread only
+	void WriteFrame(uint64 FrameNumber, const FDateTime& Stamp);
+
+	int32 GetNumActors() const { return Actors.Num(); }
+	uint64 GetNumFrames() const { return NumFrames; }
+
+	// Time the encoder tasks spent on the blocks since Open, complete after Close
+	double GetEncodeSeconds() const { return EncodeSeconds; }
+
+	// Quantization of the logged components
+	static const float LocationStep;
+	static const float RotationStep;
+	static const float ScaleStep;
+
+private:
+	// Hand the current block to the encoder task, waits for the previous block to be written
+	void FlushBlock();
+
+	// Write a record to the archive, only called from the encoder task or after it finished
+	void WriteRecord(uint32 Type, const TArray<uint8>& Payload);
+
+	FArchive* Archive;
+	TFuture<void> PendingBlock;
+	int64 SessionStartNs;
+	int32 BlockFrames;
+	uint64 NumFrames;
+	double EncodeSeconds;
+
+	TArray<TWeakObjectPtr<AActor>> Actors;
+
+	// Quantized components of every actor at the end of the previous block and of the latest sample
+	TArray<int32> BlockStartValues;
+	TArray<int32> LatestValues;
+
+	// Actor was not written in any block yet
+	TBitArray<> UnwrittenActors;
+
+	// Block being collected: slot of every actor that changed in it (INDEX_NONE otherwise)
+	TSharedPtr<FSceneStateBlock, ESPMode::ThreadSafe> Block;
+	TArray<int32> BlockSlots;
+
+	// Index: record offset, first frame and frame count of every block, blocks of every actor
+	TArray<int64> BlockOffsets;
+	TArray<uint64> BlockFirstFrames;
+	TArray<int32> BlockFrameCounts;
+	TArray<TArray<int32>> ActorBlocks;
+};
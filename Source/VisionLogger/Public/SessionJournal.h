@@ -0,0 +1,115 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/ThreadSafeBool.h"
+#include "Templates/SharedPointer.h"
+#include "FileWriteBackend.h"
+
+// Capture settings a file is listed with in the manifest
+struct FJournalFrame
+{
+	// Capture frame number
+	uint64 FrameNumber;
+
+	// JPEG quality (0 codec default) and fraction of the capture resolution the file was saved with
+	int32 JpegQuality;
+	float ResolutionScale;
+
+	FJournalFrame(uint64 InFrameNumber, int32 InJpegQuality = 0, float InResolutionScale = 1.0f)
+		: FrameNumber(InFrameNumber)
+		, JpegQuality(InJpegQuality)
+		, ResolutionScale(InResolutionScale)
+	{}
+};
+
+/**
+ * Crash safe output of one session in Saved/viewport. Files are written to <name>.tmp and committed in
+ * groups: once enough files are pending or enough time passed, the data of the whole group is flushed to
+ * disk with one file system sync, the files are renamed to their final names and the directory is synced,
+ * then their entries (with the capture settings of each file) and a "#commit" line are appended to the
+ * append-only manifest (MANIFEST.csv) and the manifest is synced. Every entry before the last "#" line
+ * names a durable, complete file.
+ */
+class VISIONLOGGER_API FSessionJournal : public TSharedFromThis<FSessionJournal, ESPMode::ThreadSafe>
+{
+public:
+	// Commit once CommitFiles files are pending or CommitInterval seconds passed since the last commit
+	FSessionJournal(const FString& InDir, int32 InCommitFiles, float InCommitInterval);
+	~FSessionJournal();
+
+	// Open the manifest for appending and log the session start
+	bool Open();
+
+	// Commit the pending files and close the manifest, flush the file writers first
+	void Close();
+	bool IsOpen() const { return ManifestFd >= 0; }
+
+	// Write Data to <Dir>/<FileName> through a temporary file, listed in the manifest with the next commit once written. Thread safe.
+	// OnWritten runs once the data is written (the file gets its final name with the next commit) or the write failed.
+	void WriteFile(const TSharedPtr<IFileWriteBackend, ESPMode::ThreadSafe>& Writer, TArray<uint8>&& Data, const FString& FileName,
+		const FJournalFrame& Frame, const FString& Stream, TFunction<void(bool)> OnWritten = nullptr);
+
+	// Sync and list all pending files now
+	void Commit();
+
+	// Commit on a worker thread if the pending files are due, game thread
+	void CommitIfDue();
+
+	int64 GetNumCommitted() const { return NumCommitted; }
+	int32 GetNumCommits() const { return NumCommits; }
+
+	/**
+	 * Restore a consistent state after a crash: drop manifest lines after its last complete "#" line and
+	 * delete the temporary files. Files with a final name missing from the manifest are not verified, they
+	 * are kept but not listed. Only the manifest and the file names are read. Returns the number of deleted files.
+	 */
+	static int32 Recover(const FString& Dir);
+
+	// Write with Writer (blocking if there is none) through the journal if there is one, directly to <Dir>/<FileName> otherwise
+	static void Save(const TSharedPtr<IFileWriteBackend, ESPMode::ThreadSafe>& Writer, const TSharedPtr<FSessionJournal, ESPMode::ThreadSafe>& Journal,
+		TArray<uint8>&& Data, const FString& Dir, const FString& FileName, const FJournalFrame& Frame, const FString& Stream, TFunction<void(bool)> OnWritten = nullptr);
+
+	// Manifest file name and suffix of files being written
+	static const TCHAR* ManifestName;
+	static const TCHAR* TempSuffix;
+
+private:
+	struct FJournalEntry
+	{
+		FString FileName;
+		FString Stream;
+		FJournalFrame Frame;
+		int64 NumBytes;
+
+		FJournalEntry(const FString& InFileName, const FString& InStream, const FJournalFrame& InFrame, int64 InNumBytes)
+			: FileName(InFileName)
+			, Stream(InStream)
+			, Frame(InFrame)
+			, NumBytes(InNumBytes)
+		{}
+	};
+
+	// Add a written temporary file to the pending files
+	void FileWritten(const FString& FileName, const FJournalFrame& Frame, const FString& Stream, int64 NumBytes);
+
+	// Commit in the background unless a commit is already scheduled
+	void ScheduleCommit();
+
+	FString Dir;
+	int32 CommitFiles;
+	double CommitInterval;
+
+	// Files written under their temporary name, not yet synced, renamed and listed
+	FCriticalSection PendingLock;
+	TArray<FJournalEntry> Pending;
+	double LastCommitTime;
+	FThreadSafeBool bCommitScheduled;
+
+	// Serializes commits, guards the manifest descriptor
+	FCriticalSection CommitLock;
+	int ManifestFd;
+	int64 NumCommitted;
+	int32 NumCommits;
+};
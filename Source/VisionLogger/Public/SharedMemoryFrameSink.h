@@ -0,0 +1,36 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Publishes frames into a POSIX shared memory ring buffer (see Client/include/vl_shm_protocol.h)
+ * for consumer processes on the same machine. The ring has a single producer, concurrent
+ * Publish calls are serialized. Only available on Linux and Mac, Open fails elsewhere.
+ */
+class VISIONLOGGER_API FSharedMemoryFrameSink
+{
+public:
+	FSharedMemoryFrameSink();
+	~FSharedMemoryFrameSink();
+
+	// Create (or replace) the shared memory object with NumSlots slots of MaxFrameBytes payload. A replaced
+	// ring is marked closed once the new one is published under the name, its readers attach again.
+	bool Open(const FString& Name, int32 NumSlots, int64 MaxFrameBytes);
+	void Close();
+	bool IsOpen() const { return Memory != nullptr; }
+
+	// Copy one frame into the oldest slot, frames larger than a slot are dropped
+	bool Publish(uint32 Stream, uint64 FrameId, const FDateTime& TimeStamp, const FTransform& CameraPose,
+		uint32 PixelFormat, int32 Width, int32 Height, const void* Data, int64 NumBytes);
+
+	// Frames published so far
+	uint64 GetNumPublished() const;
+
+private:
+	FString ShmName;
+	void* Memory;
+	int64 MappedSize;
+	FCriticalSection ProducerLock;
+};
@@ -0,0 +1,137 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/FileManager.h"
+#include "Runtime/Core/Public/Async/AsyncWork.h"
+#include "RawDataAsyncWorker.h"
+#include "StreamTraits.h"
+
+// Frames of all typed streams queued or being saved
+class VISIONLOGGER_API FStreamAsyncWorkerStats
+{
+public:
+	static int32 GetNumInFlight() { return NumInFlight.GetValue(); }
+
+private:
+	template<typename SourceType, typename PixelType> friend class TStreamAsyncWorker;
+	static FThreadSafeCounter NumInFlight;
+};
+
+/**
+ * Saves one frame of a typed stream (metric depth, label ids). The read back pixels (SourceType) are
+ * converted into the stored PixelType with the kernels of TVisionStreamTraits<PixelType>, published to
+ * the live feed and encoded with the default codec of the type, or raw. Scaled frames take the nearest
+ * pixel, depth and labels are never averaged.
+ */
+template<typename SourceType, typename PixelType>
+class TStreamAsyncWorker : public FNonAbandonableTask
+{
+public:
+	typedef TVisionStreamTraits<PixelType> FTraits;
+
+	TStreamAsyncWorker(const TArray<SourceType>& Source_init, const FVisionStreamConversion& Conversion_init, FDateTime Stamp, const FString& Name,
+		int32 Width_init, int32 Height_init, const FVisionStreamOutput& Output_init, const FVisionFrameInfo& FrameInfo_init)
+		: Source(Source_init)
+		, Conversion(Conversion_init)
+		, TimeStamp(Stamp)
+		, StreamName(Name)
+		, Width(Width_init)
+		, Height(Height_init)
+		, Output(Output_init)
+		, FrameInfo(FrameInfo_init)
+	{
+		FStreamAsyncWorkerStats::NumInFlight.Increment();
+	}
+
+	~TStreamAsyncWorker()
+	{
+		FStreamAsyncWorkerStats::NumInFlight.Decrement();
+	}
+
+	FORCEINLINE TStatId GetStatId() const
+	{
+		RETURN_QUICK_DECLARE_CYCLE_STAT(TStreamAsyncWorker, STATGROUP_ThreadPoolAsyncTasks);
+	}
+
+	void DoWork()
+	{
+		const int32 NumPixels = Width * Height;
+		if (NumPixels <= 0 || Source.Num() != NumPixels)
+		{
+			UE_LOG(LogTemp, Error, TEXT("%s frame %llu has %d pixels, expected %d"), *StreamName, FrameInfo.FrameNumber, Source.Num(), NumPixels);
+			return;
+		}
+		const double StartTime = FPlatformTime::Seconds();
+		TArray<PixelType> Pixels;
+		Pixels.SetNumUninitialized(NumPixels);
+		FTraits::Convert(Source.GetData(), NumPixels, Conversion, Pixels.GetData());
+
+		if (Output.SharedMemorySink.IsValid())
+		{
+			Output.SharedMemorySink->Publish(Output.StreamId, FrameInfo.FrameNumber, TimeStamp, FrameInfo.CameraPose, FTraits::SharedMemoryFormat,
+				Width, Height, Pixels.GetData(), (int64)NumPixels * sizeof(PixelType));
+		}
+		if (!Output.bSaveToDisk)
+		{
+			return;
+		}
+
+		int32 OutWidth = Width;
+		int32 OutHeight = Height;
+		if (FrameInfo.ResolutionScale < 1.0f)
+		{
+			OutWidth = FMath::Max(1, FMath::RoundToInt(Width * FrameInfo.ResolutionScale));
+			OutHeight = FMath::Max(1, FMath::RoundToInt(Height * FrameInfo.ResolutionScale));
+			TArray<PixelType> Scaled;
+			ResizeNearest(Pixels.GetData(), Width, Height, OutWidth, OutHeight, Scaled);
+			Pixels = MoveTemp(Scaled);
+		}
+
+		// Lossy codecs would change depth and label values, only raw replaces the default of the type
+		FVisionEncodeSettings Settings;
+		Settings.Codec = Output.Codec == EVisionImageCodec::Raw ? EVisionImageCodec::Raw : FTraits::DefaultCodec;
+		Settings.PngLevel = Output.PngLevel;
+		Settings.EncodeStripes = Output.EncodeStripes;
+		Settings.JpegQuality = FrameInfo.JpegQuality;
+		TArray<uint8> Data;
+		FString Suffix;
+		if (!FTraits::Encode(Pixels.GetData(), OutWidth, OutHeight, Settings, Data, Suffix))
+		{
+			UE_LOG(LogTemp, Error, TEXT("Could not encode %s frame %llu"), *StreamName, FrameInfo.FrameNumber);
+			return;
+		}
+
+		const FString FileDir = FPaths::ProjectSavedDir() / TEXT("viewport");
+		IFileManager::Get().MakeDirectory(*FileDir, true);
+		const FString FileName = StreamName + RawDataAsyncWorker::FormatTimeStamp(TimeStamp) + Suffix;
+		TFunction<void(bool)> OnWritten = FCaptureRateController::ReportEncoded(Output.RateController, StartTime, Data.Num());
+		FSessionJournal::Save(Output.Writer, Output.Journal, MoveTemp(Data), FileDir, FileName, FrameInfo.GetJournalFrame(), StreamName, MoveTemp(OnWritten));
+	}
+
+	// Pixel at the center of the source area of every output pixel
+	static void ResizeNearest(const PixelType* Src, int32 InWidth, int32 InHeight, int32 OutWidth, int32 OutHeight, TArray<PixelType>& Out)
+	{
+		Out.SetNumUninitialized(OutWidth * OutHeight);
+		PixelType* Dst = Out.GetData();
+		for (int32 Y = 0; Y < OutHeight; ++Y)
+		{
+			const PixelType* Row = Src + (int32)(((int64)Y * 2 + 1) * InHeight / (2 * OutHeight)) * InWidth;
+			for (int32 X = 0; X < OutWidth; ++X)
+			{
+				*Dst++ = Row[(int32)(((int64)X * 2 + 1) * InWidth / (2 * OutWidth))];
+			}
+		}
+	}
+
+private:
+	TArray<SourceType> Source;
+	FVisionStreamConversion Conversion;
+	FDateTime TimeStamp;
+	FString StreamName;
+	int32 Width;
+	int32 Height;
+	FVisionStreamOutput Output;
+	FVisionFrameInfo FrameInfo;
+};
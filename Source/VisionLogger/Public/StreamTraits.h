@@ -0,0 +1,145 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ParallelPngEncoder.h"
+#include "vl_shm_protocol.h"
+#include "StreamTraits.generated.h"
+
+class IImageWrapper;
+
+// What the depth stream saves
+UENUM(BlueprintType)
+enum class EVisionDepthValues : uint8
+{
+	// LDR depth images
+	Visualization	UMETA(DisplayName = "Visualization (8 bit)"),
+	// Scene depth in mm as 16 bit gray PNG, 0 to 65.535 m
+	Millimeters		UMETA(DisplayName = "Millimeters (16 bit PNG)"),
+	// Scene depth in cm as raw 32 bit floats
+	Centimeters		UMETA(DisplayName = "Centimeters (32 bit float)"),
+	// Half float RGBA as read back, scene depth in cm in R
+	HalfFloat		UMETA(DisplayName = "Half float RGBA (raw)")
+};
+
+// What the mask stream saves
+UENUM(BlueprintType)
+enum class EVisionMaskValues : uint8
+{
+	// Category colors
+	Colors			UMETA(DisplayName = "Colors"),
+	// Category index as 8 bit gray PNG, 255 where no labelled object is visible
+	LabelIds8		UMETA(DisplayName = "Label ids (8 bit PNG)"),
+	// Category index as 16 bit gray PNG, 65535 where no labelled object is visible
+	LabelIds16		UMETA(DisplayName = "Label ids (16 bit PNG)")
+};
+
+// Codec settings of one encoded frame
+struct FVisionEncodeSettings
+{
+	EVisionImageCodec Codec;
+
+	// PNG level (0-9) and stripes encoded in parallel (0 one per core)
+	int32 PngLevel;
+	int32 EncodeStripes;
+
+	// JPEG quality, 0 for the codec default
+	int32 JpegQuality;
+
+	// JPEG encoder of the calling task, not shared between threads
+	IImageWrapper* ImageWrapper;
+
+	FVisionEncodeSettings()
+		: Codec(EVisionImageCodec::JPEG)
+		, PngLevel(3)
+		, EncodeStripes(0)
+		, JpegQuality(0)
+		, ImageWrapper(nullptr)
+	{}
+
+	// Raw files carry the frame size in their name: _<Width>x<Height><Extension>
+	static FString GetRawSuffix(const TCHAR* Extension, int32 Width, int32 Height)
+	{
+		return TEXT("_") + FString::FromInt(Width) + TEXT("x") + FString::FromInt(Height) + Extension;
+	}
+};
+
+// Lookup tables the conversion kernels of a stream need
+struct FVisionStreamConversion
+{
+	// Object category index of every mask color, packed with FColor::DWColor
+	TMap<uint32, uint16> ColorToLabel;
+};
+
+/**
+ * Pixel type a stream is stored with. Every specialization provides NumChannels, the codec used by
+ * default, the shared memory format, the kernels converting the read back pixels (FColor or
+ * FFloat16Color) into the stored type and the encoder. The stream workers are instantiated per
+ * specialization, so the per pixel loops are resolved at compile time.
+ */
+template<typename PixelType>
+struct TVisionStreamTraits;
+
+// Color and mask colors, BGRA as read back
+template<>
+struct VISIONLOGGER_API TVisionStreamTraits<FColor>
+{
+	static const int32 NumChannels = 4;
+	static const EVisionImageCodec DefaultCodec = EVisionImageCodec::JPEG;
+	static const uint32 SharedMemoryFormat = VL_SHM_FORMAT_BGRA8;
+
+	static void Convert(const FColor* Src, int32 NumPixels, const FVisionStreamConversion& Conversion, FColor* Dst);
+	static bool Encode(const FColor* Pixels, int32 Width, int32 Height, const FVisionEncodeSettings& Settings, TArray<uint8>& Out, FString& OutSuffix);
+};
+
+// Half float scene depth as read back
+template<>
+struct VISIONLOGGER_API TVisionStreamTraits<FFloat16Color>
+{
+	static const int32 NumChannels = 4;
+	static const EVisionImageCodec DefaultCodec = EVisionImageCodec::Raw;
+	static const uint32 SharedMemoryFormat = VL_SHM_FORMAT_RGBA16F;
+
+	static void Convert(const FFloat16Color* Src, int32 NumPixels, const FVisionStreamConversion& Conversion, FFloat16Color* Dst);
+	static bool Encode(const FFloat16Color* Pixels, int32 Width, int32 Height, const FVisionEncodeSettings& Settings, TArray<uint8>& Out, FString& OutSuffix);
+};
+
+// Scene depth in cm
+template<>
+struct VISIONLOGGER_API TVisionStreamTraits<float>
+{
+	static const int32 NumChannels = 1;
+	static const EVisionImageCodec DefaultCodec = EVisionImageCodec::Raw;
+	static const uint32 SharedMemoryFormat = VL_SHM_FORMAT_FLOAT32;
+
+	static void Convert(const FFloat16Color* Src, int32 NumPixels, const FVisionStreamConversion& Conversion, float* Dst);
+	static bool Encode(const float* Pixels, int32 Width, int32 Height, const FVisionEncodeSettings& Settings, TArray<uint8>& Out, FString& OutSuffix);
+};
+
+// Scene depth in mm or 16 bit label ids
+template<>
+struct VISIONLOGGER_API TVisionStreamTraits<uint16>
+{
+	static const int32 NumChannels = 1;
+	static const EVisionImageCodec DefaultCodec = EVisionImageCodec::PNG;
+	static const uint32 SharedMemoryFormat = VL_SHM_FORMAT_GRAY16;
+	static const uint16 NoLabel = 0xFFFF;
+
+	static void Convert(const FFloat16Color* Src, int32 NumPixels, const FVisionStreamConversion& Conversion, uint16* Dst);
+	static void Convert(const FColor* Src, int32 NumPixels, const FVisionStreamConversion& Conversion, uint16* Dst);
+	static bool Encode(const uint16* Pixels, int32 Width, int32 Height, const FVisionEncodeSettings& Settings, TArray<uint8>& Out, FString& OutSuffix);
+};
+
+// Gray images and 8 bit label ids
+template<>
+struct VISIONLOGGER_API TVisionStreamTraits<uint8>
+{
+	static const int32 NumChannels = 1;
+	static const EVisionImageCodec DefaultCodec = EVisionImageCodec::PNG;
+	static const uint32 SharedMemoryFormat = VL_SHM_FORMAT_GRAY8;
+	static const uint8 NoLabel = 0xFF;
+
+	static void Convert(const FColor* Src, int32 NumPixels, const FVisionStreamConversion& Conversion, uint8* Dst);
+	static bool Encode(const uint8* Pixels, int32 Width, int32 Height, const FVisionEncodeSettings& Settings, TArray<uint8>& Out, FString& OutSuffix);
+};
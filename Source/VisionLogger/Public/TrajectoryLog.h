@@ -0,0 +1,115 @@
+// Copyright 2018, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "TrajectoryLog.generated.h"
+
+// What the logger does with the trajectory log
+UENUM(BlueprintType)
+enum class ETrajectoryMode : uint8
+{
+	// Capture live, no trajectory log
+	Off			UMETA(DisplayName = "Off"),
+	// Only log camera and actor poses, nothing is captured
+	Record		UMETA(DisplayName = "Record"),
+	// Re-pose camera and actors from the log and capture every logged tick
+	Replay		UMETA(DisplayName = "Replay")
+};
+
+// Transform of one logged actor
+struct VISIONLOGGER_API FTrajectoryActorPose
+{
+	int32 ActorId;
+	FTransform Transform;
+};
+
+// Everything logged for one game tick
+struct VISIONLOGGER_API FTrajectoryTick
+{
+	// World time in seconds and tick length
+	double Time;
+	float DeltaTime;
+
+	// Camera pose of the player camera
+	FVector CameraLocation;
+	FQuat CameraRotation;
+
+	// Actors that moved since the previous tick
+	TArray<FTrajectoryActorPose> Actors;
+};
+
+/**
+ * Appends ticks to a compact binary trajectory log.
+ * Layout: magic, version, session start (UTC ticks), followed by records. A name record maps an
+ * actor id to its name and is written before the first tick using that id, tick records hold the
+ * camera pose and only the actors whose transform changed since the previous tick.
+ */
+class VISIONLOGGER_API FTrajectoryWriter
+{
+public:
+	FTrajectoryWriter();
+	~FTrajectoryWriter();
+
+	// Create the log file, fails if it cannot be opened
+	bool Open(const FString& Path, const FDateTime& SessionStart);
+	void Close();
+	bool IsOpen() const { return Archive != nullptr; }
+
+	// Log one tick, Actors are compared against their last logged transform
+	void WriteTick(double Time, float DeltaTime, const FVector& CameraLocation, const FQuat& CameraRotation, const TArray<TWeakObjectPtr<AActor>>& Actors);
+
+	int32 GetNumTicks() const { return NumTicks; }
+
+private:
+	FArchive* Archive;
+	TMap<FString, int32> ActorIds;
+	TArray<FTransform> LastTransforms;
+	int32 NumTicks;
+};
+
+/**
+ * Reads a trajectory log tick by tick, name records are resolved while reading.
+ */
+class VISIONLOGGER_API FTrajectoryReader
+{
+public:
+	FTrajectoryReader();
+	~FTrajectoryReader();
+
+	bool Open(const FString& Path);
+	void Close();
+
+	// Read the next tick, false at the end of the log or once a corrupt record closed it
+	bool ReadTick(FTrajectoryTick& OutTick);
+
+	// Name of a logged actor id, empty for ids without name record
+	FString GetActorName(int32 ActorId) const { return ActorNames.IsValidIndex(ActorId) ? ActorNames[ActorId] : FString(); }
+
+	const FDateTime& GetSessionStart() const { return SessionStart; }
+
+private:
+	// Log a corrupt or truncated record and close the log, false
+	bool Fail(const TCHAR* Record);
+
+	FArchive* Archive;
+	TArray<FString> ActorNames;
+	FDateTime SessionStart;
+};
+
+namespace TrajectoryLog
+{
+	// Magic 'VLTR' and format version at the start of each log
+	const uint32 Magic = 0x52544C56;
+	const uint32 Version = 1;
+
+	// Record types following the header
+	const uint8 NameRecord = 0;
+	const uint8 TickRecord = 1;
+
+	// Largest actor id a log may use, ids are assigned densely from 0
+	const int32 MaxActorId = 1 << 20;
+
+	// Bytes of one actor pose in a tick record: id, location, rotation, scale
+	const int64 ActorPoseSize = sizeof(int32) + 3 * sizeof(float) + 4 * sizeof(float) + 3 * sizeof(float);
+}
@@ -5,6 +5,15 @@
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
 #include "RawDataAsyncWorker.h"
+#include "StreamAsyncWorker.h"
+#include "PixelFormatConversion.h"
+#include "FrameChangeDetector.h"
+#include "TrajectoryLog.h"
+#include "PointCloudAsyncWorker.h"
+#include "OpticalFlowAsyncWorker.h"
+#include "SceneStateLog.h"
+#include "FileWriteBackend.h"
+#include "CaptureRateController.h"
 #include "Runtime/Core/Public/Async/AsyncWork.h"
 #include "Engine/TextureRenderTarget2D.h"
 #include "StaticMeshResources.h"
@@ -71,10 +80,42 @@ public:
 	UPROPERTY(EditAnywhere, Category = "Vision Settings|Capture Mode")
 		bool bCaptureDepthImage;
 
+	// Pixel layout of the color stream before encoding/storage
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Capture Mode|Pixel Format")
+		EVisionPixelFormat ColorPixelFormat;
+
+	// Pixel layout of the mask stream before encoding/storage
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Capture Mode|Pixel Format")
+		EVisionPixelFormat MaskPixelFormat;
+
+	// Pixel layout of the depth stream before encoding/storage
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Capture Mode|Pixel Format")
+		EVisionPixelFormat DepthPixelFormat;
+
+	// Values the depth stream saves, metric depth is read back as float and ignores DepthPixelFormat
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Capture Mode|Pixel Format")
+		EVisionDepthValues DepthValueFormat;
+
+	// Values the mask stream saves, label ids are the object category indices and ignore MaskPixelFormat
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Capture Mode|Pixel Format")
+		EVisionMaskValues MaskValueFormat;
+
 	// Save data as image
 	UPROPERTY(EditAnywhere, Category = "Vision Settings|Capture Mode|Save Mode")
 		bool bSaveAsImage;
 
+	// Codec of the streams saved as images (BGRA and Gray8 layouts), depth and label ids are never saved lossy
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Capture Mode|Save Mode")
+		EVisionImageCodec ImageCodec;
+
+	// PNG compression level, 1 is fastest, 9 smallest
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Capture Mode|Save Mode", meta = (ClampMin = "0", ClampMax = "9"))
+		int32 PngCompressionLevel;
+
+	// Horizontal stripes a PNG frame is split into and compressed in parallel, 0 for one per core
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Capture Mode|Save Mode", meta = (ClampMin = "0"))
+		int32 PngEncodeStripes;
+
 	// Save data in MongoDB
 	UPROPERTY(EditAnywhere, Category = "Vision Settings|Capture Mode|Save Mode")
 		bool bSaveInMongo;
@@ -83,6 +124,154 @@ public:
 	UPROPERTY(EditAnywhere, Category = "Vision Settings|Capture Mode|Save Mode")
 		bool bSaveAsBson;
 
+	// Replace frames by "repeat of frame N" records while camera and scene are static
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Change Detection")
+		bool bSkipStaticFrames;
+
+	// Camera movement in cm below which the pose counts as static
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Change Detection", meta = (ClampMin = "0.0"))
+		float StaticPositionTolerance;
+
+	// Camera rotation in degrees below which the pose counts as static
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Change Detection", meta = (ClampMin = "0.0"))
+		float StaticRotationTolerance;
+
+	// Largest change (gray levels) of a downsampled image cell that still counts as the same frame
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Change Detection", meta = (ClampMin = "0.0"))
+		float ContentChangeThreshold;
+
+	// Record camera/actor poses only, replay them with full capture, or capture live
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Trajectory")
+		ETrajectoryMode TrajectoryMode;
+
+	// Trajectory log file, relative paths are inside Saved/Trajectories
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Trajectory")
+		FString TrajectoryFile;
+
+	// Fixed world time step in seconds while replaying
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Trajectory", meta = (ClampMin = "0.001"))
+		float ReplayTimeStep;
+
+	// Publish raw frames into a shared memory ring buffer for local consumer processes (Linux/Mac)
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Shared Memory")
+		bool bPublishSharedMemory;
+
+	// Name of the POSIX shared memory object
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Shared Memory")
+		FString SharedMemoryName;
+
+	// Number of frames the ring buffer holds before the oldest is overwritten
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Shared Memory", meta = (ClampMin = "2"))
+		int32 SharedMemorySlots;
+
+	// Back-project the depth stream into world space point clouds (Saved/viewport/POINTCLOUD*)
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Point Cloud")
+		bool bGeneratePointCloud;
+
+	// Binary PLY or the compact quantized format
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Point Cloud")
+		EPointCloudFormat PointCloudFormat;
+
+	// Edge length of the downsampling voxels in cm, 0 keeps one point per pixel
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Point Cloud", meta = (ClampMin = "0.0"))
+		float PointCloudVoxelSize;
+
+	// Pixels farther away than this (cm) are dropped
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Point Cloud", meta = (ClampMin = "1.0"))
+		float PointCloudMaxDepth;
+
+	// Color the points from the color stream (needs bCaptureColorImage)
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Point Cloud")
+		bool bColorPointCloud;
+
+	// Label the points with the object category of the mask stream (needs bCaptureMaskImage)
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Point Cloud")
+		bool bLabelPointCloud;
+
+	// Write the ground truth flow of static geometry between consecutive depth frames (Saved/viewport/FLOW*)
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Optical Flow")
+		bool bGenerateOpticalFlow;
+
+	// Pixels farther away than this (cm) get no flow
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Optical Flow", meta = (ClampMin = "1.0"))
+		float OpticalFlowMaxDepth;
+
+	// Relative depth difference up to which a reprojected pixel still counts as visible
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Optical Flow", meta = (ClampMin = "0.0"))
+		float OcclusionTolerance;
+
+	// Log the transforms of all labelled actors for every captured frame (Saved/viewport/SCENESTATE*.vlscene)
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Scene State")
+		bool bRecordSceneState;
+
+	// Frames per block of the scene state log, actors that do not move within a block are not stored
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Scene State", meta = (ClampMin = "1"))
+		int32 SceneStateBlockFrames;
+
+	// How files are written: blocking calls on the worker threads or batched asynchronous io_uring writes (Linux)
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|File Output")
+		EFileWriteBackend FileWriteBackend;
+
+	// Asynchronous writes in flight before the workers block
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|File Output", meta = (ClampMin = "1"))
+		int32 FileWriteQueueDepth;
+
+	// Files of at least this size (KB) bypass the page cache (O_DIRECT), 0 disables it
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|File Output", meta = (ClampMin = "0"))
+		int32 DirectIOMinSizeKB;
+
+	// Write files through temporary names and list them in Saved/viewport/MANIFEST.csv, partial files are cleaned up on the next start
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Journal")
+		bool bCrashSafeJournal;
+
+	// Files written before they are synced to disk together and listed in the manifest
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Journal", meta = (ClampMin = "1"))
+		int32 JournalCommitFiles;
+
+	// Seconds after which pending files are committed even if fewer were written
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Journal", meta = (ClampMin = "0.0"))
+		float JournalCommitInterval;
+
+	// Lower JPEG quality, saved resolution and per stream rate while the saving pipeline is over budget, raise them again when it recovers
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Rate Control")
+		bool bAdaptiveRateControl;
+
+	// Worker threads (seconds per second) encoding and writing may keep busy
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Rate Control", meta = (ClampMin = "0.1"))
+		float WorkerBudget;
+
+	// Encoded MB per second, 0 for no limit
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Rate Control", meta = (ClampMin = "0.0"))
+		float ByteBudgetMBps;
+
+	// Game thread ms per capture tick (read back and dispatch), 0 for no limit
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Rate Control", meta = (ClampMin = "0.0"))
+		float GameThreadBudgetMs;
+
+	// Frames queued or being saved before new frames are skipped
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Rate Control", meta = (ClampMin = "1"))
+		int32 MaxFramesInFlight;
+
+	// Lowest JPEG quality rate control goes down to
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Rate Control", meta = (ClampMin = "1", ClampMax = "100"))
+		int32 MinJpegQuality;
+
+	// JPEG quality while the pipeline is within budget
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Rate Control", meta = (ClampMin = "1", ClampMax = "100"))
+		int32 MaxJpegQuality;
+
+	// Smallest fraction of Width/Height frames are saved with
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Rate Control", meta = (ClampMin = "0.05", ClampMax = "1.0"))
+		float MinResolutionScale;
+
+	// Largest N of "save every Nth frame" per stream
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Rate Control", meta = (ClampMin = "1"))
+		int32 MaxFrameDivider;
+
+	// Seconds the load is measured over before the next adjustment
+	UPROPERTY(EditAnywhere, Category = "Vision Settings|Rate Control", meta = (ClampMin = "0.1"))
+		float ControlInterval;
+
 	// Intial Asynctask
 	bool bInitialAsyncTask;
 
@@ -102,11 +291,30 @@ public:
 	// initialize Componets
 	void Initial();
 
-	// Change the framerate on the fly
-	void SetFramerate(const float NewFramerate);
+	// Change the framerate on the fly, 0 pauses capturing (console: VisionLogger.FrameRate)
+	UFUNCTION(BlueprintCallable, Category = "Vision Settings")
+	void SetFramerate(float NewFramerate);
 
-	// Initate AsyncTask
-	void InitAsyncTask(FAsyncTask<RawDataAsyncWorker>* AsyncWorker, TArray<FColor>& image, FDateTime Stamp, FString Name, int Width, int Height);
+	// Change the capture size on the fly, frames in flight are saved with the old size first (console: VisionLogger.Resolution)
+	UFUNCTION(BlueprintCallable, Category = "Vision Settings")
+	void SetResolution(int32 NewWidth, int32 NewHeight);
+
+	// Enable or disable streams on the fly, disabled capture components are deactivated (console: VisionLogger.Streams)
+	UFUNCTION(BlueprintCallable, Category = "Vision Settings")
+	void SetCaptureStreams(bool bColor, bool bMask, bool bDepth);
+
+	// Change the content change threshold of the change detection on the fly (console: VisionLogger.ChangeThreshold)
+	UFUNCTION(BlueprintCallable, Category = "Vision Settings|Change Detection")
+	void SetContentChangeThreshold(float NewThreshold);
+
+	// Start a worker saving the frame, skipped while MaxFramesInFlight are in flight unless bWaitForWorkers
+	bool InitAsyncTask(TArray<FColor>& image, FDateTime Stamp, FString Name, int Width, int Height,
+		const FVisionStreamOutput& Output, const FVisionFrameInfo& Info, bool bWaitForWorkers);
+
+	// Start a worker saving the frame as typed stream, same limits as InitAsyncTask
+	template<typename SourceType, typename PixelType>
+	bool InitStreamTask(const TArray<SourceType>& Source, FDateTime Stamp, const FString& Name,
+		const FVisionStreamOutput& Output, const FVisionFrameInfo& Info, bool bWaitForWorkers);
 
 	// Start AsyncTask
 	void CurrentAsyncTask(FAsyncTask<RawDataAsyncWorker>* AsyncWorker);
@@ -138,6 +346,18 @@ private:
 	// Depth image buffer
 	TArray<FColor> DepthImage;
 
+	// Scene depth in cm (R channel), only read back for the point clouds
+	TArray<FFloat16Color> DepthFloatImage;
+
+	// Depth, frame and time stamp of the previous read back, start of the next flow frame
+	TArray<FFloat16Color> FlowDepthA;
+	FVisionFrameInfo FlowFrameA;
+	FDateTime FlowStampA;
+	bool bHasFlowFrameA;
+
+	// Object category index of every mask color, packed with FColor::DWColor
+	TMap<uint32, uint16> MaskColorToLabel;
+
 	// Array of objects' colors
 	TArray<FColor> ObjectColors;
 
@@ -150,8 +370,8 @@ private:
 	// number of Used Colors
 	uint32 ColorsUsed;
 
-	// Image Wrapper for saving image
-	TSharedPtr<IImageWrapper> ImageWrapper;
+	// Creates the image wrapper of every save task, concurrent tasks must not share one
+	IImageWrapperModule* ImageWrapperModule;
 
 	FRenderCommandFence ColorPixelFence;
 	FRenderCommandFence MaskPixelFence;
@@ -173,12 +393,132 @@ private:
 	mongoc_database_t *database;
 	mongoc_collection_t *collection;*/
 
+	// Output settings (pixel format, change detection, live feed) of each stream
+	FVisionStreamOutput ColorOutput;
+	FVisionStreamOutput MaskOutput;
+	FVisionStreamOutput DepthOutput;
+
+	// Shared memory live feed, only valid with bPublishSharedMemory
+	TSharedPtr<FSharedMemoryFrameSink, ESPMode::ThreadSafe> SharedMemorySink;
+
+	// File output of all streams
+	TSharedPtr<IFileWriteBackend, ESPMode::ThreadSafe> FileWriter;
+
+	// Session journal, only valid with bCrashSafeJournal
+	TSharedPtr<FSessionJournal, ESPMode::ThreadSafe> Journal;
+
+	// Quality and rate of the saved frames, only valid with bAdaptiveRateControl
+	TSharedPtr<FCaptureRateController, ESPMode::ThreadSafe> RateController;
+
+	// Frame number, pose and static flag of the frames currently being read back
+	FVisionFrameInfo ReadFrameInfo;
+	uint64 NextFrameNumber;
+
+	// Capture pose of the last read back and whether it moved since the read before
+	FTransform LastReadPose;
+	bool bHasReadPose;
+	bool bReadPoseStatic;
+
+	// Trajectory log being recorded or replayed
+	TUniquePtr<FTrajectoryWriter> TrajectoryWriter;
+	TUniquePtr<FTrajectoryReader> TrajectoryReader;
+
+	// Movable actors whose transforms are recorded
+	TArray<TWeakObjectPtr<AActor>> TrajectoryActors;
+
+	// Actors of the level by name and resolved replay ids
+	TMap<FString, TWeakObjectPtr<AActor>> ReplayActorsByName;
+	TMap<int32, TWeakObjectPtr<AActor>> ReplayActors;
+
+	// Transforms of the labelled actors per captured frame
+	TUniquePtr<FSceneStateWriter> SceneStateWriter;
+
+	// Replay starts once the capture components are initialized
+	bool bReplayReady;
+	bool bReplayFinished;
+	int32 NumReplayedTicks;
+
 	// Color Image Height and Width
 	int ColorWidth, ColorHeight;
 
+	// Capture timer, replaced when the framerate changes
+	FTimerHandle CaptureTimerHandle;
+
+	// Initial ran, configuration changes are applied to the running capture
+	bool bInitialized;
+
+	// Mask colors were painted on the objects
+	bool bObjectsColored;
+
+	// Size the render targets and read back buffers of the enabled streams to Width x Height, free the buffers of disabled ones
+	void UpdateCaptureTargets();
+	void UpdateStreamTarget(USceneCaptureComponent2D* CaptureComp, TArray<FColor>& Image, bool bEnabled, bool bFloat);
+
+	// Activate the capture components of the enabled streams, deactivate the others
+	void UpdateCaptureComponents();
+
+	// Paint every object with the color of its category and build the mask color to label map, once
+	void ColorMaskObjects();
+
+	// File output of the current frame size, handed to all streams
+	void CreateFileWriter();
+
+	// Largest unencoded frame of the enabled streams in their stored pixel type
+	int64 GetMaxFrameBytes() const;
+
+	// Re-open the shared memory slots and the writer staging buffers if frames outgrew OldFrameBytes
+	void GrowFrameBuffers(int64 OldFrameBytes);
+
+	// Save the frames being read back and wait for all workers, the next tick starts a new read back
+	void DrainPendingFrames();
+
+	// Block until no frame, point cloud or flow frame is in flight
+	void WaitForWorkers() const;
+
 	// Timer callback (timer tick)
 	void TimerTick();
 
+	// Absolute path of the trajectory log
+	FString GetTrajectoryPath() const;
+
+	// Open the trajectory log for the configured mode
+	void StartTrajectoryRecording();
+	void StartTrajectoryReplay();
+
+	// Apply the next logged tick and capture all enabled streams for it
+	void ReplayTick();
+
+	// Actor of the level matching a logged actor id
+	AActor* FindReplayActor(int32 ActorId);
+
+	// Open the scene state log and register the actors with mesh components under their mask category
+	void StartSceneStateLog();
+
+	// Compare the current capture pose with the one of the last read back (live) or replayed tick (replay)
+	void UpdatePoseStatic();
+
+	// Depth has to be captured as float scene depth instead of the LDR visualization
+	bool NeedsFloatDepth() const;
+
+	// Frames of all streams queued or being saved
+	static int32 GetNumFramesInFlight();
+
+	// Save the mask and depth frames read back last in their value format
+	void SaveMaskFrame(FDateTime Stamp, const FVisionFrameInfo& Info, bool bWaitForWorkers);
+	void SaveDepthFrame(FDateTime Stamp, const FVisionFrameInfo& Info, bool bWaitForWorkers);
+
+	// Streams whose rate was lowered save only every Nth frame, a full queue skips the frame unless bWaitForWorkers
+	bool AcquireFrameSlot(const FString& Name, const FVisionStreamOutput& Output, const FVisionFrameInfo& Info, bool bWaitForWorkers) const;
+
+	// Start a worker generating the point cloud of the frames read back last, skipped while too many are in flight unless bWaitForWorkers
+	void GeneratePointCloud(FDateTime Stamp, const FVisionFrameInfo& Info, bool bWaitForWorkers);
+
+	// Start a worker computing the flow from the previous to the last read back depth frame
+	void GenerateOpticalFlow(FDateTime Stamp, const FVisionFrameInfo& Info, bool bWaitForWorkers);
+
+	// Log how many frames and bytes the change detection saved
+	void ReportChangeDetection() const;
+
 	// Connect MongoDB
 	bool ConnectMongo(FString& MongoIp, int& MongoPort, FString& MongoDBName, FString& MongoCollection);
 	
@@ -197,6 +537,9 @@ private:
 	// Read Raw data from USceneCaptureComponent2D
 	void ReadPixels(FTextureRenderTargetResource*& RenderResource, TArray< FColor >& OutImageData, FReadSurfaceDataFlags InFlags = FReadSurfaceDataFlags(RCM_UNorm, CubeFace_MAX), FIntRect InRect = FIntRect(0, 0, 0, 0));
 
+	// Read float raw data from USceneCaptureComponent2D
+	void ReadFloatPixels(FTextureRenderTargetResource*& RenderResource, TArray< FFloat16Color >& OutImageData, FIntRect InRect = FIntRect(0, 0, 0, 0));
+
 	// Color All Actor in World
 	bool ColorAllObjects();
 
@@ -224,3 +567,17 @@ private:
 
 	
 };
+
+template<typename SourceType, typename PixelType>
+bool AUVisionlogger::InitStreamTask(const TArray<SourceType>& Source, FDateTime Stamp, const FString& Name,
+	const FVisionStreamOutput& Output, const FVisionFrameInfo& Info, bool bWaitForWorkers)
+{
+	if (!AcquireFrameSlot(Name, Output, Info, bWaitForWorkers))
+	{
+		return false;
+	}
+	FVisionStreamConversion Conversion;
+	Conversion.ColorToLabel = MaskColorToLabel;
+	(new FAutoDeleteAsyncTask<TStreamAsyncWorker<SourceType, PixelType>>(Source, Conversion, Stamp, Name, Width, Height, Output, Info))->StartBackgroundTask();
+	return true;
+}
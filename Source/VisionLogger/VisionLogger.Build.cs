@@ -1,5 +1,6 @@
 // Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
 
+using System.IO;
 using UnrealBuildTool;
 
 public class VisionLogger : ModuleRules
@@ -10,7 +11,9 @@ public class VisionLogger : ModuleRules
 		
 		PublicIncludePaths.AddRange(
 			new string[] {
-				"VisionLogger/Public"
+				"VisionLogger/Public",
+				// Shared memory protocol shared with the client library, its formats are used by the stream traits
+				Path.Combine(ModuleDirectory, "../../Client/include"),
 				// ... add public include paths required here ...
 			}
 			);
@@ -51,6 +54,9 @@ public class VisionLogger : ModuleRules
 			);
 		
 		
+		// Stripe parallel PNG encoding
+		AddEngineThirdPartyPrivateStaticDependencies(Target, "zlib");
+
 		DynamicallyLoadedModuleNames.AddRange(
 			new string[]
 			{